@@ -0,0 +1,109 @@
+/*
+	Copyright (C) 2016 by Kristina Simpson <sweet.kristas@gmail.com>
+	
+	This software is provided 'as-is', without any express or implied
+	warranty. In no event will the authors be held liable for any damages
+	arising from the use of this software.
+
+	Permission is granted to anyone to use this software for any purpose,
+	including commercial applications, and to alter it and redistribute it
+	freely, subject to the following restrictions:
+
+	   1. The origin of this software must not be misrepresented; you must not
+	   claim that you wrote the original software. If you use this software
+	   in a product, an acknowledgment in the product documentation would be
+	   appreciated but is not required.
+
+	   2. Altered source versions must be plainly marked as such, and must not be
+	   misrepresented as being the original software.
+
+	   3. This notice may not be removed or altered from any source
+	   distribution.
+*/
+
+#include <atomic>
+#include <cstdlib>
+#include <new>
+#include <string>
+#include <vector>
+
+#include "asserts.hpp"
+#include "filesystem.hpp"
+#include "FontDriver.hpp"
+#include "FontRasterQueue.hpp"
+#include "ImageDecodeQueue.hpp"
+#include "SDLWrapper.hpp"
+#include "Surface.hpp"
+#include "WindowManager.hpp"
+#include "unit_test.hpp"
+#include "variant_utils.hpp"
+#include "xhtml_render_ctx.hpp"
+
+// Counts every heap allocation made by the program, so benchmarks can report 
+// allocations per iteration.
+namespace 
+{
+	std::atomic<unsigned long long> allocation_count(0);
+}
+
+void* operator new(std::size_t size)
+{
+	allocation_count.fetch_add(1, std::memory_order_relaxed);
+	void* p = std::malloc(size == 0 ? 1 : size);
+	if(p == nullptr) {
+		throw std::bad_alloc();
+	}
+	return p;
+}
+
+void* operator new[](std::size_t size)
+{
+	return operator new(size);
+}
+
+void operator delete(void* p) noexcept
+{
+	std::free(p);
+}
+
+void operator delete[](void* p) noexcept
+{
+	std::free(p);
+}
+
+// Usage: xhtml-bench [benchmark name...]
+// With no arguments every registered benchmark is run.
+int main(int argc, char* argv[])
+{
+	std::vector<std::string> args;
+	for(int i = 1; i < argc; ++i) {
+		args.emplace_back(argv[i]);
+	}
+
+	using namespace KRE;
+	SDL::SDL_ptr manager(new SDL::SDL());
+
+	const std::string data_path = "data/";
+	sys::file_path_map font_files;
+	sys::get_unique_files(data_path + "fonts/", font_files);
+	FontDriver::setAvailableFonts(font_files);
+	FontDriver::setFontProvider("stb");
+	// Rasterize glyphs and decode images synchronously so runs are repeatable.
+	FontRasterQueue::setEnabled(false);
+	ImageDecodeQueue::setEnabled(false);
+
+	// Fonts need a rendering context to create their textures.
+	WindowManager wm("SDL");
+	variant_builder hints;
+	hints.add("renderer", "opengl");
+	auto main_wnd = wm.createWindow(640, 480, hints.build());
+
+	Surface::setFileFilter(FileFilterType::LOAD, [](const std::string& fname) { return "images/" + fname; });
+	Surface::setFileFilter(FileFilterType::SAVE, [](const std::string& fname) { return "images/" + fname; });
+
+	xhtml::RenderContextManager rcm;
+
+	test::set_allocation_counter(&allocation_count);
+	test::run_benchmarks(args.empty() ? nullptr : &args);
+	return 0;
+}
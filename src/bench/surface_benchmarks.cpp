@@ -0,0 +1,163 @@
+/*
+	Copyright (C) 2016 by Kristina Simpson <sweet.kristas@gmail.com>
+	
+	This software is provided 'as-is', without any express or implied
+	warranty. In no event will the authors be held liable for any damages
+	arising from the use of this software.
+
+	Permission is granted to anyone to use this software for any purpose,
+	including commercial applications, and to alter it and redistribute it
+	freely, subject to the following restrictions:
+
+	   1. The origin of this software must not be misrepresented; you must not
+	   claim that you wrote the original software. If you use this software
+	   in a product, an acknowledgment in the product documentation would be
+	   appreciated but is not required.
+
+	   2. Altered source versions must be plainly marked as such, and must not be
+	   misrepresented as being the original software.
+
+	   3. This notice may not be removed or altered from any source
+	   distribution.
+*/
+
+#include <cstdint>
+#include <vector>
+
+#include "AlphaMap.hpp"
+#include "Gradients.hpp"
+#include "Surface.hpp"
+#include "SurfaceBlur.hpp"
+#include "SurfaceScale.hpp"
+#include "unit_test.hpp"
+
+namespace 
+{
+	struct BlurBenchArg
+	{
+		BlurBenchArg(int sz, bool ref) : size(sz), reference(ref) {}
+		int size;
+		bool reference;
+	};
+
+	// RGBA pixels with a pattern in the alpha channel.
+	std::vector<uint8_t> create_blur_pixels(int size)
+	{
+		std::vector<uint8_t> res(size * size * 4);
+		for(int y = 0; y != size; ++y) {
+			for(int x = 0; x != size; ++x) {
+				res[(y * size + x) * 4 + 3] = ((x / 16) ^ (y / 16)) & 1 ? 255 : 0;
+			}
+		}
+		return res;
+	}
+
+	struct ScaleBenchArg
+	{
+		typedef void (*scale_fn)(const uint32_t*, int, int, int, uint32_t*);
+		ScaleBenchArg(int sz, int sc, scale_fn f) : size(sz), scale(sc), fn(f) {}
+		int size;
+		int scale;
+		scale_fn fn;
+	};
+}
+
+// Blurs the alpha channel of a square RGBA surface. The "ref" variants run the original 
+// single threaded implementation for comparison.
+BENCHMARK_ARG(surface_alpha_blur, BlurBenchArg arg)
+{
+	std::vector<uint8_t> pixels = create_blur_pixels(arg.size);
+	test::set_benchmark_units(arg.size * arg.size, "pixel");
+	BENCHMARK_LOOP {
+		if(arg.reference) {
+			KRE::pixels_alpha_blur_reference(pixels.data(), arg.size, arg.size, arg.size * 4, 4, 3, 8.0f);
+		} else {
+			KRE::pixels_alpha_blur(pixels.data(), arg.size, arg.size, arg.size * 4, 4, 3, 8.0f);
+		}
+	}
+}
+
+BENCHMARK_ARG_CALL(surface_alpha_blur, 512, BlurBenchArg(512, false));
+BENCHMARK_ARG_CALL(surface_alpha_blur, 512_ref, BlurBenchArg(512, true));
+BENCHMARK_ARG_CALL(surface_alpha_blur, 2048, BlurBenchArg(2048, false));
+BENCHMARK_ARG_CALL(surface_alpha_blur, 2048_ref, BlurBenchArg(2048, true));
+BENCHMARK_ARG_CALL(surface_alpha_blur, 4096, BlurBenchArg(4096, false));
+BENCHMARK_ARG_CALL(surface_alpha_blur, 4096_ref, BlurBenchArg(4096, true));
+
+// Scales a square image of noise, as done for UI art at load time.
+BENCHMARK_ARG(surface_scale, ScaleBenchArg arg)
+{
+	std::vector<uint32_t> pixels(arg.size * arg.size);
+	for(size_t n = 0; n != pixels.size(); ++n) {
+		pixels[n] = static_cast<uint32_t>(n * 2654435761u);
+	}
+	int w, h;
+	KRE::scale::scaled_size(arg.size, arg.size, arg.scale, &w, &h);
+	std::vector<uint32_t> res(w * h);
+	test::set_benchmark_units(w * h, "pixel");
+	BENCHMARK_LOOP {
+		arg.fn(pixels.data(), arg.size, arg.size, arg.scale, res.data());
+	}
+}
+
+BENCHMARK_ARG_CALL(surface_scale, bilinear_512x2, ScaleBenchArg(512, 200, KRE::scale::bilinear));
+BENCHMARK_ARG_CALL(surface_scale, bilinear_512x2_ref, ScaleBenchArg(512, 200, KRE::scale::reference::bilinear));
+BENCHMARK_ARG_CALL(surface_scale, bicubic_512x2, ScaleBenchArg(512, 200, KRE::scale::bicubic));
+BENCHMARK_ARG_CALL(surface_scale, bicubic_512x2_ref, ScaleBenchArg(512, 200, KRE::scale::reference::bicubic));
+BENCHMARK_ARG_CALL(surface_scale, nearest_neighbour_512x2, ScaleBenchArg(512, 200, KRE::scale::nearest_neighbour));
+BENCHMARK_ARG_CALL(surface_scale, nearest_neighbour_512x2_ref, ScaleBenchArg(512, 200, KRE::scale::reference::nearest_neighbour));
+
+// Rasterizes a four stop linear gradient at the given angle into a 1024x768 buffer.
+BENCHMARK_ARG(linear_gradient, float angle)
+{
+	KRE::LinearGradient lg;
+	lg.setAngle(angle);
+	lg.addColorStop(KRE::Color(1.0f, 0.0f, 0.0f, 1.0f), 0.0f);
+	lg.addColorStop(KRE::Color(1.0f, 1.0f, 0.0f, 0.5f), 0.3f);
+	lg.addColorStop(KRE::Color(0.0f, 1.0f, 0.0f, 0.0f), 0.6f);
+	lg.addColorStop(KRE::Color(0.0f, 0.0f, 1.0f, 1.0f), 1.0f);
+	std::vector<KRE::PixelRGBA> pixels(1024 * 768);
+	test::set_benchmark_units(1024 * 768, "pixel");
+	BENCHMARK_LOOP {
+		lg.rasterize(1024, 768, pixels.data());
+	}
+}
+
+BENCHMARK_ARG_CALL(linear_gradient, to_right, 90.0f);
+BENCHMARK_ARG_CALL(linear_gradient, to_bottom, 180.0f);
+BENCHMARK_ARG_CALL(linear_gradient, angled, 30.0f);
+
+// Builds the alpha map of a 1024x1024 RGBA image with opaque, transparent and mixed areas.
+BENCHMARK(alpha_map)
+{
+	const int size = 1024;
+	std::vector<uint8_t> pixels = create_blur_pixels(size);
+	test::set_benchmark_units(size * size, "pixel");
+	BENCHMARK_LOOP {
+		KRE::AlphaMap am(size, size);
+		for(int y = 0; y != size; ++y) {
+			am.setRow32(y, reinterpret_cast<const uint32_t*>(&pixels[y * size * 4]), 24);
+		}
+	}
+}
+
+// Loads the larger of the repository's test images, bypassing the surface cache. Needs the SDL
+// surface creator so is only meaningful when run from bench_main.
+BENCHMARK_ARG(surface_load, KRE::SurfaceFlags flags)
+{
+	const char* const files[] = { "radial_gradient.png", "test_npc.png", "lite_opaque-background.png", "summer.png" };
+	int pixels = 0;
+	for(auto f : files) {
+		auto surf = KRE::Surface::create(f, KRE::SurfaceFlags::NO_CACHE);
+		pixels += surf->width() * surf->height();
+	}
+	test::set_benchmark_units(pixels, "pixel");
+	BENCHMARK_LOOP {
+		for(auto f : files) {
+			KRE::Surface::create(f, KRE::SurfaceFlags::NO_CACHE | flags);
+		}
+	}
+}
+
+BENCHMARK_ARG_CALL(surface_load, png, KRE::SurfaceFlags::NONE);
+BENCHMARK_ARG_CALL(surface_load, png_premultiplied, KRE::SurfaceFlags::PREMULTIPLY_ALPHA);
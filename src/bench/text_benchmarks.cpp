@@ -0,0 +1,312 @@
+/*
+	Copyright (C) 2016 by Kristina Simpson <sweet.kristas@gmail.com>
+	
+	This software is provided 'as-is', without any express or implied
+	warranty. In no event will the authors be held liable for any damages
+	arising from the use of this software.
+
+	Permission is granted to anyone to use this software for any purpose,
+	including commercial applications, and to alter it and redistribute it
+	freely, subject to the following restrictions:
+
+	   1. The origin of this software must not be misrepresented; you must not
+	   claim that you wrote the original software. If you use this software
+	   in a product, an acknowledgment in the product documentation would be
+	   appreciated but is not required.
+
+	   2. Altered source versions must be plainly marked as such, and must not be
+	   misrepresented as being the original software.
+
+	   3. This notice may not be removed or altered from any source
+	   distribution.
+*/
+
+#include <cstdint>
+#include <iterator>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "asserts.hpp"
+#include "css_parser.hpp"
+#include "filesystem.hpp"
+#include "FontDriver.hpp"
+#include "unit_test.hpp"
+#include "utf8_to_codepoint.hpp"
+#include "xhtml.hpp"
+#include "xhtml_parser.hpp"
+#include "xhtml_style_tree.hpp"
+#include "xhtml_text_node.hpp"
+
+namespace 
+{
+	// Number of codepoints in each generated corpus.
+	const int corpus_length = 4096;
+
+	// Simple LCG so that the corpora are identical from run to run.
+	class corpus_rng
+	{
+	public:
+		explicit corpus_rng(uint32_t seed) : state_(seed) {}
+		uint32_t next(uint32_t range) 
+		{
+			state_ = state_ * 1664525U + 1013904223U;
+			return (state_ >> 8) % range;
+		}
+	private:
+		uint32_t state_;
+	};
+
+	enum class CorpusType {
+		LATIN,
+		CJK,
+		MIXED,
+	};
+
+	// Generates words of between 1 and 10 characters seperated by single spaces.
+	// CJK text is drawn from the first few hundred unified ideographs, none of the 
+	// bundled fonts cover these so it also exercises the missing glyph paths.
+	std::string generate_corpus(CorpusType type)
+	{
+		corpus_rng rng(0x2016);
+		std::string res;
+		int word_left = 1 + rng.next(10);
+		for(int n = 0; n != corpus_length; ++n) {
+			if(--word_left == 0) {
+				res += ' ';
+				word_left = 1 + rng.next(10);
+				continue;
+			}
+			const bool cjk = type == CorpusType::CJK || (type == CorpusType::MIXED && rng.next(4) == 0);
+			char32_t cp = cjk ? 0x4e00 + rng.next(384) : 'a' + rng.next(26);
+			res += utils::codepoint_to_utf8(cp);
+		}
+		return res;
+	}
+
+	const std::string& get_corpus(CorpusType type)
+	{
+		static std::map<CorpusType, std::string> res;
+		auto it = res.find(type);
+		if(it == res.end()) {
+			it = res.emplace(type, generate_corpus(type)).first;
+		}
+		return it->second;
+	}
+
+	int count_codepoints(const std::string& text)
+	{
+		utils::utf8_to_codepoint cp_conv(text);
+		return static_cast<int>(std::distance(cp_conv.begin(), cp_conv.end()));
+	}
+
+	std::vector<std::string> split_words(const std::string& text)
+	{
+		xhtml::Line line;
+		xhtml::tokenize_text(text, true, false, line);
+		std::vector<std::string> res;
+		for(auto& word : line.line) {
+			res.emplace_back(word.word);
+		}
+		return res;
+	}
+
+	KRE::FontHandlePtr get_bench_font(const std::string& provider)
+	{
+		return KRE::FontDriver::getFontHandle(std::vector<std::string>{ "monospace" }, 16.0f, KRE::Color::colorWhite(), true, provider);
+	}
+
+	struct TextBenchArg
+	{
+		TextBenchArg(const std::string& p, CorpusType c) : provider(p), corpus(c) {}
+		std::string provider;
+		CorpusType corpus;
+	};
+
+	// Holds a single paragraph of text with its styles applied, ready to be reflowed.
+	struct ReflowFixture
+	{
+		xhtml::DocumentPtr doc;
+		xhtml::StyleNodePtr style_tree;
+		xhtml::TextPtr text;
+		xhtml::StyleNodePtr text_style;
+	};
+
+	ReflowFixture create_reflow_fixture(const std::string& provider, const std::string& corpus)
+	{
+		// The style tree picks up fonts from the default provider.
+		KRE::FontDriver::setFontProvider(provider);
+
+		ReflowFixture res;
+		auto user_agent_style_sheet = std::make_shared<css::StyleSheet>();
+		css::Parser::parse(user_agent_style_sheet, sys::read_file("data/user_agent.css"));
+		res.doc = xhtml::Document::create(user_agent_style_sheet);
+		auto doc_frag = xhtml::parse_from_string("<html><body><p style=\"font-family: monospace\">" + corpus + "</p></body></html>", res.doc);
+		res.doc->addChild(doc_frag, res.doc);
+		res.doc->processStyles();
+		res.doc->processWhitespace();
+		res.style_tree = xhtml::StyleNode::createStyleTree(res.doc);
+
+		res.style_tree->preOrderTraversal([&res](xhtml::StyleNodePtr snode) {
+			auto node = snode->getNode();
+			if(node != nullptr && node->id() == xhtml::NodeId::TEXT) {
+				res.text = std::dynamic_pointer_cast<xhtml::Text>(node);
+				res.text_style = snode;
+				return false;
+			}
+			return true;
+		});
+		ASSERT_LOG(res.text != nullptr && res.text_style != nullptr, "No text node found in reflow benchmark document.");
+		res.text->transformText(res.text_style, true);
+
+		KRE::FontDriver::setFontProvider("stb");
+		return res;
+	}
+
+	const ReflowFixture& get_reflow_fixture(const TextBenchArg& arg)
+	{
+		static std::map<std::pair<std::string, CorpusType>, ReflowFixture> res;
+		auto key = std::make_pair(arg.provider, arg.corpus);
+		auto it = res.find(key);
+		if(it == res.end()) {
+			it = res.emplace(key, create_reflow_fixture(arg.provider, get_corpus(arg.corpus))).first;
+		}
+		return it->second;
+	}
+}
+
+BENCHMARK_ARG(utf8_decode, CorpusType type)
+{
+	const std::string& corpus = get_corpus(type);
+	test::set_benchmark_units(count_codepoints(corpus), "codepoint");
+	char32_t sum = 0;
+	BENCHMARK_LOOP {
+		for(auto cp : utils::utf8_to_codepoint(corpus)) {
+			sum += cp;
+		}
+	}
+	// keep the loop from being optimized away.
+	ASSERT_LOG(sum != 0xffffffff, "");
+}
+
+BENCHMARK_ARG_CALL(utf8_decode, latin, CorpusType::LATIN);
+BENCHMARK_ARG_CALL(utf8_decode, cjk, CorpusType::CJK);
+BENCHMARK_ARG_CALL(utf8_decode, mixed, CorpusType::MIXED);
+
+BENCHMARK_ARG(utf8_decode_bulk, CorpusType type)
+{
+	const std::string& corpus = get_corpus(type);
+	test::set_benchmark_units(count_codepoints(corpus), "codepoint");
+	std::vector<char32_t> cp_string;
+	BENCHMARK_LOOP {
+		cp_string.clear();
+		utils::utf8_to_codepoints(corpus, &cp_string);
+	}
+}
+
+BENCHMARK_ARG_CALL(utf8_decode_bulk, latin, CorpusType::LATIN);
+BENCHMARK_ARG_CALL(utf8_decode_bulk, cjk, CorpusType::CJK);
+BENCHMARK_ARG_CALL(utf8_decode_bulk, mixed, CorpusType::MIXED);
+
+BENCHMARK_ARG(tokenize_text, CorpusType type)
+{
+	const std::string& corpus = get_corpus(type);
+	test::set_benchmark_units(count_codepoints(corpus), "codepoint");
+	BENCHMARK_LOOP {
+		xhtml::Line line;
+		xhtml::tokenize_text(corpus, true, false, line);
+	}
+}
+
+BENCHMARK_ARG_CALL(tokenize_text, latin, CorpusType::LATIN);
+BENCHMARK_ARG_CALL(tokenize_text, cjk, CorpusType::CJK);
+BENCHMARK_ARG_CALL(tokenize_text, mixed, CorpusType::MIXED);
+
+// Shapes every word in the corpus with an empty path cache, this is the cost paid
+// the first time a piece of text is laid out.
+BENCHMARK_ARG(glyph_path_cold, TextBenchArg arg)
+{
+	const std::string& corpus = get_corpus(arg.corpus);
+	auto words = split_words(corpus);
+	auto fh = get_bench_font(arg.provider);
+	test::set_benchmark_units(count_codepoints(corpus), "glyph");
+	BENCHMARK_LOOP {
+		fh->clearGlyphPathCache();
+		for(auto& word : words) {
+			fh->getGlyphPath(word);
+		}
+	}
+}
+
+BENCHMARK_ARG_CALL(glyph_path_cold, stb_latin, TextBenchArg("stb", CorpusType::LATIN));
+BENCHMARK_ARG_CALL(glyph_path_cold, stb_cjk, TextBenchArg("stb", CorpusType::CJK));
+BENCHMARK_ARG_CALL(glyph_path_cold, stb_mixed, TextBenchArg("stb", CorpusType::MIXED));
+BENCHMARK_ARG_CALL(glyph_path_cold, freetype_latin, TextBenchArg("freetype", CorpusType::LATIN));
+BENCHMARK_ARG_CALL(glyph_path_cold, freetype_cjk, TextBenchArg("freetype", CorpusType::CJK));
+BENCHMARK_ARG_CALL(glyph_path_cold, freetype_mixed, TextBenchArg("freetype", CorpusType::MIXED));
+
+BENCHMARK_ARG(bounding_box, TextBenchArg arg)
+{
+	const std::string& corpus = get_corpus(arg.corpus);
+	auto fh = get_bench_font(arg.provider);
+	test::set_benchmark_units(count_codepoints(corpus), "glyph");
+	BENCHMARK_LOOP {
+		fh->getBoundingBox(corpus);
+	}
+}
+
+BENCHMARK_ARG_CALL(bounding_box, stb_latin, TextBenchArg("stb", CorpusType::LATIN));
+BENCHMARK_ARG_CALL(bounding_box, stb_mixed, TextBenchArg("stb", CorpusType::MIXED));
+BENCHMARK_ARG_CALL(bounding_box, freetype_latin, TextBenchArg("freetype", CorpusType::LATIN));
+BENCHMARK_ARG_CALL(bounding_box, freetype_mixed, TextBenchArg("freetype", CorpusType::MIXED));
+
+// Breaks the corpus into 400px lines, glyph paths are cached after the warm up
+// run so this measures the line breaking itself.
+BENCHMARK_ARG(reflow_text, TextBenchArg arg)
+{
+	const std::string& corpus = get_corpus(arg.corpus);
+	auto& fixture = get_reflow_fixture(arg);
+	const xhtml::FixedPoint line_width = 400 * 65536;
+	test::set_benchmark_units(count_codepoints(corpus), "glyph");
+	BENCHMARK_LOOP {
+		auto it = fixture.text->begin();
+		while(it != fixture.text->end()) {
+			auto line = fixture.text->reflowText(it, line_width, fixture.text_style);
+			if(line->line.empty() && it != fixture.text->end()) {
+				// word wider than a line.
+				++it;
+			}
+		}
+	}
+}
+
+BENCHMARK_ARG_CALL(reflow_text, stb_latin, TextBenchArg("stb", CorpusType::LATIN));
+BENCHMARK_ARG_CALL(reflow_text, stb_mixed, TextBenchArg("stb", CorpusType::MIXED));
+BENCHMARK_ARG_CALL(reflow_text, freetype_latin, TextBenchArg("freetype", CorpusType::LATIN));
+BENCHMARK_ARG_CALL(reflow_text, freetype_mixed, TextBenchArg("freetype", CorpusType::MIXED));
+
+// Generates the vertex/texture coordinates for each word, which is what is done
+// every time a text box is rendered.
+BENCHMARK_ARG(glyph_coords, TextBenchArg arg)
+{
+	const std::string& corpus = get_corpus(arg.corpus);
+	auto words = split_words(corpus);
+	auto fh = get_bench_font(arg.provider);
+	std::vector<std::vector<point>> paths;
+	for(auto& word : words) {
+		paths.emplace_back(fh->getGlyphPath(word));
+	}
+	test::set_benchmark_units(count_codepoints(corpus), "glyph");
+	std::vector<KRE::font_coord> coords;
+	BENCHMARK_LOOP {
+		coords.clear();
+		for(int n = 0; n != static_cast<int>(words.size()); ++n) {
+			fh->generateGlyphCoords(words[n], paths[n], &coords);
+		}
+	}
+}
+
+BENCHMARK_ARG_CALL(glyph_coords, stb_latin, TextBenchArg("stb", CorpusType::LATIN));
+BENCHMARK_ARG_CALL(glyph_coords, stb_mixed, TextBenchArg("stb", CorpusType::MIXED));
+BENCHMARK_ARG_CALL(glyph_coords, freetype_latin, TextBenchArg("freetype", CorpusType::LATIN));
+BENCHMARK_ARG_CALL(glyph_coords, freetype_mixed, TextBenchArg("freetype", CorpusType::MIXED));
@@ -0,0 +1,220 @@
+/*
+	Copyright (C) 2016 by Kristina Simpson <sweet.kristas@gmail.com>
+	
+	This software is provided 'as-is', without any express or implied
+	warranty. In no event will the authors be held liable for any damages
+	arising from the use of this software.
+
+	Permission is granted to anyone to use this software for any purpose,
+	including commercial applications, and to alter it and redistribute it
+	freely, subject to the following restrictions:
+
+	   1. The origin of this software must not be misrepresented; you must not
+	   claim that you wrote the original software. If you use this software
+	   in a product, an acknowledgment in the product documentation would be
+	   appreciated but is not required.
+
+	   2. Altered source versions must be plainly marked as such, and must not be
+	   misrepresented as being the original software.
+
+	   3. This notice may not be removed or altered from any source
+	   distribution.
+*/
+
+#include <algorithm>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define ALPHA_MAP_SSE2
+#include <emmintrin.h>
+#endif
+
+#include "asserts.hpp"
+#include "AlphaMap.hpp"
+#include "unit_test.hpp"
+
+namespace KRE
+{
+	namespace 
+	{
+		enum {
+			// Tile has a pixel with non-zero alpha.
+			TILE_VISIBLE		= 1,
+			// Tile has a pixel with alpha less than 255.
+			TILE_TRANSLUCENT	= 2,
+		};
+
+		AlphaCoverage tile_flags_to_coverage(int flags)
+		{
+			if(!(flags & TILE_VISIBLE)) {
+				return AlphaCoverage::Transparent;
+			}
+			return flags & TILE_TRANSLUCENT ? AlphaCoverage::Mixed : AlphaCoverage::Opaque;
+		}
+	}
+
+	AlphaMap::AlphaMap(int width, int height)
+		: width_(width),
+		  height_(height),
+		  stride_((width + 31) / 32),
+		  tiles_wide_((width + TileSize - 1) / TileSize),
+		  tiles_high_((height + TileSize - 1) / TileSize),
+		  bits_(stride_ * height, ~0U),
+		  tiles_(tiles_wide_ * tiles_high_, 0)
+	{
+		ASSERT_LOG(width >= 0 && height >= 0, "Invalid alpha map size: " << width << "x" << height);
+	}
+
+	void AlphaMap::setOpaque()
+	{
+		std::fill(bits_.begin(), bits_.end(), 0);
+		std::fill(tiles_.begin(), tiles_.end(), static_cast<uint8_t>(TILE_VISIBLE));
+	}
+
+	void AlphaMap::setTileBits(int x, int y, uint32_t transparent, uint32_t opaque, int count)
+	{
+		// count never crosses a tile boundary, so the bits are always within one word.
+		const uint32_t valid = (1U << count) - 1;
+		uint32_t& word = bits_[y * stride_ + (x >> 5)];
+		word = (word & ~(valid << (x & 31))) | (transparent << (x & 31));
+		uint8_t& tile = tiles_[(y / TileSize) * tiles_wide_ + x / TileSize];
+		if(transparent != valid) {
+			tile |= TILE_VISIBLE;
+		}
+		if(opaque != valid) {
+			tile |= TILE_TRANSLUCENT;
+		}
+	}
+
+	void AlphaMap::setRow32(int y, const uint32_t* px, int alpha_shift)
+	{
+		ASSERT_LOG(y >= 0 && y < height_, "Row out of range: " << y);
+		const uint32_t amask = 0xffU << alpha_shift;
+#if defined(ALPHA_MAP_SSE2)
+		const __m128i mask = _mm_set1_epi32(static_cast<int>(amask));
+		const __m128i zero = _mm_setzero_si128();
+#endif
+		for(int x = 0; x < width_; x += TileSize) {
+			const int count = std::min(static_cast<int>(TileSize), width_ - x);
+			uint32_t transparent = 0;
+			uint32_t opaque = 0;
+			int n = 0;
+#if defined(ALPHA_MAP_SSE2)
+			for(; n + 4 <= count; n += 4) {
+				const __m128i a = _mm_and_si128(_mm_loadu_si128(reinterpret_cast<const __m128i*>(px + x + n)), mask);
+				transparent |= static_cast<uint32_t>(_mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(a, zero)))) << n;
+				opaque |= static_cast<uint32_t>(_mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(a, mask)))) << n;
+			}
+#endif
+			for(; n < count; ++n) {
+				const uint32_t a = px[x + n] & amask;
+				transparent |= (a == 0 ? 1U : 0U) << n;
+				opaque |= (a == amask ? 1U : 0U) << n;
+			}
+			setTileBits(x, y, transparent, opaque, count);
+		}
+	}
+
+	void AlphaMap::setAlphaSpan(int x, int y, const uint8_t* alpha, int stride, int count)
+	{
+		ASSERT_LOG(y >= 0 && y < height_ && x >= 0 && x + count <= width_, "Span out of range: " << x << "," << y << " + " << count);
+		int n = 0;
+		while(n < count) {
+			// Split the span at tile boundaries.
+			const int len = std::min(count - n, TileSize - (x + n) % TileSize);
+			uint32_t transparent = 0;
+			uint32_t opaque = 0;
+			for(int i = 0; i != len; ++i) {
+				const uint8_t a = alpha[(n + i) * stride];
+				transparent |= (a == 0 ? 1U : 0U) << i;
+				opaque |= (a == 255 ? 1U : 0U) << i;
+			}
+			setTileBits(x + n, y, transparent, opaque, len);
+			n += len;
+		}
+	}
+
+	AlphaCoverage AlphaMap::getTileCoverage(int tx, int ty) const
+	{
+		ASSERT_LOG(tx >= 0 && tx < tiles_wide_ && ty >= 0 && ty < tiles_high_, "Tile out of range: " << tx << "," << ty);
+		return tile_flags_to_coverage(tiles_[ty * tiles_wide_ + tx]);
+	}
+
+	AlphaCoverage AlphaMap::getCoverage(const rect& r) const
+	{
+		const int x1 = std::max(0, r.x());
+		const int y1 = std::max(0, r.y());
+		const int x2 = std::min(width_, r.x2());
+		const int y2 = std::min(height_, r.y2());
+		if(x1 >= x2 || y1 >= y2) {
+			return AlphaCoverage::Transparent;
+		}
+		int flags = 0;
+		for(int ty = y1 / TileSize; ty <= (y2 - 1) / TileSize; ++ty) {
+			for(int tx = x1 / TileSize; tx <= (x2 - 1) / TileSize; ++tx) {
+				flags |= tiles_[ty * tiles_wide_ + tx];
+			}
+		}
+		return tile_flags_to_coverage(flags);
+	}
+
+	AlphaCoverage AlphaMap::getCoverage() const
+	{
+		return getCoverage(rect(0, 0, width_, height_));
+	}
+
+	int AlphaMap::countVisibleTiles() const
+	{
+		return static_cast<int>(std::count_if(tiles_.begin(), tiles_.end(), [](uint8_t t) { return (t & TILE_VISIBLE) != 0; }));
+	}
+}
+
+UNIT_TEST(alpha_map)
+{
+	// 40x20, so the last column of tiles is partial. Left tiles opaque, the middle tiles 
+	// transparent apart from one translucent pixel and the right tiles transparent.
+	const int w = 40;
+	const int h = 20;
+	std::vector<uint32_t> px(w * h);
+	for(int y = 0; y != h; ++y) {
+		for(int x = 0; x != w; ++x) {
+			uint32_t a = x < 16 ? 255 : 0;
+			if(x == 20 && y == 3) {
+				a = 128;
+			}
+			px[y * w + x] = (a << 24) | 0x00408020;
+		}
+	}
+
+	KRE::AlphaMap simd(w, h);
+	KRE::AlphaMap scalar(w, h);
+	for(int y = 0; y != h; ++y) {
+		simd.setRow32(y, &px[y * w], 24);
+		// Split oddly so spans cross tile boundaries.
+		const uint8_t* alpha = reinterpret_cast<const uint8_t*>(&px[y * w]) + 3;
+		scalar.setAlphaSpan(0, y, alpha, 4, 7);
+		scalar.setAlphaSpan(7, y, alpha + 7 * 4, 4, w - 7);
+	}
+	for(int y = 0; y != h; ++y) {
+		for(int x = 0; x != w; ++x) {
+			const bool expected = (px[y * w + x] >> 24) == 0;
+			CHECK_EQ(simd.isTransparent(x, y), expected);
+			CHECK_EQ(scalar.isTransparent(x, y), expected);
+		}
+	}
+	for(auto am : { &simd, &scalar }) {
+		CHECK_EQ(am->tilesWide(), 3);
+		CHECK_EQ(am->tilesHigh(), 2);
+		CHECK(am->getTileCoverage(0, 0) == KRE::AlphaCoverage::Opaque, "tile 0,0 should be opaque");
+		CHECK(am->getTileCoverage(1, 0) == KRE::AlphaCoverage::Mixed, "tile 1,0 should be mixed");
+		CHECK(am->getTileCoverage(1, 1) == KRE::AlphaCoverage::Transparent, "tile 1,1 should be transparent");
+		CHECK(am->getTileCoverage(2, 1) == KRE::AlphaCoverage::Transparent, "tile 2,1 should be transparent");
+		CHECK(am->getCoverage(rect(0, 0, 16, 20)) == KRE::AlphaCoverage::Opaque, "left column should be opaque");
+		CHECK(am->getCoverage(rect(32, 0, 100, 100)) == KRE::AlphaCoverage::Transparent, "right column should be transparent");
+		CHECK(am->getCoverage() == KRE::AlphaCoverage::Mixed, "whole map should be mixed");
+		CHECK_EQ(am->countVisibleTiles(), 3);
+	}
+
+	simd.setOpaque();
+	CHECK(simd.getCoverage() == KRE::AlphaCoverage::Opaque, "map should be opaque");
+	CHECK_EQ(simd.isTransparent(39, 19), false);
+}
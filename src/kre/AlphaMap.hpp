@@ -0,0 +1,89 @@
+/*
+	Copyright (C) 2016 by Kristina Simpson <sweet.kristas@gmail.com>
+	
+	This software is provided 'as-is', without any express or implied
+	warranty. In no event will the authors be held liable for any damages
+	arising from the use of this software.
+
+	Permission is granted to anyone to use this software for any purpose,
+	including commercial applications, and to alter it and redistribute it
+	freely, subject to the following restrictions:
+
+	   1. The origin of this software must not be misrepresented; you must not
+	   claim that you wrote the original software. If you use this software
+	   in a product, an acknowledgment in the product documentation would be
+	   appreciated but is not required.
+
+	   2. Altered source versions must be plainly marked as such, and must not be
+	   misrepresented as being the original software.
+
+	   3. This notice may not be removed or altered from any source
+	   distribution.
+*/
+
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "geometry.hpp"
+
+namespace KRE
+{
+	// Not upper case, wingdi.h defines TRANSPARENT and OPAQUE as macros.
+	enum class AlphaCoverage {
+		Transparent,
+		Opaque,
+		Mixed,
+	};
+
+	// Coverage of a surface: one bit per pixel marking fully transparent pixels, for hit testing,
+	// and each TileSize square of pixels classified as fully transparent, fully opaque or mixed,
+	// so rendering can tell when blending or drawing can be skipped. Built once when the surface
+	// is loaded, each row should only be set once.
+	class AlphaMap
+	{
+	public:
+		static const int TileSize = 16;
+
+		// Starts with every pixel transparent.
+		AlphaMap(int width, int height);
+
+		// Marks every pixel opaque, for surfaces without an alpha channel.
+		void setOpaque();
+
+		// Sets row y from 32-bit pixels with the alpha channel at alpha_shift.
+		void setRow32(int y, const uint32_t* px, int alpha_shift);
+		// Sets count pixels starting at x,y from alpha values stride bytes apart.
+		void setAlphaSpan(int x, int y, const uint8_t* alpha, int stride, int count);
+
+		int width() const { return width_; }
+		int height() const { return height_; }
+		int tilesWide() const { return tiles_wide_; }
+		int tilesHigh() const { return tiles_high_; }
+
+		bool isTransparent(int x, int y) const {
+			return (bits_[y * stride_ + (x >> 5)] >> (x & 31)) & 1;
+		}
+		AlphaCoverage getTileCoverage(int tx, int ty) const;
+		// Coverage of the area from the tiles it touches, so a partly covered mixed tile makes it mixed.
+		AlphaCoverage getCoverage(const rect& r) const;
+		AlphaCoverage getCoverage() const;
+		// Number of tiles that aren't fully transparent.
+		int countVisibleTiles() const;
+	private:
+		void setTileBits(int x, int y, uint32_t transparent, uint32_t opaque, int count);
+
+		int width_;
+		int height_;
+		// 32-bit words per row of bits_.
+		int stride_;
+		int tiles_wide_;
+		int tiles_high_;
+		std::vector<uint32_t> bits_;
+		// TILE_VISIBLE and TILE_TRANSLUCENT flags of each tile.
+		std::vector<uint8_t> tiles_;
+	};
+	typedef std::shared_ptr<AlphaMap> AlphaMapPtr;
+}
@@ -21,7 +21,13 @@
 	   distribution.
 */
 
+#include <algorithm>
+#include <cstring>
+#include <deque>
+
+#include "profile_timer.hpp"
 #include "AttributeSetOGL.hpp"
+#include "StateTrackerOGL.hpp"
 
 namespace KRE
 {
@@ -55,6 +61,159 @@ namespace KRE
 			ASSERT_LOG(false, "Not a valid combination of Access Frequency and Access Type.");
 			return GL_NONE;
 		}
+
+		const size_t stream_alignment = 16;
+		const size_t stream_initial_size = 1024 * 1024;
+		// Past this a frame that fills the ring waits for its own earlier draws instead.
+		const size_t stream_max_size = 16 * 1024 * 1024;
+		const GLuint64 stream_wait_timeout = 1000000000;
+
+		// Positions count the bytes streamed since the buffer was created, the offset into the
+		// buffer being the position modulo the capacity. Data stays intact until more than the
+		// capacity has been written after it.
+		class StreamRing
+		{
+		public:
+			struct Allocation
+			{
+				std::shared_ptr<GLuint> buffer;
+				size_t offset;
+				unsigned long long pos;
+			};
+
+			static StreamRing& getInstance() {
+				// Never destroyed, the context is gone by the time statics are.
+				static StreamRing* res = new StreamRing();
+				return *res;
+			}
+
+			Allocation write(const void* data, size_t size) {
+				const size_t aligned = (size + stream_alignment - 1) & ~(stream_alignment - 1);
+				if(buffer_ == nullptr) {
+					grow(std::max(stream_initial_size, aligned * 4));
+				} else if(aligned * 4 > capacity_) {
+					grow(std::max(capacity_ * 2, aligned * 4));
+				}
+
+				unsigned long long pos = head_;
+				size_t offset = static_cast<size_t>(pos % capacity_);
+				if(offset + aligned > capacity_) {
+					// Doesn't fit before the end, so skip to the start.
+					pos += capacity_ - offset;
+					offset = 0;
+				}
+				if(pos + aligned > capacity_) {
+					const unsigned long long needed = pos + aligned - capacity_;
+					if(needed > fenced_) {
+						// Would overwrite data from the frame still being built.
+						if(capacity_ < stream_max_size) {
+							grow(capacity_ * 2);
+							return write(data, size);
+						}
+						fence();
+					}
+					waitFor(needed);
+				}
+
+				if(mapped_ != nullptr) {
+					std::memcpy(mapped_ + offset, data, size);
+				} else {
+					StateTrackerOGL::getInstance().bindBuffer(GL_ARRAY_BUFFER, *buffer_);
+					void* dst = glMapBufferRange(GL_ARRAY_BUFFER, offset, aligned, GL_MAP_WRITE_BIT | GL_MAP_UNSYNCHRONIZED_BIT | GL_MAP_INVALIDATE_RANGE_BIT);
+					ASSERT_LOG(dst != nullptr, "Unable to map stream buffer range: " << offset << "," << aligned);
+					std::memcpy(dst, data, size);
+					glUnmapBuffer(GL_ARRAY_BUFFER);
+				}
+				head_ = pos + aligned;
+				PROFILE_COUNT(UPLOADED_BYTES, size);
+				Allocation res = { buffer_, offset, pos };
+				return res;
+			}
+
+			// Data left in a buffer the ring has since outgrown is moved so the buffer can go.
+			bool isIntact(const std::shared_ptr<GLuint>& buffer, unsigned long long pos) const {
+				return buffer != nullptr && buffer == buffer_ && head_ <= pos + capacity_;
+			}
+
+			void fence() {
+				if(head_ > fenced_) {
+					Fence f = { glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0), head_ };
+					fences_.emplace_back(f);
+					fenced_ = head_;
+				}
+				// Retire whatever has already passed so the queue stays short.
+				while(!fences_.empty()) {
+					GLenum res = glClientWaitSync(fences_.front().sync, 0, 0);
+					if(res != GL_ALREADY_SIGNALED && res != GL_CONDITION_SATISFIED) {
+						break;
+					}
+					retireFront();
+				}
+			}
+		private:
+			StreamRing() : mapped_(nullptr), capacity_(0), head_(0), fenced_(0), completed_(0) {}
+
+			struct Fence
+			{
+				GLsync sync;
+				unsigned long long pos;
+			};
+
+			void waitFor(unsigned long long pos) {
+				while(completed_ < pos) {
+					ASSERT_LOG(!fences_.empty(), "No fence covers stream buffer position: " << pos);
+					GLenum res;
+					do {
+						res = glClientWaitSync(fences_.front().sync, GL_SYNC_FLUSH_COMMANDS_BIT, stream_wait_timeout);
+					} while(res == GL_TIMEOUT_EXPIRED);
+					ASSERT_LOG(res != GL_WAIT_FAILED, "Waiting on a stream buffer fence failed.");
+					retireFront();
+				}
+			}
+
+			void retireFront() {
+				completed_ = fences_.front().pos;
+				glDeleteSync(fences_.front().sync);
+				fences_.pop_front();
+			}
+
+			// Anything still drawing from the old buffer keeps it alive until it's done.
+			void grow(size_t capacity) {
+				for(auto& f : fences_) {
+					glDeleteSync(f.sync);
+				}
+				fences_.clear();
+				head_ = fenced_ = completed_ = 0;
+				capacity_ = capacity;
+
+				buffer_ = std::shared_ptr<GLuint>(new GLuint, [](GLuint* id) {
+					StateTrackerOGL::getInstance().bufferDeleted(*id);
+					glDeleteBuffers(1, id);
+					delete id;
+				});
+				glGenBuffers(1, buffer_.get());
+				StateTrackerOGL::getInstance().bindBuffer(GL_ARRAY_BUFFER, *buffer_);
+				if(GLEW_ARB_buffer_storage) {
+					const GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+					glBufferStorage(GL_ARRAY_BUFFER, capacity_, nullptr, flags);
+					mapped_ = static_cast<char*>(glMapBufferRange(GL_ARRAY_BUFFER, 0, capacity_, flags));
+					ASSERT_LOG(mapped_ != nullptr, "Unable to persistently map stream buffer of size: " << capacity_);
+				} else {
+					glBufferData(GL_ARRAY_BUFFER, capacity_, nullptr, GL_STREAM_DRAW);
+					mapped_ = nullptr;
+				}
+				LOG_DEBUG("Stream buffer is now " << capacity_ << " bytes" << (mapped_ != nullptr ? ", persistently mapped." : "."));
+			}
+
+			std::shared_ptr<GLuint> buffer_;
+			char* mapped_;
+			size_t capacity_;
+			unsigned long long head_;
+			// Everything before fenced_ has a fence queued, everything before completed_ is done with.
+			unsigned long long fenced_;
+			unsigned long long completed_;
+			std::deque<Fence> fences_;
+		};
 	}
 
 
@@ -75,12 +234,15 @@ namespace KRE
 
 	HardwareAttributeOGL::~HardwareAttributeOGL()
 	{
+		StateTrackerOGL::getInstance().bufferDeleted(buffer_id_);
 		glDeleteBuffers(1, &buffer_id_);
 	}
 
 	void HardwareAttributeOGL::update(const void* value, ptrdiff_t offset, size_t size)
 	{
-		glBindBuffer(GL_ARRAY_BUFFER, buffer_id_);
+		// Left bound, the draw that follows an update usually binds it again.
+		StateTrackerOGL::getInstance().bindBuffer(GL_ARRAY_BUFFER, buffer_id_);
+		PROFILE_COUNT(UPLOADED_BYTES, size);
 		if(offset == 0) {
 			// this is a minor optimisation.
 			glBufferData(GL_ARRAY_BUFFER, size, 0, access_pattern_);
@@ -98,17 +260,79 @@ namespace KRE
 			glBufferSubData(GL_ARRAY_BUFFER, offset, size, value);
 			size_ = size + offset;
 		}
-		glBindBuffer(GL_ARRAY_BUFFER, 0);
 	}
 
 	void HardwareAttributeOGL::bind()
 	{
-		glBindBuffer(GL_ARRAY_BUFFER, buffer_id_);
+		StateTrackerOGL::getInstance().bindBuffer(GL_ARRAY_BUFFER, buffer_id_);
 	}
 
 	void HardwareAttributeOGL::unbind()
 	{
-		glBindBuffer(GL_ARRAY_BUFFER, 0);
+		StateTrackerOGL::getInstance().bindBuffer(GL_ARRAY_BUFFER, 0);
+	}
+
+
+	StreamingAttributeOGL::StreamingAttributeOGL(AttributeBase* parent)
+		: HardwareAttribute(parent),
+		data_(nullptr),
+		size_(0),
+		buffer_(),
+		offset_(0),
+		stream_pos_(0)
+	{
+	}
+
+	HardwareAttributePtr StreamingAttributeOGL::create(AttributeBase* parent)
+	{
+		return std::make_shared<StreamingAttributeOGL>(parent);
+	}
+
+	bool StreamingAttributeOGL::isSupported()
+	{
+		return GLEW_ARB_map_buffer_range && GLEW_ARB_sync;
+	}
+
+	void StreamingAttributeOGL::endFrame()
+	{
+		StreamRing::getInstance().fence();
+	}
+
+	std::shared_ptr<GLuint> StreamingAttributeOGL::write(const void* data, size_t size, size_t* offset)
+	{
+		auto res = StreamRing::getInstance().write(data, size);
+		*offset = res.offset;
+		return res.buffer;
+	}
+
+	void StreamingAttributeOGL::update(const void* value, ptrdiff_t offset, size_t size)
+	{
+		// The parent keeps its data until the next update, so it can be copied in again later.
+		ASSERT_LOG(offset == 0, "Streaming attributes only support replacing all of their data.");
+		data_ = value;
+		size_ = size;
+		upload();
+	}
+
+	void StreamingAttributeOGL::upload()
+	{
+		auto res = StreamRing::getInstance().write(data_, size_);
+		buffer_ = res.buffer;
+		offset_ = res.offset;
+		stream_pos_ = res.pos;
+	}
+
+	void StreamingAttributeOGL::bind()
+	{
+		if(size_ != 0 && !StreamRing::getInstance().isIntact(buffer_, stream_pos_)) {
+			upload();
+		}
+		StateTrackerOGL::getInstance().bindBuffer(GL_ARRAY_BUFFER, buffer_ != nullptr ? *buffer_ : 0);
+	}
+
+	void StreamingAttributeOGL::unbind()
+	{
+		StateTrackerOGL::getInstance().bindBuffer(GL_ARRAY_BUFFER, 0);
 	}
 
 
@@ -131,6 +355,7 @@ namespace KRE
 	AttributeSetOGL::~AttributeSetOGL()
 	{
 		if(isIndexed()) {
+			StateTrackerOGL::getInstance().bufferDeleted(index_buffer_id_);
 			glDeleteBuffers(1, &index_buffer_id_);
 		}
 	}
@@ -140,29 +365,20 @@ namespace KRE
 		return std::make_shared<AttributeSetOGL>(*this);
 	}
 
-	struct IndexManager
-	{
-		IndexManager(GLuint buffer_id) {
-			glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, buffer_id);
-		}
-		~IndexManager() {
-			glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
-		}
-	};
-
 	void AttributeSetOGL::bindIndex()
 	{
-		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, index_buffer_id_);
+		StateTrackerOGL::getInstance().bindBuffer(GL_ELEMENT_ARRAY_BUFFER, index_buffer_id_);
 	}
 
 	void AttributeSetOGL::unbindIndex()
 	{
-		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+		StateTrackerOGL::getInstance().bindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
 	}
 
 	void AttributeSetOGL::handleIndexUpdate()
 	{
-		IndexManager im(index_buffer_id_);
+		bindIndex();
 		glBufferData(GL_ELEMENT_ARRAY_BUFFER, getTotalArraySize(), getIndexData(), GL_STATIC_DRAW);
+		PROFILE_COUNT(UPLOADED_BYTES, getTotalArraySize());
 	}
 }
@@ -45,6 +45,36 @@ namespace KRE
 		size_t size_;
 	};
 
+	// Streams vertex data through a ring buffer shared by all streaming attributes, rather than
+	// orphaning a buffer object of its own on every update. Space is handed back once the fence
+	// placed at the end of the frame that used it has passed. If a draw finds the data has been
+	// overwritten since it was written it is copied in again, so this suits geometry that is
+	// rebuilt most frames. Attributes opt in with AccessFreqHint::STREAM.
+	class StreamingAttributeOGL : public HardwareAttribute
+	{
+	public:
+		StreamingAttributeOGL(AttributeBase* parent);
+		void update(const void* value, ptrdiff_t offset, size_t size) override;
+		void bind() override;
+		void unbind() override;
+		intptr_t value() override { return static_cast<intptr_t>(offset_); }
+		HardwareAttributePtr create(AttributeBase* parent) override;
+		// Needs map_buffer_range and sync objects, buffer_storage is used when present.
+		static bool isSupported();
+		// Fences everything streamed so far. Called once a frame has been submitted.
+		static void endFrame();
+		// Copies data into the ring for a draw made straight away, returning the buffer and offset
+		// it landed at.
+		static std::shared_ptr<GLuint> write(const void* data, size_t size, size_t* offset);
+	private:
+		void upload();
+		const void* data_;
+		size_t size_;
+		std::shared_ptr<GLuint> buffer_;
+		size_t offset_;
+		unsigned long long stream_pos_;
+	};
+
 
 	class AttributeSetOGL : public AttributeSet
 	{
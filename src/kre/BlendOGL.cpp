@@ -28,6 +28,7 @@
 #include "asserts.hpp"
 #include "BlendModeScope.hpp"
 #include "BlendOGL.hpp"
+#include "StateTrackerOGL.hpp"
 
 namespace KRE
 {
@@ -112,7 +113,7 @@ namespace KRE
 				get_equation_stack().emplace(BlendEquationConstants::BE_ADD, BlendEquationConstants::BE_ADD);
 			}
 			get_equation_stack().emplace(eqn);
-			glBlendEquationSeparate(convert_eqn(eqn.getRgbEquation()), convert_eqn(eqn.getAlphaEquation()));
+			StateTrackerOGL::getInstance().setBlendEquation(convert_eqn(eqn.getRgbEquation()), convert_eqn(eqn.getAlphaEquation()));
 		}
 	}
 
@@ -122,7 +123,7 @@ namespace KRE
 			ASSERT_LOG(!get_equation_stack().empty(), "Something went badly wrong blend mode stack was empty.");
 			get_equation_stack().pop();
 			BlendEquation& eqn = get_equation_stack().top();
-			glBlendEquationSeparate(convert_eqn(eqn.getRgbEquation()), convert_eqn(eqn.getAlphaEquation()));
+			StateTrackerOGL::getInstance().setBlendEquation(convert_eqn(eqn.getRgbEquation()), convert_eqn(eqn.getAlphaEquation()));
 		}
 	}
 
@@ -132,7 +133,7 @@ namespace KRE
 		const BlendEquation& eqn = sv.getBlendEquation();
 		if(sv.isBlendEquationSet() && eqn != BlendEquation()) {
 			get_equation_stack().emplace(eqn);
-			glBlendEquationSeparate(convert_eqn(eqn.getRgbEquation()), convert_eqn(eqn.getAlphaEquation()));
+			StateTrackerOGL::getInstance().setBlendEquation(convert_eqn(eqn.getRgbEquation()), convert_eqn(eqn.getAlphaEquation()));
 			stored_ = true;
 		}
 	}
@@ -144,9 +145,9 @@ namespace KRE
 			get_equation_stack().pop();
 			if(!get_equation_stack().empty()) {
 				BlendEquation& eqn = get_equation_stack().top();
-				glBlendEquationSeparate(convert_eqn(eqn.getRgbEquation()), convert_eqn(eqn.getAlphaEquation()));
+				StateTrackerOGL::getInstance().setBlendEquation(convert_eqn(eqn.getRgbEquation()), convert_eqn(eqn.getAlphaEquation()));
 			} else {
-				glBlendEquationSeparate(GL_FUNC_ADD, GL_FUNC_ADD);
+				StateTrackerOGL::getInstance().setBlendEquation(GL_FUNC_ADD, GL_FUNC_ADD);
 			}
 		}
 	}
@@ -157,11 +158,7 @@ namespace KRE
 	{
 		auto& bm = sv.getBlendMode();
 		if(sv.isBlendStateSet()) {
-			if(sv.isBlendEnabled()) {
-				glEnable(GL_BLEND);
-			} else {
-				glDisable(GL_BLEND);
-			}
+			StateTrackerOGL::getInstance().setBlendEnabled(sv.isBlendEnabled());
 			get_blend_state_stack().emplace(sv.isBlendEnabled());
 			state_stored_ = true;
 		}
@@ -169,12 +166,12 @@ namespace KRE
 		if(sv.isBlendModeSet() && bm != BlendMode()) {
 			get_blend_mode_stack().emplace(bm);
 			stored_ = true;
-			glBlendFunc(convert_blend_mode(bm.src()), convert_blend_mode(bm.dst()));
+			StateTrackerOGL::getInstance().setBlendFunc(convert_blend_mode(bm.src()), convert_blend_mode(bm.dst()));
 		} else if(BlendModeScope::getCurrentMode() != BlendMode()) {
 			auto& bm = BlendModeScope::getCurrentMode();
 			get_blend_mode_stack().emplace(bm);
 			stored_ = true;
-			glBlendFunc(convert_blend_mode(bm.src()), convert_blend_mode(bm.dst()));
+			StateTrackerOGL::getInstance().setBlendFunc(convert_blend_mode(bm.src()), convert_blend_mode(bm.dst()));
 		}
 	}
 
@@ -185,28 +182,16 @@ namespace KRE
 			get_blend_mode_stack().pop();
 			if(!get_blend_mode_stack().empty()) {
 				BlendMode& bm = get_blend_mode_stack().top();
-				glBlendFunc(convert_blend_mode(bm.src()), convert_blend_mode(bm.dst()));
+				StateTrackerOGL::getInstance().setBlendFunc(convert_blend_mode(bm.src()), convert_blend_mode(bm.dst()));
 			} else {
-				glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+				StateTrackerOGL::getInstance().setBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
 			}
 		}
 
 		if(state_stored_) {
 			ASSERT_LOG(!get_blend_state_stack().empty(), "Something went badly wrong blend state stack was empty.");
-			bool state = get_blend_state_stack().top();
 			get_blend_state_stack().pop();
-			if(!get_blend_state_stack().empty()) {
-				if(get_blend_state_stack().top()) {
-					glEnable(GL_BLEND);
-				} else {
-					glDisable(GL_BLEND);
-				}
-			} else {
-				// We check this so we don't have extraneous blend enable calls.
-				if(!state) {
-					glEnable(GL_BLEND);
-				}
-			}
+			StateTrackerOGL::getInstance().setBlendEnabled(get_blend_state_stack().empty() || get_blend_state_stack().top());
 		}
 	}
 }
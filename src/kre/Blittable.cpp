@@ -125,6 +125,7 @@ namespace KRE
 			vertices.emplace_back(glm::vec2(vx2,vy2), glm::vec2(r.x2(),r.y2()));
 			getAttributeSet().back()->setCount(vertices.size());
 			attribs_->update(&vertices);
+			setLocalBounds(rectf::from_coordinates(vx1, vy1, vx2, vy2));
 		}
 	}
 
@@ -137,6 +138,8 @@ namespace KRE
 
 	void Blittable::update(std::vector<vertex_texcoord>* queue)
 	{
+		clearLocalBounds();
+		extendLocalBounds(queue->cbegin(), queue->cend(), [](const vertex_texcoord& v) { return v.vtx; });
 		attribs_->update(queue);
 	}
 
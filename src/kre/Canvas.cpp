@@ -57,7 +57,8 @@ namespace KRE
 		  window_(WindowManager::getMainWindow()),
 		  size_change_key_(-1),
 		  camera_(nullptr),
-		  pv_(1.0f)
+		  pv_(1.0f),
+		  batch_depth_(0)
 	{
 		width_ = getWindow()->width();
 		height_ = getWindow()->height();			
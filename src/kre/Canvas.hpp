@@ -143,6 +143,26 @@ namespace KRE
 			CanvasPtr canvas_;
 		};
 
+		// While one of these is alive, primitives sharing a shader and texture may be held back and
+		// drawn together. They're drawn when the state they need changes and when the last scope ends.
+		struct BatchScope
+		{
+			BatchScope() : canvas_(Canvas::getInstance()) {
+				++canvas_->batch_depth_;
+			}
+			~BatchScope()
+			{
+				if(--canvas_->batch_depth_ == 0) {
+					canvas_->flush();
+				}
+			}
+			CanvasPtr canvas_;
+		};
+
+		bool isBatching() const { return batch_depth_ > 0; }
+		// Draws anything held back by a BatchScope.
+		virtual void flush() const {}
+
 		const Color getColor() const {
 			if(color_stack_.empty()) {
 				return Color::colorWhite();
@@ -178,6 +198,7 @@ namespace KRE
 		int size_change_key_;
 		CameraPtr camera_;
 		glm::mat4 pv_;
+		int batch_depth_;
 	};
 
 	// Helper function to generate a color wheel between the given hue values.
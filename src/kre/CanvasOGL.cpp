@@ -24,8 +24,13 @@
 #include <glm/gtc/type_ptr.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 
+#include "unit_test.hpp"
+
+#include "AttributeSetOGL.hpp"
 #include "CanvasOGL.hpp"
+#include "DisplayDevice.hpp"
 #include "ShadersOGL.hpp"
+#include "StateTrackerOGL.hpp"
 #include "TextureOGL.hpp"
 
 namespace KRE
@@ -37,11 +42,208 @@ namespace KRE
 			static CanvasPtr res = CanvasPtr(new CanvasOGL());
 			return res;
 		}
+
+		enum class BatchMode {
+			NONE,
+			TRIANGLES,
+			LINES,
+			TEXTURED,
+		};
+
+		// Primitives held back while batching. Vertices are stored with their model matrix already 
+		// applied, so primitives with different transforms can share a draw. Solid primitives carry
+		// their color per vertex, textured ones share the shader, texture and color uniform.
+		struct CanvasBatch
+		{
+			CanvasBatch() : mode(BatchMode::NONE), primitives(0), shader(), texture(), color(1.0f), pmat(1.0f), vmat(1.0f), colored(), textured() {}
+			BatchMode mode;
+			int primitives;
+			ShaderProgramPtr shader;
+			TexturePtr texture;
+			glm::vec4 color;
+			glm::mat4 pmat;
+			glm::mat4 vmat;
+			std::vector<vertex_color> colored;
+			std::vector<vertex_texcoord> textured;
+		};
+
+		CanvasBatch& get_batch()
+		{
+			static CanvasBatch res;
+			return res;
+		}
+
+		// Only matrices leaving z at 0 and w at 1 can be applied ahead of the draw without changing the output.
+		bool is_flat_transform(const glm::mat4& m)
+		{
+			return m[0][2] == 0.0f && m[1][2] == 0.0f && m[3][2] == 0.0f 
+				&& m[0][3] == 0.0f && m[1][3] == 0.0f && m[3][3] == 1.0f;
+		}
+
+		// Returns the batch to add a primitive to, drawing the current one first if it needs different state.
+		CanvasBatch& begin_batch(BatchMode mode, const CameraPtr& cam, const ShaderProgramPtr& shader=nullptr, const TexturePtr& tex=nullptr, const glm::vec4& color=glm::vec4(1.0f))
+		{
+			auto& b = get_batch();
+			if(b.mode != BatchMode::NONE && (b.mode != mode || b.shader != shader || b.texture != tex || b.color != color 
+				|| b.pmat != cam->getProjectionMat() || b.vmat != cam->getViewMat())) {
+				CanvasOGL::flushBatch();
+			}
+			if(b.mode == BatchMode::NONE) {
+				b.mode = mode;
+				b.shader = shader;
+				b.texture = tex;
+				b.color = color;
+				b.pmat = cam->getProjectionMat();
+				b.vmat = cam->getViewMat();
+			}
+			++b.primitives;
+			return b;
+		}
+
+		glm::vec2 transform(const glm::mat4& m, const glm::vec2& v)
+		{
+			return glm::vec2(m * glm::vec4(v, 0.0f, 1.0f));
+		}
+
+		// Quads are given in triangle strip order.
+		void add_quad(std::vector<vertex_color>* out, const glm::mat4& m, const glm::vec2* v, const glm::u8vec4& color)
+		{
+			for(int n : { 0, 1, 2, 2, 1, 3 }) {
+				out->emplace_back(transform(m, v[n]), color);
+			}
+		}
+
+		// A one unit wide outline just inside r. It is drawn as quads on the unbatched path too, so
+		// strokes look the same whether or not they were batched.
+		void add_outline(std::vector<vertex_color>* out, const glm::mat4& m, const rectf& r, const glm::u8vec4& color)
+		{
+			const float x1 = r.x1();
+			const float y1 = r.y1();
+			const float x2 = r.x2();
+			const float y2 = r.y2();
+			const glm::vec2 edges[][4] = {
+				{ glm::vec2(x1, y1), glm::vec2(x2, y1), glm::vec2(x1, y1 + 1.0f), glm::vec2(x2, y1 + 1.0f) },
+				{ glm::vec2(x1, y2 - 1.0f), glm::vec2(x2, y2 - 1.0f), glm::vec2(x1, y2), glm::vec2(x2, y2) },
+				{ glm::vec2(x1, y1 + 1.0f), glm::vec2(x1 + 1.0f, y1 + 1.0f), glm::vec2(x1, y2 - 1.0f), glm::vec2(x1 + 1.0f, y2 - 1.0f) },
+				{ glm::vec2(x2 - 1.0f, y1 + 1.0f), glm::vec2(x2, y1 + 1.0f), glm::vec2(x2 - 1.0f, y2 - 1.0f), glm::vec2(x2, y2 - 1.0f) },
+			};
+			for(auto& e : edges) {
+				add_quad(out, m, e, color);
+			}
+		}
+
+		void add_textured_quad(CanvasBatch& b, const glm::mat4& m, const glm::vec2* v, const glm::vec2* tc)
+		{
+			for(int n : { 0, 1, 2, 2, 1, 3 }) {
+				b.textured.emplace_back(transform(m, v[n]), tc[n]);
+			}
+		}
+
+		void add_line_strip(CanvasBatch& b, const glm::mat4& m, const glm::vec2* v, size_t count, const glm::u8vec4& color, bool loop=false)
+		{
+			for(size_t n = 1; n < count; ++n) {
+				b.colored.emplace_back(transform(m, v[n-1]), color);
+				b.colored.emplace_back(transform(m, v[n]), color);
+			}
+			if(loop && count > 2) {
+				b.colored.emplace_back(transform(m, v[count-1]), color);
+				b.colored.emplace_back(transform(m, v[0]), color);
+			}
+		}
+
+		glm::vec4 as_vec4(const Color& color)
+		{
+			return glm::vec4(color.r(), color.g(), color.b(), color.a());
+		}
+
+		// A draw of per vertex colored primitives, with the model matrix still to be applied.
+		struct ColoredDraw
+		{
+			BatchMode mode;
+			glm::mat4 pmat;
+			glm::mat4 vmat;
+			glm::mat4 mmat;
+			std::vector<vertex_color> vertices;
+		};
+
+		// If set colored draws are handed to this instead of GL, so the unit tests can see them.
+		std::function<void(const ColoredDraw&)>& get_draw_recorder()
+		{
+			static std::function<void(const ColoredDraw&)> res;
+			return res;
+		}
+
+		// Draws the vertices as lines or triangles, used by both the batched and unbatched paths.
+		void draw_colored(BatchMode mode, const glm::mat4& pmat, const glm::mat4& vmat, const glm::mat4& mmat, const std::vector<vertex_color>& vertices)
+		{
+			if(get_draw_recorder()) {
+				const ColoredDraw draw = { mode, pmat, vmat, mmat, vertices };
+				get_draw_recorder()(draw);
+				return;
+			}
+			static OpenGL::ShaderProgramPtr shader = OpenGL::ShaderProgram::factory("attr_color_shader");
+			shader->makeActive();
+			shader->setMvpMatrix(pmat, vmat, mmat);
+			shader->setUniformValue(shader->getColorUniform(), glm::value_ptr(glm::vec4(1.0f)));
+
+			const size_t size = vertices.size() * sizeof(vertex_color);
+			// With streaming support the vertices go through the shared ring, otherwise they're drawn from client memory.
+			const unsigned char* base = reinterpret_cast<const unsigned char*>(vertices.data());
+			std::shared_ptr<GLuint> buffer;
+			if(StreamingAttributeOGL::isSupported()) {
+				size_t offset = 0;
+				buffer = StreamingAttributeOGL::write(vertices.data(), size, &offset);
+				base = reinterpret_cast<const unsigned char*>(offset);
+			}
+			StateTrackerOGL::getInstance().bindBuffer(GL_ARRAY_BUFFER, buffer != nullptr ? *buffer : 0);
+
+			glEnableVertexAttribArray(shader->getVertexAttribute());
+			glEnableVertexAttribArray(shader->getColorAttribute());
+			glVertexAttribPointer(shader->getVertexAttribute(), 2, GL_FLOAT, GL_FALSE, sizeof(vertex_color), base + offsetof(vertex_color, vertex));
+			glVertexAttribPointer(shader->getColorAttribute(), 4, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(vertex_color), base + offsetof(vertex_color, color));
+			StateTrackerOGL::getInstance().applyState();
+			glDrawArrays(mode == BatchMode::LINES ? GL_LINES : GL_TRIANGLES, 0, static_cast<GLsizei>(vertices.size()));
+			glDisableVertexAttribArray(shader->getColorAttribute());
+			glDisableVertexAttribArray(shader->getVertexAttribute());
+			StateTrackerOGL::getInstance().bindBuffer(GL_ARRAY_BUFFER, 0);
+		}
+
+		// A filled rect with an optional stroke. The same vertices are generated whether the rect 
+		// is batched or not, only where the model matrix gets applied differs.
+		void draw_solid_rect(const CameraPtr& cam, bool batching, const rect& r, const glm::u8vec4& fill_color, const glm::u8vec4* stroke_color, float rotation)
+		{
+			const rectf vtx = r.as_type<float>();
+			const glm::vec2 corners[] = {
+				glm::vec2(vtx.x1(), vtx.y1()),
+				glm::vec2(vtx.x2(), vtx.y1()),
+				glm::vec2(vtx.x1(), vtx.y2()),
+				glm::vec2(vtx.x2(), vtx.y2()),
+			};
+
+			glm::mat4 model = glm::translate(glm::mat4(1.0f), glm::vec3(vtx.mid_x(),vtx.mid_y(),0.0f)) * glm::rotate(glm::mat4(1.0f), glm::radians(rotation), glm::vec3(0.0f,0.0f,1.0f)) * glm::translate(glm::mat4(1.0f), glm::vec3(-vtx.mid_x(),-vtx.mid_y(),0.0f));
+			glm::mat4 mmat = model * get_global_model_matrix();
+			if(batching && is_flat_transform(mmat)) {
+				auto& b = begin_batch(BatchMode::TRIANGLES, cam);
+				add_quad(&b.colored, mmat, corners, fill_color);
+				if(stroke_color != nullptr) {
+					add_outline(&b.colored, mmat, vtx, *stroke_color);
+				}
+				return;
+			}
+			CanvasOGL::flushBatch();
+			std::vector<vertex_color> vertices;
+			add_quad(&vertices, glm::mat4(1.0f), corners, fill_color);
+			if(stroke_color != nullptr) {
+				add_outline(&vertices, glm::mat4(1.0f), vtx, *stroke_color);
+			}
+			draw_colored(BatchMode::TRIANGLES, cam->getProjectionMat(), cam->getViewMat(), mmat, vertices);
+		}
 	}
 
 	CanvasOGL::CanvasOGL()
 	{
 		handleDimensionsChanged();
+		StateTrackerOGL::getInstance().setPendingDrawsFn(&CanvasOGL::flushBatch);
 	}
 
 	CanvasOGL::~CanvasOGL()
@@ -87,13 +289,20 @@ namespace KRE
 		//LOG_DEBUG("blit: " << src << "," << dst);
 		//LOG_DEBUG("blit: " << tx1 << "," << ty1 << "," << tx2 << "," << ty2 << " : " << vx1 << "," << vy1 << "," << vx2 << "," << vy2);
 
-		glm::mat4 mvp;
+		glm::mat4 mmat;
 		if(std::abs(rotation) > FLT_EPSILON) {
 			glm::mat4 model = glm::translate(glm::mat4(1.0f), glm::vec3((vx1+vx2)/2.0f,(vy1+vy2)/2.0f,0.0f)) * glm::rotate(glm::mat4(1.0f), glm::radians(rotation), glm::vec3(0.0f,0.0f,1.0f)) * glm::translate(glm::mat4(1.0f), glm::vec3(-(vx1+vx2)/2.0f,-(vy1+vy2)/2.0f,0.0f));
-			mvp = getPVMatrix() * model * get_global_model_matrix();
+			mmat = model * get_global_model_matrix();
 		} else {
-			mvp = getPVMatrix() * get_global_model_matrix();
+			mmat = get_global_model_matrix();
 		}
+		const glm::vec4 blit_color = as_vec4(color != KRE::Color::colorWhite() ? color * getColor() : getColor());
+		if(isBatching() && is_flat_transform(mmat)) {
+			auto& b = begin_batch(BatchMode::TEXTURED, getCamera(), getCurrentShader(), texture, blit_color);
+			add_textured_quad(b, mmat, reinterpret_cast<const glm::vec2*>(vtx_coords), reinterpret_cast<const glm::vec2*>(uv_coords));
+			return;
+		}
+		flushBatch();
 		auto shader = getCurrentShader();
 		shader->makeActive();
 		shader->setUniformsForTexture(texture);
@@ -101,7 +310,7 @@ namespace KRE
 		if(uniform_draw_fn) {
 			uniform_draw_fn(shader);
 		}
-		shader->setUniformValue(shader->getMvpUniform(), glm::value_ptr(mvp));
+		shader->setMvpMatrix(getCamera()->getProjectionMat(), getCamera()->getViewMat(), mmat);
 		if(color != KRE::Color::colorWhite()) {
 			shader->setUniformValue(shader->getColorUniform(), (color*getColor()).asFloatVector());
 		} else {
@@ -109,11 +318,13 @@ namespace KRE
 		}
 		// XXX the following line are only temporary, obviously.
 		//shader->SetUniformValue(shader->GetUniformIterator("discard"), 0);
+		StateTrackerOGL::getInstance().bindBuffer(GL_ARRAY_BUFFER, 0);
 		glEnableVertexAttribArray(shader->getVertexAttribute());
 		glVertexAttribPointer(shader->getVertexAttribute(), 2, GL_FLOAT, GL_FALSE, 0, vtx_coords);
 		glEnableVertexAttribArray(shader->getTexcoordAttribute());
 		glVertexAttribPointer(shader->getTexcoordAttribute(), 2, GL_FLOAT, GL_FALSE, 0, uv_coords);
 
+		StateTrackerOGL::getInstance().applyState();
 		glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
 
 		glDisableVertexAttribArray(shader->getTexcoordAttribute());
@@ -123,7 +334,15 @@ namespace KRE
 	void CanvasOGL::blitTexture(const TexturePtr& tex, const std::vector<vertex_texcoord>& vtc, float rotation, const Color& color)
 	{
 		glm::mat4 model = glm::rotate(glm::mat4(1.0f), glm::radians(rotation), glm::vec3(0, 0, 1.0f));
-		glm::mat4 mvp = getPVMatrix() * model * get_global_model_matrix();
+		glm::mat4 mmat = model * get_global_model_matrix();
+		if(isBatching() && is_flat_transform(mmat)) {
+			auto& b = begin_batch(BatchMode::TEXTURED, getCamera(), getCurrentShader(), tex, as_vec4(color != KRE::Color::colorWhite() ? color * getColor() : getColor()));
+			for(auto& v : vtc) {
+				b.textured.emplace_back(transform(mmat, v.vtx), v.tc);
+			}
+			return;
+		}
+		flushBatch();
 		auto shader = getCurrentShader();
 		shader->makeActive();
 		shader->setUniformsForTexture(tex);
@@ -131,7 +350,7 @@ namespace KRE
 		if(uniform_draw_fn) {
 			uniform_draw_fn(shader);
 		}
-		shader->setUniformValue(shader->getMvpUniform(), glm::value_ptr(mvp));
+		shader->setMvpMatrix(getCamera()->getProjectionMat(), getCamera()->getViewMat(), mmat);
 		if(color != KRE::Color::colorWhite()) {
 			shader->setUniformValue(shader->getColorUniform(), (color*getColor()).asFloatVector());
 		} else {
@@ -139,11 +358,13 @@ namespace KRE
 		}
 		// XXX the following line are only temporary, obviously.
 		//shader->SetUniformValue(shader->GetUniformIterator("discard"), 0);
+		StateTrackerOGL::getInstance().bindBuffer(GL_ARRAY_BUFFER, 0);
 		glEnableVertexAttribArray(shader->getVertexAttribute());
 		glVertexAttribPointer(shader->getVertexAttribute(), 2, GL_FLOAT, GL_FALSE, sizeof(vertex_texcoord), reinterpret_cast<const unsigned char*>(&vtc[0]) + offsetof(vertex_texcoord, vtx));
 		glEnableVertexAttribArray(shader->getTexcoordAttribute());
 		glVertexAttribPointer(shader->getTexcoordAttribute(), 2, GL_FLOAT, GL_FALSE, sizeof(vertex_texcoord), reinterpret_cast<const unsigned char*>(&vtc[0]) + offsetof(vertex_texcoord, tc));
 
+		StateTrackerOGL::getInstance().applyState();
 		glDrawArrays(GL_TRIANGLES, 0, static_cast<GLsizei>(vtc.size()));
 
 		glDisableVertexAttribArray(shader->getTexcoordAttribute());
@@ -152,65 +373,13 @@ namespace KRE
 
 	void CanvasOGL::drawSolidRect(const rect& r, const Color& fill_color, const Color& stroke_color, float rotation) const
 	{
-		rectf vtx = r.as_type<float>();
-		const float vtx_coords[] = {
-			vtx.x1(), vtx.y1(),
-			vtx.x2(), vtx.y1(),
-			vtx.x1(), vtx.y2(),
-			vtx.x2(), vtx.y2(),
-		};
-
-		glm::mat4 model = glm::translate(glm::mat4(1.0f), glm::vec3(vtx.mid_x(),vtx.mid_y(),0.0f)) * glm::rotate(glm::mat4(1.0f), glm::radians(rotation), glm::vec3(0.0f,0.0f,1.0f)) * glm::translate(glm::mat4(1.0f), glm::vec3(-vtx.mid_x(),-vtx.mid_y(),0.0f));
-		glm::mat4 mvp = getPVMatrix() * model * get_global_model_matrix();
-		static OpenGL::ShaderProgramPtr shader = OpenGL::ShaderProgram::factory("simple");
-		shader->makeActive();
-		shader->setUniformValue(shader->getMvpUniform(), glm::value_ptr(mvp));
-
-		// Draw a filled rect
-		shader->setUniformValue(shader->getColorUniform(), fill_color.asFloatVector());
-		glEnableVertexAttribArray(shader->getVertexAttribute());
-		glVertexAttribPointer(shader->getVertexAttribute(), 2, GL_FLOAT, GL_FALSE, 0, vtx_coords);
-		glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
-
-		// Draw stroke if stroke_color is specified.
-		// XXX I think there is an easier way of doing this, with modern GL
-		const float vtx_coords_line[] = {
-			vtx.x1(), vtx.y1(),
-			vtx.x2(), vtx.y1(),
-			vtx.x2(), vtx.y2(),
-			vtx.x1(), vtx.y2(),
-			vtx.x1(), vtx.y1(),
-		};
-		shader->setUniformValue(shader->getColorUniform(), stroke_color.asFloatVector());
-		glEnableVertexAttribArray(shader->getVertexAttribute());
-		glVertexAttribPointer(shader->getVertexAttribute(), 2, GL_FLOAT, GL_FALSE, 0, vtx_coords_line);
-		// XXX this may not be right.
-		glDrawArrays(GL_LINE_STRIP, 0, 5);
-		glDisableVertexAttribArray(shader->getVertexAttribute());
+		const glm::u8vec4 stroke = stroke_color.as_u8vec4();
+		draw_solid_rect(getCamera(), isBatching(), r, fill_color.as_u8vec4(), &stroke, rotation);
 	}
 
 	void CanvasOGL::drawSolidRect(const rect& r, const Color& fill_color, float rotation) const
 	{
-		rectf vtx = r.as_type<float>();
-		const float vtx_coords[] = {
-			vtx.x1(), vtx.y1(),
-			vtx.x2(), vtx.y1(),
-			vtx.x1(), vtx.y2(),
-			vtx.x2(), vtx.y2(),
-		};
-
-		glm::mat4 model = glm::translate(glm::mat4(1.0f), glm::vec3(vtx.mid_x(),vtx.mid_y(),0.0f)) * glm::rotate(glm::mat4(1.0f), glm::radians(rotation), glm::vec3(0.0f,0.0f,1.0f)) * glm::translate(glm::mat4(1.0f), glm::vec3(-vtx.mid_x(),-vtx.mid_y(),0.0f));
-		glm::mat4 mvp = getPVMatrix() * model * get_global_model_matrix();
-		static OpenGL::ShaderProgramPtr shader = OpenGL::ShaderProgram::factory("simple");
-		shader->makeActive();
-		shader->setUniformValue(shader->getMvpUniform(), glm::value_ptr(mvp));
-
-		// Draw a filled rect
-		shader->setUniformValue(shader->getColorUniform(), fill_color.asFloatVector());
-		glEnableVertexAttribArray(shader->getVertexAttribute());
-		glVertexAttribPointer(shader->getVertexAttribute(), 2, GL_FLOAT, GL_FALSE, 0, vtx_coords);
-		glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
-		glDisableVertexAttribArray(shader->getVertexAttribute());
+		draw_solid_rect(getCamera(), isBatching(), r, fill_color.as_u8vec4(), nullptr, rotation);
 	}
 
 	void CanvasOGL::drawHollowRect(const rect& r, const Color& stroke_color, float rotation) const
@@ -225,17 +394,25 @@ namespace KRE
 		};
 
 		glm::mat4 model = glm::translate(glm::mat4(1.0f), glm::vec3(vtx.mid_x(),vtx.mid_y(),0.0f)) * glm::rotate(glm::mat4(1.0f), glm::radians(rotation), glm::vec3(0.0f,0.0f,1.0f)) * glm::translate(glm::mat4(1.0f), glm::vec3(-vtx.mid_x(),-vtx.mid_y(),0.0f));
-		glm::mat4 mvp = getPVMatrix() * model * get_global_model_matrix();
+		glm::mat4 mmat = model * get_global_model_matrix();
+
+		if(isBatching() && is_flat_transform(mmat)) {
+			add_line_strip(begin_batch(BatchMode::LINES, getCamera()), mmat, reinterpret_cast<const glm::vec2*>(vtx_coords_line), 5, stroke_color.as_u8vec4());
+			return;
+		}
+		flushBatch();
 
 		static OpenGL::ShaderProgramPtr shader = OpenGL::ShaderProgram::factory("simple");
 		shader->makeActive();
-		shader->setUniformValue(shader->getMvpUniform(), glm::value_ptr(mvp));
+		shader->setMvpMatrix(getCamera()->getProjectionMat(), getCamera()->getViewMat(), mmat);
 
 		// Draw stroke if stroke_color is specified.
 		// XXX I think there is an easier way of doing this, with modern GL
 		shader->setUniformValue(shader->getColorUniform(), stroke_color.asFloatVector());
+		StateTrackerOGL::getInstance().bindBuffer(GL_ARRAY_BUFFER, 0);
 		glEnableVertexAttribArray(shader->getVertexAttribute());
 		glVertexAttribPointer(shader->getVertexAttribute(), 2, GL_FLOAT, GL_FALSE, 0, vtx_coords_line);
+		StateTrackerOGL::getInstance().applyState();
 		glDrawArrays(GL_LINE_STRIP, 0, 5);
 		glDisableVertexAttribArray(shader->getVertexAttribute());
 	}
@@ -247,15 +424,23 @@ namespace KRE
 			static_cast<float>(p2.x), static_cast<float>(p2.y),
 		};
 		// This draws an aliased line -- consider making this a nicer unaliased line.
-		glm::mat4 mvp = getPVMatrix() * get_global_model_matrix();
+		glm::mat4 mmat = get_global_model_matrix();
+
+		if(isBatching() && is_flat_transform(mmat)) {
+			add_line_strip(begin_batch(BatchMode::LINES, getCamera()), mmat, reinterpret_cast<const glm::vec2*>(vtx_coords_line), 2, color.as_u8vec4());
+			return;
+		}
+		flushBatch();
 
 		static OpenGL::ShaderProgramPtr shader = OpenGL::ShaderProgram::factory("simple");
 		shader->makeActive();
-		shader->setUniformValue(shader->getMvpUniform(), glm::value_ptr(mvp));
+		shader->setMvpMatrix(getCamera()->getProjectionMat(), getCamera()->getViewMat(), mmat);
 
 		shader->setUniformValue(shader->getColorUniform(), color.asFloatVector());
+		StateTrackerOGL::getInstance().bindBuffer(GL_ARRAY_BUFFER, 0);
 		glEnableVertexAttribArray(shader->getVertexAttribute());
 		glVertexAttribPointer(shader->getVertexAttribute(), 2, GL_FLOAT, GL_FALSE, 0, vtx_coords_line);
+		StateTrackerOGL::getInstance().applyState();
 		glDrawArrays(GL_LINES, 0, 2);
 		glDisableVertexAttribArray(shader->getVertexAttribute());
 	}
@@ -305,16 +490,27 @@ namespace KRE
 		glDrawArrays(GL_TRIANGLE_STRIP, 0, vertices.size());
 		glDisableVertexAttribArray(shader->getNormalAttribute());
 		glDisableVertexAttribArray(shader->getVertexAttribute());*/
-		glm::mat4 mvp = getPVMatrix() * get_global_model_matrix();
+		glm::mat4 mmat = get_global_model_matrix();
+
+		if(isBatching() && is_flat_transform(mmat)) {
+			auto& b = begin_batch(BatchMode::LINES, getCamera());
+			for(size_t n = 1; n < varray.size(); n += 2) {
+				add_line_strip(b, mmat, &varray[n-1], 2, color.as_u8vec4());
+			}
+			return;
+		}
+		flushBatch();
 
 		static OpenGL::ShaderProgramPtr shader = OpenGL::ShaderProgram::factory("simple");
 		shader->makeActive();
-		shader->setUniformValue(shader->getMvpUniform(), glm::value_ptr(mvp));
+		shader->setMvpMatrix(getCamera()->getProjectionMat(), getCamera()->getViewMat(), mmat);
 
 		shader->setUniformValue(shader->getLineWidthUniform(), line_width);
 		shader->setUniformValue(shader->getColorUniform(), color.asFloatVector());
+		StateTrackerOGL::getInstance().bindBuffer(GL_ARRAY_BUFFER, 0);
 		glEnableVertexAttribArray(shader->getVertexAttribute());
 		glVertexAttribPointer(shader->getVertexAttribute(), 2, GL_FLOAT, GL_FALSE, 0, &varray[0]);
+		StateTrackerOGL::getInstance().applyState();
 		glDrawArrays(GL_LINES, 0, static_cast<GLsizei>(varray.size()));
 		glDisableVertexAttribArray(shader->getVertexAttribute());
 	}
@@ -323,19 +519,31 @@ namespace KRE
 	{
 		ASSERT_LOG(varray.size() == carray.size(), "Vertex and color array sizes don't match.");
 		// This draws an aliased line -- consider making this a nicer unaliased line.
-		glm::mat4 mvp = getPVMatrix() * get_global_model_matrix();
+		glm::mat4 mmat = get_global_model_matrix();
+
+		if(isBatching() && is_flat_transform(mmat)) {
+			auto& b = begin_batch(BatchMode::LINES, getCamera());
+			for(size_t n = 1; n < varray.size(); n += 2) {
+				b.colored.emplace_back(transform(mmat, varray[n-1]), carray[n-1]);
+				b.colored.emplace_back(transform(mmat, varray[n]), carray[n]);
+			}
+			return;
+		}
+		flushBatch();
 
 		static OpenGL::ShaderProgramPtr shader = OpenGL::ShaderProgram::factory("attr_color_shader");
 		shader->makeActive();
-		shader->setUniformValue(shader->getMvpUniform(), glm::value_ptr(mvp));
+		shader->setMvpMatrix(getCamera()->getProjectionMat(), getCamera()->getViewMat(), mmat);
 
 		/// XXX FIXME no line_width in attr_color_shader
 		//shader->setUniformValue(shader->getLineWidthUniform(), line_width);
 		shader->setUniformValue(shader->getColorUniform(), glm::value_ptr(glm::vec4(1.0f)));
+		StateTrackerOGL::getInstance().bindBuffer(GL_ARRAY_BUFFER, 0);
 		glEnableVertexAttribArray(shader->getVertexAttribute());
 		glEnableVertexAttribArray(shader->getColorAttribute());
 		glVertexAttribPointer(shader->getVertexAttribute(), 2, GL_FLOAT, GL_FALSE, 0, &varray[0]);
 		glVertexAttribPointer(shader->getColorAttribute(), 4, GL_UNSIGNED_BYTE, GL_TRUE, 0, &carray[0]);
+		StateTrackerOGL::getInstance().applyState();
 		glDrawArrays(GL_LINES, 0, static_cast<GLsizei>(varray.size()));
 		glDisableVertexAttribArray(shader->getColorAttribute());
 		glDisableVertexAttribArray(shader->getVertexAttribute());
@@ -344,16 +552,24 @@ namespace KRE
 	void CanvasOGL::drawLineStrip(const std::vector<glm::vec2>& varray, float line_width, const Color& color) const 
 	{
 		// This draws an aliased line -- consider making this a nicer unaliased line.
-		glm::mat4 mvp = getPVMatrix() * get_global_model_matrix();
+		glm::mat4 mmat = get_global_model_matrix();
+
+		if(isBatching() && is_flat_transform(mmat)) {
+			add_line_strip(begin_batch(BatchMode::LINES, getCamera()), mmat, varray.data(), varray.size(), color.as_u8vec4());
+			return;
+		}
+		flushBatch();
 
 		static OpenGL::ShaderProgramPtr shader = OpenGL::ShaderProgram::factory("simple");
 		shader->makeActive();
-		shader->setUniformValue(shader->getMvpUniform(), glm::value_ptr(mvp));
+		shader->setMvpMatrix(getCamera()->getProjectionMat(), getCamera()->getViewMat(), mmat);
 
 		shader->setUniformValue(shader->getLineWidthUniform(), line_width);
 		shader->setUniformValue(shader->getColorUniform(), color.asFloatVector());
+		StateTrackerOGL::getInstance().bindBuffer(GL_ARRAY_BUFFER, 0);
 		glEnableVertexAttribArray(shader->getVertexAttribute());
 		glVertexAttribPointer(shader->getVertexAttribute(), 2, GL_FLOAT, GL_FALSE, 0, &varray[0]);
+		StateTrackerOGL::getInstance().applyState();
 		glDrawArrays(GL_LINE_STRIP, 0, static_cast<GLsizei>(varray.size()));
 		glDisableVertexAttribArray(shader->getVertexAttribute());
 	}
@@ -361,16 +577,24 @@ namespace KRE
 	void CanvasOGL::drawLineLoop(const std::vector<glm::vec2>& varray, float line_width, const Color& color) const 
 	{
 		// This draws an aliased line -- consider making this a nicer unaliased line.
-		glm::mat4 mvp = getPVMatrix() * get_global_model_matrix();
+		glm::mat4 mmat = get_global_model_matrix();
+
+		if(isBatching() && is_flat_transform(mmat)) {
+			add_line_strip(begin_batch(BatchMode::LINES, getCamera()), mmat, varray.data(), varray.size(), color.as_u8vec4(), true);
+			return;
+		}
+		flushBatch();
 
 		static OpenGL::ShaderProgramPtr shader = OpenGL::ShaderProgram::factory("simple");
 		shader->makeActive();
-		shader->setUniformValue(shader->getMvpUniform(), glm::value_ptr(mvp));
+		shader->setMvpMatrix(getCamera()->getProjectionMat(), getCamera()->getViewMat(), mmat);
 
 		shader->setUniformValue(shader->getLineWidthUniform(), line_width);
 		shader->setUniformValue(shader->getColorUniform(), color.asFloatVector());
+		StateTrackerOGL::getInstance().bindBuffer(GL_ARRAY_BUFFER, 0);
 		glEnableVertexAttribArray(shader->getVertexAttribute());
 		glVertexAttribPointer(shader->getVertexAttribute(), 2, GL_FLOAT, GL_FALSE, 0, &varray[0]);
+		StateTrackerOGL::getInstance().applyState();
 		glDrawArrays(GL_LINE_LOOP, 0, static_cast<GLsizei>(varray.size()));
 		glDisableVertexAttribArray(shader->getVertexAttribute());
 	}
@@ -382,15 +606,23 @@ namespace KRE
 			p2.x, p2.y,
 		};
 		// This draws an aliased line -- consider making this a nicer unaliased line.
-		glm::mat4 mvp = getPVMatrix() * get_global_model_matrix();
+		glm::mat4 mmat = get_global_model_matrix();
+
+		if(isBatching() && is_flat_transform(mmat)) {
+			add_line_strip(begin_batch(BatchMode::LINES, getCamera()), mmat, reinterpret_cast<const glm::vec2*>(vtx_coords_line), 2, color.as_u8vec4());
+			return;
+		}
+		flushBatch();
 
 		static OpenGL::ShaderProgramPtr shader = OpenGL::ShaderProgram::factory("simple");
 		shader->makeActive();
-		shader->setUniformValue(shader->getMvpUniform(), glm::value_ptr(mvp));
+		shader->setMvpMatrix(getCamera()->getProjectionMat(), getCamera()->getViewMat(), mmat);
 
 		shader->setUniformValue(shader->getColorUniform(), color.asFloatVector());
+		StateTrackerOGL::getInstance().bindBuffer(GL_ARRAY_BUFFER, 0);
 		glEnableVertexAttribArray(shader->getVertexAttribute());
 		glVertexAttribPointer(shader->getVertexAttribute(), 2, GL_FLOAT, GL_FALSE, 0, vtx_coords_line);
+		StateTrackerOGL::getInstance().applyState();
 		glDrawArrays(GL_LINES, 0, 2);
 		glDisableVertexAttribArray(shader->getVertexAttribute());
 	}
@@ -398,16 +630,19 @@ namespace KRE
 	void CanvasOGL::drawPolygon(const std::vector<glm::vec2>& varray, const Color& color) const 
 	{
 		// This draws an aliased line -- consider making this a nicer unaliased line.
-		glm::mat4 mvp = getPVMatrix() * get_global_model_matrix();
+		glm::mat4 mmat = get_global_model_matrix();
 
+		flushBatch();
 		static OpenGL::ShaderProgramPtr shader = OpenGL::ShaderProgram::factory("simple");
 		shader->makeActive();
-		shader->setUniformValue(shader->getMvpUniform(), glm::value_ptr(mvp));
+		shader->setMvpMatrix(getCamera()->getProjectionMat(), getCamera()->getViewMat(), mmat);
 
 		shader->setUniformValue(shader->getLineWidthUniform(), 1.0f);
 		shader->setUniformValue(shader->getColorUniform(), color.asFloatVector());
+		StateTrackerOGL::getInstance().bindBuffer(GL_ARRAY_BUFFER, 0);
 		glEnableVertexAttribArray(shader->getVertexAttribute());
 		glVertexAttribPointer(shader->getVertexAttribute(), 2, GL_FLOAT, GL_FALSE, 0, &varray[0]);
+		StateTrackerOGL::getInstance().applyState();
 		glDrawArrays(GL_POLYGON, 0, static_cast<GLsizei>(varray.size()));
 		glDisableVertexAttribArray(shader->getVertexAttribute());
 	}
@@ -429,7 +664,7 @@ namespace KRE
 
 	void CanvasOGL::drawSolidCircle(const pointf& centre, float radius, const Color& color) const 
 	{
-		glm::mat4 mvp = getPVMatrix() * get_global_model_matrix();
+		glm::mat4 mmat = get_global_model_matrix();
 
 		rectf vtx(centre.x - radius - 2, centre.y - radius - 2, 2 * radius + 4, 2 * radius + 4);
 		const float vtx_coords[] = {
@@ -439,9 +674,10 @@ namespace KRE
 			vtx.x2(), vtx.y2(),
 		};
 
+		flushBatch();
 		static OpenGL::ShaderProgramPtr shader = OpenGL::ShaderProgram::factory("circle");
 		shader->makeActive();
-		shader->setUniformValue(shader->getMvpUniform(), glm::value_ptr(mvp));
+		shader->setMvpMatrix(getCamera()->getProjectionMat(), getCamera()->getViewMat(), mmat);
 
 		try {
 			static auto screen_dim = shader->getUniform("screen_dimensions");
@@ -464,20 +700,17 @@ namespace KRE
 		} catch(ShaderUniformError&) {
 		}
 		shader->setUniformValue(shader->getColorUniform(), color.asFloatVector());
+		StateTrackerOGL::getInstance().bindBuffer(GL_ARRAY_BUFFER, 0);
 		glEnableVertexAttribArray(shader->getVertexAttribute());
 		glVertexAttribPointer(shader->getVertexAttribute(), 2, GL_FLOAT, GL_FALSE, 0, vtx_coords);
+		StateTrackerOGL::getInstance().applyState();
 		glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
 		glDisableVertexAttribArray(shader->getVertexAttribute());
 	}
 
 	void CanvasOGL::drawSolidCircle(const pointf& centre, float radius, const std::vector<glm::u8vec4>& color) const 
 	{
-		glm::mat4 mvp = getPVMatrix() * get_global_model_matrix();
-
-		static OpenGL::ShaderProgramPtr shader = OpenGL::ShaderProgram::factory("attr_color_shader");
-		shader->makeActive();
-		shader->setUniformValue(shader->getMvpUniform(), glm::value_ptr(mvp));
-		shader->setUniformValue(shader->getColorUniform(), getColor().asFloatVector());
+		glm::mat4 mmat = get_global_model_matrix();
 
 		// XXX figure out a nice way to do this with shaders.
 		std::vector<glm::vec2> varray;
@@ -491,10 +724,29 @@ namespace KRE
 		// last co-ordinate is repeated first point on circle.
 		varray.emplace_back(varray[1]);
 
+		// The batch has no color uniform to tint with, so only untinted circles can join it.
+		if(isBatching() && is_flat_transform(mmat) && getColor() == Color::colorWhite()) {
+			auto& b = begin_batch(BatchMode::TRIANGLES, getCamera());
+			for(size_t n = 2; n < varray.size(); ++n) {
+				for(size_t i : { size_t(0), n - 1, n }) {
+					b.colored.emplace_back(transform(mmat, varray[i]), color[i]);
+				}
+			}
+			return;
+		}
+		flushBatch();
+
+		static OpenGL::ShaderProgramPtr shader = OpenGL::ShaderProgram::factory("attr_color_shader");
+		shader->makeActive();
+		shader->setMvpMatrix(getCamera()->getProjectionMat(), getCamera()->getViewMat(), mmat);
+		shader->setUniformValue(shader->getColorUniform(), getColor().asFloatVector());
+
+		StateTrackerOGL::getInstance().bindBuffer(GL_ARRAY_BUFFER, 0);
 		glEnableVertexAttribArray(shader->getVertexAttribute());
 		glEnableVertexAttribArray(shader->getColorAttribute());
 		glVertexAttribPointer(shader->getVertexAttribute(), 2, GL_FLOAT, GL_FALSE, 0, &varray[0]);
 		glVertexAttribPointer(shader->getColorAttribute(), 4, GL_UNSIGNED_BYTE, GL_TRUE, 0, &color[0]);
+		StateTrackerOGL::getInstance().applyState();
 		glDrawArrays(GL_TRIANGLE_FAN, 0, static_cast<GLsizei>(varray.size()));
 		glDisableVertexAttribArray(shader->getColorAttribute());
 		glDisableVertexAttribArray(shader->getVertexAttribute());
@@ -503,7 +755,7 @@ namespace KRE
 
 	void CanvasOGL::drawHollowCircle(const pointf& centre, float outer_radius, float inner_radius, const Color& color) const 
 	{
-		glm::mat4 mvp = getPVMatrix() * get_global_model_matrix();
+		glm::mat4 mmat = get_global_model_matrix();
 
 		rectf vtx(centre.x - outer_radius - 2, centre.y - outer_radius - 2, 2 * outer_radius + 4, 2 * outer_radius + 4);
 		const float vtx_coords[] = {
@@ -513,9 +765,10 @@ namespace KRE
 			vtx.x2(), vtx.y2(),
 		};
 
+		flushBatch();
 		static OpenGL::ShaderProgramPtr shader = OpenGL::ShaderProgram::factory("circle");
 		shader->makeActive();
-		shader->setUniformValue(shader->getMvpUniform(), glm::value_ptr(mvp));
+		shader->setMvpMatrix(getCamera()->getProjectionMat(), getCamera()->getViewMat(), mmat);
 
 		try {
 			static auto screen_dim = shader->getUniform("screen_dimensions");
@@ -538,8 +791,10 @@ namespace KRE
 		} catch(ShaderUniformError&) {
 		}
 		shader->setUniformValue(shader->getColorUniform(), color.asFloatVector());
+		StateTrackerOGL::getInstance().bindBuffer(GL_ARRAY_BUFFER, 0);
 		glEnableVertexAttribArray(shader->getVertexAttribute());
 		glVertexAttribPointer(shader->getVertexAttribute(), 2, GL_FLOAT, GL_FALSE, 0, vtx_coords);
+		StateTrackerOGL::getInstance().applyState();
 		glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
 		glDisableVertexAttribArray(shader->getVertexAttribute());
 	}
@@ -547,23 +802,134 @@ namespace KRE
 	void CanvasOGL::drawPoints(const std::vector<glm::vec2>& varray, float radius, const Color& color) const 
 	{
 		// This draws an aliased line -- consider making this a nicer unaliased line.
-		glm::mat4 mvp = getPVMatrix() * get_global_model_matrix();
+		glm::mat4 mmat = get_global_model_matrix();
 
+		flushBatch();
 		static OpenGL::ShaderProgramPtr shader = OpenGL::ShaderProgram::factory("simple");
 		shader->makeActive();
-		shader->setUniformValue(shader->getMvpUniform(), glm::value_ptr(mvp));
+		shader->setMvpMatrix(getCamera()->getProjectionMat(), getCamera()->getViewMat(), mmat);
 
 		static auto it = shader->getUniform("point_size");
 		shader->setUniformValue(it, radius);
 		shader->setUniformValue(shader->getColorUniform(), color.asFloatVector());
+		StateTrackerOGL::getInstance().bindBuffer(GL_ARRAY_BUFFER, 0);
 		glEnableVertexAttribArray(shader->getVertexAttribute());
 		glVertexAttribPointer(shader->getVertexAttribute(), 2, GL_FLOAT, GL_FALSE, 0, &varray[0]);
+		StateTrackerOGL::getInstance().applyState();
 		glDrawArrays(GL_POINTS, 0, static_cast<GLsizei>(varray.size()));
 		glDisableVertexAttribArray(shader->getVertexAttribute());
 	}
 
+	void CanvasOGL::flush() const
+	{
+		flushBatch();
+	}
+
+	void CanvasOGL::flushBatch()
+	{
+		auto& b = get_batch();
+		const BatchMode mode = b.mode;
+		if(mode == BatchMode::NONE) {
+			return;
+		}
+		// Anything flushing the batch while it is being drawn finds it empty.
+		b.mode = BatchMode::NONE;
+		DisplayDevice::getRenderStats().canvas_draws_batched += b.primitives - 1;
+
+		if(mode != BatchMode::TEXTURED) {
+			draw_colored(mode, b.pmat, b.vmat, glm::mat4(1.0f), b.colored);
+		} else {
+			ShaderProgramPtr shader = b.shader;
+			shader->makeActive();
+			shader->setUniformsForTexture(b.texture);
+			auto uniform_draw_fn = shader->getUniformDrawFunction();
+			if(uniform_draw_fn) {
+				uniform_draw_fn(shader);
+			}
+			shader->setMvpMatrix(b.pmat, b.vmat, glm::mat4(1.0f));
+			shader->setUniformValue(shader->getColorUniform(), glm::value_ptr(b.color));
+
+			const size_t size = b.textured.size() * sizeof(vertex_texcoord);
+			const unsigned char* base = reinterpret_cast<const unsigned char*>(b.textured.data());
+			std::shared_ptr<GLuint> buffer;
+			if(StreamingAttributeOGL::isSupported()) {
+				size_t offset = 0;
+				buffer = StreamingAttributeOGL::write(b.textured.data(), size, &offset);
+				base = reinterpret_cast<const unsigned char*>(offset);
+			}
+			StateTrackerOGL::getInstance().bindBuffer(GL_ARRAY_BUFFER, buffer != nullptr ? *buffer : 0);
+
+			glEnableVertexAttribArray(shader->getVertexAttribute());
+			glEnableVertexAttribArray(shader->getTexcoordAttribute());
+			glVertexAttribPointer(shader->getVertexAttribute(), 2, GL_FLOAT, GL_FALSE, sizeof(vertex_texcoord), base + offsetof(vertex_texcoord, vtx));
+			glVertexAttribPointer(shader->getTexcoordAttribute(), 2, GL_FLOAT, GL_FALSE, sizeof(vertex_texcoord), base + offsetof(vertex_texcoord, tc));
+			StateTrackerOGL::getInstance().applyState();
+			glDrawArrays(GL_TRIANGLES, 0, static_cast<GLsizei>(b.textured.size()));
+			glDisableVertexAttribArray(shader->getTexcoordAttribute());
+			glDisableVertexAttribArray(shader->getVertexAttribute());
+			StateTrackerOGL::getInstance().bindBuffer(GL_ARRAY_BUFFER, 0);
+		}
+
+		b.primitives = 0;
+		b.shader.reset();
+		b.texture.reset();
+		b.colored.clear();
+		b.textured.clear();
+	}
+
 	CanvasPtr CanvasOGL::getInstance()
 	{
 		return get_instance();
 	}
 }
+
+UNIT_TEST(canvas_batched_rects_match_unbatched)
+{
+	using namespace KRE;
+	std::vector<ColoredDraw> draws;
+	get_draw_recorder() = [&draws](const ColoredDraw& d) { draws.emplace_back(d); };
+	auto cam = Camera::createInstance("batch_test", 0, 200, 0, 100);
+	const rect rects[] = { rect(10, 10, 50, 20), rect(30, 40, 20, 20), rect(5, 70, 100, 10) };
+	const glm::u8vec4 fill[] = { glm::u8vec4(255, 0, 0, 255), glm::u8vec4(0, 255, 0, 128), glm::u8vec4(0, 0, 255, 255) };
+	const glm::u8vec4 stroke[] = { glm::u8vec4(0, 0, 0, 255), glm::u8vec4(255, 255, 255, 255), glm::u8vec4(10, 20, 30, 40) };
+	const float rotation[] = { 0.0f, 30.0f, 0.0f };
+
+	for(int n = 0; n != 3; ++n) {
+		draw_solid_rect(cam, false, rects[n], fill[n], &stroke[n], rotation[n]);
+	}
+	CHECK_EQ(draws.size(), 3U);
+	// What the unbatched draws put on screen, once the shader has applied the model matrix.
+	std::vector<vertex_color> expected;
+	for(auto& d : draws) {
+		CHECK(d.mode == BatchMode::TRIANGLES, "Unbatched stroke wasn't drawn as triangles");
+		for(auto& v : d.vertices) {
+			expected.emplace_back(transform(d.mmat, v.vertex), v.color);
+		}
+	}
+	draws.clear();
+
+	for(int n = 0; n != 3; ++n) {
+		draw_solid_rect(cam, true, rects[n], fill[n], &stroke[n], rotation[n]);
+	}
+	CHECK(draws.empty(), "Batched rects were drawn before the batch was flushed");
+
+	// Needing a different projection is a state change, so the held back rects have to be drawn first.
+	auto other_cam = Camera::createInstance("batch_test_other", 0, 400, 0, 300);
+	draw_solid_rect(other_cam, true, rects[0], fill[0], nullptr, 0.0f);
+	CHECK_EQ(draws.size(), 1U);
+	const ColoredDraw& batched = draws.front();
+	CHECK(batched.mode == BatchMode::TRIANGLES, "Batched rects weren't drawn as triangles");
+	CHECK(batched.pmat == cam->getProjectionMat(), "Batch was drawn with the wrong projection");
+	CHECK(batched.mmat == glm::mat4(1.0f), "Batched vertices should already be transformed");
+	CHECK_EQ(batched.vertices.size(), expected.size());
+	for(size_t n = 0; n != expected.size(); ++n) {
+		CHECK(batched.vertices[n].vertex == expected[n].vertex, "Vertex " << n << " differs between the batched and unbatched paths");
+		CHECK(batched.vertices[n].color == expected[n].color, "Color of vertex " << n << " differs between the batched and unbatched paths");
+	}
+
+	CanvasOGL::flushBatch();
+	CHECK_EQ(draws.size(), 2U);
+	CHECK(draws.back().pmat == other_cam->getProjectionMat(), "Rect after the state change was drawn with the wrong projection");
+	CHECK_EQ(draws.back().vertices.size(), 6U);
+	get_draw_recorder() = nullptr;
+}
@@ -63,6 +63,10 @@ namespace KRE
 
 		void drawPoints(const std::vector<glm::vec2>& points, float radius, const Color& color=Color::colorWhite()) const override;
 
+		void flush() const override;
+		// Draws any primitives held back for batching. Called before GL state they depend on changes.
+		static void flushBatch();
+
 		static CanvasPtr getInstance();
 	private:
 		DISALLOW_COPY_AND_ASSIGN(CanvasOGL);
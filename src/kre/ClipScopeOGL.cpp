@@ -30,6 +30,7 @@
 #include "DisplayDeviceOGL.hpp"
 #include "ModelMatrixScope.hpp"
 #include "ShadersOGL.hpp"
+#include "StateTrackerOGL.hpp"
 #include "StencilScopeOGL.hpp"
 
 namespace KRE
@@ -47,6 +48,7 @@ namespace KRE
 
 	void ClipScopeOGL::apply(const CameraPtr& cam) const 
 	{
+		StateTrackerOGL::getInstance().flushPendingDraws();
 		stencil_scope_.reset(new StencilScopeOGL(get_stencil_mask_settings()));
 
 		glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
@@ -65,15 +67,15 @@ namespace KRE
 			clip_cam = DisplayDevice::getCurrent()->getDefaultCamera();
 		}
 
-		glm::mat4 mvp = clip_cam->getProjectionMat() * clip_cam->getViewMat() * get_global_model_matrix();
-		
 		static OpenGL::ShaderProgramPtr shader = OpenGL::ShaderProgram::factory("simple");
 		shader->makeActive();
-		shader->setUniformValue(shader->getMvpUniform(), glm::value_ptr(mvp));
+		shader->setMvpMatrix(clip_cam->getProjectionMat(), clip_cam->getViewMat(), get_global_model_matrix());
 		shader->setUniformValue(shader->getColorUniform(), Color::colorWhite().asFloatVector());
 
+		StateTrackerOGL::getInstance().bindBuffer(GL_ARRAY_BUFFER, 0);
 		glEnableVertexAttribArray(shader->getVertexAttribute());
 		glVertexAttribPointer(shader->getVertexAttribute(), 2, GL_FLOAT, GL_FALSE, 0, varray);
+		StateTrackerOGL::getInstance().applyState();
 		glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
 
 		stencil_scope_->applyNewSettings(get_stencil_keep_settings());
@@ -84,6 +86,7 @@ namespace KRE
 
 	void ClipScopeOGL::clear() const 
 	{
+		StateTrackerOGL::getInstance().flushPendingDraws();
 		stencil_scope_.reset();
 	}
 
@@ -102,6 +105,7 @@ namespace KRE
 
 	void ClipShapeScopeOGL::apply(const CameraPtr& cam) const 
 	{
+		StateTrackerOGL::getInstance().flushPendingDraws();
 		stencil_scope_.reset(new StencilScopeOGL(get_stencil_mask_settings()));
 
 		glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
@@ -127,6 +131,7 @@ namespace KRE
 
 	void ClipShapeScopeOGL::clear() const 
 	{
+		StateTrackerOGL::getInstance().flushPendingDraws();
 		stencil_scope_.reset();
 	}
 
@@ -97,6 +97,17 @@ namespace KRE
 		return current_display_device();
 	}
 
+	RenderStats& DisplayDevice::getRenderStats()
+	{
+		static RenderStats res;
+		return res;
+	}
+
+	void DisplayDevice::resetRenderStats()
+	{
+		getRenderStats() = RenderStats();
+	}
+
 	void DisplayDevice::registerFactoryFunction(const std::string& type, std::function<DisplayDevicePtr(WindowPtr)> create_fn)
 	{
 		auto it = get_display_registry().find(type);
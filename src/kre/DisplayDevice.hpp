@@ -90,6 +90,28 @@ namespace KRE
 		BGRA_INT,
 	};
 
+	// Counted by the backends, reset once a frame with DisplayDevice::resetRenderStats().
+	struct RenderStats
+	{
+		RenderStats() : draw_calls(0), texture_binds(0), state_changes(0), state_changes_skipped(0), camera_uploads(0), 
+			uniform_uploads(0), uniform_uploads_skipped(0), culled_subtrees(0), canvas_draws_batched(0) {}
+		int draw_calls;
+		int texture_binds;
+		// Program, texture, buffer, blend and depth state calls made, and those skipped because
+		// they wouldn't have changed anything.
+		int state_changes;
+		int state_changes_skipped;
+		// Uploads of the projection and view matrices shared by programs using the camera block.
+		int camera_uploads;
+		// glUniform* calls made, and those skipped because the program already had the value.
+		int uniform_uploads;
+		int uniform_uploads_skipped;
+		// Scene tree nodes skipped because they were outside the clip rect or viewport.
+		int culled_subtrees;
+		// Canvas primitives drawn as part of an earlier primitive's draw call.
+		int canvas_draws_batched;
+	};
+
 	class DisplayDevice
 	{
 	public:
@@ -104,6 +126,8 @@ namespace KRE
 			DISPLAY_DEVICE_SDL,
 			// Display device is Direct3D
 			DISPLAY_DEVICE_D3D,
+			// Display device records commands without rendering anything
+			DISPLAY_DEVICE_NULL,
 		};
 
 		explicit DisplayDevice(WindowPtr wnd);
@@ -194,6 +218,9 @@ namespace KRE
 		static bool checkForFeature(DisplayDeviceCapabilties cap);
 
 		static void registerFactoryFunction(const std::string& type, std::function<DisplayDevicePtr(WindowPtr)>);
+
+		static RenderStats& getRenderStats();
+		static void resetRenderStats();
 	private:
 		std::weak_ptr<Window> parent_;
 
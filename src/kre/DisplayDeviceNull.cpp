@@ -0,0 +1,1126 @@
+/*
+	Copyright (C) 2016 by Kristina Simpson <sweet.kristas@gmail.com>
+	
+	This software is provided 'as-is', without any express or implied
+	warranty. In no event will the authors be held liable for any damages
+	arising from the use of this software.
+
+	Permission is granted to anyone to use this software for any purpose,
+	including commercial applications, and to alter it and redistribute it
+	freely, subject to the following restrictions:
+
+	   1. The origin of this software must not be misrepresented; you must not
+	   claim that you wrote the original software. If you use this software
+	   in a product, an acknowledgment in the product documentation would be
+	   appreciated but is not required.
+
+	   2. Altered source versions must be plainly marked as such, and must not be
+	   misrepresented as being the original software.
+
+	   3. This notice may not be removed or altered from any source
+	   distribution.
+*/
+
+#include <map>
+#include <sstream>
+#include <stack>
+
+#include <glm/gtc/type_ptr.hpp>
+
+#include "asserts.hpp"
+#include "profile_timer.hpp"
+#include "AttributeSet.hpp"
+#include "CameraObject.hpp"
+#include "Canvas.hpp"
+#include "ClipScope.hpp"
+#include "ColorScope.hpp"
+#include "DisplayDeviceNull.hpp"
+#include "Effects.hpp"
+#include "ModelMatrixScope.hpp"
+#include "RenderTarget.hpp"
+#include "Scissor.hpp"
+#include "StencilScope.hpp"
+#include "Texture.hpp"
+#include "WindowManager.hpp"
+#include "unit_test.hpp"
+
+namespace KRE
+{
+	namespace
+	{
+		static DisplayDeviceRegistrar<DisplayDeviceNull> null_register("null");
+
+		const int max_texture_units = 32;
+
+		// What the null device would have had bound on a real one, used so that redundant
+		// changes are counted the same way as the OpenGL state tracker counts them.
+		struct NullState
+		{
+			NullState() 
+				: commands(), 
+				  last_frame(), 
+				  stats(), 
+				  program(0), 
+				  textures(max_texture_units, 0), 
+				  blend(0), 
+				  depth_test(0), 
+				  targets(), 
+				  next_id(1) 
+			{}
+			std::vector<NullCommand> commands;
+			std::vector<NullCommand> last_frame;
+			NullDeviceStats stats;
+
+			unsigned program;
+			std::vector<unsigned> textures;
+			unsigned blend;
+			unsigned depth_test;
+			std::stack<std::pair<unsigned, rect>> targets;
+
+			unsigned next_id;
+		};
+
+		NullState& get_state()
+		{
+			static NullState res;
+			return res;
+		}
+
+		unsigned next_object_id()
+		{
+			return get_state().next_id++;
+		}
+
+		void record(NullCommand::Type type, unsigned arg, int count)
+		{
+			get_state().commands.emplace_back(type, arg, count);
+		}
+
+		// Returns true and records the change if value differs from current.
+		bool change_state(unsigned& current, unsigned value, NullCommand::Type type)
+		{
+			auto& st = get_state();
+			if(current == value) {
+				++st.stats.state_changes_skipped;
+				++DisplayDevice::getRenderStats().state_changes_skipped;
+				return false;
+			}
+			current = value;
+			++st.stats.state_changes;
+			++DisplayDevice::getRenderStats().state_changes;
+			record(type, value, 0);
+			return true;
+		}
+
+		void record_upload(unsigned id, long long bytes)
+		{
+			if(bytes <= 0) {
+				return;
+			}
+			get_state().stats.uploaded_bytes += bytes;
+			record(NullCommand::Type::UPLOAD, id, static_cast<int>(bytes));
+		}
+
+		void record_draw(NullCommand::Type type, int vertices)
+		{
+			auto& st = get_state();
+			if(type == NullCommand::Type::CANVAS_DRAW) {
+				++st.stats.canvas_draws;
+			}
+			++st.stats.draws;
+			st.stats.vertices += vertices;
+			++DisplayDevice::getRenderStats().draw_calls;
+			PROFILE_COUNT(DRAW_CALLS, 1);
+			record(type, st.program, vertices);
+		}
+
+		unsigned blend_key(const BlendMode& bm, const BlendEquation& eqn)
+		{
+			return (static_cast<unsigned>(bm.src()) << 24) 
+				| (static_cast<unsigned>(bm.dst()) << 16)
+				| (static_cast<unsigned>(eqn.getRgbEquation()) << 8)
+				| static_cast<unsigned>(eqn.getAlphaEquation());
+		}
+
+		const unsigned default_blend_key = blend_key(BlendMode(BlendModeConstants::BM_SRC_ALPHA, BlendModeConstants::BM_ONE_MINUS_SRC_ALPHA), BlendEquation(BlendEquationConstants::BE_ADD));
+
+		unsigned blend_key_for(const ScopeableValue& sv, unsigned parent_key)
+		{
+			if(!sv.isBlendModeSet() && !sv.isBlendEquationSet()) {
+				return parent_key;
+			}
+			BlendMode bm(static_cast<BlendModeConstants>((parent_key >> 24) & 0xff), static_cast<BlendModeConstants>((parent_key >> 16) & 0xff));
+			BlendEquation eqn(static_cast<BlendEquationConstants>((parent_key >> 8) & 0xff), static_cast<BlendEquationConstants>(parent_key & 0xff));
+			return blend_key(sv.isBlendModeSet() ? sv.getBlendMode() : bm, sv.isBlendEquationSet() ? sv.getBlendEquation() : eqn);
+		}
+
+		class NullTexture : public Texture
+		{
+		public:
+			explicit NullTexture(const variant& node, const std::vector<SurfacePtr>& surfaces)
+				: Texture(node, surfaces),
+				  ids_()
+			{
+				createIds();
+			}
+			explicit NullTexture(const std::vector<SurfacePtr>& surfaces, TextureType type, int mipmap_levels)
+				: Texture(surfaces, type, mipmap_levels),
+				  ids_()
+			{
+				createIds();
+			}
+			explicit NullTexture(int count, int width, int height, int depth, PixelFormat::PF fmt, TextureType type)
+				: Texture(count, width, height, depth, fmt, type),
+				  ids_()
+			{
+				createIds();
+			}
+			// Copies share the texture objects, like the OpenGL textures do.
+			NullTexture(const NullTexture& other)
+				: Texture(other),
+				  ids_(other.ids_)
+			{
+			}
+
+			void init(int n) override {
+				auto& surf = getSurface(n);
+				if(surf != nullptr) {
+					record_upload(ids_[n], static_cast<long long>(surf->rowPitch()) * surf->height());
+				}
+			}
+
+			void bind(int binding_point) override {
+				bool bound = false;
+				for(int n = 0; n != static_cast<int>(ids_.size()); ++n) {
+					const int unit = n + binding_point;
+					ASSERT_LOG(unit < max_texture_units, "Texture unit out of range: " << unit);
+					bound |= change_state(get_state().textures[unit], ids_[n], NullCommand::Type::TEXTURE);
+				}
+				if(bound) {
+					++DisplayDevice::getRenderStats().texture_binds;
+				}
+			}
+
+			unsigned id(int n) const override {
+				ASSERT_LOG(n < static_cast<int>(ids_.size()), "Requested texture id outside bounds.");
+				return ids_[n];
+			}
+
+			void update(int n, int x, int width, void* pixels) override {
+				record_upload(ids_[n], static_cast<long long>(width) * bytesPerPixel(n));
+			}
+			void update(int n, int x, int y, int width, int height, const void* pixels) override {
+				record_upload(ids_[n], static_cast<long long>(width) * height * bytesPerPixel(n));
+			}
+			void update2D(int n, int x, int y, int width, int height, int stride, const void* pixels) override {
+				record_upload(ids_[n], static_cast<long long>(stride) * height);
+			}
+			void updateYUV(int x, int y, int width, int height, const std::vector<int>& stride, const std::vector<void*>& pixels) override {
+				for(int n = 0; n != static_cast<int>(ids_.size()) && n != static_cast<int>(stride.size()); ++n) {
+					// chroma planes are half height.
+					record_upload(ids_[n], static_cast<long long>(stride[n]) * (n == 0 ? height : height / 2));
+				}
+			}
+			void update(int n, int x, int y, int z, int width, int height, int depth, void* pixels) override {
+				record_upload(ids_[n], static_cast<long long>(width) * height * depth * bytesPerPixel(n));
+			}
+
+			SurfacePtr extractTextureToSurface(int n) const override {
+				if(getSurface(n) != nullptr) {
+					return getSurface(n);
+				}
+				return Surface::create(actualWidth(n), actualHeight(n), PixelFormat::PF::PIXELFORMAT_ABGR8888);
+			}
+
+			const unsigned char* colorAt(int x, int y) const override {
+				return nullptr;
+			}
+
+			TexturePtr clone() override {
+				return std::make_shared<NullTexture>(*this);
+			}
+		private:
+			void createIds() {
+				for(int n = 0; n != getTextureCount(); ++n) {
+					ids_.emplace_back(next_object_id());
+					++get_state().stats.textures_created;
+					init(n);
+				}
+			}
+			int bytesPerPixel(int n) const {
+				auto& surf = getSurface(n);
+				return surf != nullptr ? surf->getPixelFormat()->bytesPerPixel() : 4;
+			}
+			void rebuild() override {
+				for(int n = 0; n != static_cast<int>(ids_.size()); ++n) {
+					init(n);
+				}
+			}
+			void handleAddPalette(int index, const SurfacePtr& palette) override {
+				record_upload(ids_.front(), static_cast<long long>(palette->rowPitch()) * palette->height());
+			}
+
+			std::vector<unsigned> ids_;
+		};
+
+		class NullShaderProgram : public ShaderProgram
+		{
+		public:
+			explicit NullShaderProgram(const std::string& name, const variant& node)
+				: ShaderProgram(name, node),
+				  id_(next_object_id()),
+				  uniforms_(),
+				  attributes_()
+			{
+			}
+
+			void makeActive() override {
+				change_state(get_state().program, id_, NullCommand::Type::SHADER);
+			}
+			void applyAttribute(AttributeBasePtr attr) override {
+				attr->getDeviceBufferData()->bind();
+			}
+			void cleanUpAfterDraw() override {}
+
+			int getAttributeOrDie(const std::string& attr) const override { return getAttribute(attr); }
+			int getUniformOrDie(const std::string& attr) const override { return getUniform(attr); }
+
+			// Any name is accepted, there being no source to check it against.
+			int getAttribute(const std::string& attr) const override { return lookup(attributes_, attr); }
+			int getUniform(const std::string& attr) const override { return lookup(uniforms_, attr); }
+
+			void setUniformMapping(const std::vector<std::pair<std::string, std::string>>& mapping) override {
+				for(auto& m : mapping) {
+					uniforms_[m.first] = getUniform(m.second);
+				}
+			}
+			void setAttributeMapping(const std::vector<std::pair<std::string, std::string>>& mapping) override {
+				for(auto& m : mapping) {
+					attributes_[m.first] = getAttribute(m.second);
+				}
+			}
+
+			void setUniformValue(int uid, const int) const override { ++get_state().stats.uniform_updates; }
+			void setUniformValue(int uid, const float) const override { ++get_state().stats.uniform_updates; }
+			void setUniformValue(int uid, const float*) const override { ++get_state().stats.uniform_updates; }
+			void setUniformValue(int uid, const int*) const override { ++get_state().stats.uniform_updates; }
+			void setUniformValue(int uid, const void*) const override { ++get_state().stats.uniform_updates; }
+			void setUniformFromVariant(int uid, const variant& value) const override { ++get_state().stats.uniform_updates; }
+
+			void setAttributeValue(int aid, const int) const override {}
+			void setAttributeValue(int aid, const float) const override {}
+			void setAttributeValue(int aid, const float*) const override {}
+			void setAttributeValue(int aid, const int*) const override {}
+			void setAttributeValue(int aid, const void*) const override {}
+			void setAttributeValue(int aid, const unsigned char*) const override {}
+			void setAttributeFromVariant(int uid, const variant& value) const override {}
+
+			void configureActives(AttributeSetPtr attrset) override {
+				for(auto& attr : attrset->getAttributes()) {
+					configureAttribute(attr);
+				}
+			}
+			void configureAttribute(AttributeBasePtr attr) override {
+				for(auto& desc : attr->getAttrDesc()) {
+					desc.setLocation(getAttribute(desc.getAttrName()));
+				}
+			}
+			void configureUniforms(UniformBufferBase& uniforms) override {}
+
+			int getColorUniform() const override { return getUniform("u_color"); }
+			int getLineWidthUniform() const override { return getUniform("u_line_width"); }
+			int getMvUniform() const override { return getUniform("u_mv_matrix"); }
+			int getPUniform() const override { return getUniform("u_p_matrix"); }
+			int getMvpUniform() const override { return getUniform("u_mvp_matrix"); }
+			int getTexMapUniform() const override { return getUniform("u_tex_map"); }
+			int getMUniform() const override { return getUniform("u_m_matrix"); }
+
+			void setMvpMatrix(const glm::mat4& p, const glm::mat4& v, const glm::mat4& m) const override {
+				setUniformValue(getMvpUniform(), glm::value_ptr(p * v * m));
+			}
+			bool usesCameraBlock() const override { return false; }
+
+			int getColorAttribute() const override { return getAttribute("a_color"); }
+			int getVertexAttribute() const override { return getAttribute("a_position"); }
+			int getTexcoordAttribute() const override { return getAttribute("a_texcoord"); }
+			int getNormalAttribute() const override { return getAttribute("a_normal"); }
+
+			void setUniformsForTexture(const TexturePtr& tex) const override {
+				if(tex) {
+					setUniformValue(getTexMapUniform(), 0);
+					tex->bind();
+				}
+			}
+
+			ShaderProgramPtr clone() override {
+				return std::make_shared<NullShaderProgram>(*this);
+			}
+		private:
+			typedef std::map<std::string, int> active_map;
+			static int lookup(active_map& actives, const std::string& name) {
+				auto it = actives.find(name);
+				if(it == actives.end()) {
+					it = actives.emplace(name, static_cast<int>(actives.size())).first;
+				}
+				return it->second;
+			}
+
+			unsigned id_;
+			mutable active_map uniforms_;
+			mutable active_map attributes_;
+		};
+
+		typedef std::map<std::string, ShaderProgramPtr> shader_factory_map;
+		shader_factory_map& get_shader_factory()
+		{
+			static shader_factory_map res;
+			return res;
+		}
+
+		ShaderProgramPtr get_or_create_shader(const std::string& name, const variant& node=variant())
+		{
+			auto& sf = get_shader_factory();
+			auto it = sf.find(name);
+			if(it == sf.end()) {
+				it = sf.emplace(name, std::make_shared<NullShaderProgram>(name, node)).first;
+			}
+			return it->second;
+		}
+
+		// Keeps client side pointer semantics, but counts what would have been sent to a buffer object.
+		class NullHardwareAttribute : public HardwareAttribute
+		{
+		public:
+			explicit NullHardwareAttribute(AttributeBase* parent) 
+				: HardwareAttribute(parent), 
+				  id_(next_object_id()), 
+				  value_(0) 
+			{}
+			void update(const void* value, ptrdiff_t offset, size_t size) override {
+				if(offset == 0) {
+					value_ = reinterpret_cast<intptr_t>(value);
+				}
+				record_upload(id_, static_cast<long long>(size));
+			}
+			intptr_t value() override { return value_; }
+			HardwareAttributePtr create(AttributeBase* parent) override {
+				return std::make_shared<NullHardwareAttribute>(parent);
+			}
+		private:
+			unsigned id_;
+			intptr_t value_;
+		};
+
+		class NullAttributeSet : public AttributeSet
+		{
+		public:
+			explicit NullAttributeSet(bool indexed, bool instanced) : AttributeSet(indexed, instanced) {}
+			bool isHardwareBacked() const override { return true; }
+		};
+
+		class NullRenderTarget : public RenderTarget
+		{
+		public:
+			explicit NullRenderTarget(int width, int height, 
+				int color_plane_count, 
+				bool depth, 
+				bool stencil, 
+				bool use_multi_sampling, 
+				int multi_samples)
+				: RenderTarget(width, height, color_plane_count, depth, stencil, use_multi_sampling, multi_samples),
+				  id_(next_object_id())
+			{
+				on_create();
+			}
+			explicit NullRenderTarget(const variant& node)
+				: RenderTarget(node),
+				  id_(next_object_id())
+			{
+				on_create();
+			}
+			NullRenderTarget(const NullRenderTarget& op)
+				: RenderTarget(op),
+				  id_(next_object_id())
+			{
+				on_create();
+			}
+		private:
+			void handleCreate() override {
+				auto tex = Texture::createTextureArray(getColorPlanes(), width(), height(), PixelFormat::PF::PIXELFORMAT_RGBA8888, TextureType::TEXTURE_2D);
+				tex->setSourceRect(-1, rect(0, 0, width(), height()));
+				setTexture(tex);
+				setDrawRect(rect(0, 0, width(), height()));
+			}
+			void handleApply(const rect& r) const override {
+				auto& st = get_state();
+				unsigned current = st.targets.empty() ? 0 : st.targets.top().first;
+				if(change_state(current, id_, NullCommand::Type::RENDER_TARGET)) {
+					++st.stats.render_target_switches;
+				}
+				st.targets.emplace(id_, r);
+				DisplayDevice::getCurrent()->setViewPort(r);
+			}
+			void handleUnapply() const override {
+				auto& st = get_state();
+				ASSERT_LOG(!st.targets.empty() && st.targets.top().first == id_, "Render target stack mismatch. This should never happen if calls to apply/unapply are balanced.");
+				st.targets.pop();
+				unsigned current = id_;
+				if(st.targets.empty()) {
+					if(change_state(current, 0, NullCommand::Type::RENDER_TARGET)) {
+						++st.stats.render_target_switches;
+					}
+					WindowPtr wnd = WindowManager::getMainWindow();
+					DisplayDevice::getCurrent()->setViewPort(0, 0, wnd->width(), wnd->height());
+				} else {
+					if(change_state(current, st.targets.top().first, NullCommand::Type::RENDER_TARGET)) {
+						++st.stats.render_target_switches;
+					}
+					DisplayDevice::getCurrent()->setViewPort(st.targets.top().second);
+				}
+			}
+			void handleClear() const override {
+				record(NullCommand::Type::CLEAR, id_, 0);
+			}
+			void handleSizeChange(int width, int height) override {
+				handleCreate();
+			}
+			RenderTargetPtr handleClone() override {
+				return std::make_shared<NullRenderTarget>(*this);
+			}
+			// Nothing is ever drawn, so reads give back the clear color as RGBA.
+			std::vector<uint8_t> handleReadPixels() const override {
+				const Color& c = getClearColor();
+				const uint8_t color[] = { 
+					static_cast<uint8_t>(c.r_int()), 
+					static_cast<uint8_t>(c.g_int()), 
+					static_cast<uint8_t>(c.b_int()), 
+					static_cast<uint8_t>(c.a_int()),
+				};
+				std::vector<uint8_t> res(width() * height() * 4);
+				for(size_t n = 0; n < res.size(); n += 4) {
+					std::copy(color, color + 4, res.begin() + n);
+				}
+				return res;
+			}
+			SurfacePtr handleReadToSurface(SurfacePtr s) const override {
+				s = Surface::create(width(), height(), PixelFormat::PF::PIXELFORMAT_ABGR8888);
+				auto pixels = handleReadPixels();
+				s->writePixels(pixels.data(), static_cast<int>(pixels.size()));
+				return s;
+			}
+
+			unsigned id_;
+		};
+
+		// Draws are counted with the vertex count the OpenGL canvas would have submitted.
+		class NullCanvas : public Canvas
+		{
+		public:
+			NullCanvas() {}
+			void blitTexture(const TexturePtr& tex, const rect& src, float rotation, const rect& dst, const Color& color, CanvasBlitFlags flags) const override {
+				draw(tex, 4);
+			}
+			void blitTexture(const TexturePtr& tex, const std::vector<vertex_texcoord>& vtc, float rotation, const Color& color) override {
+				draw(tex, static_cast<int>(vtc.size()));
+			}
+			void drawSolidRect(const rect& r, const Color& fill_color, const Color& stroke_color, float rotate) const override {
+				draw(nullptr, 4);
+				draw(nullptr, 4);
+			}
+			void drawSolidRect(const rect& r, const Color& fill_color, float rotate) const override {
+				draw(nullptr, 4);
+			}
+			void drawHollowRect(const rect& r, const Color& stroke_color, float rotate) const override {
+				draw(nullptr, 4);
+			}
+			void drawLine(const point& p1, const point& p2, const Color& color) const override {
+				draw(nullptr, 2);
+			}
+			void drawLines(const std::vector<glm::vec2>& varray, float line_width, const Color& color) const override {
+				draw(nullptr, static_cast<int>(varray.size()));
+			}
+			void drawLines(const std::vector<glm::vec2>& varray, float line_width, const std::vector<glm::u8vec4>& carray) const override {
+				draw(nullptr, static_cast<int>(varray.size()));
+			}
+			void drawLineStrip(const std::vector<glm::vec2>& points, float line_width, const Color& color) const override {
+				draw(nullptr, static_cast<int>(points.size()));
+			}
+			void drawLineLoop(const std::vector<glm::vec2>& varray, float line_width, const Color& color) const override {
+				draw(nullptr, static_cast<int>(varray.size()));
+			}
+			void drawLine(const pointf& p1, const pointf& p2, const Color& color) const override {
+				draw(nullptr, 2);
+			}
+			void drawPolygon(const std::vector<glm::vec2>& points, const Color& color) const override {
+				draw(nullptr, static_cast<int>(points.size()));
+			}
+			// Plain circles are drawn as a single point sprite.
+			void drawSolidCircle(const point& centre, float radius, const Color& color) const override {
+				draw(nullptr, 1);
+			}
+			void drawSolidCircle(const point& centre, float radius, const std::vector<glm::u8vec4>& color) const override {
+				draw(nullptr, static_cast<int>(color.size()));
+			}
+			void drawSolidCircle(const pointf& centre, float radius, const Color& color) const override {
+				draw(nullptr, 1);
+			}
+			void drawSolidCircle(const pointf& centre, float radius, const std::vector<glm::u8vec4>& color) const override {
+				draw(nullptr, static_cast<int>(color.size()));
+			}
+			void drawHollowCircle(const point& centre, float outer_radius, float inner_radius, const Color& color) const override {
+				draw(nullptr, 1);
+			}
+			void drawHollowCircle(const pointf& centre, float outer_radius, float inner_radius, const Color& color) const override {
+				draw(nullptr, 1);
+			}
+			void drawPoints(const std::vector<glm::vec2>& points, float radius, const Color& color) const override {
+				draw(nullptr, static_cast<int>(points.size()));
+			}
+		private:
+			void handleDimensionsChanged() override {}
+			void draw(const TexturePtr& tex, int vertices) const {
+				getCurrentShader()->makeActive();
+				if(tex) {
+					tex->bind();
+				}
+				record_draw(NullCommand::Type::CANVAS_DRAW, vertices);
+			}
+		};
+
+		CanvasPtr& get_canvas_instance()
+		{
+			static CanvasPtr res = CanvasPtr(new NullCanvas());
+			return res;
+		}
+
+		class NullClipScope : public ClipScope
+		{
+		public:
+			explicit NullClipScope(const rect& r) : ClipScope(r) {}
+			void apply(const CameraPtr& cam) const override {
+				record(NullCommand::Type::CLEAR, 0, 0);
+				record_draw(NullCommand::Type::DRAW, 4);
+			}
+			void clear() const override {}
+		};
+
+		class NullClipShapeScope : public ClipShapeScope
+		{
+		public:
+			explicit NullClipShapeScope(const RenderablePtr& r) : ClipShapeScope(r) {}
+			void apply(const CameraPtr& cam) const override {
+				CameraPtr clip_cam = cam;
+				if(cam == nullptr) {
+					clip_cam = DisplayDevice::getCurrent()->getDefaultCamera();
+				}
+				record(NullCommand::Type::CLEAR, 0, 0);
+				auto& clip_shape = getRenderable();
+				clip_shape->setCamera(clip_cam);
+				DisplayDevice::getCurrent()->render(clip_shape.get());
+				clip_shape->setCamera(nullptr);
+			}
+			void clear() const override {}
+		};
+
+		class NullStencilScope : public StencilScope
+		{
+		public:
+			explicit NullStencilScope(const StencilSettings& settings) : StencilScope(settings) {}
+		private:
+			void handleUpdatedMask() override {}
+			void handleUpdatedSettings() override {}
+		};
+
+		class NullScissor : public Scissor
+		{
+		public:
+			explicit NullScissor(const rect& area) : Scissor(area) {}
+			void apply() override {}
+			void clear() override {}
+		};
+
+		class NullEffect : public Effect
+		{
+		public:
+			void apply() override {}
+			void clear() override {}
+		};
+
+		class NullBlendEquationImpl : public BlendEquationImplBase
+		{
+		public:
+			void apply(const BlendEquation& eqn) const override {
+				const unsigned key = blend_key_for_equation(eqn);
+				change_state(get_state().blend, key, NullCommand::Type::BLEND);
+			}
+			void clear(const BlendEquation& eqn) const override {
+				change_state(get_state().blend, default_blend_key, NullCommand::Type::BLEND);
+			}
+		private:
+			static unsigned blend_key_for_equation(const BlendEquation& eqn) {
+				return (get_state().blend & 0xffff0000) 
+					| (static_cast<unsigned>(eqn.getRgbEquation()) << 8) 
+					| static_cast<unsigned>(eqn.getAlphaEquation());
+			}
+		};
+	}
+
+	DisplayDeviceNull::DisplayDeviceNull(WindowPtr wnd)
+		: DisplayDevice(wnd),
+		  viewport_(),
+		  default_camera_(),
+		  clear_color_(0.0f, 0.0f, 0.0f, 1.0f)
+	{
+	}
+
+	DisplayDeviceNull::~DisplayDeviceNull()
+	{
+	}
+
+	void DisplayDeviceNull::init(int width, int height)
+	{
+		auto& st = get_state();
+		st.program = 0;
+		std::fill(st.textures.begin(), st.textures.end(), 0);
+		st.blend = default_blend_key;
+		st.depth_test = 0;
+		viewport_ = rect(0, 0, width, height);
+	}
+
+	void DisplayDeviceNull::printDeviceInfo()
+	{
+		LOG_INFO("Null display device: nothing will be drawn, commands are recorded only.");
+	}
+
+	int DisplayDeviceNull::queryParameteri(DisplayDeviceParameters param)
+	{
+		switch (param)
+		{
+		case DisplayDeviceParameters::MAX_TEXTURE_UNITS:	return max_texture_units;
+		default: break;
+		}
+		ASSERT_LOG(false, "Invalid Parameter requested: " << static_cast<int>(param));
+		return -1;
+	}
+
+	void DisplayDeviceNull::clearTextures()
+	{
+	}
+
+	void DisplayDeviceNull::clear(ClearFlags clr)
+	{
+		record(NullCommand::Type::CLEAR, 0, static_cast<int>(clr));
+	}
+
+	void DisplayDeviceNull::setClearColor(float r, float g, float b, float a) const
+	{
+		clear_color_ = Color(r, g, b, a);
+	}
+
+	void DisplayDeviceNull::setClearColor(const Color& color) const
+	{
+		clear_color_ = color;
+	}
+
+	void DisplayDeviceNull::swap()
+	{
+		auto& st = get_state();
+		st.last_frame.swap(st.commands);
+		st.commands.clear();
+		++st.stats.frames;
+	}
+
+	const std::vector<NullCommand>& DisplayDeviceNull::getLastFrame()
+	{
+		return get_state().last_frame;
+	}
+
+	const NullDeviceStats& DisplayDeviceNull::getStats()
+	{
+		return get_state().stats;
+	}
+
+	void DisplayDeviceNull::resetStats()
+	{
+		get_state().stats = NullDeviceStats();
+	}
+
+	ShaderProgramPtr DisplayDeviceNull::getDefaultShader()
+	{
+		return get_or_create_shader("default");
+	}
+
+	CameraPtr DisplayDeviceNull::setDefaultCamera(const CameraPtr& cam)
+	{
+		auto old_cam = default_camera_;
+		default_camera_ = cam;
+		return old_cam;
+	}
+
+	CameraPtr DisplayDeviceNull::getDefaultCamera() const
+	{
+		return default_camera_;
+	}
+
+	// Does the same CPU side work as DisplayDeviceOpenGL::render(), recording where that would 
+	// call into GL.
+	void DisplayDeviceNull::render(const Renderable* r) const
+	{
+		if(!r->isEnabled()) {
+			return;
+		}
+
+		auto& st = get_state();
+
+		if(r->hasClipSettings()) {
+			ModelManager2D mm(static_cast<int>(r->getPosition().x), static_cast<int>(r->getPosition().y));
+			auto clip_shape = r->getStencilMask();
+			bool cam_set = false;
+			if(clip_shape->getCamera() == nullptr && r->getCamera() != nullptr) {
+				cam_set = true;
+				clip_shape->setCamera(r->getCamera());
+			}
+			record(NullCommand::Type::CLEAR, 0, static_cast<int>(ClearFlags::STENCIL));
+			render(clip_shape.get());
+			if(cam_set) {
+				clip_shape->setCamera(nullptr);
+			}
+		}
+
+		auto shader = r->getShader();
+		shader->makeActive();
+
+		const unsigned r_blend = blend_key_for(*r, default_blend_key);
+
+		change_state(st.depth_test, r->isDepthEnableStateSet() && r->isDepthEnabled() ? 1 : 0, NullCommand::Type::DEPTH);
+
+		glm::mat4 pmat(1.0f);
+		glm::mat4 vmat(1.0f);
+		if(r->getCamera()) {
+			pmat = r->getCamera()->getProjectionMat();
+			vmat = r->getCamera()->getViewMat();
+		} else if(default_camera_ != nullptr) {
+			pmat = default_camera_->getProjectionMat();
+			vmat = default_camera_->getViewMat();
+		}
+
+		if(r->getRenderTarget()) {
+			r->getRenderTarget()->apply();
+		}
+
+		if(shader->getPUniform() != ShaderProgram::INVALID_UNIFORM) {
+			shader->setUniformValue(shader->getPUniform(), glm::value_ptr(pmat));
+		}
+
+		glm::mat4 mmat = r->getModelMatrix();
+		if(is_global_model_matrix_valid() && !r->ignoreGlobalModelMatrix()) {
+			mmat = get_global_model_matrix() * mmat;
+		}
+
+		if(shader->getMvUniform() != ShaderProgram::INVALID_UNIFORM) {
+			shader->setUniformValue(shader->getMvUniform(), glm::value_ptr(vmat * mmat));
+		}
+
+		shader->setMvpMatrix(pmat, vmat, mmat);
+
+		if(shader->getColorUniform() != ShaderProgram::INVALID_UNIFORM) {
+			if(r->isColorSet()) {
+				shader->setUniformValue(shader->getColorUniform(), r->getColor().asFloatVector());
+			} else {
+				shader->setUniformValue(shader->getColorUniform(), ColorScope::getCurrentColor().asFloatVector());
+			}
+		}
+
+		shader->setUniformsForTexture(r->getTexture());
+
+		auto uniform_draw_fn = shader->getUniformDrawFunction();
+		if(uniform_draw_fn) {
+			uniform_draw_fn(shader);
+		}
+
+		for(auto as : r->getAttributeSet()) {
+			if(!as->isEnabled()) {
+				continue;
+			}
+			if((!as->isMultiDrawEnabled() && as->getCount() <= 0) || (as->isMultiDrawEnabled() && as->getMultiDrawCount() <= 0)) {
+				continue;
+			}
+
+			change_state(st.blend, blend_key_for(*as, r_blend), NullCommand::Type::BLEND);
+
+			if(shader->getColorUniform() != ShaderProgram::INVALID_UNIFORM && as->isColorSet()) {
+				shader->setUniformValue(shader->getColorUniform(), as->getColor().asFloatVector());
+			}
+
+			for(auto& attr : as->getAttributes()) {
+				if(attr->isEnabled()) {
+					shader->applyAttribute(attr);
+				}
+			}
+
+			int vertices = 0;
+			if(as->isMultiDrawEnabled() && !as->isIndexed() && !as->isInstanced()) {
+				for(auto count : as->getMultiCountArray()) {
+					vertices += count;
+				}
+			} else {
+				vertices = static_cast<int>(as->getCount());
+				if(as->isInstanced()) {
+					vertices *= as->getInstanceCount();
+				}
+			}
+			record_draw(NullCommand::Type::DRAW, vertices);
+
+			shader->cleanUpAfterDraw();
+		}
+
+		if(r->getRenderTarget()) {
+			r->getRenderTarget()->unapply();
+		}
+	}
+
+	ScissorPtr DisplayDeviceNull::getScissor(const rect& r)
+	{
+		return ScissorPtr(new NullScissor(r));
+	}
+
+	TexturePtr DisplayDeviceNull::handleCreateTexture(const SurfacePtr& surface, const variant& node)
+	{
+		std::vector<SurfacePtr> surfaces;
+		if(surface != nullptr) {
+			surfaces.emplace_back(surface);
+		}
+		return std::make_shared<NullTexture>(node, surfaces);
+	}
+
+	TexturePtr DisplayDeviceNull::handleCreateTexture(const SurfacePtr& surface, TextureType type, int mipmap_levels)
+	{
+		std::vector<SurfacePtr> surfaces(1, surface);
+		return std::make_shared<NullTexture>(surfaces, type, mipmap_levels);
+	}
+
+	TexturePtr DisplayDeviceNull::handleCreateTexture1D(int width, PixelFormat::PF fmt)
+	{
+		return std::make_shared<NullTexture>(1, width, 0, 0, fmt, TextureType::TEXTURE_1D);
+	}
+
+	TexturePtr DisplayDeviceNull::handleCreateTexture2D(int width, int height, PixelFormat::PF fmt)
+	{
+		const int count = fmt == PixelFormat::PF::PIXELFORMAT_YV12 ? 3 : 1;
+		return std::make_shared<NullTexture>(count, width, height, 0, fmt, TextureType::TEXTURE_2D);
+	}
+	
+	TexturePtr DisplayDeviceNull::handleCreateTexture3D(int width, int height, int depth, PixelFormat::PF fmt)
+	{
+		return std::make_shared<NullTexture>(1, width, height, depth, fmt, TextureType::TEXTURE_3D);
+	}
+
+	TexturePtr DisplayDeviceNull::handleCreateTextureArray(int count, int width, int height, PixelFormat::PF fmt, TextureType type)
+	{
+		return std::make_shared<NullTexture>(count, width, height, 0, fmt, type);
+	}
+
+	TexturePtr DisplayDeviceNull::handleCreateTextureArray(const std::vector<SurfacePtr>& surfaces, const variant& node)
+	{
+		return std::make_shared<NullTexture>(node, surfaces);
+	}
+
+	RenderTargetPtr DisplayDeviceNull::handleCreateRenderTarget(int width, int height, 
+			int color_plane_count, 
+			bool depth, 
+			bool stencil, 
+			bool use_multi_sampling, 
+			int multi_samples)
+	{
+		return std::make_shared<NullRenderTarget>(width, height, color_plane_count, depth, stencil, use_multi_sampling, multi_samples);
+	}
+
+	RenderTargetPtr DisplayDeviceNull::handleCreateRenderTarget(const variant& node)
+	{
+		return std::make_shared<NullRenderTarget>(node);
+	}
+
+	AttributeSetPtr DisplayDeviceNull::handleCreateAttributeSet(bool indexed, bool instanced)
+	{
+		return std::make_shared<NullAttributeSet>(indexed, instanced);
+	}
+
+	HardwareAttributePtr DisplayDeviceNull::handleCreateAttribute(AttributeBase* parent)
+	{
+		return std::make_shared<NullHardwareAttribute>(parent);
+	}
+
+	CanvasPtr DisplayDeviceNull::getCanvas()
+	{
+		return get_canvas_instance();
+	}
+
+	ClipScopePtr DisplayDeviceNull::createClipScope(const rect& r)
+	{
+		return ClipScopePtr(new NullClipScope(r));
+	}
+
+	ClipShapeScopePtr DisplayDeviceNull::createClipShapeScope(const RenderablePtr& r)
+	{
+		return ClipShapeScopePtr(new NullClipShapeScope(r));
+	}
+
+	StencilScopePtr DisplayDeviceNull::createStencilScope(const StencilSettings& settings)
+	{
+		return StencilScopePtr(new NullStencilScope(settings));
+	}
+
+	BlendEquationImplBasePtr DisplayDeviceNull::getBlendEquationImpl()
+	{
+		return BlendEquationImplBasePtr(new NullBlendEquationImpl());
+	}
+
+	void DisplayDeviceNull::setViewPort(int x, int y, int width, int height)
+	{
+		setViewPort(rect(x, y, width, height));
+	}
+
+	void DisplayDeviceNull::setViewPort(const rect& vp)
+	{
+		if(vp.w() != 0 && vp.h() != 0) {
+			viewport_ = vp;
+		}
+	}
+
+	const rect& DisplayDeviceNull::getViewPort() const 
+	{
+		return viewport_;
+	}
+	
+	bool DisplayDeviceNull::doCheckForFeature(DisplayDeviceCapabilties cap)
+	{
+		// Claim everything, so callers take the same paths they would on capable hardware.
+		return true;
+	}
+
+	void DisplayDeviceNull::loadShadersFromVariant(const variant& node) 
+	{
+		if(node.has_key("instances") && node["instances"].is_list()) {
+			for(auto instance : node["instances"].as_list()) {
+				get_or_create_shader(instance["name"].as_string(), instance);
+			}
+		} else {
+			get_or_create_shader(node["name"].as_string(), node);
+		}
+	}
+
+	ShaderProgramPtr DisplayDeviceNull::getShaderProgram(const std::string& name)
+	{
+		return get_or_create_shader(name);
+	}
+
+	ShaderProgramPtr DisplayDeviceNull::getShaderProgram(const variant& node)
+	{
+		ASSERT_LOG(node.has_key("name"), "Shader definitions must have a name: " << node.to_debug_string());
+		return get_or_create_shader(node["name"].as_string(), node);
+	}
+
+	ShaderProgramPtr DisplayDeviceNull::createShader(const std::string& name, 
+		const std::vector<ShaderData>& shader_data, 
+		const std::vector<ActiveMapping>& uniform_map,
+		const std::vector<ActiveMapping>& attribute_map)
+	{
+		auto spp = std::make_shared<NullShaderProgram>(name, variant());
+		std::vector<std::pair<std::string, std::string>> mapping;
+		for(auto& m : uniform_map) {
+			mapping.emplace_back(m.alt_name, m.name);
+		}
+		spp->setUniformMapping(mapping);
+		mapping.clear();
+		for(auto& m : attribute_map) {
+			mapping.emplace_back(m.alt_name, m.name);
+		}
+		spp->setAttributeMapping(mapping);
+		return spp;
+	}
+
+	ShaderProgramPtr DisplayDeviceNull::createGaussianShader(int radius) 
+	{
+		std::stringstream ss;
+		ss << "blur" << radius;
+		return get_or_create_shader(ss.str());
+	}
+
+	void DisplayDeviceNull::doBlitTexture(const TexturePtr& tex, int dstx, int dsty, int dstw, int dsth, float rotation, int srcx, int srcy, int srcw, int srch)
+	{
+		getDefaultShader()->makeActive();
+		getDefaultShader()->setUniformsForTexture(tex);
+		record_draw(NullCommand::Type::DRAW, 4);
+	}
+
+	// Nothing is ever drawn, so reads give back the clear color.
+	bool DisplayDeviceNull::handleReadPixels(int x, int y, unsigned width, unsigned height, ReadFormat fmt, AttrFormat type, void* data, int stride)
+	{
+		ASSERT_LOG(width > 0 && height > 0, "Width or height was negative: " << width << " x " << height);
+		uint8_t* pixels = static_cast<uint8_t*>(data);
+		std::fill(pixels, pixels + height * stride, 0);
+		if(type != AttrFormat::UNSIGNED_BYTE || (fmt != ReadFormat::RGB && fmt != ReadFormat::RGBA)) {
+			return true;
+		}
+		const int bpp = fmt == ReadFormat::RGB ? 3 : 4;
+		const uint8_t color[] = { 
+			static_cast<uint8_t>(clear_color_.r_int()), 
+			static_cast<uint8_t>(clear_color_.g_int()), 
+			static_cast<uint8_t>(clear_color_.b_int()), 
+			static_cast<uint8_t>(clear_color_.a_int()),
+		};
+		for(unsigned row = 0; row != height; ++row) {
+			uint8_t* p = pixels + row * stride;
+			for(unsigned col = 0; col != width; ++col, p += bpp) {
+				std::copy(color, color + bpp, p);
+			}
+		}
+		return true;
+	}
+
+	EffectPtr DisplayDeviceNull::createEffect(const variant& node)
+	{
+		ASSERT_LOG(node.has_key("type") && node["type"].is_string(), "Effects must have 'type' attribute as string: " << node.to_debug_string());
+		return std::make_shared<NullEffect>();
+	}
+}
+
+UNIT_TEST(null_device_records_frame)
+{
+	using namespace KRE;
+	auto device = DisplayDevice::factory("null", nullptr);
+	device->init(320, 240);
+	DisplayDeviceNull::resetStats();
+
+	auto tex = Texture::createTexture2D(16, 16, PixelFormat::PF::PIXELFORMAT_RGBA8888);
+	CHECK_EQ(DisplayDeviceNull::getStats().textures_created, 1);
+	// Clones share the texture object.
+	auto copy = tex->clone();
+	CHECK_EQ(copy->id(0), tex->id(0));
+	CHECK_EQ(DisplayDeviceNull::getStats().textures_created, 1);
+
+	device->clear(ClearFlags::COLOR);
+	auto canvas = Canvas::getInstance();
+	canvas->drawSolidRect(rect(0, 0, 10, 10), Color::colorWhite());
+	canvas->drawLine(point(0, 0), point(10, 10), Color::colorWhite());
+	device->swap();
+
+	const NullDeviceStats& stats = DisplayDeviceNull::getStats();
+	CHECK_EQ(stats.frames, 1);
+	CHECK_EQ(stats.draws, 2);
+	CHECK_EQ(stats.canvas_draws, 2);
+	CHECK_EQ(stats.vertices, 6);
+	const std::vector<NullCommand>& frame = DisplayDeviceNull::getLastFrame();
+	CHECK(!frame.empty() && frame.front().type == NullCommand::Type::CLEAR, "frame doesn't start with the clear");
+	const auto draws = std::count_if(frame.begin(), frame.end(), [](const NullCommand& cmd) { return cmd.type == NullCommand::Type::CANVAS_DRAW; });
+	CHECK_EQ(draws, 2);
+
+	// Render targets read back as their clear color.
+	auto rt = DisplayDevice::renderTargetInstance(2, 2);
+	rt->setClearColor(10, 20, 30, 40);
+	const std::vector<uint8_t> pixels = rt->readPixels();
+	CHECK_EQ(pixels.size(), 16U);
+	for(size_t n = 0; n < pixels.size(); n += 4) {
+		CHECK(pixels[n] == 10 && pixels[n + 1] == 20 && pixels[n + 2] == 30 && pixels[n + 3] == 40, "render target pixel " << (n / 4) << " isn't the clear color");
+	}
+}
@@ -30,6 +30,7 @@
 #include <GL/glew.h>
 
 #include "asserts.hpp"
+#include "profile_timer.hpp"
 #include "AttributeSetOGL.hpp"
 #include "BlendOGL.hpp"
 #include "CameraObject.hpp"
@@ -41,10 +42,13 @@
 #include "FboOGL.hpp"
 #include "LightObject.hpp"
 #include "ModelMatrixScope.hpp"
+#include "ProgramCacheOGL.hpp"
 #include "ScissorOGL.hpp"
 #include "ShadersOGL.hpp"
+#include "StateTrackerOGL.hpp"
 #include "StencilScopeOGL.hpp"
 #include "TextureOGL.hpp"
+#include "UniformBufferOGL.hpp"
 #include "WindowManager.hpp"
 
 namespace KRE
@@ -65,12 +69,6 @@ namespace KRE
 			return res;
 		}
 
-		bool& get_current_depth_enable()
-		{
-			static bool depth_enable = false;
-			return depth_enable;
-		}
-
 		bool& get_current_depth_write()
 		{
 			static bool depth_write = false;
@@ -141,8 +139,13 @@ namespace KRE
 
 		glViewport(0, 0, width, height);
 
-		glEnable(GL_BLEND);
-		glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+		// A new context, so nothing the state tracker remembers holds any more.
+		StateTrackerOGL::getInstance().reset();
+		CameraUniformsOGL::getInstance().reset();
+		ProgramCacheOGL::getInstance().reset();
+		StateTrackerOGL::getInstance().setBlendEnabled(true);
+		StateTrackerOGL::getInstance().setBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+		StateTrackerOGL::getInstance().applyState();
 
 		int extension_count = 0;
 		glGetIntegerv(GL_NUM_EXTENSIONS, &extension_count);
@@ -238,6 +241,7 @@ namespace KRE
 
 	void DisplayDeviceOpenGL::clear(ClearFlags clr)
 	{
+		StateTrackerOGL::getInstance().flushPendingDraws();
 		glClear((clr & ClearFlags::COLOR ? GL_COLOR_BUFFER_BIT : 0) 
 			| (clr & ClearFlags::DEPTH ? GL_DEPTH_BUFFER_BIT : 0) 
 			| (clr & ClearFlags::STENCIL ? GL_STENCIL_BUFFER_BIT : 0));
@@ -255,7 +259,8 @@ namespace KRE
 
 	void DisplayDeviceOpenGL::swap()
 	{
-		// This is a no-action.
+		// The window presents the frame, this just marks the end of it.
+		StreamingAttributeOGL::endFrame();
 	}
 
 	ShaderProgramPtr DisplayDeviceOpenGL::getDefaultShader()
@@ -281,6 +286,8 @@ namespace KRE
 			// Renderable item not enabled then early return.
 			return;
 		}
+		// Canvas draws made before this one have to land first.
+		StateTrackerOGL::getInstance().flushPendingDraws();
 
 		StencilScopePtr stencil_scope;
 		if(r->hasClipSettings()) {
@@ -314,23 +321,8 @@ namespace KRE
 		// apply lighting/depth check/depth write here.
 		bool use_lighting = r->isLightingStateSet() ? r->useLighting() : false;
 
-		// Set the depth enable.
-		if(r->isDepthEnableStateSet()) {
-			if(get_current_depth_enable() != r->isDepthEnabled()) {
-				if(r->isDepthEnabled()) {
-					glEnable(GL_DEPTH_TEST);
-				} else {
-					glDisable(GL_DEPTH_TEST);
-				}
-				get_current_depth_enable() = r->isDepthEnabled();
-			}
-		} else {
-			// We assume that depth is disabled if not specified.
-			if(get_current_depth_enable() == true) {
-				glDisable(GL_DEPTH_TEST);
-				get_current_depth_enable() = false;
-			}
-		}
+		// Set the depth enable. We assume that depth is disabled if not specified.
+		StateTrackerOGL::getInstance().setDepthTest(r->isDepthEnableStateSet() && r->isDepthEnabled());
 
 		glm::mat4 pmat(1.0f);
 		glm::mat4 vmat(1.0f);
@@ -357,26 +349,18 @@ namespace KRE
 			shader->setUniformValue(shader->getPUniform(), glm::value_ptr(pmat));
 		}
 
-		if(shader->getMvUniform() != ShaderProgram::INVALID_UNIFORM) {
-			glm::mat4 mvmat = vmat;
-			if(is_global_model_matrix_valid() && !r->ignoreGlobalModelMatrix()) {
-				mvmat *= get_global_model_matrix() * r->getModelMatrix();
-			} else {
-				mvmat *= r->getModelMatrix();
-			}
-			shader->setUniformValue(shader->getMvUniform(), glm::value_ptr(mvmat));
+		glm::mat4 mmat = r->getModelMatrix();
+		if(is_global_model_matrix_valid() && !r->ignoreGlobalModelMatrix()) {
+			mmat = get_global_model_matrix() * mmat;
 		}
 
-		if(shader->getMvpUniform() != ShaderProgram::INVALID_UNIFORM) {
-			glm::mat4 pvmat(1.0f);
-			if(is_global_model_matrix_valid() && !r->ignoreGlobalModelMatrix()) {
-				pvmat = pmat * vmat * get_global_model_matrix() * r->getModelMatrix();
-			} else {
-				pvmat = pmat * vmat * r->getModelMatrix();
-			}
-			shader->setUniformValue(shader->getMvpUniform(), glm::value_ptr(pvmat));
+		if(shader->getMvUniform() != ShaderProgram::INVALID_UNIFORM) {
+			shader->setUniformValue(shader->getMvUniform(), glm::value_ptr(vmat * mmat));
 		}
 
+		// The projection and view are only uploaded when they change for programs using the camera block.
+		shader->setMvpMatrix(pmat, vmat, mmat);
+
 		if(shader->getColorUniform() != ShaderProgram::INVALID_UNIFORM) {
 			if(r->isColorSet()) {
 				shader->setUniformValue(shader->getColorUniform(), r->getColor().asFloatVector());
@@ -423,18 +407,23 @@ namespace KRE
 				shader->setUniformValue(shader->getColorUniform(), as->getColor().asFloatVector());
 			}
 
+			// Attributes without a hardware buffer are client side arrays.
+			if(!as->isHardwareBacked()) {
+				StateTrackerOGL::getInstance().bindBuffer(GL_ARRAY_BUFFER, 0);
+			}
 			for(auto& attr : as->getAttributes()) {
 				if(attr->isEnabled()) {
 					shader->applyAttribute(attr);
 				}
 			}
 
+			StateTrackerOGL::getInstance().applyState();
+
 			if(as->isInstanced()) {
 				if(as->isIndexed()) {
 					as->bindIndex();
 					// XXX as->GetIndexArray() should be as->GetIndexArray()+as->GetOffset()
 					glDrawElementsInstanced(draw_mode, static_cast<GLsizei>(as->getCount()), convert_index_type(as->getIndexType()), as->getIndexArray(), as->getInstanceCount());
-					as->unbindIndex();
 				} else {
 					glDrawArraysInstanced(draw_mode, static_cast<GLint>(as->getOffset()), static_cast<GLsizei>(as->getCount()), as->getInstanceCount());
 				}
@@ -443,7 +432,6 @@ namespace KRE
 					as->bindIndex();
 					// XXX as->GetIndexArray() should be as->GetIndexArray()+as->GetOffset()
 					glDrawElements(draw_mode, static_cast<GLsizei>(as->getCount()), convert_index_type(as->getIndexType()), as->getIndexArray());
-					as->unbindIndex();
 				} else {
 					if(as->isMultiDrawEnabled()) {
 						glMultiDrawArrays(draw_mode, as->getMultiOffsetArray().data(), as->getMultiCountArray().data(), as->getMultiDrawCount());
@@ -452,9 +440,10 @@ namespace KRE
 					}
 				}
 			}
+			++getRenderStats().draw_calls;
+			PROFILE_COUNT(DRAW_CALLS, 1);
 
 			shader->cleanUpAfterDraw();
-			glBindBuffer(GL_ARRAY_BUFFER, 0);
 		}
 
 		if(r->getRenderTarget()) {
@@ -532,6 +521,9 @@ namespace KRE
 
 	HardwareAttributePtr DisplayDeviceOpenGL::handleCreateAttribute(AttributeBase* parent)
 	{
+		if(parent->getAccessFrequency() == AccessFreqHint::STREAM && StreamingAttributeOGL::isSupported()) {
+			return std::make_shared<StreamingAttributeOGL>(parent);
+		}
 		return std::make_shared<HardwareAttributeOGL>(parent);
 	}
 
@@ -661,21 +653,24 @@ namespace KRE
 		BlendModeScopeOGL bm_scope(*tex);
 
 		glm::mat4 model = glm::translate(glm::mat4(1.0f), glm::vec3((vx1+vx2)/2.0f,(vy1+vy2)/2.0f,0.0f)) * glm::rotate(glm::mat4(1.0f), glm::radians(rotation), glm::vec3(0.0f,0.0f,1.0f)) * glm::translate(glm::mat4(1.0f), glm::vec3(-(vx1+vy1)/2.0f,-(vy1+vy1)/2.0f,0.0f));
-		glm::mat4 mvp = glm::ortho(0.0f, 800.0f, 600.0f, 0.0f) * model;
 		auto shader = OpenGL::ShaderProgram::defaultSystemShader();
 		shader->makeActive();
 		getDefaultShader()->setUniformsForTexture(tex);
 
-		shader->setUniformValue(shader->getMvpUniform(), glm::value_ptr(mvp));
+		shader->setMvpMatrix(glm::ortho(0.0f, 800.0f, 600.0f, 0.0f), glm::mat4(1.0f), model);
 		shader->setUniformValue(shader->getColorUniform(), glm::value_ptr(glm::vec4(1.0f,1.0f,1.0f,1.0f)));
 		// XXX the following line are only temporary, obviously.
 		//shader->setUniformValue(shader->getUniform("discard"), 0);
+		StateTrackerOGL::getInstance().bindBuffer(GL_ARRAY_BUFFER, 0);
 		glEnableVertexAttribArray(shader->getVertexAttribute());
 		glVertexAttribPointer(shader->getVertexAttribute(), 2, GL_FLOAT, GL_FALSE, 0, vtx_coords);
 		glEnableVertexAttribArray(shader->getTexcoordAttribute());
 		glVertexAttribPointer(shader->getTexcoordAttribute(), 2, GL_FLOAT, GL_FALSE, 0, uv_coords);
 
+		StateTrackerOGL::getInstance().applyState();
 		glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+		++getRenderStats().draw_calls;
+		PROFILE_COUNT(DRAW_CALLS, 1);
 
 		glDisableVertexAttribArray(shader->getTexcoordAttribute());
 		glDisableVertexAttribArray(shader->getVertexAttribute());
@@ -746,6 +741,8 @@ namespace KRE
 		//	glPixelStorei(GL_PACK_ALIGNMENT, 1);
 		//}
 		//glPixelStorei(GL_PACK_ALIGNMENT, 4);
+		// Batched canvas draws have to land before we read them back.
+		StateTrackerOGL::getInstance().flushPendingDraws();
 		LOG_DEBUG("before read pixels");
 		glReadPixels(x, y, static_cast<int>(width), static_cast<int>(height), convert_read_format(fmt), convert_attr_format(type), &new_data[0]);
 		LOG_DEBUG("after read pixels");
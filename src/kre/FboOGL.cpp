@@ -29,6 +29,7 @@
 #include "asserts.hpp"
 #include "DisplayDevice.hpp"
 #include "FboOGL.hpp"
+#include "StateTrackerOGL.hpp"
 #include "TextureOGL.hpp"
 #include "TextureUtils.hpp"
 #include "WindowManager.hpp"
@@ -281,6 +282,7 @@ namespace KRE
 
 	void FboOpenGL::handleApply(const rect& r) const
 	{
+		StateTrackerOGL::getInstance().flushPendingDraws();
 		ASSERT_LOG(framebuffer_id_ != nullptr, "Framebuffer object hasn't been created.");
 		if(sample_framebuffer_id_) {
 			glBindFramebuffer(GL_FRAMEBUFFER, *sample_framebuffer_id_);
@@ -296,6 +298,7 @@ namespace KRE
 
 	void FboOpenGL::handleUnapply() const
 	{
+		StateTrackerOGL::getInstance().flushPendingDraws();
 		ASSERT_LOG(!get_fbo_stack().empty(), "FBO id stack was empty. This should never happen if calls to apply/unapply are balanced.");
 		// This should be our id at top.
 		auto chk = get_fbo_stack().top(); get_fbo_stack().pop();
@@ -332,6 +335,7 @@ namespace KRE
 
 	void FboOpenGL::handleClear() const
 	{
+		StateTrackerOGL::getInstance().flushPendingDraws();
 		bool appl = applied_;
 		if(!appl) {
 			handleApply(rect());
@@ -374,6 +378,8 @@ namespace KRE
 		std::vector<uint8_t> pixels;
 		pixels.resize(stride * tex_height_);
 
+		// Batched canvas draws have to land before we read them back.
+		StateTrackerOGL::getInstance().flushPendingDraws();
 		glBindFramebuffer(GL_READ_FRAMEBUFFER, *framebuffer_id_);
 		glReadPixels(0, 0, tex_width_, tex_height_, GL_RGBA, GL_UNSIGNED_BYTE, pixels.data());
 		glBindFramebuffer(GL_READ_FRAMEBUFFER, get_fbo_stack().top().id);
@@ -23,6 +23,7 @@
 
 #include "DisplayDevice.hpp"
 #include "FontDriver.hpp"
+#include "FontIndex.hpp"
 #include "FontImpl.hpp"
 #include "Shaders.hpp"
 
@@ -52,11 +53,23 @@ namespace KRE
 
 		struct CacheKey
 		{
-			CacheKey(const std::string& fn, float sz) : font_name(fn), size(sz) {}
+			CacheKey(const std::string& fn, float sz, const std::string& prov, int w, FontStyle st) : font_name(fn), size(sz), provider(prov), weight(w), style(st) {}
 			std::string font_name;
 			float size;
+			std::string provider;
+			int weight;
+			FontStyle style;
 			bool operator<(const CacheKey& other) const {
-				return font_name == other.font_name ? size < other.size : font_name < other.font_name;
+				if(font_name != other.font_name) {
+					return font_name < other.font_name;
+				}
+				if(size != other.size) {
+					return size < other.size;
+				}
+				if(provider != other.provider) {
+					return provider < other.provider;
+				}
+				return weight == other.weight ? style < other.style : weight < other.weight;
 			}
 		};
 
@@ -95,6 +108,12 @@ namespace KRE
 			static font_impl_creation_fn res;
 			return res;
 		}
+
+		std::string& default_font_provider_name()
+		{
+			static std::string res;
+			return res;
+		}
 	}
 
 	FontDriver::FontDriver()
@@ -106,6 +125,7 @@ namespace KRE
 		auto it = get_font_providers().find(name);
 		if(it != get_font_providers().end()) {
 			defaul_font_provider() = it->second;
+			default_font_provider_name() = name;
 		} else {
 			LOG_ERROR("No font provider found for '" << name << "' retaining current default.");
 		}
@@ -115,6 +135,7 @@ namespace KRE
 	{
 		if(get_font_providers().empty()) {
 			defaul_font_provider() = create_fn;
+			default_font_provider_name() = name;
 		}
 		get_font_providers()[name] = create_fn;
 	}
@@ -124,7 +145,7 @@ namespace KRE
 		get_font_path_cache() = font_map;
 	}
 
-	FontHandlePtr FontDriver::getFontHandle(const std::vector<std::string>& font_list, float size, const Color& color, bool init_texture, const std::string& driver)
+	FontHandlePtr FontDriver::getFontHandle(const std::vector<std::string>& font_list, float size, const Color& color, bool init_texture, const std::string& driver, int weight, FontStyle style)
 	{
 		std::string selected_font;
 		std::string font_path;
@@ -156,6 +177,13 @@ namespace KRE
 								break;
 							}
 						}
+						// Fall back to looking the family up in the system font index.
+						const FontIndexEntry* fe = FontIndex::getInstance().find(fnt, weight, style);
+						if(fe != nullptr) {
+							selected_font = fnt;
+							font_path = fe->path;
+							break;
+						}
 					}
 				}
 			}
@@ -170,7 +198,11 @@ namespace KRE
 			throw FontError2(ss.str());
 		}
 
-		auto it = get_font_cache().find(CacheKey(font_path, size));
+		// Handles are cached per provider so different providers can be used side by side. The
+		// weight and style are part of the key as they change which fallback fonts are used.
+		const std::string provider = !driver.empty() && get_font_providers().find(driver) != get_font_providers().end() ? driver : default_font_provider_name();
+		const CacheKey key(font_path, size, provider, weight, style);
+		auto it = get_font_cache().find(key);
 		if(it != get_font_cache().end()) {
 			return it->second;
 		}
@@ -188,9 +220,10 @@ namespace KRE
 			fnt_impl = defaul_font_provider()(selected_font, font_path, size, color, init_texture);
 		}
 		ASSERT_LOG(fnt_impl != nullptr, "No font implementation.");
+		fnt_impl->setStyle(weight, style);
 		// N.B. After this call fnt_impl is moved into the FontHandle object and while no longer be valid.
 		auto fh = std::make_shared<FontHandle>(std::move(fnt_impl), selected_font, font_path, size, color, init_texture);
-		get_font_cache()[CacheKey(font_path, size)] = fh;
+		get_font_cache()[key] = fh;
 		return fh;
 	}
 
@@ -199,6 +232,13 @@ namespace KRE
 		return get_common_glyphs();
 	}
 
+	void FontDriver::commitPendingGlyphs()
+	{
+		for(auto& fnt : get_font_cache()) {
+			fnt.second->commitPendingGlyphs();
+		}
+	}
+
 	FontRenderable::FontRenderable() 
 		: SceneObject("font-renderable"),
 		  attribs_(nullptr),
@@ -244,12 +284,14 @@ namespace KRE
 
 	void FontRenderable::update(std::vector<font_coord>* queue)
 	{
+		extendLocalBounds(queue->cbegin(), queue->cend(), [](const font_coord& fc) { return fc.vtx; });
 		attribs_->update(queue, attribs_->end());
 	}
 
 	void FontRenderable::clear()
 	{
 		attribs_->clear();
+		clearLocalBounds();
 	}
 
 	ColoredFontRenderable::ColoredFontRenderable() 
@@ -301,6 +343,7 @@ namespace KRE
 
 	void ColoredFontRenderable::update(std::vector<font_coord>* queue)
 	{
+		extendLocalBounds(queue->cbegin(), queue->cend(), [](const font_coord& fc) { return fc.vtx; });
 		attribs_->update(queue, attribs_->end());
 	}
 
@@ -320,6 +363,7 @@ namespace KRE
 	void ColoredFontRenderable::clear()
 	{
 		attribs_->clear();
+		clearLocalBounds();
 	}
 
 	FontHandle::FontHandle(std::unique_ptr<Impl>&& impl, const std::string& fnt_name, const std::string& fnt_path, float size, const Color& color, bool init_texture)
@@ -336,6 +380,16 @@ namespace KRE
 		return impl_->size_;
 	}
 
+	int FontHandle::getFontWeight() const
+	{
+		return impl_->weight_;
+	}
+
+	FontStyle FontHandle::getFontStyle() const
+	{
+		return impl_->style_;
+	}
+
 	float FontHandle::getFontXHeight()
 	{
 		// XXX
@@ -386,6 +440,11 @@ namespace KRE
 		return impl_->getGlyphPath(text);
 	}
 
+	void FontHandle::clearGlyphPathCache()
+	{
+		impl_->glyph_path_cache_.clear();
+	}
+
 	rect FontHandle::getBoundingBox(const std::string& text)
 	{
 		long w, h;
@@ -398,6 +457,11 @@ namespace KRE
 		return impl_->createRenderableFromPath(r, text, path);
 	}
 
+	void FontHandle::generateGlyphCoords(const std::string& text, const std::vector<point>& path, std::vector<font_coord>* coords)
+	{
+		impl_->generateGlyphCoords(text, path, coords);
+	}
+
 	ColoredFontRenderablePtr FontHandle::createColoredRenderableFromPath(ColoredFontRenderablePtr r, const std::string& text, const std::vector<point>& path, const std::vector<KRE::Color>& colors)
 	{
 		return impl_->createColoredRenderableFromPath(r, text, path, colors);
@@ -422,4 +486,9 @@ namespace KRE
 	{
 		return impl_->getLineGap();
 	}
+
+	bool FontHandle::commitPendingGlyphs()
+	{
+		return impl_->commitPendingGlyphs();
+	}
 }
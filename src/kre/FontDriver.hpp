@@ -31,6 +31,7 @@
 #include "geometry.hpp"
 #include "AttributeSet.hpp"
 #include "Color.hpp"
+#include "FontIndex.hpp"
 #include "RenderFwd.hpp"
 #include "SceneObject.hpp"
 #include "Texture.hpp"
@@ -104,6 +105,8 @@ namespace KRE
 		FontHandle(std::unique_ptr<Impl>&& impl, const std::string& fnt_name, const std::string& fnt_path, float size, const Color& color, bool init_texture);
 		~FontHandle();
 		float getFontSize();
+		int getFontWeight() const;
+		FontStyle getFontStyle() const;
 		float getFontXHeight();
 		const std::string& getFontName();
 		const std::string& getFontPath();
@@ -115,13 +118,16 @@ namespace KRE
 		int getBaseline();
 		rect getBoundingBox(const std::string& text);
 		FontRenderablePtr createRenderableFromPath(FontRenderablePtr r, const std::string& text, const std::vector<point>& path);
+		void generateGlyphCoords(const std::string& text, const std::vector<point>& path, std::vector<font_coord>* coords);
 		ColoredFontRenderablePtr createColoredRenderableFromPath(ColoredFontRenderablePtr r, const std::string& text, const std::vector<point>& path, const std::vector<KRE::Color>& colors);
 		const std::vector<point>& getGlyphPath(const std::string& text);
+		void clearGlyphPathCache();
 		int calculateCharAdvance(char32_t cp);
 		int getScaleFactor() const { return 65536; }
 		std::vector<unsigned> getGlyphs(const std::string& text);
 		void* getRawFontHandle();
 		float getLineGap() const;
+		bool commitPendingGlyphs();
 	private:
 		std::unique_ptr<Impl> impl_;
 	};
@@ -134,10 +140,15 @@ namespace KRE
 	public:
 		static void setFontProvider(const std::string& name);
 		static void registerFontProvider(const std::string& name, font_impl_creation_fn create_fn);
-		static FontHandlePtr getFontHandle(const std::vector<std::string>& font_list, float size, const Color& color=Color::colorWhite(), bool init_texture=true, const std::string& driver=std::string());
+		// weight (CSS, 100 to 900) and style select the face when the family is found in the system 
+		// font index, they are also used to pick fonts for any codepoints the font doesn't have.
+		static FontHandlePtr getFontHandle(const std::vector<std::string>& font_list, float size, const Color& color=Color::colorWhite(), bool init_texture=true, const std::string& driver=std::string(), int weight=400, FontStyle style=FontStyle::NORMAL);
 		static void setAvailableFonts(const font_path_cache& font_map);
 		//static TexturePtr renderText(const std::string& text, ...);
 		static const std::vector<char32_t>& getCommonGlyphs();
+		// Uploads glyphs rasterized in the background to the font textures and rebuilds
+		// any font renderables that were waiting on them. Call once a frame from the render thread.
+		static void commitPendingGlyphs();
 	private:
 		FontDriver();
 	};
@@ -33,6 +33,9 @@
 #include FT_LCD_FILTER_H
 #include FT_BBOX_H
 
+#include <cstdint>
+#include <mutex>
+#include <set>
 #include <unordered_map>
 
 #include "formatter.hpp"
@@ -41,6 +44,7 @@
 
 #include "DisplayDevice.hpp"
 #include "FontImpl.hpp"
+#include "FontRasterQueue.hpp"
 #include "SceneObject.hpp"
 #include "Shaders.hpp"
 
@@ -54,6 +58,12 @@ namespace KRE
 		const int surface_width = 2048;
 		const int surface_height = 2048;
 
+		// Codepoints below this get a flat character index lookup table.
+		const char32_t char_index_table_size = 0x800;
+		const FT_UInt invalid_char_index = ~0U;
+		// Glyph index pairs with both indices below this get a flat kerning table.
+		const FT_UInt kerning_table_size = 0x80;
+		const int32_t invalid_kerning = INT32_MIN;
 
 		FT_Library& get_ft_library()
 		{
@@ -86,6 +96,148 @@ namespace KRE
 		long bearing_y;
 	};
 
+	// Glyph metrics needed when measuring text, loaded without rendering a bitmap.
+	struct GlyphMetrics
+	{
+		GlyphMetrics() : loaded(false), valid(false), advance(0), width(0), height(0) {}
+		bool loaded;
+		// false if the glyph failed to load.
+		bool valid;
+		// Linear horizontal advance, 16.16 fixed point.
+		FT_Fixed advance;
+		// Width and height of the glyph, 26.6 fixed point.
+		FT_Pos width;
+		FT_Pos height;
+	};
+
+	// A glyph bitmap waiting to be placed in the font texture.
+	struct RasterizedGlyph
+	{
+		RasterizedGlyph() : cp(0), gi(), pitch(0), pixels() {}
+		char32_t cp;
+		GlyphInfo gi;
+		int pitch;
+		std::vector<uint8_t> pixels;
+	};
+
+	// State used by background rasterization jobs. The rasterization thread gets its
+	// own library and face since FreeType faces can't be shared between threads.
+	struct FreetypeRasterState
+	{
+		FreetypeRasterState(const std::string& path, float sz, int flags) 
+			: font_path(path), 
+			  size(sz), 
+			  load_flags(flags), 
+			  library(nullptr), 
+			  face(nullptr), 
+			  mutex(), 
+			  completed(),
+			  failed()
+		{
+		}
+		~FreetypeRasterState()
+		{
+			if(face) {
+				FT_Done_Face(face);
+			}
+			if(library) {
+				FT_Done_FreeType(library);
+			}
+		}
+		std::string font_path;
+		float size;
+		int load_flags;
+		// library and face are only touched from the rasterization thread.
+		FT_Library library;
+		FT_Face face;
+		// guards completed and failed.
+		std::mutex mutex;
+		std::vector<RasterizedGlyph> completed;
+		std::vector<char32_t> failed;
+	};
+	typedef std::shared_ptr<FreetypeRasterState> FreetypeRasterStatePtr;
+
+	namespace
+	{
+		// Loads and renders the glyph for cp, converting the bitmap to 8-bit gray.
+		bool rasterize_glyph(FT_Face face, char32_t cp, int load_flags, RasterizedGlyph* res)
+		{
+			if(FT_Load_Char(face, cp, load_flags) != 0) {
+				LOG_ERROR("Font '" << face->family_name << "' does not contain glyph for: " << utils::codepoint_to_utf8(cp));
+				return false;
+			}
+			FT_GlyphSlot slot = face->glyph;
+			if(slot->bitmap.buffer == nullptr) {
+				return false;
+			}
+			res->cp = cp;
+			res->gi.width = static_cast<unsigned short>(slot->metrics.width/64);
+			res->gi.height = static_cast<unsigned short>(slot->metrics.height/64);
+			res->gi.advance_x = slot->linearHoriAdvance;
+			res->gi.advance_y = 0;
+			res->gi.bearing_x = slot->metrics.horiBearingX;
+			res->gi.bearing_y = slot->metrics.horiBearingY;
+
+			switch(slot->bitmap.pixel_mode) {
+				case FT_PIXEL_MODE_MONO: {
+					const int width = slot->bitmap.width;
+					const int rows = slot->bitmap.rows;
+					res->pitch = width;
+					res->pixels.assign(width * rows, 0);
+					for(int y = 0; y != rows; ++y) {
+						const uint8_t* src = slot->bitmap.buffer + y * slot->bitmap.pitch;
+						for(int x = 0; x != width; ++x) {
+							res->pixels[y * width + x] = (src[x >> 3] & (128 >> (x & 7))) ? 255 : 0;
+						}
+					}
+					break;
+				}
+				case FT_PIXEL_MODE_GRAY:
+					res->pitch = slot->bitmap.pitch;
+					res->pixels.assign(slot->bitmap.buffer, slot->bitmap.buffer + slot->bitmap.pitch * slot->bitmap.rows);
+					break;
+				case FT_PIXEL_MODE_LCD:
+				case FT_PIXEL_MODE_GRAY2:
+				case FT_PIXEL_MODE_GRAY4:
+				case FT_PIXEL_MODE_LCD_V:
+				/* case FT_PIXEL_MODE_BGRA: */
+				default:
+					ASSERT_LOG(false, "Unhandled font pixel mode: " << slot->bitmap.pixel_mode);
+					break;
+			}
+			return true;
+		}
+
+		// Runs on the rasterization thread.
+		void rasterize_glyphs(const FreetypeRasterStatePtr& state, const std::vector<char32_t>& glyphs)
+		{
+			if(state->face == nullptr) {
+				if(FT_Init_FreeType(&state->library) != 0 
+					|| FT_New_Face(state->library, state->font_path.c_str(), 0, &state->face) != 0) {
+					LOG_ERROR("Unable to open font for background rasterization: " << state->font_path);
+					return;
+				}
+				FT_Set_Char_Size(state->face, static_cast<int>(state->size * 64), 0, default_dpi, 0);
+			}
+			std::vector<RasterizedGlyph> res;
+			std::vector<char32_t> failed;
+			res.reserve(glyphs.size());
+			for(auto cp : glyphs) {
+				RasterizedGlyph rg;
+				if(rasterize_glyph(state->face, cp, state->load_flags, &rg)) {
+					res.emplace_back(std::move(rg));
+				} else {
+					failed.emplace_back(cp);
+				}
+			}
+			std::lock_guard<std::mutex> lock(state->mutex);
+			for(auto& rg : res) {
+				state->completed.emplace_back(std::move(rg));
+			}
+			state->failed.insert(state->failed.end(), failed.begin(), failed.end());
+		}
+	}
+
 	class FreetypeImpl : public FontHandle::Impl, public AlignedAllocator16
 	{
 	public:
@@ -93,6 +245,7 @@ namespace KRE
 			: FontHandle::Impl(fnt_name, fnt_path, size, color, init_texture),
 			  face_(nullptr),
 			  font_load_flags_(FT_LOAD_RENDER | FT_LOAD_FORCE_AUTOHINT),
+			  measure_load_flags_(FT_LOAD_NO_BITMAP | FT_LOAD_FORCE_AUTOHINT),
 			  font_texture_(),
 			  next_font_x_(0),
 			  next_font_y_(0),
@@ -101,7 +254,15 @@ namespace KRE
 			  bounding_height_(0),
 			  glyph_info_(),
 			  line_gap_(0),
-			  baseline_(0)
+			  baseline_(0),
+			  raster_state_(),
+			  pending_glyphs_(),
+			  missing_glyphs_(),
+			  glyph_metrics_(),
+			  char_index_(),
+			  char_index_map_(),
+			  kerning_table_(),
+			  kerning_cache_()
 		{
 			// XXX starting off with a basic way of rendering glyphs.
 			// It'd be better to render all the glyphs to a texture,
@@ -127,14 +288,19 @@ namespace KRE
 
 			line_gap_ = face_->height / 16.0f;
 
+			glyph_metrics_.resize(face_->num_glyphs);
+			char_index_.resize(char_index_table_size, invalid_char_index);
+
 			FT_UInt glyph_index = FT_Get_Char_Index(face_, 'x');
-			FT_Load_Glyph(face_, glyph_index, font_load_flags_);
+			loadMeasureGlyph(glyph_index);
 			x_height_ = face_->glyph->metrics.height / 64.0f;
 
 			glyph_index = FT_Get_Char_Index(face_, 'X');
-			FT_Load_Glyph(face_, glyph_index, font_load_flags_);
+			loadMeasureGlyph(glyph_index);
 			baseline_ = face_->glyph->metrics.horiBearingY * 1024;
 
+			raster_state_ = std::make_shared<FreetypeRasterState>(fnt_path_, size, font_load_flags_);
+
 			if(init_texture) {
 				// This is an empirical fudge that just adds all the glyphs in the
 				// font to the texture on the caveat that they will fit.
@@ -169,28 +335,28 @@ namespace KRE
 		}
 		void getBoundingBox(const std::string& str, long* w, long* h) override
 		{
-			FT_GlyphSlot slot = face_->glyph;
 			FT_UInt previous_glyph = 0;
 			ASSERT_LOG(w != nullptr && h != nullptr, "w or h is nullptr");
 			FT_Vector pen = { 0, 0 };
-			for(char32_t cp : utils::utf8_to_codepoint(str)) {
-				FT_UInt glyph_index = FT_Get_Char_Index(face_, cp);
+			static const GlyphMetrics empty_metrics;
+			const GlyphMetrics* last = &empty_metrics;
+			for(char32_t cp : utils::utf8_to_codepoints(str)) {
+				FT_UInt glyph_index = getCharIndex(cp);
 				if(has_kerning_ && previous_glyph && glyph_index) {
-					FT_Vector  delta;
-					FT_Get_Kerning(face_, previous_glyph, glyph_index, FT_KERNING_DEFAULT, &delta);
-					pen.x += delta.x;
+					pen.x += getKerning(previous_glyph, glyph_index, FT_KERNING_DEFAULT);
 				}
-				FT_Error error;
-				if((error = FT_Load_Glyph(face_, glyph_index, font_load_flags_)) != 0) {
+				const GlyphMetrics& gm = getGlyphMetrics(glyph_index);
+				if(!gm.valid) {
 					continue;
 				}
-				pen.x += slot->linearHoriAdvance;
+				pen.x += gm.advance;
 				pen.y += 0;
 				previous_glyph = glyph_index;
+				last = &gm;
 			}
 			// This is to ensure that the returned dimensions are tight, i.e. the final advance is replaced by the width of the character.
-			*w = (pen.x - slot->linearHoriAdvance + slot->metrics.width*65536L);
-			*h = (pen.y - slot->linearHoriAdvance + slot->metrics.height*65536L);
+			*w = (pen.x - last->advance + last->width*65536L);
+			*h = (pen.y - last->advance + last->height*65536L);
 		}
 
 		int getBoundingHeight()
@@ -201,7 +367,7 @@ namespace KRE
 		std::vector<unsigned> getGlyphs(const std::string& text) override
 		{
 			std::vector<unsigned> res;
-			for(auto cp : utils::utf8_to_codepoint(text)) {
+			for(auto cp : utils::utf8_to_codepoints(text)) {
 				res.emplace_back(FT_Get_Char_Index(face_, cp));
 			}
 			return res;
@@ -216,35 +382,20 @@ namespace KRE
 			std::vector<point>& path = glyph_path_cache_[text];
 
 			FT_Vector pen = { 0, 0 };
-			FT_Error error;
 			FT_UInt previous_glyph = 0;
-			FT_Pos  prev_rsb_delta = 0;
-			for(char32_t cp : utils::utf8_to_codepoint(text)) {
+			const std::vector<char32_t> cp_string = utils::utf8_to_codepoints(text);
+			path.reserve(cp_string.size() + 1);
+			for(char32_t cp : cp_string) {
 				path.emplace_back(pen.x, pen.y);
-				FT_UInt glyph_index = FT_Get_Char_Index(face_, cp);
+				FT_UInt glyph_index = getCharIndex(cp);
 				if(has_kerning_ && previous_glyph && glyph_index) {
-					static char32_t previous_cp = 0;
-					FT_Vector delta;
-					FT_Get_Kerning(face_, previous_glyph, glyph_index, FT_KERNING_UNFITTED, &delta);
-					//if(delta.x != 0) {
-					//	LOG_DEBUG("Kerning between: '" << char(previous_cp) << "' and '" << char(cp) << "' : " << delta.x);
-					//}
-					pen.x += static_cast<long>(delta.x) << 6;
-					previous_cp = cp;
+					pen.x += static_cast<long>(getKerning(previous_glyph, glyph_index, FT_KERNING_UNFITTED)) << 6;
 				}
-				if((error = FT_Load_Glyph(face_, glyph_index, font_load_flags_)) != 0) {
+				const GlyphMetrics& gm = getGlyphMetrics(glyph_index);
+				if(!gm.valid) {
 					continue;
 				}
-				FT_GlyphSlot slot = face_->glyph;
-
-				/*if(prev_rsb_delta - slot->lsb_delta >= 32) {
-					pen.x -= 65536;
-				} else if(prev_rsb_delta - slot->lsb_delta < -32) {
-					pen.x += 65536;
-				}
-				prev_rsb_delta = slot->rsb_delta; */
-
-				pen.x += slot->linearHoriAdvance;
+				pen.x += gm.advance;
 				pen.y += 0;//slot->linearVertAdvance;
 
 				previous_glyph = glyph_index;
@@ -254,40 +405,44 @@ namespace KRE
 			return path;
 		}
 		
-		// text is a utf-8 string, path is expected to have at least has many data points as there
-		// are codepoints in the string. path should be in units consist with FT_Pos
-		// N.B. the origin of the Renderable object created is the baseline of the font
-		FontRenderablePtr createRenderableFromPath(FontRenderablePtr font_renderable, const std::string& text, const std::vector<point>& path) override
+		// Generates the quads for the glyphs in text at the positions in path, width and height
+		// are updated with the size of the glyphs. Returns true if any glyphs are still being rasterized.
+		bool generateCoords(const std::string& text, const std::vector<point>& path, std::vector<font_coord>* coords, int* width, int* height)
 		{
-			auto cp_string = utils::utf8_to_codepoint(text);
-			int glyphs_in_text = 0;
+			const std::vector<char32_t> cp_string = utils::utf8_to_codepoints(text);
+			const int glyphs_in_text = static_cast<int>(cp_string.size());
 			std::vector<char32_t> glyphs_to_add;
 			for(char32_t cp : cp_string) {
-				++glyphs_in_text;
 				auto it = glyph_info_.find(cp);
-				if(it == glyph_info_.end()) {
+				if(it == glyph_info_.end() && pending_glyphs_.find(cp) == pending_glyphs_.end() && missing_glyphs_.find(cp) == missing_glyphs_.end()) {
 					glyphs_to_add.emplace_back(cp);
 				}
 			}
 			if(!glyphs_to_add.empty()) {
-				addGlyphsToTexture(glyphs_to_add);
+				if(FontRasterQueue::isEnabled() && font_texture_ != nullptr) {
+					pending_glyphs_.insert(glyphs_to_add.begin(), glyphs_to_add.end());
+					auto state = raster_state_;
+					FontRasterQueue::getInstance().queue([state, glyphs_to_add]() {
+						rasterize_glyphs(state, glyphs_to_add);
+					});
+				} else {
+					addGlyphsToTexture(glyphs_to_add);
+				}
 			}
 			
-			if(font_renderable == nullptr) {
-				font_renderable = std::make_shared<FontRenderable>();
-				font_renderable->setTexture(font_texture_);
-			}
-
-			int width = 0;
-			int height = 0;
-
-			std::vector<font_coord> coords;
-			coords.reserve(glyphs_in_text * 6);
+			bool has_pending = false;
+			coords->reserve(coords->size() + glyphs_in_text * 6);
 			int n = 0;
 			for(char32_t cp : cp_string) {
 				ASSERT_LOG(n < static_cast<int>(path.size()), "Insufficient points were supplied to create a path from the string '" << text << "'");
 				auto& pt =path[n];
 				auto it = glyph_info_.find(cp);
+				if(it == glyph_info_.end() && pending_glyphs_.find(cp) != pending_glyphs_.end()) {
+					// No quad until the glyph bitmap is in the texture.
+					has_pending = true;
+					++n;
+					continue;
+				}
 				if(it == glyph_info_.end()) {
 					it = glyph_info_.find(0xfffd);
 					if(it == glyph_info_.end()) {
@@ -296,8 +451,8 @@ namespace KRE
 				}
 				GlyphInfo& gi = it->second;
 				
-				width += gi.width;
-				height = std::max(height, static_cast<int>(gi.height));
+				*width += gi.width;
+				*height = std::max(*height, static_cast<int>(gi.height));
 
 				const float u1 = font_texture_->getTextureCoordW(0, gi.tex_x);
 				const float v1 = font_texture_->getTextureCoordH(0, gi.tex_y);
@@ -308,15 +463,41 @@ namespace KRE
 				const float y1 = static_cast<float>(pt.y) / 65536.0f - gi.bearing_y/64.0f;
 				const float x2 = x1 + static_cast<float>(gi.width);
 				const float y2 = y1 + static_cast<float>(gi.height);
-				coords.emplace_back(glm::vec2(x1, y2), glm::vec2(u1, v2));
-				coords.emplace_back(glm::vec2(x1, y1), glm::vec2(u1, v1));
-				coords.emplace_back(glm::vec2(x2, y1), glm::vec2(u2, v1));
+				coords->emplace_back(glm::vec2(x1, y2), glm::vec2(u1, v2));
+				coords->emplace_back(glm::vec2(x1, y1), glm::vec2(u1, v1));
+				coords->emplace_back(glm::vec2(x2, y1), glm::vec2(u2, v1));
 
-				coords.emplace_back(glm::vec2(x2, y1), glm::vec2(u2, v1));
-				coords.emplace_back(glm::vec2(x1, y2), glm::vec2(u1, v2));
-				coords.emplace_back(glm::vec2(x2, y2), glm::vec2(u2, v2));
+				coords->emplace_back(glm::vec2(x2, y1), glm::vec2(u2, v1));
+				coords->emplace_back(glm::vec2(x1, y2), glm::vec2(u1, v2));
+				coords->emplace_back(glm::vec2(x2, y2), glm::vec2(u2, v2));
 				++n;
 			}
+			return has_pending;
+		}
+
+		void generateGlyphCoords(const std::string& text, const std::vector<point>& path, std::vector<font_coord>* coords) override
+		{
+			int width = 0;
+			int height = 0;
+			generateCoords(text, path, coords, &width, &height);
+		}
+
+		// text is a utf-8 string, path is expected to have at least has many data points as there
+		// are codepoints in the string. path should be in units consist with FT_Pos
+		// N.B. the origin of the Renderable object created is the baseline of the font
+		FontRenderablePtr createRenderableFromPath(FontRenderablePtr font_renderable, const std::string& text, const std::vector<point>& path) override
+		{
+			if(font_renderable == nullptr) {
+				font_renderable = std::make_shared<FontRenderable>();
+				font_renderable->setTexture(font_texture_);
+			}
+
+			int width = 0;
+			int height = 0;
+			std::vector<font_coord> coords;
+			if(generateCoords(text, path, &coords, &width, &height)) {
+				addPendingRenderable(font_renderable, text, path);
+			}
 
 			font_renderable->setWidth(width);
 			font_renderable->setHeight(height);
@@ -342,12 +523,92 @@ namespace KRE
 
 		long calculateCharAdvance(char32_t cp) override
 		{
-			FT_Error error;
-			FT_GlyphSlot slot = face_->glyph;
-			if((error = FT_Load_Char(face_, cp, font_load_flags_)) != 0) {
-				return 0;
+			const GlyphMetrics& gm = getGlyphMetrics(getCharIndex(cp));
+			return gm.valid ? gm.advance : 0;
+		}
+
+		FT_UInt getCharIndex(char32_t cp)
+		{
+			if(cp < char_index_table_size) {
+				FT_UInt& ndx = char_index_[cp];
+				if(ndx == invalid_char_index) {
+					ndx = FT_Get_Char_Index(face_, cp);
+				}
+				return ndx;
 			}
-			return slot->linearHoriAdvance;
+			auto it = char_index_map_.find(cp);
+			if(it != char_index_map_.end()) {
+				return it->second;
+			}
+			FT_UInt ndx = FT_Get_Char_Index(face_, cp);
+			char_index_map_[cp] = ndx;
+			return ndx;
+		}
+
+		// Loads the glyph outline into face_->glyph. Glyphs with no outline (bitmap fonts,
+		// CBDT/sbix color emoji) are loaded from their embedded bitmaps instead.
+		// Returns false if the glyph couldn't be loaded either way.
+		bool loadMeasureGlyph(FT_UInt glyph_index, bool* scalable=nullptr)
+		{
+			if(FT_Load_Glyph(face_, glyph_index, measure_load_flags_) == 0) {
+				if(scalable != nullptr) {
+					*scalable = true;
+				}
+				return true;
+			}
+			if(scalable != nullptr) {
+				*scalable = false;
+			}
+			return FT_Load_Glyph(face_, glyph_index, FT_LOAD_DEFAULT | FT_LOAD_COLOR) == 0;
+		}
+
+		// Loads the glyph metrics (no bitmap is rendered) the first time they are asked for.
+		const GlyphMetrics& getGlyphMetrics(FT_UInt glyph_index)
+		{
+			ASSERT_LOG(glyph_index < glyph_metrics_.size(), "Glyph index out of range: " << glyph_index);
+			GlyphMetrics& gm = glyph_metrics_[glyph_index];
+			if(!gm.loaded) {
+				gm.loaded = true;
+				bool scalable = true;
+				if(loadMeasureGlyph(glyph_index, &scalable)) {
+					FT_GlyphSlot slot = face_->glyph;
+					gm.valid = true;
+					// linearHoriAdvance is only set for scalable glyphs, convert the
+					// bitmap's 26.6 advance to 16.16 otherwise.
+					gm.advance = scalable ? slot->linearHoriAdvance : slot->advance.x << 10;
+					gm.width = slot->metrics.width;
+					gm.height = slot->metrics.height;
+				}
+			}
+			return gm;
+		}
+
+		FT_Pos getKerning(FT_UInt left, FT_UInt right, FT_Kerning_Mode mode)
+		{
+			// Most kerned text uses the low glyph indices, which get a flat table
+			// per kerning mode, allocated the first time the mode is used.
+			if(left < kerning_table_size && right < kerning_table_size && mode < kerning_modes) {
+				std::vector<int32_t>& table = kerning_table_[mode];
+				if(table.empty()) {
+					table.resize(kerning_table_size * kerning_table_size, invalid_kerning);
+				}
+				int32_t& kern = table[left * kerning_table_size + right];
+				if(kern == invalid_kerning) {
+					FT_Vector delta = { 0, 0 };
+					FT_Get_Kerning(face_, left, right, mode, &delta);
+					kern = static_cast<int32_t>(delta.x);
+				}
+				return kern;
+			}
+			const uint64_t key = (static_cast<uint64_t>(mode) << 62) | (static_cast<uint64_t>(left) << 31) | right;
+			auto it = kerning_cache_.find(key);
+			if(it != kerning_cache_.end()) {
+				return it->second;
+			}
+			FT_Vector delta = { 0, 0 };
+			FT_Get_Kerning(face_, left, right, mode, &delta);
+			kerning_cache_[key] = delta.x;
+			return delta.x;
 		}
 
 		// Adds all the glyphs in the font to the texture.
@@ -378,72 +639,64 @@ namespace KRE
 				font_texture_->setUnpackAlignment(0, 1);
 				next_font_x_ = next_font_y_ = 0;
 			}
-			FT_Error error;
-			FT_GlyphSlot slot = face_->glyph;
-			// use a simple packing algorithm.
 			for(auto& cp : glyphs) {
 				if(glyph_info_.find(cp) != glyph_info_.end()) {
 					continue;
 				}
-				if((error = FT_Load_Char(face_, cp, font_load_flags_/*&~FT_LOAD_RENDER*/)) != 0) {
-					LOG_ERROR("Font '" << fnt_ << "' does not contain glyph for: " << utils::codepoint_to_utf8(cp));
-					continue;
-				}
-				//FT_Outline_Transform(&slot->outline, &shear);
-				//FT_Render_Glyph(slot, FT_RENDER_MODE_NORMAL);
-				if(slot->bitmap.buffer == nullptr) {
-					continue;
+				RasterizedGlyph rg;
+				if(rasterize_glyph(face_, cp, font_load_flags_, &rg)) {
+					placeGlyph(rg);
 				}
+			}
+		}
 
-				GlyphInfo& gi = glyph_info_[cp];
-				gi.width = static_cast<unsigned short>(slot->metrics.width/64);
-				gi.height = static_cast<unsigned short>(slot->metrics.height/64);
-				gi.advance_x = slot->linearHoriAdvance;
-				gi.advance_y = 0;
-				gi.bearing_x = slot->metrics.horiBearingX;
-				gi.bearing_y = slot->metrics.horiBearingY;
-				last_line_height_ = std::max(last_line_height_, gi.height);
-				if(gi.width + next_font_x_ > surface_width) {
-					next_font_x_ = 0;
-					next_font_y_ += last_line_height_;
-					ASSERT_LOG(next_font_y_ < surface_height, "This font would exceed to maximum surface size. " 
-						<< surface_width << "x" << surface_height << ", number of glyphs: " << glyph_info_.size());
+		bool commitPendingGlyphs() override
+		{
+			std::vector<RasterizedGlyph> completed;
+			std::vector<char32_t> failed;
+			{
+				std::unique_lock<std::mutex> lock(raster_state_->mutex, std::try_to_lock);
+				if(!lock.owns_lock() || (raster_state_->completed.empty() && raster_state_->failed.empty())) {
+					return false;
 				}
-				gi.tex_x = next_font_x_;
-				gi.tex_y = next_font_y_;
-
-				switch(slot->bitmap.pixel_mode) {
-					case FT_PIXEL_MODE_MONO: {
-						const int pixel_count = slot->bitmap.pitch * slot->bitmap.rows;
-						std::vector<uint8_t> pixels(pixel_count, 0);
-						for(int n = 0; n != pixel_count; n += 8) {
-							pixels[n+0] = (slot->bitmap.buffer[n] & 128) ? 255 : 0;
-							pixels[n+1] = (slot->bitmap.buffer[n] &  64) ? 255 : 0;
-							pixels[n+2] = (slot->bitmap.buffer[n] &  32) ? 255 : 0;
-							pixels[n+3] = (slot->bitmap.buffer[n] &  16) ? 255 : 0;
-							pixels[n+4] = (slot->bitmap.buffer[n] &   8) ? 255 : 0;
-							pixels[n+5] = (slot->bitmap.buffer[n] &   4) ? 255 : 0;
-							pixels[n+6] = (slot->bitmap.buffer[n] &   2) ? 255 : 0;
-							pixels[n+7] = (slot->bitmap.buffer[n] &   1) ? 255 : 0;
-						}
-						font_texture_->update2D(0, next_font_x_, next_font_y_, gi.width, gi.height, slot->bitmap.pitch, &pixels[0]);
-						break;
-					}
-					case FT_PIXEL_MODE_GRAY:
-						font_texture_->update2D(0, next_font_x_, next_font_y_, gi.width, gi.height, slot->bitmap.pitch, slot->bitmap.buffer);
-						break;
-					case FT_PIXEL_MODE_LCD:
-					case FT_PIXEL_MODE_GRAY2:
-					case FT_PIXEL_MODE_GRAY4:
-					case FT_PIXEL_MODE_LCD_V:
-					/* case FT_PIXEL_MODE_BGRA: */
-					default:
-						ASSERT_LOG(false, "Unhandled font pixel mode: " << slot->bitmap.pixel_mode);
-						break;
+				completed.swap(raster_state_->completed);
+				failed.swap(raster_state_->failed);
+			}
+			for(auto cp : failed) {
+				// these will be drawn with the replacement character from now on.
+				pending_glyphs_.erase(cp);
+				missing_glyphs_.insert(cp);
+			}
+			for(auto& rg : completed) {
+				pending_glyphs_.erase(rg.cp);
+				if(glyph_info_.find(rg.cp) == glyph_info_.end()) {
+					placeGlyph(rg);
 				}
-				next_font_x_ += gi.width;
 			}
+			refreshPendingRenderables();
+			return true;
 		}
+
+		// Copies a rasterized glyph into the texture using a simple packing algorithm.
+		void placeGlyph(const RasterizedGlyph& rg)
+		{
+			GlyphInfo& gi = glyph_info_[rg.cp];
+			gi = rg.gi;
+			last_line_height_ = std::max(last_line_height_, gi.height);
+			if(gi.width + next_font_x_ > surface_width) {
+				next_font_x_ = 0;
+				next_font_y_ += last_line_height_;
+				ASSERT_LOG(next_font_y_ < surface_height, "This font would exceed to maximum surface size. " 
+					<< surface_width << "x" << surface_height << ", number of glyphs: " << glyph_info_.size());
+			}
+			gi.tex_x = next_font_x_;
+			gi.tex_y = next_font_y_;
+			if(!rg.pixels.empty()) {
+				font_texture_->update2D(0, next_font_x_, next_font_y_, gi.width, gi.height, rg.pitch, rg.pixels.data());
+			}
+			next_font_x_ += gi.width;
+		}
+
 		void* getRawFontHandle() override
 		{
 			return face_;
@@ -455,6 +708,8 @@ namespace KRE
 	private:
 		FT_Face face_;
 		int font_load_flags_;
+		// flags used when we only need the glyph metrics.
+		int measure_load_flags_;
 		TexturePtr font_texture_;
 		int next_font_x_;
 		int next_font_y_;
@@ -466,6 +721,21 @@ namespace KRE
 		std::map<char32_t, GlyphInfo> glyph_info_;
 		float line_gap_;
 		int baseline_;
+		FreetypeRasterStatePtr raster_state_;
+		// glyphs queued for background rasterization.
+		std::set<char32_t> pending_glyphs_;
+		// glyphs the background rasterization couldn't render.
+		std::set<char32_t> missing_glyphs_;
+		// Measurement caches. Metrics are indexed by glyph index, character indices 
+		// for the first char_index_table_size codepoints are in a flat table.
+		std::vector<GlyphMetrics> glyph_metrics_;
+		std::vector<FT_UInt> char_index_;
+		std::unordered_map<char32_t, FT_UInt> char_index_map_;
+		// Kerning for glyph index pairs below kerning_table_size is in a flat table
+		// per mode, anything else goes in the map.
+		static const int kerning_modes = FT_KERNING_UNSCALED + 1;
+		std::vector<int32_t> kerning_table_[kerning_modes];
+		std::unordered_map<uint64_t, FT_Pos> kerning_cache_;
 	};
 
 
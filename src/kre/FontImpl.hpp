@@ -24,6 +24,7 @@
 #pragma once
 
 #include "FontDriver.hpp"
+#include "FontIndex.hpp"
 
 namespace KRE
 {
@@ -35,9 +36,12 @@ namespace KRE
 			  fnt_path_(fnt_path),
 			  size_(size),
 			  color_(color),
+			  weight_(400),
+			  style_(FontStyle::NORMAL),
 			  has_kerning_(false),
 			  x_height_(0),
-			  glyph_path_cache_()
+			  glyph_path_cache_(),
+			  pending_renderables_()
 		{
 		}
 		virtual ~Impl() {}
@@ -47,20 +51,82 @@ namespace KRE
 		virtual void getBoundingBox(const std::string& str, long* w, long* h) = 0;
 		virtual std::vector<unsigned> getGlyphs(const std::string& text) = 0;
 		virtual const std::vector<point>& getGlyphPath(const std::string& text) = 0;
+		// Appends the vertices for the text along the path to coords, without creating a renderable.
+		virtual void generateGlyphCoords(const std::string& text, const std::vector<point>& path, std::vector<font_coord>* coords) = 0;
 		virtual FontRenderablePtr createRenderableFromPath(FontRenderablePtr font_renderable, const std::string& text, const std::vector<point>& path) = 0;
 		virtual ColoredFontRenderablePtr createColoredRenderableFromPath(ColoredFontRenderablePtr r, const std::string& text, const std::vector<point>& path, const std::vector<KRE::Color>& colors) = 0;
 		virtual long calculateCharAdvance(char32_t cp) = 0;
 		virtual void addGlyphsToTexture(const std::vector<char32_t>& glyphs) = 0;
 		virtual void* getRawFontHandle() = 0;
 		virtual float getLineGap() const = 0;
+		// Called on the render thread to upload any glyphs that were rasterized in the
+		// background. Returns true if the font texture was changed.
+		virtual bool commitPendingGlyphs() { return false; }
+		// The CSS weight and style the font was asked for, used when picking fallback fonts.
+		void setStyle(int weight, FontStyle style) { weight_ = weight; style_ = style; }
 	protected:
+		// Path of the closest indexed system font with a glyph for cp, for codepoints 
+		// this font doesn't have. Empty if there is no such font.
+		std::string findFallbackFont(char32_t cp) const
+		{
+			const FontIndexEntry* fe = FontIndex::getInstance().findFallback(cp, weight_, style_);
+			return fe != nullptr && fe->path != fnt_path_ ? fe->path : std::string();
+		}
+
+		// A renderable that was created while some of its glyphs were still being
+		// rasterized, it gets rebuilt once the glyphs have been committed. Only one of
+		// renderable and colored is set.
+		struct PendingRenderable
+		{
+			PendingRenderable(const FontRenderablePtr& r, const std::string& t, const std::vector<point>& p)
+				: renderable(r), colored(), text(t), path(p), colors(), width(r->getWidth()), height(r->getHeight()) {}
+			PendingRenderable(const ColoredFontRenderablePtr& r, const std::string& t, const std::vector<point>& p, const std::vector<Color>& c)
+				: renderable(), colored(r), text(t), path(p), colors(c), width(r->getWidth()), height(r->getHeight()) {}
+			std::weak_ptr<FontRenderable> renderable;
+			std::weak_ptr<ColoredFontRenderable> colored;
+			std::string text;
+			std::vector<point> path;
+			std::vector<Color> colors;
+			int width;
+			int height;
+		};
+		void addPendingRenderable(const FontRenderablePtr& r, const std::string& text, const std::vector<point>& path)
+		{
+			pending_renderables_.emplace_back(r, text, path);
+		}
+		void addPendingRenderable(const ColoredFontRenderablePtr& r, const std::string& text, const std::vector<point>& path, const std::vector<Color>& colors)
+		{
+			pending_renderables_.emplace_back(r, text, path, colors);
+		}
+		void refreshPendingRenderables()
+		{
+			std::vector<PendingRenderable> pending;
+			pending.swap(pending_renderables_);
+			for(auto& pr : pending) {
+				if(auto r = pr.renderable.lock()) {
+					r->clear();
+					r->setWidth(pr.width);
+					r->setHeight(pr.height);
+					createRenderableFromPath(r, pr.text, pr.path);
+				} else if(auto r = pr.colored.lock()) {
+					r->clear();
+					r->setWidth(pr.width);
+					r->setHeight(pr.height);
+					createColoredRenderableFromPath(r, pr.text, pr.path, pr.colors);
+				}
+			}
+		}
+
 		std::string fnt_;
 		std::string fnt_path_;
 		float size_;
 		Color color_;
+		int weight_;
+		FontStyle style_;
 		bool has_kerning_;
 		float x_height_;
 		std::map<std::string, std::vector<point>> glyph_path_cache_;
+		std::vector<PendingRenderable> pending_renderables_;
 		friend class FontHandle;
 	};
 }
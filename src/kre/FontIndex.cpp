@@ -0,0 +1,525 @@
+/*
+	Copyright (C) 2016 by Kristina Simpson <sweet.kristas@gmail.com>
+	
+	This software is provided 'as-is', without any express or implied
+	warranty. In no event will the authors be held liable for any damages
+	arising from the use of this software.
+
+	Permission is granted to anyone to use this software for any purpose,
+	including commercial applications, and to alter it and redistribute it
+	freely, subject to the following restrictions:
+
+	   1. The origin of this software must not be misrepresented; you must not
+	   claim that you wrote the original software. If you use this software
+	   in a product, an acknowledgment in the product documentation would be
+	   appreciated but is not required.
+
+	   2. Altered source versions must be plainly marked as such, and must not be
+	   misrepresented as being the original software.
+
+	   3. This notice may not be removed or altered from any source
+	   distribution.
+*/
+
+#include <algorithm>
+#include <cctype>
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+
+#include <boost/filesystem.hpp>
+
+#if defined(USE_FONTCONFIG)
+#include <fontconfig/fontconfig.h>
+#endif
+
+#include "asserts.hpp"
+#include "unit_test.hpp"
+
+#include "FontIndex.hpp"
+
+namespace KRE
+{
+	namespace
+	{
+		const std::string cache_header = "xhtml-font-index 1";
+
+		std::string to_lower(const std::string& s)
+		{
+			std::string res(s);
+			std::transform(res.begin(), res.end(), res.begin(), [](char c) { return static_cast<char>(std::tolower(static_cast<unsigned char>(c))); });
+			return res;
+		}
+
+		long long get_modified_time(const std::string& dir)
+		{
+			boost::system::error_code ec;
+			const std::time_t t = boost::filesystem::last_write_time(dir, ec);
+			return ec ? -1 : static_cast<long long>(t);
+		}
+
+		// Penalty for using a font with the given weight and style in place of the requested
+		// one. Style mismatches are worse than any weight mismatch, italic and oblique are 
+		// allowed to stand in for each other.
+		int match_distance(const FontIndexEntry& fe, int weight, FontStyle style)
+		{
+			int res = std::abs(fe.weight - weight);
+			if(fe.style != style) {
+				res += style == FontStyle::NORMAL || fe.style == FontStyle::NORMAL ? 2000 : 1000;
+			}
+			return res;
+		}
+
+		const char* const generic_families[] = { "serif", "sans-serif", "monospace", "cursive", "fantasy" };
+
+#if defined(USE_FONTCONFIG)
+		int fc_weight_to_css(int w)
+		{
+			if(w <= FC_WEIGHT_THIN) { return 100; }
+			if(w <= FC_WEIGHT_EXTRALIGHT) { return 200; }
+			if(w < FC_WEIGHT_BOOK) { return 300; }
+			if(w <= FC_WEIGHT_REGULAR) { return 400; }
+			if(w <= FC_WEIGHT_MEDIUM) { return 500; }
+			if(w <= FC_WEIGHT_DEMIBOLD) { return 600; }
+			if(w <= FC_WEIGHT_BOLD) { return 700; }
+			if(w <= FC_WEIGHT_EXTRABOLD) { return 800; }
+			return 900;
+		}
+
+		void read_coverage(FcCharSet* cs, std::vector<std::pair<char32_t, char32_t>>* coverage)
+		{
+			FcChar32 map[FC_CHARSET_MAP_SIZE];
+			FcChar32 next;
+			for(FcChar32 base = FcCharSetFirstPage(cs, map, &next); base != FC_CHARSET_DONE; base = FcCharSetNextPage(cs, map, &next)) {
+				for(int n = 0; n != FC_CHARSET_MAP_SIZE; ++n) {
+					for(FcChar32 bits = map[n], bit = 0; bits != 0; bits >>= 1, ++bit) {
+						if((bits & 1) == 0) {
+							continue;
+						}
+						const char32_t cp = base + n * 32 + bit;
+						if(!coverage->empty() && coverage->back().second + 1 == cp) {
+							coverage->back().second = cp;
+						} else {
+							coverage->emplace_back(cp, cp);
+						}
+					}
+				}
+			}
+		}
+#endif
+	}
+
+	bool FontIndexEntry::hasCodepoint(char32_t cp) const
+	{
+		auto it = std::upper_bound(coverage.begin(), coverage.end(), cp, [](char32_t c, const std::pair<char32_t, char32_t>& range) {
+			return c < range.first;
+		});
+		return it != coverage.begin() && cp <= (it-1)->second;
+	}
+
+	FontIndex::FontIndex()
+		: fonts_(),
+		  font_dirs_(),
+		  aliases_(),
+		  families_(),
+		  fallback_cache_()
+	{
+	}
+
+	FontIndex& FontIndex::getInstance()
+	{
+		static FontIndex res;
+		return res;
+	}
+
+	void FontIndex::load(const std::string& cache_file)
+	{
+		if(!cache_file.empty() && readCache(cache_file) && !fontDirsChanged()) {
+			LOG_INFO("Read " << fonts_.size() << " fonts from the font index cache: " << cache_file);
+			return;
+		}
+
+		enumerateSystemFonts();
+		buildFamilyMap();
+		LOG_INFO("Indexed " << fonts_.size() << " system fonts");
+		if(!cache_file.empty()) {
+			writeCache(cache_file);
+		}
+	}
+
+	bool FontIndex::fontDirsChanged() const
+	{
+		for(auto& dir : font_dirs_) {
+			if(get_modified_time(dir.first) != dir.second) {
+				LOG_INFO("Font directory changed, rebuilding font index: " << dir.first);
+				return true;
+			}
+		}
+		return false;
+	}
+
+	void FontIndex::buildFamilyMap()
+	{
+		families_.clear();
+		fallback_cache_.clear();
+		for(int n = 0; n != static_cast<int>(fonts_.size()); ++n) {
+			for(auto& family : fonts_[n].families) {
+				families_[to_lower(family)].emplace_back(n);
+			}
+		}
+	}
+
+	const FontIndexEntry* FontIndex::bestMatch(const std::vector<int>& candidates, int weight, FontStyle style, char32_t cp) const
+	{
+		const FontIndexEntry* res = nullptr;
+		int best_distance = 0;
+		for(int n : candidates) {
+			const FontIndexEntry& fe = fonts_[n];
+			if(cp != 0 && !fe.hasCodepoint(cp)) {
+				continue;
+			}
+			const int distance = match_distance(fe, weight, style);
+			if(res == nullptr || distance < best_distance) {
+				res = &fe;
+				best_distance = distance;
+			}
+		}
+		return res;
+	}
+
+	const FontIndexEntry* FontIndex::find(const std::string& family, int weight, FontStyle style, char32_t cp) const
+	{
+		std::string name = to_lower(family);
+		auto ait = aliases_.find(name);
+		if(ait != aliases_.end()) {
+			name = to_lower(ait->second);
+		}
+		auto it = families_.find(name);
+		if(it == families_.end()) {
+			return nullptr;
+		}
+		return bestMatch(it->second, weight, style, cp);
+	}
+
+	const FontIndexEntry* FontIndex::findFallback(char32_t cp, int weight, FontStyle style) const
+	{
+		const unsigned long long key = (static_cast<unsigned long long>(cp) << 16) | (weight << 2) | static_cast<int>(style);
+		auto it = fallback_cache_.find(key);
+		if(it != fallback_cache_.end()) {
+			return it->second < 0 ? nullptr : &fonts_[it->second];
+		}
+
+		std::vector<int> all(fonts_.size());
+		for(int n = 0; n != static_cast<int>(fonts_.size()); ++n) {
+			all[n] = n;
+		}
+		const FontIndexEntry* fe = bestMatch(all, weight, style, cp);
+		fallback_cache_[key] = fe == nullptr ? -1 : static_cast<int>(fe - fonts_.data());
+		return fe;
+	}
+
+	void FontIndex::getFilePaths(std::map<std::string, std::string>* res) const
+	{
+		for(auto& fe : fonts_) {
+			res->emplace(boost::filesystem::path(fe.path).filename().string(), fe.path);
+		}
+	}
+
+	// The cache is a line based text file:
+	//   D <mtime> <directory>
+	//   A <generic family> <family>
+	//   F <weight> <style> <path>
+	//   N <family name>, one or more for the preceding F.
+	//   C <first>-<last> ..., hex codepoint ranges for the preceding F.
+	bool FontIndex::readCache(const std::string& cache_file)
+	{
+		std::ifstream file(cache_file, std::ios_base::binary);
+		if(!file.is_open()) {
+			return false;
+		}
+		std::string line;
+		if(!std::getline(file, line) || line != cache_header) {
+			LOG_INFO("Ignoring font index cache with unknown version: " << cache_file);
+			return false;
+		}
+
+		fonts_.clear();
+		font_dirs_.clear();
+		aliases_.clear();
+		while(std::getline(file, line)) {
+			if(line.size() < 2) {
+				continue;
+			}
+			std::istringstream ss(line.substr(2));
+			switch(line[0]) {
+				case 'D': {
+					long long mtime = 0;
+					ss >> mtime;
+					std::string dir;
+					std::getline(ss >> std::ws, dir);
+					font_dirs_[dir] = mtime;
+					break;
+				}
+				case 'A': {
+					std::string generic, family;
+					ss >> generic;
+					std::getline(ss >> std::ws, family);
+					aliases_[generic] = family;
+					break;
+				}
+				case 'F': {
+					fonts_.emplace_back();
+					int style = 0;
+					ss >> fonts_.back().weight >> style;
+					fonts_.back().style = static_cast<FontStyle>(style);
+					std::getline(ss >> std::ws, fonts_.back().path);
+					break;
+				}
+				case 'N':
+					if(fonts_.empty()) {
+						return false;
+					}
+					fonts_.back().families.emplace_back(line.substr(2));
+					break;
+				case 'C': {
+					if(fonts_.empty()) {
+						return false;
+					}
+					auto& coverage = fonts_.back().coverage;
+					unsigned first = 0, last = 0;
+					char sep;
+					while(ss >> std::hex >> first >> sep >> last) {
+						coverage.emplace_back(first, last);
+					}
+					break;
+				}
+				default:
+					LOG_WARN("Bad line in font index cache: " << cache_file);
+					return false;
+			}
+		}
+		buildFamilyMap();
+		return !font_dirs_.empty();
+	}
+
+	void FontIndex::writeCache(const std::string& cache_file) const
+	{
+		boost::system::error_code ec;
+		const boost::filesystem::path p(cache_file);
+		if(p.has_parent_path()) {
+			boost::filesystem::create_directories(p.parent_path(), ec);
+		}
+		std::ofstream file(cache_file, std::ios_base::binary | std::ios_base::trunc);
+		if(!file.is_open()) {
+			LOG_WARN("Unable to write font index cache: " << cache_file);
+			return;
+		}
+
+		file << cache_header << "\n";
+		for(auto& dir : font_dirs_) {
+			file << "D " << dir.second << " " << dir.first << "\n";
+		}
+		for(auto& alias : aliases_) {
+			file << "A " << alias.first << " " << alias.second << "\n";
+		}
+		for(auto& fe : fonts_) {
+			file << "F " << fe.weight << " " << static_cast<int>(fe.style) << " " << fe.path << "\n";
+			for(auto& family : fe.families) {
+				file << "N " << family << "\n";
+			}
+			file << "C" << std::hex;
+			for(auto& range : fe.coverage) {
+				file << " " << range.first << "-" << range.second;
+			}
+			file << std::dec << "\n";
+		}
+	}
+
+	void FontIndex::enumerateSystemFonts()
+	{
+		fonts_.clear();
+		font_dirs_.clear();
+		aliases_.clear();
+#if defined(USE_FONTCONFIG)
+		FcConfig* config = FcInitLoadConfigAndFonts();
+		if(config == nullptr) {
+			LOG_WARN("Unable to initialise fontconfig, no system fonts will be available.");
+			return;
+		}
+
+		FcStrList* dirs = FcConfigGetFontDirs(config);
+		while(FcChar8* dir = FcStrListNext(dirs)) {
+			// Directories that don't exist yet are recorded too, so that creating them is noticed.
+			const std::string dir_name(reinterpret_cast<const char*>(dir));
+			font_dirs_[dir_name] = get_modified_time(dir_name);
+		}
+		FcStrListDone(dirs);
+
+		FcPattern* pattern = FcPatternCreate();
+		FcObjectSet* os = FcObjectSetBuild(FC_FAMILY, FC_FILE, FC_INDEX, FC_WEIGHT, FC_SLANT, FC_CHARSET, FC_FONTFORMAT, nullptr);
+		FcFontSet* fs = FcFontList(config, pattern, os);
+		for(int n = 0; fs != nullptr && n != fs->nfont; ++n) {
+			FcPattern* font = fs->fonts[n];
+			FcChar8* file = nullptr;
+			FcChar8* format = nullptr;
+			int index = 0;
+			if(FcPatternGetString(font, FC_FILE, 0, &file) != FcResultMatch) {
+				continue;
+			}
+			// Only scalable fonts can be loaded, and the font providers only ever use the 
+			// first face in a collection.
+			if(FcPatternGetString(font, FC_FONTFORMAT, 0, &format) != FcResultMatch
+				|| (std::string(reinterpret_cast<const char*>(format)) != "TrueType" && std::string(reinterpret_cast<const char*>(format)) != "CFF")) {
+				continue;
+			}
+			if(FcPatternGetInteger(font, FC_INDEX, 0, &index) == FcResultMatch && index != 0) {
+				continue;
+			}
+
+			FontIndexEntry fe;
+			fe.path = reinterpret_cast<const char*>(file);
+			FcChar8* family = nullptr;
+			for(int f = 0; FcPatternGetString(font, FC_FAMILY, f, &family) == FcResultMatch; ++f) {
+				fe.families.emplace_back(reinterpret_cast<const char*>(family));
+			}
+			int weight = FC_WEIGHT_REGULAR;
+			FcPatternGetInteger(font, FC_WEIGHT, 0, &weight);
+			fe.weight = fc_weight_to_css(weight);
+			int slant = FC_SLANT_ROMAN;
+			FcPatternGetInteger(font, FC_SLANT, 0, &slant);
+			fe.style = slant == FC_SLANT_ITALIC ? FontStyle::ITALIC : slant == FC_SLANT_OBLIQUE ? FontStyle::OBLIQUE : FontStyle::NORMAL;
+			FcCharSet* cs = nullptr;
+			if(FcPatternGetCharSet(font, FC_CHARSET, 0, &cs) == FcResultMatch) {
+				read_coverage(cs, &fe.coverage);
+			}
+			fonts_.emplace_back(fe);
+		}
+		if(fs != nullptr) {
+			FcFontSetDestroy(fs);
+		}
+		FcObjectSetDestroy(os);
+		FcPatternDestroy(pattern);
+
+		// Ask fontconfig what the generic families are mapped to.
+		for(auto generic : generic_families) {
+			FcPattern* pat = FcNameParse(reinterpret_cast<const FcChar8*>(generic));
+			FcConfigSubstitute(config, pat, FcMatchPattern);
+			FcDefaultSubstitute(pat);
+			FcResult result;
+			FcPattern* match = FcFontMatch(config, pat, &result);
+			FcChar8* family = nullptr;
+			if(match != nullptr && FcPatternGetString(match, FC_FAMILY, 0, &family) == FcResultMatch) {
+				aliases_[generic] = reinterpret_cast<const char*>(family);
+			}
+			if(match != nullptr) {
+				FcPatternDestroy(match);
+			}
+			FcPatternDestroy(pat);
+		}
+
+		FcConfigDestroy(config);
+#else
+		LOG_WARN("Built without fontconfig, no system fonts will be indexed.");
+#endif
+	}
+}
+
+namespace
+{
+	// A cache listing a few made up fonts, in a temporary directory which is removed afterwards.
+	struct test_font_cache
+	{
+		explicit test_font_cache(long long mtime_offset) 
+			: dir(boost::filesystem::temp_directory_path() / boost::filesystem::unique_path("xhtml-font-index-%%%%-%%%%")),
+			  cache_file((dir / "font-index.cache").string())
+		{
+			// The cache lives next to the font directory so writing it doesn't change the mtime.
+			const boost::filesystem::path font_dir = dir / "fonts";
+			boost::filesystem::create_directories(font_dir);
+			std::ofstream file(cache_file, std::ios_base::binary);
+			file << "xhtml-font-index 1\n"
+				<< "D " << (static_cast<long long>(boost::filesystem::last_write_time(font_dir)) + mtime_offset) << " " << font_dir.string() << "\n"
+				<< "A sans-serif Test Sans\n"
+				<< "F 400 0 /nonexistent/TestSans.ttf\nN Test Sans\nC 20-7e a0-ff\n"
+				<< "F 700 0 /nonexistent/TestSans-Bold.ttf\nN Test Sans\nC 20-7e\n"
+				<< "F 400 1 /nonexistent/TestSans-Italic.ttf\nN Test Sans\nC 20-7e\n"
+				<< "F 400 0 /nonexistent/TestSymbols.ttf\nN Test Symbols\nC 20-20 2190-21ff 2600-26ff\n";
+		}
+		~test_font_cache() 
+		{
+			boost::system::error_code ec;
+			boost::filesystem::remove_all(dir, ec);
+		}
+		boost::filesystem::path dir;
+		std::string cache_file;
+	};
+
+	std::string font_path(const KRE::FontIndexEntry* fe)
+	{
+		return fe != nullptr ? fe->path : std::string();
+	}
+}
+
+UNIT_TEST(font_index_cache_round_trip)
+{
+	test_font_cache tmp(0);
+	KRE::FontIndex index;
+	CHECK(index.readCache(tmp.cache_file), "Unable to read the font index cache");
+	CHECK(!index.fontDirsChanged(), "Unmodified font directory was reported as changed");
+	CHECK_EQ(index.getFonts().size(), 4U);
+
+	const std::string copy_file = (tmp.dir / "copy.cache").string();
+	index.writeCache(copy_file);
+	KRE::FontIndex copy;
+	CHECK(copy.readCache(copy_file), "Unable to read back the written font index cache");
+	CHECK(!copy.fontDirsChanged(), "Font directory times changed in the cache round trip");
+	CHECK_EQ(copy.getFonts().size(), index.getFonts().size());
+	for(size_t n = 0; n != index.getFonts().size(); ++n) {
+		const KRE::FontIndexEntry& a = index.getFonts()[n];
+		const KRE::FontIndexEntry& b = copy.getFonts()[n];
+		CHECK_EQ(a.path, b.path);
+		CHECK_EQ(a.weight, b.weight);
+		CHECK(a.style == b.style, "Font style changed in the cache round trip: " << a.path);
+		CHECK(a.families == b.families, "Font families changed in the cache round trip: " << a.path);
+		CHECK(a.coverage == b.coverage, "Font coverage changed in the cache round trip: " << a.path);
+	}
+	CHECK_EQ(font_path(copy.find("sans-serif", 700)), "/nonexistent/TestSans-Bold.ttf");
+}
+
+UNIT_TEST(font_index_stale_cache)
+{
+	test_font_cache tmp(-10);
+	KRE::FontIndex index;
+	CHECK(index.readCache(tmp.cache_file), "Unable to read the font index cache");
+	CHECK(index.fontDirsChanged(), "Modified font directory wasn't noticed");
+
+	// load() has to drop the stale entries and rewrite the cache from the system fonts.
+	index.load(tmp.cache_file);
+	for(auto& fe : index.getFonts()) {
+		CHECK(fe.path.find("/nonexistent/") != 0, "Stale font index entry was kept: " << fe.path);
+	}
+	std::ifstream file(tmp.cache_file, std::ios_base::binary);
+	const std::string contents((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+	CHECK_EQ(contents.find("/nonexistent/"), std::string::npos);
+}
+
+UNIT_TEST(font_index_fallback)
+{
+	test_font_cache tmp(0);
+	KRE::FontIndex index;
+	CHECK(index.readCache(tmp.cache_file), "Unable to read the font index cache");
+
+	CHECK_EQ(font_path(index.find("test sans", 700)), "/nonexistent/TestSans-Bold.ttf");
+	CHECK_EQ(font_path(index.find("Test Sans", 400, KRE::FontStyle::OBLIQUE)), "/nonexistent/TestSans-Italic.ttf");
+	CHECK_EQ(font_path(index.find("Test Sans", 700, KRE::FontStyle::NORMAL, 0xe9)), "/nonexistent/TestSans.ttf");
+	CHECK_EQ(font_path(index.find("Test Sans", 400, KRE::FontStyle::NORMAL, 0x2603)), "");
+
+	CHECK_EQ(font_path(index.findFallback(0x2603)), "/nonexistent/TestSymbols.ttf");
+	CHECK_EQ(font_path(index.findFallback(0x2190, 700, KRE::FontStyle::ITALIC)), "/nonexistent/TestSymbols.ttf");
+	CHECK_EQ(font_path(index.findFallback('A', 700)), "/nonexistent/TestSans-Bold.ttf");
+	CHECK_EQ(font_path(index.findFallback('A', 400, KRE::FontStyle::ITALIC)), "/nonexistent/TestSans-Italic.ttf");
+	CHECK_EQ(font_path(index.findFallback(0x4e00)), "");
+	// Second lookups come from the fallback cache.
+	CHECK_EQ(font_path(index.findFallback(0x4e00)), "");
+	CHECK_EQ(font_path(index.findFallback(0x2603)), "/nonexistent/TestSymbols.ttf");
+}
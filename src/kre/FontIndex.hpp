@@ -0,0 +1,98 @@
+/*
+	Copyright (C) 2016 by Kristina Simpson <sweet.kristas@gmail.com>
+	
+	This software is provided 'as-is', without any express or implied
+	warranty. In no event will the authors be held liable for any damages
+	arising from the use of this software.
+
+	Permission is granted to anyone to use this software for any purpose,
+	including commercial applications, and to alter it and redistribute it
+	freely, subject to the following restrictions:
+
+	   1. The origin of this software must not be misrepresented; you must not
+	   claim that you wrote the original software. If you use this software
+	   in a product, an acknowledgment in the product documentation would be
+	   appreciated but is not required.
+
+	   2. Altered source versions must be plainly marked as such, and must not be
+	   misrepresented as being the original software.
+
+	   3. This notice may not be removed or altered from any source
+	   distribution.
+*/
+
+#pragma once
+
+#include <map>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace KRE
+{
+	enum class FontStyle {
+		NORMAL,
+		ITALIC,
+		OBLIQUE,
+	};
+
+	struct FontIndexEntry
+	{
+		FontIndexEntry() : families(), path(), weight(400), style(FontStyle::NORMAL), coverage() {}
+		bool hasCodepoint(char32_t cp) const;
+
+		std::vector<std::string> families;
+		std::string path;
+		// CSS weight, 100 to 900.
+		int weight;
+		FontStyle style;
+		// Sorted, non-overlapping inclusive ranges of the codepoints that have glyphs.
+		std::vector<std::pair<char32_t, char32_t>> coverage;
+	};
+
+	// Index of the fonts installed on the system. Enumerating the fonts and their coverage
+	// is slow, so the result is kept in a cache file which is only rebuilt when one of
+	// the font directories changes.
+	class FontIndex
+	{
+	public:
+		FontIndex();
+		static FontIndex& getInstance();
+
+		void load(const std::string& cache_file);
+		// Reads or writes just the cache file, load() should normally be used instead.
+		bool readCache(const std::string& cache_file);
+		void writeCache(const std::string& cache_file) const;
+		// true if any of the font directories were modified since the index was built.
+		bool fontDirsChanged() const;
+		bool empty() const { return fonts_.empty(); }
+		const std::vector<FontIndexEntry>& getFonts() const { return fonts_; }
+
+		// Finds the closest match to the family, weight and style. Generic family names 
+		// (serif, monospace, ...) are resolved to the systems preferred font. If cp is
+		// non-zero only fonts that have a glyph for it are considered.
+		const FontIndexEntry* find(const std::string& family, int weight=400, FontStyle style=FontStyle::NORMAL, char32_t cp=0) const;
+		// Finds the closest matching font, from any family, that has a glyph for cp.
+		const FontIndexEntry* findFallback(char32_t cp, int weight=400, FontStyle style=FontStyle::NORMAL) const;
+
+		// Adds file name to path mappings for all the indexed fonts, existing entries are kept.
+		void getFilePaths(std::map<std::string, std::string>* res) const;
+	private:
+		void enumerateSystemFonts();
+		void buildFamilyMap();
+		const FontIndexEntry* bestMatch(const std::vector<int>& candidates, int weight, FontStyle style, char32_t cp) const;
+
+		std::vector<FontIndexEntry> fonts_;
+		// Font directories and their modification times when the index was built.
+		std::map<std::string, long long> font_dirs_;
+		// Generic family name to the family it resolves to.
+		std::map<std::string, std::string> aliases_;
+		// Lower-cased family name to indexes into fonts_.
+		std::unordered_map<std::string, std::vector<int>> families_;
+		// (codepoint, weight, style) to the index of the fallback font, -1 if there is none.
+		mutable std::unordered_map<unsigned long long, int> fallback_cache_;
+
+		FontIndex(const FontIndex&);
+		void operator=(const FontIndex&);
+	};
+}
@@ -0,0 +1,126 @@
+/*
+	Copyright (C) 2016 by Kristina Simpson <sweet.kristas@gmail.com>
+	
+	This software is provided 'as-is', without any express or implied
+	warranty. In no event will the authors be held liable for any damages
+	arising from the use of this software.
+
+	Permission is granted to anyone to use this software for any purpose,
+	including commercial applications, and to alter it and redistribute it
+	freely, subject to the following restrictions:
+
+	   1. The origin of this software must not be misrepresented; you must not
+	   claim that you wrote the original software. If you use this software
+	   in a product, an acknowledgment in the product documentation would be
+	   appreciated but is not required.
+
+	   2. Altered source versions must be plainly marked as such, and must not be
+	   misrepresented as being the original software.
+
+	   3. This notice may not be removed or altered from any source
+	   distribution.
+*/
+
+#include "asserts.hpp"
+#include "profile_timer.hpp"
+#include "FontRasterQueue.hpp"
+
+namespace KRE
+{
+	namespace
+	{
+		bool& async_rasterization_enabled()
+		{
+			static bool res = true;
+			return res;
+		}
+	}
+
+	FontRasterQueue::FontRasterQueue()
+		: worker_(),
+		  mutex_(),
+		  job_cond_(),
+		  idle_cond_(),
+		  jobs_(),
+		  running_(true),
+		  busy_(false)
+	{
+		worker_ = std::thread(&FontRasterQueue::run, this);
+	}
+
+	FontRasterQueue::~FontRasterQueue()
+	{
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			running_ = false;
+		}
+		job_cond_.notify_all();
+		if(worker_.joinable()) {
+			worker_.join();
+		}
+	}
+
+	FontRasterQueue& FontRasterQueue::getInstance()
+	{
+		static FontRasterQueue res;
+		return res;
+	}
+
+	void FontRasterQueue::setEnabled(bool en)
+	{
+		async_rasterization_enabled() = en;
+	}
+
+	bool FontRasterQueue::isEnabled()
+	{
+		return async_rasterization_enabled();
+	}
+
+	void FontRasterQueue::queue(job_fn job)
+	{
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			jobs_.emplace_back(job);
+		}
+		job_cond_.notify_one();
+	}
+
+	void FontRasterQueue::flush()
+	{
+		std::unique_lock<std::mutex> lock(mutex_);
+		idle_cond_.wait(lock, [this]() { return jobs_.empty() && !busy_; });
+	}
+
+	int FontRasterQueue::getQueueDepth()
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		return static_cast<int>(jobs_.size()) + (busy_ ? 1 : 0);
+	}
+
+	void FontRasterQueue::run()
+	{
+		PROFILE_THREAD_NAME("font raster");
+		for(;;) {
+			job_fn job;
+			{
+				std::unique_lock<std::mutex> lock(mutex_);
+				job_cond_.wait(lock, [this]() { return !jobs_.empty() || !running_; });
+				if(!running_) {
+					return;
+				}
+				job = jobs_.front();
+				jobs_.pop_front();
+				busy_ = true;
+			}
+			{
+				PROFILE_SCOPE("rasterize glyphs");
+				job();
+			}
+			{
+				std::lock_guard<std::mutex> lock(mutex_);
+				busy_ = false;
+			}
+			idle_cond_.notify_all();
+		}
+	}
+}
@@ -0,0 +1,67 @@
+/*
+	Copyright (C) 2016 by Kristina Simpson <sweet.kristas@gmail.com>
+	
+	This software is provided 'as-is', without any express or implied
+	warranty. In no event will the authors be held liable for any damages
+	arising from the use of this software.
+
+	Permission is granted to anyone to use this software for any purpose,
+	including commercial applications, and to alter it and redistribute it
+	freely, subject to the following restrictions:
+
+	   1. The origin of this software must not be misrepresented; you must not
+	   claim that you wrote the original software. If you use this software
+	   in a product, an acknowledgment in the product documentation would be
+	   appreciated but is not required.
+
+	   2. Altered source versions must be plainly marked as such, and must not be
+	   misrepresented as being the original software.
+
+	   3. This notice may not be removed or altered from any source
+	   distribution.
+*/
+
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+namespace KRE
+{
+	// Runs glyph rasterization jobs on a single background worker thread.
+	// Jobs must not touch any GL state, the results are handed back to the
+	// render thread by the font implementations in commitPendingGlyphs().
+	class FontRasterQueue
+	{
+	public:
+		typedef std::function<void()> job_fn;
+		~FontRasterQueue();
+
+		static FontRasterQueue& getInstance();
+		// When disabled missing glyphs are rasterized synchronously.
+		static void setEnabled(bool en);
+		static bool isEnabled();
+
+		void queue(job_fn job);
+		// Blocks until all the currently queued jobs have completed.
+		void flush();
+		int getQueueDepth();
+	private:
+		FontRasterQueue();
+		void run();
+
+		std::thread worker_;
+		std::mutex mutex_;
+		std::condition_variable job_cond_;
+		std::condition_variable idle_cond_;
+		std::deque<job_fn> jobs_;
+		bool running_;
+		bool busy_;
+
+		FontRasterQueue(const FontRasterQueue&);
+		void operator=(const FontRasterQueue&);
+	};
+}
@@ -21,10 +21,16 @@
 	   distribution.
 */
 
+#include <algorithm>
+#include <mutex>
+
 #include "filesystem.hpp"
+#include "unit_test.hpp"
 
+#include "DisplayDevice.hpp"
 #include "FontDriver.hpp"
 #include "FontImpl.hpp"
+#include "FontRasterQueue.hpp"
 #include "utf8_to_codepoint.hpp"
 
 #define STBTT_STATIC
@@ -58,30 +64,99 @@ namespace KRE
 		}
 	};
 
+	// A range of glyphs that has been packed into the font atlas pixels but
+	// has not yet been committed to the font texture.
+	struct PackedRange
+	{
+		PackedRange(const UnicodeRange& r) : range(r), chars(r.size()) {}
+		UnicodeRange range;
+		std::vector<stbtt_packedchar> chars;
+	};
+
+	// Everything needed to rasterize glyphs, shared with the background rasterization
+	// jobs so that it outlives the font if a job is still in flight.
+	struct PackState
+	{
+		PackState() : pc(), pixels(), font_data(), mutex(), completed() {}
+		~PackState() 
+		{
+			stbtt_PackEnd(&pc);
+		}
+		stbtt_pack_context pc;
+		std::vector<unsigned char> pixels;
+		std::string font_data;
+		// guards pc, pixels and completed.
+		std::mutex mutex;
+		std::vector<PackedRange> completed;
+	};
+	typedef std::shared_ptr<PackState> PackStatePtr;
+
+	namespace
+	{
+		// Rasterizes the given (sorted, unique) codepoints from font_data into the pack state 
+		// pixels. Safe to call from the background rasterization thread.
+		void pack_glyphs(const PackStatePtr& state, const std::string& font_data, float font_size, const std::vector<char32_t>& codepoints)
+		{
+			std::vector<PackedRange> packed;
+			char32_t first_cp = codepoints.front();
+			char32_t last_cp = codepoints.front();
+			for(auto it = codepoints.begin() + 1; it != codepoints.end(); ++it) {
+				if(*it != last_cp + 1) {
+					packed.emplace_back(UnicodeRange(first_cp, last_cp));
+					first_cp = *it;
+				}
+				last_cp = *it;
+			}
+			packed.emplace_back(UnicodeRange(first_cp, last_cp));
+
+			std::vector<stbtt_pack_range> ranges;
+			ranges.reserve(packed.size());
+			for(auto& pr : packed) {
+				stbtt_pack_range range;
+				range.num_chars_in_range          = pr.range.size();
+				range.chardata_for_range          = pr.chars.data();
+				range.font_size                   = font_size;
+				range.first_unicode_char_in_range = pr.range.first;
+				ranges.emplace_back(range);
+			}
+
+			std::lock_guard<std::mutex> lock(state->mutex);
+			auto ttf_buffer = reinterpret_cast<const unsigned char*>(font_data.c_str());
+			stbtt_PackFontRanges(&state->pc, ttf_buffer, 0, ranges.data(), ranges.size());
+			for(auto& pr : packed) {
+				state->completed.emplace_back(std::move(pr));
+			}
+		}
+	}
+
 	class stb_impl : public FontHandle::Impl, public AlignedAllocator16
 	{
 	public:
 		stb_impl(const std::string& fnt_name, const std::string& fnt_path, float size, const Color& color, bool init_texture)
 			: FontHandle::Impl(fnt_name, fnt_path, size, color, init_texture),
 			  font_handle_(),
-			  font_data_(),
 			  ascent_(0),
 			  descent_(0),
-			  line_gap_(0),
 			  baseline_(0),
+			  bounding_height_(0),
 			  scale_(1.0f),
+			  pack_scale_(1.0f),
 			  font_size_(default_dpi * size / 72.0f),
-			  pc_(),
+			  line_gap_(0),
+			  state_(std::make_shared<PackState>()),
 			  packed_char_(),
-			  pixels_(),
+			  pending_glyphs_(),
+			  fallback_font_data_(),
 			  font_texture_()
 		{
 			// Read font data and initialise
-			font_data_ = sys::read_file(fnt_path);
-			auto ttf_buffer = reinterpret_cast<const unsigned char*>(font_data_.c_str());
+			state_->font_data = sys::read_file(fnt_path);
+			auto ttf_buffer = reinterpret_cast<const unsigned char*>(state_->font_data.c_str());
 			stbtt_InitFont(&font_handle_, ttf_buffer, 0);
 
 			scale_ = stbtt_ScaleForPixelHeight(&font_handle_, size);
+			// glyphs are packed at font_size_, so metrics for glyphs not yet packed use this scale.
+			pack_scale_ = stbtt_ScaleForPixelHeight(&font_handle_, font_size_);
 			int line_gap = 0;
 			stbtt_GetFontVMetrics(&font_handle_, &ascent_, &descent_, &line_gap);
 			baseline_ = static_cast<int>(ascent_ * scale_);
@@ -101,8 +176,11 @@ namespace KRE
 				;
 			LOG_DEBUG(debug_ss.str());
 
-			pixels_.resize(surface_width * surface_height);
-			stbtt_PackBegin(&pc_, pixels_.data(), surface_width, surface_height, 0, 1, nullptr);
+			state_->pixels.resize(surface_width * surface_height);
+			stbtt_PackBegin(&state_->pc, state_->pixels.data(), surface_width, surface_height, 0, 1, nullptr);
+			if(font_size_ < 20.0f) {
+				stbtt_PackSetOversampling(&state_->pc, 2, 2);
+			}
 			if(init_texture) {
 				font_texture_ = Texture::createTexture2D(surface_width, surface_height, PixelFormat::PF::PIXELFORMAT_R8);
 				font_texture_->setUnpackAlignment(0, 1);
@@ -122,11 +200,6 @@ namespace KRE
 			}
 		}
 
-		~stb_impl() 
-		{
-			stbtt_PackEnd(&pc_);
-		}
-
 		int getDescender() override
 		{
 			return static_cast<int>(descent_ * scale_ * 65536.0f);
@@ -148,7 +221,7 @@ namespace KRE
 			ASSERT_LOG(h != nullptr, "getBoundingBox: height was null.");
 			*w = 0;
 			*h = 0;
-			glyphTraverse(str, [w, h](stbtt_packedchar* b) {
+			glyphTraverse(str, [w, h](const stbtt_packedchar* b) {
 				auto char_width = b->x1 - b->x0;
 				auto char_height = b->y1 - b->y0;
 				*w += char_width;
@@ -161,129 +234,194 @@ namespace KRE
 		std::vector<unsigned> getGlyphs(const std::string& text) override		
 		{
 			std::vector<unsigned> res;
-			for(auto cp : utils::utf8_to_codepoint(text)) {
+			for(auto cp : utils::utf8_to_codepoints(text)) {
 				res.emplace_back(stbtt_FindGlyphIndex(&font_handle_, cp));
 			}
 			return res;
 		}
 
-
-		void glyphTraverse(const std::string& text, std::function<void(stbtt_packedchar*)> fn)
+		// Makes sure all the codepoints are either in the texture or queued for rasterization.
+		void ensureGlyphs(const std::vector<char32_t>& cp_str)
 		{
-			auto cp_str = utils::utf8_to_codepoint(text);
-
 			std::vector<char32_t> glyphs_to_add;
 			for(char32_t cp : cp_str) {
-				auto it = packed_char_.find(UnicodeRange(cp));
-				if(it == packed_char_.end()) {
+				if(packed_char_.find(UnicodeRange(cp)) == packed_char_.end() && pending_glyphs_.find(cp) == pending_glyphs_.end()) {
 					glyphs_to_add.emplace_back(cp);
 				}
 			}
-			if(!glyphs_to_add.empty()) {
+			if(glyphs_to_add.empty()) {
+				return;
+			}
+			std::sort(glyphs_to_add.begin(), glyphs_to_add.end());
+			glyphs_to_add.erase(std::unique(glyphs_to_add.begin(), glyphs_to_add.end()), glyphs_to_add.end());
+
+			if(!FontRasterQueue::isEnabled() || font_texture_ == nullptr) {
 				addGlyphsToTexture(glyphs_to_add);
+				return;
+			}
+			glyphs_to_add = addFallbackGlyphs(glyphs_to_add);
+			if(glyphs_to_add.empty()) {
+				return;
 			}
 
-			for(char32_t cp : cp_str) {
-				auto it = packed_char_.find(UnicodeRange(cp));
-				if(it == packed_char_.end()) {
-					cp = 0xfffd;
-					it = packed_char_.find(UnicodeRange(0xfffd));
-					if(it == packed_char_.end()) {
-						continue;
-					}
+			// Use the glyph metrics until the bitmaps have been rasterized.
+			for(char32_t cp : glyphs_to_add) {
+				stbtt_packedchar& b = pending_glyphs_[cp];
+				int advance = 0;
+				int bearing = 0;
+				stbtt_GetCodepointHMetrics(&font_handle_, cp, &advance, &bearing);
+				int ix0 = 0, iy0 = 0, ix1 = 0, iy1 = 0;
+				stbtt_GetCodepointBitmapBox(&font_handle_, cp, pack_scale_, pack_scale_, &ix0, &iy0, &ix1, &iy1);
+				b.x0 = b.y0 = 0;
+				b.x1 = static_cast<unsigned short>(ix1 - ix0);
+				b.y1 = static_cast<unsigned short>(iy1 - iy0);
+				b.xoff = static_cast<float>(ix0);
+				b.yoff = static_cast<float>(iy0);
+				b.xoff2 = static_cast<float>(ix1);
+				b.yoff2 = static_cast<float>(iy1);
+				b.xadvance = advance * pack_scale_;
+			}
+			auto state = state_;
+			const float font_size = font_size_;
+			FontRasterQueue::getInstance().queue([state, font_size, glyphs_to_add]() {
+				pack_glyphs(state, state->font_data, font_size, glyphs_to_add);
+			});
+		}
+
+		// Font data for a system font that has a glyph for cp, nullptr if this font has 
+		// the glyph or no indexed font does.
+		const std::string* findFallbackData(char32_t cp)
+		{
+			if(stbtt_FindGlyphIndex(&font_handle_, cp) != 0) {
+				return nullptr;
+			}
+			const std::string path = findFallbackFont(cp);
+			if(path.empty()) {
+				return nullptr;
+			}
+			auto it = fallback_font_data_.find(path);
+			if(it == fallback_font_data_.end()) {
+				std::string data = sys::file_exists(path) ? sys::read_file(path) : std::string();
+				stbtt_fontinfo info;
+				if(!data.empty() && stbtt_InitFont(&info, reinterpret_cast<const unsigned char*>(data.c_str()), 0) == 0) {
+					data.clear();
+				}
+				if(data.empty()) {
+					LOG_WARN("Unable to load fallback font: " << path);
 				}
-				
-				stbtt_packedchar* b = it->second.data() + cp - it->first.first;
-				fn(b);
+				it = fallback_font_data_.emplace(path, std::move(data)).first;
 			}
+			return it->second.empty() ? nullptr : &it->second;
 		}
 
-		const std::vector<point>& getGlyphPath(const std::string& text) override
+		// Rasterizes the (sorted, unique) codepoints this font has no glyph for from fallback
+		// fonts, straight into the texture. Returns the codepoints that are left.
+		std::vector<char32_t> addFallbackGlyphs(const std::vector<char32_t>& codepoints)
 		{
-			auto it = glyph_path_cache_.find(text);
-			if(it != glyph_path_cache_.end()) {
-				return it->second;
+			std::vector<char32_t> res;
+			std::map<const std::string*, std::vector<char32_t>> fallback_glyphs;
+			for(char32_t cp : codepoints) {
+				const std::string* font_data = findFallbackData(cp);
+				if(font_data != nullptr) {
+					fallback_glyphs[font_data].emplace_back(cp);
+				} else {
+					res.emplace_back(cp);
+				}
 			}
-			std::vector<point>& path = glyph_path_cache_[text];
+			for(auto& fg : fallback_glyphs) {
+				pack_glyphs(state_, *fg.first, font_size_, fg.second);
+			}
+			if(!fallback_glyphs.empty()) {
+				commitPackedGlyphs(true);
+			}
+			return res;
+		}
+
+		// Finds the packed data for the codepoint, falling back to the replacement character.
+		// pending is set if only the metrics of the glyph are known.
+		const stbtt_packedchar* findPackedChar(char32_t cp, bool* pending)
+		{
+			*pending = false;
+			auto it = packed_char_.find(UnicodeRange(cp));
+			if(it != packed_char_.end()) {
+				return it->second.data() + cp - it->first.first;
+			}
+			auto pit = pending_glyphs_.find(cp);
+			if(pit != pending_glyphs_.end()) {
+				*pending = true;
+				return &pit->second;
+			}
+			it = packed_char_.find(UnicodeRange(0xfffd));
+			if(it != packed_char_.end()) {
+				return it->second.data() + 0xfffd - it->first.first;
+			}
+			return nullptr;
+		}
 
-			auto cp_str = utils::utf8_to_codepoint(text);
+		void glyphTraverse(const std::string& text, std::function<void(const stbtt_packedchar*)> fn)
+		{
+			const std::vector<char32_t> cp_str = utils::utf8_to_codepoints(text);
+			ensureGlyphs(cp_str);
 
-			std::vector<char32_t> glyphs_to_add;
 			for(char32_t cp : cp_str) {
-				auto it = packed_char_.find(UnicodeRange(cp));
-				if(it == packed_char_.end()) {
-					glyphs_to_add.emplace_back(cp);
+				bool pending = false;
+				const stbtt_packedchar* b = findPackedChar(cp, &pending);
+				if(b != nullptr) {
+					fn(b);
 				}
 			}
-			if(!glyphs_to_add.empty()) {
-				addGlyphsToTexture(glyphs_to_add);
+		}
+
+		const std::vector<point>& getGlyphPath(const std::string& text) override
+		{
+			auto it = glyph_path_cache_.find(text);
+			if(it != glyph_path_cache_.end()) {
+				return it->second;
 			}
+			std::vector<point>& path = glyph_path_cache_[text];
 
 			point pen;
-			for(char32_t cp : cp_str) {
+			glyphTraverse(text, [&path, &pen](const stbtt_packedchar* b) {
 				path.emplace_back(pen);
-				auto it = packed_char_.find(UnicodeRange(cp));
-				if(it == packed_char_.end()) {
-					cp = 0xfffd;
-					it = packed_char_.find(UnicodeRange(0xfffd));
-					if(it == packed_char_.end()) {
-						continue;
-					}
-				}
-				
-				stbtt_packedchar *b = it->second.data() + cp - it->first.first;
 				pen.x += static_cast<int>(b->xadvance * 65536.0f);
-			}
+			});
 			path.emplace_back(pen);
 
 			return path;
 		}
 
-		FontRenderablePtr createRenderableFromPath(FontRenderablePtr font_renderable, const std::string& text, const std::vector<point>& path) override
-		{			
-			auto cp_string = utils::utf8_to_codepoint(text);
-			int glyphs_in_text = 0;
-			std::vector<char32_t> glyphs_to_add;
-			for(char32_t cp : cp_string) {
-				++glyphs_in_text;
-
-				auto it = packed_char_.find(UnicodeRange(cp));
-				if(it == packed_char_.end()) {
-					glyphs_to_add.emplace_back(cp);
-				}
-			}
-			if(!glyphs_to_add.empty()) {
-				addGlyphsToTexture(glyphs_to_add);
-			}
-			
-			if(font_renderable == nullptr) {
-				font_renderable = std::make_shared<FontRenderable>();
-				font_renderable->setTexture(font_texture_);
-			}
+		// Generates the quads for the glyphs in text at the positions in path. Returns the
+		// maximum glyph height, has_pending is set if any glyphs are still being rasterized.
+		// If glyphs is given the index in text of the codepoint for each quad is added to it.
+		int generateCoords(const std::string& text, const std::vector<point>& path, std::vector<font_coord>* coords, bool* has_pending, std::vector<int>* glyphs=nullptr)
+		{
+			const std::vector<char32_t> cp_string = utils::utf8_to_codepoints(text);
+			ensureGlyphs(cp_string);
 
-			int width = font_renderable->getWidth();
-			int height = font_renderable->getHeight();
 			int max_height = 0;
-
-			std::vector<font_coord> coords;
-			coords.reserve(glyphs_in_text * 6);
+			*has_pending = false;
+			coords->reserve(coords->size() + cp_string.size() * 6);
 			int n = 0;
+			int index = -1;
 			for(char32_t cp : cp_string) {
+				++index;
 				ASSERT_LOG(n < static_cast<int>(path.size()), "Insufficient points were supplied to create a path from the string '" << text << "'");
 				auto& pt =path[n];
-				auto it = packed_char_.find(UnicodeRange(cp));
-				if(it == packed_char_.end()) {
-					it = packed_char_.find(UnicodeRange(0xfffd));
-					if(it == packed_char_.end()) {
-						continue;
-					}
+				bool pending = false;
+				const stbtt_packedchar *b = findPackedChar(cp, &pending);
+				if(b == nullptr) {
+					continue;
 				}
-
-				stbtt_packedchar *b = it->second.data() + cp - it->first.first;
+				++n;
 
 				//width += pt.x >> 16;
 				//width += static_cast<int>(b->xoff2 - b->xoff);
 				max_height = std::max(max_height, static_cast<int>(b->yoff2 - b->yoff));
+				if(pending) {
+					// No quad until the glyph bitmap is in the texture.
+					*has_pending = true;
+					continue;
+				}
 
 				const float u1 = font_texture_->getTextureCoordW(0, b->x0);
 				const float v1 = font_texture_->getTextureCoordH(0, b->y0);
@@ -294,14 +432,41 @@ namespace KRE
 				const float y1 = static_cast<float>(pt.y) / 65536.0f + b->yoff;
 				const float x2 = x1 + b->xoff2 - b->xoff;
 				const float y2 = y1 + b->yoff2 - b->yoff;
-				coords.emplace_back(glm::vec2(x1, y2), glm::vec2(u1, v2));
-				coords.emplace_back(glm::vec2(x1, y1), glm::vec2(u1, v1));
-				coords.emplace_back(glm::vec2(x2, y1), glm::vec2(u2, v1));
+				coords->emplace_back(glm::vec2(x1, y2), glm::vec2(u1, v2));
+				coords->emplace_back(glm::vec2(x1, y1), glm::vec2(u1, v1));
+				coords->emplace_back(glm::vec2(x2, y1), glm::vec2(u2, v1));
+
+				coords->emplace_back(glm::vec2(x2, y1), glm::vec2(u2, v1));
+				coords->emplace_back(glm::vec2(x1, y2), glm::vec2(u1, v2));
+				coords->emplace_back(glm::vec2(x2, y2), glm::vec2(u2, v2));
+				if(glyphs != nullptr) {
+					glyphs->emplace_back(index);
+				}
+			}
+			return max_height;
+		}
 
-				coords.emplace_back(glm::vec2(x2, y1), glm::vec2(u2, v1));
-				coords.emplace_back(glm::vec2(x1, y2), glm::vec2(u1, v2));
-				coords.emplace_back(glm::vec2(x2, y2), glm::vec2(u2, v2));
-				++n;
+		void generateGlyphCoords(const std::string& text, const std::vector<point>& path, std::vector<font_coord>* coords) override
+		{
+			bool has_pending = false;
+			generateCoords(text, path, coords, &has_pending);
+		}
+
+		FontRenderablePtr createRenderableFromPath(FontRenderablePtr font_renderable, const std::string& text, const std::vector<point>& path) override
+		{			
+			if(font_renderable == nullptr) {
+				font_renderable = std::make_shared<FontRenderable>();
+				font_renderable->setTexture(font_texture_);
+			}
+
+			int width = font_renderable->getWidth();
+			int height = font_renderable->getHeight();
+
+			std::vector<font_coord> coords;
+			bool has_pending = false;
+			const int max_height = generateCoords(text, path, &coords, &has_pending);
+			if(has_pending) {
+				addPendingRenderable(font_renderable, text, path);
 			}
 			height += max_height;
 			width = std::max(width, path.back().x >> 16);
@@ -314,22 +479,7 @@ namespace KRE
 
 		ColoredFontRenderablePtr createColoredRenderableFromPath(ColoredFontRenderablePtr font_renderable, const std::string& text, const std::vector<point>& path, const std::vector<KRE::Color>& colors) override
 		{
-			auto cp_string = utils::utf8_to_codepoint(text);
-			int glyphs_in_text = 0;
-			std::vector<char32_t> glyphs_to_add;
-			for(char32_t cp : cp_string) {
-				++glyphs_in_text;
-
-				auto it = packed_char_.find(UnicodeRange(cp));
-				if(it == packed_char_.end()) {
-					glyphs_to_add.emplace_back(cp);
-				}
-			}
-			if(!glyphs_to_add.empty()) {
-				addGlyphsToTexture(glyphs_to_add);
-			}
-			ASSERT_LOG(glyphs_in_text == colors.size(), "Not enough/Too many colors for the text.");
-			
+			ASSERT_LOG(utils::utf8_to_codepoints(text).size() == colors.size(), "Not enough/Too many colors for the text.");
 			if(font_renderable == nullptr) {
 				font_renderable = std::make_shared<ColoredFontRenderable>();
 				font_renderable->setTexture(font_texture_);
@@ -337,45 +487,19 @@ namespace KRE
 
 			int width = font_renderable->getWidth();
 			int height = font_renderable->getHeight();
-			int max_height = 0;
 
 			std::vector<font_coord> coords;
-			coords.reserve(glyphs_in_text * 6);
-			int n = 0;
-			for(char32_t cp : cp_string) {
-				ASSERT_LOG(n < static_cast<int>(path.size()), "Insufficient points were supplied to create a path from the string '" << text << "'");
-				auto& pt =path[n];
-				auto it = packed_char_.find(UnicodeRange(cp));
-				if(it == packed_char_.end()) {
-					it = packed_char_.find(UnicodeRange(0xfffd));
-					if(it == packed_char_.end()) {
-						continue;
-					}
-				}
-
-				stbtt_packedchar *b = it->second.data() + cp - it->first.first;
-
-				//width += pt.x >> 16;
-				//width += static_cast<int>(b->xoff2 - b->xoff);
-				max_height = std::max(max_height, static_cast<int>(b->yoff2 - b->yoff));
-
-				const float u1 = font_texture_->getTextureCoordW(0, b->x0);
-				const float v1 = font_texture_->getTextureCoordH(0, b->y0);
-				const float u2 = font_texture_->getTextureCoordW(0, b->x1);
-				const float v2 = font_texture_->getTextureCoordH(0, b->y1);
-
-				const float x1 = static_cast<float>(pt.x) / 65536.0f + b->xoff;
-				const float y1 = static_cast<float>(pt.y) / 65536.0f + b->yoff;
-				const float x2 = x1 + b->xoff2 - b->xoff;
-				const float y2 = static_cast<float>(pt.y) / 65536.0f + b->yoff2;
-				coords.emplace_back(glm::vec2(x1, y2), glm::vec2(u1, v2));
-				coords.emplace_back(glm::vec2(x1, y1), glm::vec2(u1, v1));
-				coords.emplace_back(glm::vec2(x2, y1), glm::vec2(u2, v1));
-
-				coords.emplace_back(glm::vec2(x2, y1), glm::vec2(u2, v1));
-				coords.emplace_back(glm::vec2(x1, y2), glm::vec2(u1, v2));
-				coords.emplace_back(glm::vec2(x2, y2), glm::vec2(u2, v2));
-				++n;
+			std::vector<int> glyphs;
+			bool has_pending = false;
+			const int max_height = generateCoords(text, path, &coords, &has_pending, &glyphs);
+			if(has_pending) {
+				addPendingRenderable(font_renderable, text, path, colors);
+			}
+			// Glyphs still being rasterized have no quad, so their colors are skipped too.
+			std::vector<Color> glyph_colors;
+			glyph_colors.reserve(glyphs.size());
+			for(int n : glyphs) {
+				glyph_colors.emplace_back(colors[n]);
 			}
 			height += max_height;
 			width = std::max(width, path.back().x >> 16);
@@ -384,7 +508,7 @@ namespace KRE
 			font_renderable->setHeight(height);
 			font_renderable->update(&coords);
 			font_renderable->setVerticesPerColor(6);
-			font_renderable->updateColors(colors);
+			font_renderable->updateColors(glyph_colors);
 			return font_renderable;
 		}
 
@@ -396,6 +520,10 @@ namespace KRE
 			//return static_cast<int>(advance * scale_ * 65536.0f);
 			auto it = packed_char_.find(UnicodeRange(cp));
 			if(it == packed_char_.end()) {
+				auto pit = pending_glyphs_.find(cp);
+				if(pit != pending_glyphs_.end()) {
+					return static_cast<int>(pit->second.xadvance * 65536.0f);
+				}
 				int advance = 0;
 				int bearing = 0;
 				stbtt_GetCodepointHMetrics(&font_handle_, cp, &advance, &bearing);
@@ -405,55 +533,23 @@ namespace KRE
 			return static_cast<int>(b->xadvance * 65536.0f);
 		}
 
+		// Synchronously rasterizes the codepoints and uploads them to the texture.
 		void addGlyphsToTexture(const std::vector<char32_t>& codepoints) override
 		{
 			if(codepoints.empty()) {
 				LOG_WARN("stb_impl::addGlyphsToTexture: no codepoints.");
 				return;
 			}
-			int old_size = packed_char_.size();
-			auto ttf_buffer = reinterpret_cast<const unsigned char*>(font_data_.c_str());
-			if(font_size_ < 20.0f) {
-				stbtt_PackSetOversampling(&pc_, 2, 2);
-			}
-			
-			std::vector<stbtt_pack_range> ranges;
-			char32_t last_cp = codepoints.front();
-			char32_t first_cp = codepoints.front();
-			int num_chars = 1;
-			for(auto it = codepoints.begin() + 1; it != codepoints.end(); ++it) {
-				char32_t cp = *it;
-				if(cp == last_cp+1) {
-					++num_chars;
-				} else {
-					auto& packed_data = packed_char_[UnicodeRange(first_cp, first_cp+num_chars-1)];
-					packed_data.resize(num_chars);
-
-					stbtt_pack_range range;
-					range.num_chars_in_range          = num_chars;
-					range.chardata_for_range          = packed_data.data();
-					range.font_size                   = font_size_;
-					range.first_unicode_char_in_range = first_cp;
-					ranges.emplace_back(range);
-
-					num_chars = 1;
-					first_cp = cp;					
-				}
-				last_cp = cp;
+			const std::vector<char32_t> remaining = addFallbackGlyphs(codepoints);
+			if(!remaining.empty()) {
+				pack_glyphs(state_, state_->font_data, font_size_, remaining);
+				commitPackedGlyphs(true);
 			}
-			auto& packed_data = packed_char_[UnicodeRange(first_cp, first_cp+num_chars-1)];
-			packed_data.resize(num_chars);
-
-			stbtt_pack_range range;
-			range.num_chars_in_range          = num_chars;
-			range.chardata_for_range          = packed_data.data();
-			range.font_size                   = font_size_;
-			range.first_unicode_char_in_range = first_cp;
-			ranges.emplace_back(range);
-
-			stbtt_PackFontRanges(&pc_, ttf_buffer, 0, ranges.data(), ranges.size());
+		}
 
-			font_texture_->update2D(0, 0, 0, surface_width, surface_height, surface_width, pixels_.data());
+		bool commitPendingGlyphs() override
+		{
+			return commitPackedGlyphs(false);
 		}
 
 		void* getRawFontHandle() override
@@ -466,18 +562,54 @@ namespace KRE
 			return line_gap_;
 		}
 	private:
+		// Moves any packed glyphs into the lookup table, uploads the atlas and rebuilds the
+		// renderables waiting on them. If wait is false and the rasterization thread is busy
+		// with the pixels we try again later.
+		bool commitPackedGlyphs(bool wait)
+		{
+			std::vector<PackedRange> completed;
+			{
+				std::unique_lock<std::mutex> lock(state_->mutex, std::defer_lock);
+				if(wait) {
+					lock.lock();
+				} else if(!lock.try_lock()) {
+					return false;
+				}
+				if(state_->completed.empty()) {
+					return false;
+				}
+				completed.swap(state_->completed);
+				if(font_texture_ != nullptr) {
+					font_texture_->update2D(0, 0, 0, surface_width, surface_height, surface_width, state_->pixels.data());
+				}
+			}
+			for(auto& pr : completed) {
+				for(char32_t cp = pr.range.first; cp != pr.range.last + 1; ++cp) {
+					pending_glyphs_.erase(cp);
+				}
+				packed_char_[pr.range] = std::move(pr.chars);
+			}
+			// completed may include ranges queued asynchronously, so this is needed on the
+			// synchronous path too.
+			refreshPendingRenderables();
+			return true;
+		}
+
 		stbtt_fontinfo font_handle_;
-		std::string font_data_;
 		int ascent_;
 		int descent_;
 		int baseline_;
 		int bounding_height_;
 		float scale_;
+		float pack_scale_;
 		float font_size_;
 		float line_gap_;
-		stbtt_pack_context pc_;
+		PackStatePtr state_;
 		std::map<UnicodeRange, std::vector<stbtt_packedchar>, UnicodeRange> packed_char_;
-		std::vector<unsigned char> pixels_;
+		// glyphs queued for rasterization, only the metrics fields are valid.
+		std::map<char32_t, stbtt_packedchar> pending_glyphs_;
+		// Contents of the fallback fonts by path, empty if the font couldn't be loaded.
+		std::map<std::string, std::string> fallback_font_data_;
 		TexturePtr font_texture_;
 	};
 
@@ -485,3 +617,36 @@ namespace KRE
 		return std::unique_ptr<stb_impl>(new stb_impl(fnt_name, fnt_path, size, color, init_texture));
 	});
 }
+
+UNIT_TEST(font_async_glyphs_committed_by_sync_add)
+{
+	using namespace KRE;
+	const std::string font_path = "data/fonts/Furore.ttf";
+	if(!sys::file_exists(font_path)) {
+		return;
+	}
+	DisplayDevice::factory("null", nullptr);
+	const bool was_enabled = FontRasterQueue::isEnabled();
+	FontRasterQueue::setEnabled(true);
+
+	std::unique_ptr<stb_impl> font(new stb_impl("Furore", font_path, 16.0f, Color::colorWhite(), true));
+	// Outside the common glyphs, so these are queued on the rasterization thread.
+	const std::string text = "\xd0\x90\xd0\x91";
+	const std::vector<point>& path = font->getGlyphPath(text);
+	FontRenderablePtr r = font->createRenderableFromPath(nullptr, text, path);
+	CHECK(!r->hasLocalBounds(), "renderable has quads for glyphs still being rasterized");
+
+	// Colored renderables don't wait for the glyphs either, they are rebuilt along with r.
+	const std::vector<Color> colors(2, Color::colorRed());
+	ColoredFontRenderablePtr cr = font->createColoredRenderableFromPath(nullptr, text, path, colors);
+	CHECK(!cr->hasLocalBounds(), "colored renderable has quads for glyphs still being rasterized");
+
+	// A synchronous add commits the finished async range as well, which must rebuild r.
+	FontRasterQueue::getInstance().flush();
+	font->addGlyphsToTexture(std::vector<char32_t>(1, 0x416));
+	CHECK(r->hasLocalBounds(), "renderable wasn't rebuilt when the glyphs were committed");
+	CHECK(cr->hasLocalBounds(), "colored renderable wasn't rebuilt when the glyphs were committed");
+	CHECK(!font->commitPendingGlyphs(), "glyphs committed twice");
+
+	FontRasterQueue::setEnabled(was_enabled);
+}
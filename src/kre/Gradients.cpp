@@ -21,7 +21,17 @@
 	   distribution.
 */
 
+#include <algorithm>
+#include <cmath>
+#include <tuple>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define GRADIENT_SSE2
+#include <emmintrin.h>
+#endif
+
 #include "asserts.hpp"
+#include "unit_test.hpp"
 
 #include "AttributeSet.hpp"
 #include "CameraObject.hpp"
@@ -31,6 +41,7 @@
 #include "SceneObject.hpp"
 #include "Shaders.hpp"
 #include "StencilSettings.hpp"
+#include "Texture.hpp"
 #include "WindowManager.hpp"
 
 namespace KRE
@@ -90,6 +101,89 @@ namespace KRE
 			std::shared_ptr<KRE::Attribute<KRE::vertex_color>> attribs_;
 		};
 		typedef std::shared_ptr<GradientRenderable> GradientRenderablePtr;
+
+		// Largest number of entries in a color ramp, longer gradient lines share entries between pixels.
+		const int max_ramp_size = 4096;
+
+		// angle, width, height and the stops as (RGBA, length).
+		typedef std::tuple<float, int, int, std::vector<std::pair<uint32_t, float>>> GradientKey;
+		typedef LruCache<GradientKey, Texture> GradientCache;
+		GradientCache& get_gradient_cache()
+		{
+			// Never destroyed, the textures can't be released once the display device has gone.
+			static GradientCache* res = new GradientCache(16 * 1024 * 1024);
+			return *res;
+		}
+
+		// Samples the stops at count evenly spaced points along the gradient line.
+		std::vector<PixelRGBA> build_color_ramp(const std::vector<ColorStop>& stops, int count)
+		{
+			// Colors are interpolated premultiplied, so transparent stops don't darken their neighbours.
+			std::vector<glm::vec4> colors;
+			std::vector<float> lengths;
+			for(auto& cs : stops) {
+				const float a = cs.color.a();
+				colors.emplace_back(cs.color.r() * a, cs.color.g() * a, cs.color.b() * a, a);
+				// A stop before the previous one is moved up to it.
+				lengths.emplace_back(lengths.empty() ? cs.length : std::max(cs.length, lengths.back()));
+			}
+
+			std::vector<PixelRGBA> ramp(count);
+			size_t seg = 0;
+			for(int n = 0; n != count; ++n) {
+				const float t = static_cast<float>(n) / static_cast<float>(count - 1);
+				while(seg < lengths.size() && lengths[seg] <= t) {
+					++seg;
+				}
+				glm::vec4 c;
+				if(seg == 0) {
+					c = colors.front();
+				} else if(seg == lengths.size()) {
+					c = colors.back();
+				} else {
+					const float f = (t - lengths[seg - 1]) / (lengths[seg] - lengths[seg - 1]);
+					c = colors[seg - 1] + (colors[seg] - colors[seg - 1]) * f;
+				}
+				const float inv_a = c.a > 0.0f ? 255.0f / c.a : 0.0f;
+				ramp[n].r = static_cast<uint8_t>(std::min(c.r * inv_a + 0.5f, 255.0f));
+				ramp[n].g = static_cast<uint8_t>(std::min(c.g * inv_a + 0.5f, 255.0f));
+				ramp[n].b = static_cast<uint8_t>(std::min(c.b * inv_a + 0.5f, 255.0f));
+				ramp[n].a = static_cast<uint8_t>(std::min(c.a * 255.0f + 0.5f, 255.0f));
+			}
+			return ramp;
+		}
+
+		// Writes count pixels whose positions in the ramp start at pos and advance by step.
+		void fill_row(const PixelRGBA* ramp, int ramp_max, float pos, float step, int count, PixelRGBA* out)
+		{
+			if(step == 0.0f) {
+				std::fill(out, out + count, ramp[std::min(std::max(static_cast<int>(pos + 0.5f), 0), ramp_max)]);
+				return;
+			}
+			int x = 0;
+#if defined(GRADIENT_SSE2)
+			const __m128 steps = _mm_setr_ps(0.0f, step, step * 2.0f, step * 3.0f);
+			const __m128 start = _mm_add_ps(_mm_set1_ps(pos + 0.5f), steps);
+			const __m128 step4 = _mm_set1_ps(step * 4.0f);
+			const __m128 lo = _mm_setzero_ps();
+			const __m128 hi = _mm_set1_ps(static_cast<float>(ramp_max));
+			__m128 offs = _mm_setzero_ps();
+			int32_t index[4];
+			for(; x + 4 <= count; x += 4) {
+				const __m128 p = _mm_add_ps(start, offs);
+				_mm_storeu_si128(reinterpret_cast<__m128i*>(index), _mm_cvttps_epi32(_mm_min_ps(_mm_max_ps(p, lo), hi)));
+				out[x + 0] = ramp[index[0]];
+				out[x + 1] = ramp[index[1]];
+				out[x + 2] = ramp[index[2]];
+				out[x + 3] = ramp[index[3]];
+				offs = _mm_add_ps(offs, step4);
+			}
+#endif
+			for(; x != count; ++x) {
+				const float p = pos + step * static_cast<float>(x) + 0.5f;
+				out[x] = ramp[std::min(std::max(static_cast<int>(p), 0), ramp_max)];
+			}
+		}
 	}
 
 	SceneObjectPtr LinearGradient::createRenderable()
@@ -131,34 +225,109 @@ namespace KRE
 		return gr;
 	}
 
-	TexturePtr LinearGradient::createAsTexture(int width, int height)
+	void LinearGradient::rasterize(int width, int height, PixelRGBA* out) const
 	{
+		ASSERT_LOG(color_stops_.size() >= 1, "Must be at least one color stop.");
+		if(width <= 0 || height <= 0) {
+			return;
+		}
+		// The gradient line goes through the centre, long enough that the corners get the end colors.
+		const float theta = angle_ / 180.0f * static_cast<float>(M_PI);
+		// Snapped so that horizontal and vertical gradients take the fast paths.
+		const float dx = std::abs(std::sin(theta)) < 1e-6f ? 0.0f : std::sin(theta);
+		const float dy = std::abs(std::cos(theta)) < 1e-6f ? 0.0f : -std::cos(theta);
 		const float w = static_cast<float>(width);
 		const float h = static_cast<float>(height);
-		
-		const float sa = std::abs(std::sin(-angle_ / 180.0f * static_cast<float>(M_PI)));
-		const float ca = std::abs(std::cos(-angle_ / 180.0f * static_cast<float>(M_PI)));
-		//const float length = std::min(ca < FLT_EPSILON ? FLT_MAX : width / ca, sa < FLT_EPSILON ? FLT_MAX : height / sa);
-		//const float length = std::min(ca < FLT_EPSILON ? w : 2.0f * ca * w, sa < FLT_EPSILON ? h : 2.0f * sa * h);
-
-		WindowPtr wnd = WindowManager::getMainWindow();
-		CameraPtr cam = std::make_shared<Camera>("ortho_lg", 0, width, 0, height);
-		auto grad = createRenderable();
-		grad->setCamera(cam);
-		grad->setScale(ca < FLT_EPSILON ? w : 2.0f * w / ca, sa < FLT_EPSILON ? h : 2.0f * h / sa);
-		grad->setPosition(w/2.0f, h/2.0f);
-
-
-		RenderTargetPtr rt = RenderTarget::create(width, height);
-		rt->getTexture()->setFiltering(-1, Texture::Filtering::LINEAR, Texture::Filtering::LINEAR, Texture::Filtering::POINT);
-		rt->getTexture()->setAddressModes(-1, Texture::AddressMode::CLAMP, Texture::AddressMode::CLAMP);
-		rt->setCentre(Blittable::Centre::TOP_LEFT);
-		rt->setClearColor(Color(0,0,0,0));
-		{
-			RenderTarget::RenderScope rs(rt, rect(0, 0, width, height));
-			grad->preRender(wnd);
-			wnd->render(grad.get());
+		const float length = std::max(std::abs(w * dx) + std::abs(h * dy), 1.0f);
+
+		// A few ramp entries per pixel keeps hard stops within a fraction of a pixel of where they should be.
+		const int ramp_size = std::min(std::max(static_cast<int>(std::ceil(length * 4.0f)) + 1, 2), max_ramp_size);
+		const auto ramp = build_color_ramp(color_stops_, ramp_size);
+		const int ramp_max = ramp_size - 1;
+		const float scale = static_cast<float>(ramp_max) / length;
+
+		// Position in the ramp is linear in x and y, so each row is a start and a step.
+		const float step = dx * scale;
+		for(int y = 0; y != height; ++y) {
+			const float py = static_cast<float>(y) + 0.5f - h / 2.0f;
+			const float pos = ((0.5f - w / 2.0f) * dx + py * dy) * scale + static_cast<float>(ramp_max) / 2.0f;
+			PixelRGBA* row = out + y * width;
+			if(y > 0 && dy == 0.0f) {
+				std::copy(row - width, row, row);
+			} else {
+				fill_row(ramp.data(), ramp_max, pos, step, width, row);
+			}
 		}
-		return rt->getTexture();
 	}
+
+	SurfacePtr LinearGradient::createAsSurface(int width, int height) const
+	{
+		if(width <= 0 || height <= 0) {
+			return nullptr;
+		}
+		std::vector<PixelRGBA> pixels(width * height);
+		rasterize(width, height, pixels.data());
+		auto surf = Surface::create(width, height, PixelFormat::PF::PIXELFORMAT_ABGR8888);
+		SurfaceLock lck(surf);
+		for(int y = 0; y != height; ++y) {
+			surf->writeRow(0, y, width, &pixels[y * width]);
+		}
+		return surf;
+	}
+
+	TexturePtr LinearGradient::createAsTexture(int width, int height)
+	{
+		if(width <= 0 || height <= 0) {
+			return nullptr;
+		}
+		std::vector<std::pair<uint32_t, float>> stops;
+		for(auto& cs : color_stops_) {
+			const auto c = cs.color.as_u8vec4();
+			stops.emplace_back((c.r << 24) | (c.g << 16) | (c.b << 8) | c.a, cs.length);
+		}
+		const GradientKey key(angle_, width, height, stops);
+		auto& cache = get_gradient_cache();
+		auto tex = cache.get(key);
+		if(tex == nullptr) {
+			tex = Texture::createTexture(createAsSurface(width, height));
+			tex->setFiltering(-1, Texture::Filtering::LINEAR, Texture::Filtering::LINEAR, Texture::Filtering::POINT);
+			tex->setAddressModes(-1, Texture::AddressMode::CLAMP, Texture::AddressMode::CLAMP);
+			cache.put(key, tex, width * height * 4);
+		}
+		// Callers may change the texture parameters, so they get their own copy.
+		return tex->clone();
+	}
+}
+
+UNIT_TEST(linear_gradient_rasterize)
+{
+	// Left to right from transparent to opaque white, the middle should be half transparent white not grey.
+	KRE::LinearGradient lg;
+	lg.setAngle(90.0f);
+	lg.addColorStop(KRE::Color(1.0f, 1.0f, 1.0f, 0.0f), 0.0f);
+	lg.addColorStop(KRE::Color(1.0f, 1.0f, 1.0f, 1.0f), 1.0f);
+	const int w = 101;
+	const int h = 3;
+	std::vector<KRE::PixelRGBA> px(w * h);
+	lg.rasterize(w, h, px.data());
+	CHECK_LE(static_cast<int>(px[0].a), 2);
+	CHECK_GE(static_cast<int>(px[w - 1].a), 253);
+	CHECK_EQ(static_cast<int>(px[w / 2].r), 255);
+	CHECK_LE(std::abs(static_cast<int>(px[w / 2].a) - 128), 2);
+	for(int x = 0; x != w; ++x) {
+		CHECK_EQ(px[x].a, px[x + 2 * w].a);
+	}
+
+	// Top to bottom with a hard stop half way.
+	KRE::LinearGradient hard;
+	hard.setAngle(180.0f);
+	hard.addColorStop(KRE::Color(1.0f, 0.0f, 0.0f), 0.0f);
+	hard.addColorStop(KRE::Color(1.0f, 0.0f, 0.0f), 0.5f);
+	hard.addColorStop(KRE::Color(0.0f, 0.0f, 1.0f), 0.5f);
+	hard.addColorStop(KRE::Color(0.0f, 0.0f, 1.0f), 1.0f);
+	std::vector<KRE::PixelRGBA> hpx(4 * 10);
+	hard.rasterize(4, 10, hpx.data());
+	CHECK_EQ(static_cast<int>(hpx[4 * 4 + 3].r), 255);
+	CHECK_EQ(static_cast<int>(hpx[4 * 5].b), 255);
+	CHECK_EQ(static_cast<int>(hpx[4 * 5].r), 0);
 }
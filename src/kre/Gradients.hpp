@@ -25,6 +25,7 @@
 
 #include "Color.hpp"
 #include "SceneObject.hpp"
+#include "Surface.hpp"
 
 namespace KRE
 {
@@ -44,7 +45,12 @@ namespace KRE
 		void setAngle(float a) { angle_ = a; }
 		void addColorStop(const KRE::Color& col, float len) { color_stops_.emplace_back(col, len); }
 		SceneObjectPtr createRenderable();
+		// Textures are rasterized on the CPU and cached by angle, stops and size.
 		TexturePtr createAsTexture(int width, int height);
+		SurfacePtr createAsSurface(int width, int height) const;
+		// Fills width * height pixels following the CSS gradient line for the angle, colors
+		// between stops are interpolated with premultiplied alpha.
+		void rasterize(int width, int height, PixelRGBA* out) const;
 	private:
 		// angle of gradient line, 0 degrees is straight up, 90 degrees is to the right.
 		float angle_;
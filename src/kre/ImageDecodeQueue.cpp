@@ -0,0 +1,315 @@
+/*
+	Copyright (C) 2016 by Kristina Simpson <sweet.kristas@gmail.com>
+	
+	This software is provided 'as-is', without any express or implied
+	warranty. In no event will the authors be held liable for any damages
+	arising from the use of this software.
+
+	Permission is granted to anyone to use this software for any purpose,
+	including commercial applications, and to alter it and redistribute it
+	freely, subject to the following restrictions:
+
+	   1. The origin of this software must not be misrepresented; you must not
+	   claim that you wrote the original software. If you use this software
+	   in a product, an acknowledgment in the product documentation would be
+	   appreciated but is not required.
+
+	   2. Altered source versions must be plainly marked as such, and must not be
+	   misrepresented as being the original software.
+
+	   3. This notice may not be removed or altered from any source
+	   distribution.
+*/
+
+#include <algorithm>
+#include <fstream>
+
+#include "asserts.hpp"
+#include "profile_timer.hpp"
+#include "unit_test.hpp"
+
+#include "ImageDecodeQueue.hpp"
+
+namespace KRE
+{
+	namespace
+	{
+		bool& async_decode_enabled()
+		{
+			static bool res = true;
+			return res;
+		}
+
+		// Decoding is mostly waiting on memory and the disk, a few threads is plenty.
+		const int max_decode_threads = 4;
+
+		// Enough of a file to get past the EXIF data in front of a JPEG frame header.
+		const size_t image_header_read_size = 128 * 1024;
+
+		SurfacePtr decode_image(const std::string& src, SurfaceFlags flags)
+		{
+			try {
+				return Surface::create(src, flags);
+			} catch(ImageLoadError&) {
+				// Surface creation has already logged the error.
+			}
+			return nullptr;
+		}
+
+		int read_be16(const unsigned char* p)
+		{
+			return (p[0] << 8) | p[1];
+		}
+	}
+
+	ImageDecodeQueue::ImageDecodeQueue()
+		: workers_(),
+		  mutex_(),
+		  job_cond_(),
+		  idle_cond_(),
+		  jobs_(),
+		  results_(),
+		  busy_(0),
+		  running_(true),
+		  stats_(),
+		  total_latency_ms_(0)
+	{
+	}
+
+	// The threads aren't started until something is queued, so none are created when
+	// decoding synchronously.
+	void ImageDecodeQueue::startWorkers()
+	{
+		const int hw_threads = static_cast<int>(std::thread::hardware_concurrency());
+		const int worker_count = std::max(1, std::min(hw_threads, max_decode_threads));
+		for(int n = 0; n != worker_count; ++n) {
+			workers_.emplace_back(&ImageDecodeQueue::run, this);
+		}
+	}
+
+	ImageDecodeQueue::~ImageDecodeQueue()
+	{
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			running_ = false;
+		}
+		job_cond_.notify_all();
+		for(auto& worker : workers_) {
+			if(worker.joinable()) {
+				worker.join();
+			}
+		}
+	}
+
+	ImageDecodeQueue& ImageDecodeQueue::getInstance()
+	{
+		static ImageDecodeQueue res;
+		return res;
+	}
+
+	void ImageDecodeQueue::setEnabled(bool en)
+	{
+		async_decode_enabled() = en;
+	}
+
+	bool ImageDecodeQueue::isEnabled()
+	{
+		return async_decode_enabled();
+	}
+
+	void ImageDecodeQueue::queue(const std::string& src, SurfaceFlags flags, done_fn done)
+	{
+		if(!isEnabled()) {
+			done(decode_image(src, flags));
+			return;
+		}
+		if(workers_.empty()) {
+			startWorkers();
+		}
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			Job job;
+			job.src = src;
+			job.flags = flags;
+			job.done = done;
+			job.queued = std::chrono::steady_clock::now();
+			jobs_.emplace_back(std::move(job));
+			++stats_.queued;
+			stats_.max_queue_depth = std::max(stats_.max_queue_depth, static_cast<int>(jobs_.size()) + busy_);
+		}
+		job_cond_.notify_one();
+	}
+
+	int ImageDecodeQueue::commit()
+	{
+		std::vector<Result> results;
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			results.swap(results_);
+		}
+		for(auto& res : results) {
+			res.done(res.surface);
+		}
+		return static_cast<int>(results.size());
+	}
+
+	void ImageDecodeQueue::flush()
+	{
+		{
+			std::unique_lock<std::mutex> lock(mutex_);
+			idle_cond_.wait(lock, [this]() { return jobs_.empty() && busy_ == 0; });
+		}
+		commit();
+	}
+
+	ImageDecodeStats ImageDecodeQueue::getStats()
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		ImageDecodeStats res = stats_;
+		res.queue_depth = static_cast<int>(jobs_.size()) + busy_;
+		const int finished = stats_.completed + stats_.failed;
+		res.average_latency_ms = finished > 0 ? total_latency_ms_ / finished : 0;
+		return res;
+	}
+
+	void ImageDecodeQueue::run()
+	{
+		PROFILE_THREAD_NAME("image decode");
+		for(;;) {
+			Job job;
+			{
+				std::unique_lock<std::mutex> lock(mutex_);
+				job_cond_.wait(lock, [this]() { return !jobs_.empty() || !running_; });
+				if(!running_) {
+					return;
+				}
+				job = std::move(jobs_.front());
+				jobs_.pop_front();
+				++busy_;
+			}
+			Result res;
+			{
+				PROFILE_SCOPE("decode image");
+				res.surface = decode_image(job.src, job.flags);
+			}
+			res.done = std::move(job.done);
+			const double latency = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - job.queued).count();
+			{
+				std::lock_guard<std::mutex> lock(mutex_);
+				--busy_;
+				if(res.surface != nullptr) {
+					++stats_.completed;
+				} else {
+					++stats_.failed;
+				}
+				total_latency_ms_ += latency;
+				stats_.max_latency_ms = std::max(stats_.max_latency_ms, latency);
+				results_.emplace_back(std::move(res));
+			}
+			idle_cond_.notify_all();
+		}
+	}
+
+	bool read_image_size(const char* data, size_t len, int* width, int* height)
+	{
+		const unsigned char* d = reinterpret_cast<const unsigned char*>(data);
+		static const unsigned char png_signature[] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n' };
+		if(len >= 24 && std::equal(png_signature, png_signature + 8, d) && std::equal(d + 12, d + 16, "IHDR")) {
+			// Width and height are the first fields of the IHDR chunk, as 32-bit big endian.
+			*width = (d[16] << 24) | (d[17] << 16) | (d[18] << 8) | d[19];
+			*height = (d[20] << 24) | (d[21] << 16) | (d[22] << 8) | d[23];
+			return *width > 0 && *height > 0;
+		}
+
+		if(len >= 10 && (std::equal(d, d + 6, "GIF87a") || std::equal(d, d + 6, "GIF89a"))) {
+			*width = d[6] | (d[7] << 8);
+			*height = d[8] | (d[9] << 8);
+			return *width > 0 && *height > 0;
+		}
+
+		if(len >= 4 && d[0] == 0xff && d[1] == 0xd8) {
+			// Walk the JPEG segments looking for a start of frame header.
+			size_t pos = 2;
+			while(pos + 4 <= len) {
+				if(d[pos] != 0xff) {
+					return false;
+				}
+				const unsigned char marker = d[pos + 1];
+				if(marker == 0xff) {
+					// fill byte
+					++pos;
+					continue;
+				}
+				pos += 2;
+				if(marker == 0x01 || (marker >= 0xd0 && marker <= 0xd8)) {
+					// markers without a length
+					continue;
+				}
+				if(marker == 0xd9 || marker == 0xda) {
+					// end of image or start of scan, without a frame header seen.
+					return false;
+				}
+				const int segment_len = read_be16(d + pos);
+				if(segment_len < 2) {
+					return false;
+				}
+				// SOF0-SOF15 except DHT, JPG and DAC.
+				if(marker >= 0xc0 && marker <= 0xcf && marker != 0xc4 && marker != 0xc8 && marker != 0xcc) {
+					if(pos + 7 > len) {
+						return false;
+					}
+					*height = read_be16(d + pos + 3);
+					*width = read_be16(d + pos + 5);
+					return *width > 0 && *height > 0;
+				}
+				pos += segment_len;
+			}
+		}
+		return false;
+	}
+
+	bool read_image_file_size(const std::string& filename, int* width, int* height)
+	{
+		std::ifstream file(filename, std::ios::binary);
+		if(!file.is_open()) {
+			return false;
+		}
+		// Most headers are in the first few bytes, JPEGs with large metadata segments may need more.
+		std::vector<char> buf(image_header_read_size);
+		file.read(buf.data(), 4096);
+		size_t len = static_cast<size_t>(file.gcount());
+		if(read_image_size(buf.data(), len, width, height)) {
+			return true;
+		}
+		if(len < 4096) {
+			return false;
+		}
+		file.read(buf.data() + len, buf.size() - len);
+		len += static_cast<size_t>(file.gcount());
+		return read_image_size(buf.data(), len, width, height);
+	}
+}
+
+UNIT_TEST(read_image_size)
+{
+	int w = 0, h = 0;
+	const unsigned char png[] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n', 0, 0, 0, 13, 'I', 'H', 'D', 'R', 0, 0, 0x01, 0x2c, 0, 0, 0, 0x64, 8, 6, 0, 0, 0 };
+	CHECK(KRE::read_image_size(reinterpret_cast<const char*>(png), sizeof(png), &w, &h), "PNG size not read");
+	CHECK_EQ(w, 300);
+	CHECK_EQ(h, 100);
+
+	const unsigned char gif[] = { 'G', 'I', 'F', '8', '9', 'a', 0x20, 0x03, 0x58, 0x02, 0xf7, 0, 0 };
+	CHECK(KRE::read_image_size(reinterpret_cast<const char*>(gif), sizeof(gif), &w, &h), "GIF size not read");
+	CHECK_EQ(w, 800);
+	CHECK_EQ(h, 600);
+
+	// SOI, an APP0 segment, a fill byte and then a baseline frame header.
+	const unsigned char jpeg[] = { 0xff, 0xd8, 0xff, 0xe0, 0, 6, 'J', 'F', 'I', 'F', 0xff, 0xff, 0xc0, 0, 17, 8, 0x01, 0xe0, 0x02, 0x80, 3 };
+	CHECK(KRE::read_image_size(reinterpret_cast<const char*>(jpeg), sizeof(jpeg), &w, &h), "JPEG size not read");
+	CHECK_EQ(w, 640);
+	CHECK_EQ(h, 480);
+
+	// Truncated before the frame header.
+	CHECK(!KRE::read_image_size(reinterpret_cast<const char*>(jpeg), 12, &w, &h), "truncated JPEG gave a size");
+	CHECK(!KRE::read_image_size("not an image", 12, &w, &h), "unknown data gave a size");
+}
@@ -0,0 +1,113 @@
+/*
+	Copyright (C) 2016 by Kristina Simpson <sweet.kristas@gmail.com>
+	
+	This software is provided 'as-is', without any express or implied
+	warranty. In no event will the authors be held liable for any damages
+	arising from the use of this software.
+
+	Permission is granted to anyone to use this software for any purpose,
+	including commercial applications, and to alter it and redistribute it
+	freely, subject to the following restrictions:
+
+	   1. The origin of this software must not be misrepresented; you must not
+	   claim that you wrote the original software. If you use this software
+	   in a product, an acknowledgment in the product documentation would be
+	   appreciated but is not required.
+
+	   2. Altered source versions must be plainly marked as such, and must not be
+	   misrepresented as being the original software.
+
+	   3. This notice may not be removed or altered from any source
+	   distribution.
+*/
+
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "Surface.hpp"
+
+namespace KRE
+{
+	struct ImageDecodeStats
+	{
+		ImageDecodeStats() : queued(0), completed(0), failed(0), queue_depth(0), max_queue_depth(0), average_latency_ms(0), max_latency_ms(0) {}
+		int queued;
+		int completed;
+		int failed;
+		// Images waiting for or being decoded.
+		int queue_depth;
+		int max_queue_depth;
+		// Time from being queued to finishing decoding.
+		double average_latency_ms;
+		double max_latency_ms;
+	};
+
+	// Decodes images on a few background threads, so that pages with a lot of images don't 
+	// stall on loading them. Completion callbacks are run on the render thread from commit(),
+	// where it's safe to create textures from the decoded surfaces.
+	class ImageDecodeQueue
+	{
+	public:
+		typedef std::function<void(const SurfacePtr&)> done_fn;
+		~ImageDecodeQueue();
+
+		static ImageDecodeQueue& getInstance();
+		// When disabled images are decoded synchronously and done is called from queue().
+		static void setEnabled(bool en);
+		static bool isEnabled();
+
+		// Decodes the image file, or the image data if flags has FROM_DATA. done is passed 
+		// nullptr if the image couldn't be decoded.
+		void queue(const std::string& src, SurfaceFlags flags, done_fn done);
+		// Runs the callbacks for images that have finished decoding, returning how many were run.
+		int commit();
+		// Waits for all queued images to be decoded then commits them.
+		void flush();
+
+		ImageDecodeStats getStats();
+	private:
+		ImageDecodeQueue();
+		void startWorkers();
+		void run();
+
+		struct Job
+		{
+			std::string src;
+			SurfaceFlags flags;
+			done_fn done;
+			std::chrono::steady_clock::time_point queued;
+		};
+		struct Result
+		{
+			done_fn done;
+			SurfacePtr surface;
+		};
+
+		std::vector<std::thread> workers_;
+		std::mutex mutex_;
+		std::condition_variable job_cond_;
+		std::condition_variable idle_cond_;
+		std::deque<Job> jobs_;
+		std::vector<Result> results_;
+		int busy_;
+		bool running_;
+		ImageDecodeStats stats_;
+		double total_latency_ms_;
+
+		ImageDecodeQueue(const ImageDecodeQueue&);
+		void operator=(const ImageDecodeQueue&);
+	};
+
+	// Reads the size of a PNG, JPEG or GIF image from its header without decoding it. Returns 
+	// false if the format isn't recognised or the size isn't in the data given.
+	bool read_image_size(const char* data, size_t len, int* width, int* height);
+	bool read_image_file_size(const std::string& filename, int* width, int* height);
+}
@@ -0,0 +1,149 @@
+/*
+	Copyright (C) 2016 by Kristina Simpson <sweet.kristas@gmail.com>
+	
+	This software is provided 'as-is', without any express or implied
+	warranty. In no event will the authors be held liable for any damages
+	arising from the use of this software.
+
+	Permission is granted to anyone to use this software for any purpose,
+	including commercial applications, and to alter it and redistribute it
+	freely, subject to the following restrictions:
+
+	   1. The origin of this software must not be misrepresented; you must not
+	   claim that you wrote the original software. If you use this software
+	   in a product, an acknowledgment in the product documentation would be
+	   appreciated but is not required.
+
+	   2. Altered source versions must be plainly marked as such, and must not be
+	   misrepresented as being the original software.
+
+	   3. This notice may not be removed or altered from any source
+	   distribution.
+*/
+
+#pragma once
+
+#include <cstddef>
+#include <list>
+#include <map>
+#include <memory>
+#include <ostream>
+#include <string>
+
+namespace KRE
+{
+	struct CacheStats
+	{
+		CacheStats() : hits(0), misses(0), evictions(0), entries(0), bytes(0), in_use_bytes(0), budget(0) {}
+		int hits;
+		int misses;
+		int evictions;
+		int entries;
+		size_t bytes;
+		// Bytes held by entries that something outside the cache still references.
+		size_t in_use_bytes;
+		size_t budget;
+	};
+
+	// Least recently used cache with a budget in bytes. Only entries that nothing outside the 
+	// cache holds a reference to are evicted, so usage can go over budget while everything in 
+	// it is in use. Not thread-safe.
+	template<typename Key, typename T>
+	class LruCache
+	{
+	public:
+		typedef std::shared_ptr<T> value_type;
+
+		explicit LruCache(size_t budget) : entries_(), index_(), bytes_(0), budget_(budget), hits_(0), misses_(0), evictions_(0) {}
+
+		// Returns nullptr if key isn't cached, otherwise makes it the most recently used entry.
+		value_type get(const Key& key) {
+			auto it = index_.find(key);
+			if(it == index_.end()) {
+				++misses_;
+				return nullptr;
+			}
+			++hits_;
+			entries_.splice(entries_.begin(), entries_, it->second);
+			return it->second->value;
+		}
+
+		void put(const Key& key, const value_type& value, size_t bytes, const std::string& label=std::string()) {
+			erase(key);
+			entries_.push_front(Entry(key, value, bytes, label));
+			index_[key] = entries_.begin();
+			bytes_ += bytes;
+			trim();
+		}
+
+		void erase(const Key& key) {
+			auto it = index_.find(key);
+			if(it != index_.end()) {
+				bytes_ -= it->second->bytes;
+				entries_.erase(it->second);
+				index_.erase(it);
+			}
+		}
+
+		void clear() {
+			entries_.clear();
+			index_.clear();
+			bytes_ = 0;
+		}
+
+		// Evicts unreferenced entries, least recently used first, until usage is within budget.
+		void trim() {
+			for(auto it = entries_.end(); it != entries_.begin() && bytes_ > budget_; ) {
+				--it;
+				if(it->value.use_count() == 1) {
+					bytes_ -= it->bytes;
+					index_.erase(it->key);
+					it = entries_.erase(it);
+					++evictions_;
+				}
+			}
+		}
+
+		void setBudget(size_t budget) { budget_ = budget; trim(); }
+		size_t getBudget() const { return budget_; }
+
+		CacheStats getStats() const {
+			CacheStats stats;
+			stats.hits = hits_;
+			stats.misses = misses_;
+			stats.evictions = evictions_;
+			stats.entries = static_cast<int>(entries_.size());
+			stats.bytes = bytes_;
+			stats.budget = budget_;
+			for(auto& e : entries_) {
+				if(e.value.use_count() > 1) {
+					stats.in_use_bytes += e.bytes;
+				}
+			}
+			return stats;
+		}
+
+		// Writes a line for each entry, most recently used first.
+		void dump(std::ostream& os) const {
+			for(auto& e : entries_) {
+				os << "  " << (e.label.empty() ? "<unnamed>" : e.label) << ": " << e.bytes << " bytes" << (e.value.use_count() > 1 ? ", in use" : "") << "\n";
+			}
+		}
+	private:
+		struct Entry
+		{
+			Entry(const Key& k, const value_type& v, size_t b, const std::string& l) : key(k), value(v), bytes(b), label(l) {}
+			Key key;
+			value_type value;
+			size_t bytes;
+			std::string label;
+		};
+		std::list<Entry> entries_;
+		std::map<Key, typename std::list<Entry>::iterator> index_;
+		size_t bytes_;
+		size_t budget_;
+		int hits_;
+		int misses_;
+		int evictions_;
+	};
+}
@@ -506,7 +506,7 @@ namespace KRE
 			auto as = DisplayDevice::createAttributeSet(true, false, false);
 			as->setDrawMode(DrawMode::TRIANGLES);
 
-			arv_ = std::make_shared<Attribute<vertex_texture_color3>>(AccessFreqHint::DYNAMIC);
+			arv_ = std::make_shared<Attribute<vertex_texture_color3>>(AccessFreqHint::STREAM);
 			arv_->addAttributeDesc(AttributeDesc(AttrType::POSITION, 3, AttrFormat::FLOAT, false, sizeof(vertex_texture_color3), offsetof(vertex_texture_color3, vertex)));
 			arv_->addAttributeDesc(AttributeDesc(AttrType::TEXTURE, 2, AttrFormat::FLOAT, false, sizeof(vertex_texture_color3), offsetof(vertex_texture_color3, texcoord)));
 			arv_->addAttributeDesc(AttributeDesc(AttrType::COLOR, 4, AttrFormat::UNSIGNED_BYTE, true, sizeof(vertex_texture_color3), offsetof(vertex_texture_color3, color)));
@@ -787,7 +787,7 @@ namespace KRE
 			auto as = DisplayDevice::createAttributeSet(true, false, false);
 			as->setDrawMode(DrawMode::LINES);
 
-			attrs_ = std::make_shared<Attribute<vertex_color3>>(AccessFreqHint::DYNAMIC);
+			attrs_ = std::make_shared<Attribute<vertex_color3>>(AccessFreqHint::STREAM);
 			attrs_->addAttributeDesc(AttributeDesc(AttrType::POSITION, 3, AttrFormat::FLOAT, false, sizeof(vertex_color3), offsetof(vertex_color3, vertex)));
 			attrs_->addAttributeDesc(AttributeDesc(AttrType::COLOR, 4, AttrFormat::UNSIGNED_BYTE, true, sizeof(vertex_color3), offsetof(vertex_color3, color)));
 
@@ -23,6 +23,7 @@
 
 #pragma once
 
+#include <array>
 #include <cstdint>
 #include "Color.hpp"
 
@@ -75,6 +76,11 @@ namespace KRE
 
 		virtual bool hasPalette() const = 0;
 
+		// For formats that store 8-bit channels in a 32-bit pixel, gets the shifts of the red, 
+		// green, blue and alpha channels, -1 for a channel that isn't present. Returns false
+		// for any other format.
+		bool getChannelShifts32(std::array<int, 4>* shifts);
+
 		enum class PF {
 			PIXELFORMAT_UNKNOWN,
 			PIXELFORMAT_INDEX1LSB,
@@ -0,0 +1,216 @@
+/*
+	Copyright (C) 2016 by Kristina Simpson <sweet.kristas@gmail.com>
+	
+	This software is provided 'as-is', without any express or implied
+	warranty. In no event will the authors be held liable for any damages
+	arising from the use of this software.
+
+	Permission is granted to anyone to use this software for any purpose,
+	including commercial applications, and to alter it and redistribute it
+	freely, subject to the following restrictions:
+
+	   1. The origin of this software must not be misrepresented; you must not
+	   claim that you wrote the original software. If you use this software
+	   in a product, an acknowledgment in the product documentation would be
+	   appreciated but is not required.
+
+	   2. Altered source versions must be plainly marked as such, and must not be
+	   misrepresented as being the original software.
+
+	   3. This notice may not be removed or altered from any source
+	   distribution.
+*/
+
+
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+
+#include <boost/filesystem.hpp>
+
+#include "asserts.hpp"
+#include "ProgramCacheOGL.hpp"
+#include "Shaders.hpp"
+
+namespace KRE
+{
+	namespace
+	{
+		const char* const cache_header = "xhtml-program-binary 1";
+
+		std::string get_gl_string(GLenum name)
+		{
+			const GLubyte* str = glGetString(name);
+			return str != nullptr ? std::string(reinterpret_cast<const char*>(str)) : std::string();
+		}
+
+		void fnv1a(unsigned long long* hash, const std::string& str)
+		{
+			for(auto c : str) {
+				*hash ^= static_cast<unsigned char>(c);
+				*hash *= 1099511628211ULL;
+			}
+			// So that parts can't run into each other.
+			*hash ^= 0xff;
+			*hash *= 1099511628211ULL;
+		}
+	}
+
+	ProgramCacheOGL::ProgramCacheOGL()
+		: probed_(false),
+		  enabled_(false),
+		  driver_()
+	{
+	}
+
+	ProgramCacheOGL& ProgramCacheOGL::getInstance()
+	{
+		static ProgramCacheOGL res;
+		return res;
+	}
+
+	void ProgramCacheOGL::reset()
+	{
+		probed_ = false;
+		enabled_ = false;
+		driver_.clear();
+	}
+
+	bool ProgramCacheOGL::isEnabled()
+	{
+		if(probed_) {
+			return enabled_;
+		}
+		probed_ = true;
+		if(ShaderProgram::getProgramCacheDir().empty()) {
+			return false;
+		}
+		if(GLEW_ARB_get_program_binary) {
+			// Some drivers have the extension but no formats to save in.
+			GLint formats = 0;
+			glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+			enabled_ = formats > 0;
+		}
+		if(!enabled_) {
+			LOG_INFO("Program binaries aren't supported, shaders will be built from source.");
+			return false;
+		}
+		driver_ = get_gl_string(GL_VENDOR) + " / " + get_gl_string(GL_RENDERER) + " / " + get_gl_string(GL_VERSION);
+		for(auto& c : driver_) {
+			if(c == '\n' || c == '\r') {
+				c = ' ';
+			}
+		}
+		return true;
+	}
+
+	std::string ProgramCacheOGL::makeKey(const std::vector<std::string>& parts)
+	{
+		unsigned long long hash = 14695981039346656037ULL;
+		fnv1a(&hash, driver_);
+		for(auto& part : parts) {
+			fnv1a(&hash, part);
+		}
+		std::ostringstream ss;
+		ss << std::hex << std::setw(16) << std::setfill('0') << hash;
+		return ss.str();
+	}
+
+	std::string ProgramCacheOGL::getPath(const std::string& key) const
+	{
+		return ShaderProgram::getProgramCacheDir() + "/" + key + ".bin";
+	}
+
+	ProgramCacheOGL::LoadResult ProgramCacheOGL::load(GLuint program, const std::string& key)
+	{
+		if(!isEnabled()) {
+			return LoadResult::MISSING;
+		}
+		const std::string path = getPath(key);
+		std::ifstream file(path, std::ios_base::binary);
+		if(!file.is_open()) {
+			return LoadResult::MISSING;
+		}
+
+		// The driver strings are checked as well as being in the key, in case of a collision.
+		std::string header, driver, stored_key;
+		if(!std::getline(file, header) || header != cache_header 
+			|| !std::getline(file, driver) || driver != driver_ 
+			|| !std::getline(file, stored_key) || stored_key != key) {
+			return LoadResult::MISSING;
+		}
+		unsigned format = 0;
+		int length = 0;
+		file >> format >> length;
+		file.get();
+		if(!file || length <= 0) {
+			return LoadResult::MISSING;
+		}
+		std::vector<char> binary(length);
+		if(!file.read(&binary[0], length)) {
+			return LoadResult::MISSING;
+		}
+		file.close();
+
+		glProgramBinary(program, static_cast<GLenum>(format), &binary[0], length);
+		GLint linked = 0;
+		glGetProgramiv(program, GL_LINK_STATUS, &linked);
+		if(!linked) {
+			// Allowed at any time, e.g. after a driver update which kept the version string.
+			LOG_INFO("Driver rejected program binary, building from source: " << path);
+			boost::system::error_code ec;
+			boost::filesystem::remove(path, ec);
+			return LoadResult::REJECTED;
+		}
+		return LoadResult::LOADED;
+	}
+
+	void ProgramCacheOGL::prepare(GLuint program)
+	{
+		if(isEnabled()) {
+			glProgramParameteri(program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+		}
+	}
+
+	void ProgramCacheOGL::store(GLuint program, const std::string& key)
+	{
+		if(!isEnabled()) {
+			return;
+		}
+		GLint length = 0;
+		glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+		if(length <= 0) {
+			return;
+		}
+		std::vector<char> binary(length);
+		GLenum format = GL_NONE;
+		glGetProgramBinary(program, length, &length, &format, &binary[0]);
+		if(length <= 0) {
+			return;
+		}
+
+		boost::system::error_code ec;
+		boost::filesystem::create_directories(ShaderProgram::getProgramCacheDir(), ec);
+		// Written aside and renamed into place, so another instance never reads half a file.
+		const std::string path = getPath(key);
+		const std::string tmp_path = path + ".tmp";
+		{
+			std::ofstream file(tmp_path, std::ios_base::binary | std::ios_base::trunc);
+			if(!file.is_open()) {
+				LOG_WARN("Unable to write program binary: " << tmp_path);
+				return;
+			}
+			file << cache_header << "\n" << driver_ << "\n" << key << "\n" << format << " " << length << "\n";
+			file.write(&binary[0], length);
+			if(!file) {
+				LOG_WARN("Unable to write program binary: " << tmp_path);
+				return;
+			}
+		}
+		boost::filesystem::rename(tmp_path, path, ec);
+		if(ec) {
+			LOG_WARN("Unable to write program binary: " << path);
+			boost::filesystem::remove(tmp_path, ec);
+		}
+	}
+}
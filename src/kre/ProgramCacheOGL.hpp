@@ -0,0 +1,70 @@
+/*
+	Copyright (C) 2016 by Kristina Simpson <sweet.kristas@gmail.com>
+	
+	This software is provided 'as-is', without any express or implied
+	warranty. In no event will the authors be held liable for any damages
+	arising from the use of this software.
+
+	Permission is granted to anyone to use this software for any purpose,
+	including commercial applications, and to alter it and redistribute it
+	freely, subject to the following restrictions:
+
+	   1. The origin of this software must not be misrepresented; you must not
+	   claim that you wrote the original software. If you use this software
+	   in a product, an acknowledgment in the product documentation would be
+	   appreciated but is not required.
+
+	   2. Altered source versions must be plainly marked as such, and must not be
+	   misrepresented as being the original software.
+
+	   3. This notice may not be removed or altered from any source
+	   distribution.
+*/
+
+
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include <GL/glew.h>
+
+namespace KRE
+{
+	// Keeps linked programs on disk as driver binaries (ARB_get_program_binary) so later runs
+	// can skip compiling and linking. Files live in ShaderProgram::getProgramCacheDir() and are
+	// named by a hash of the driver's vendor, renderer and version strings and everything the
+	// program was built from, so a new driver or a changed shader simply misses. Drivers may
+	// still refuse a binary they wrote, in which case it is deleted and the program is built
+	// from source as if there were no cache.
+	class ProgramCacheOGL
+	{
+	public:
+		static ProgramCacheOGL& getInstance();
+
+		// For a new context, support and the driver strings are looked up again on next use.
+		void reset();
+		bool isEnabled();
+
+		// Key for a program built from the given parts, i.e. its sources and pre-link settings.
+		std::string makeKey(const std::vector<std::string>& parts);
+
+		enum class LoadResult { MISSING, LOADED, REJECTED };
+		// Loads the binary stored under key into program. Unless it's LOADED, program is left
+		// unlinked to be built from source.
+		LoadResult load(GLuint program, const std::string& key);
+		// Call before linking a program that is going to be stored.
+		void prepare(GLuint program);
+		void store(GLuint program, const std::string& key);
+	private:
+		ProgramCacheOGL();
+		ProgramCacheOGL(const ProgramCacheOGL&);
+		void operator=(const ProgramCacheOGL&);
+
+		std::string getPath(const std::string& key) const;
+
+		bool probed_;
+		bool enabled_;
+		std::string driver_;
+	};
+}
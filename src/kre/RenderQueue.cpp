@@ -22,12 +22,144 @@
 */
 
 #include "asserts.hpp"
+#include "unit_test.hpp"
+#include "AttributeSet.hpp"
+#include "CameraObject.hpp"
+#include "ColorScope.hpp"
+#include "DisplayDevice.hpp"
+#include "ModelMatrixScope.hpp"
 #include "Renderable.hpp"
 #include "RenderQueue.hpp"
+#include "Texture.hpp"
 #include "WindowManager.hpp"
 
 namespace KRE
 {
+	namespace
+	{
+		// How many of the already placed draws a draw looks back through for one to join.
+		const int max_lookback = 64;
+
+		bool& get_sorting_enabled()
+		{
+			static bool res = true;
+			return res;
+		}
+
+		std::vector<RenderQueue*>& get_queue_stack()
+		{
+			static std::vector<RenderQueue*> res;
+			return res;
+		}
+
+		struct SortItem
+		{
+			SortItem() : key(0), bounds(), space(nullptr), barrier(true) {}
+			SortItem(uint64_t k, const rectf& b, const void* s) : key(k), bounds(b), space(s), barrier(false) {}
+			// Draws with the same key share shader, texture and blend state.
+			uint64_t key;
+			rectf bounds;
+			// Bounds are only comparable between draws in the same space, i.e. camera.
+			const void* space;
+			// Barriers are drawn in order and nothing is moved past them.
+			bool barrier;
+		};
+
+		bool overlaps(const rectf& a, const rectf& b)
+		{
+			return a.x1() < b.x2() && b.x1() < a.x2() && a.y1() < b.y2() && b.y1() < a.y2();
+		}
+
+		// Returns the order to draw the items in. Each item is placed straight after the last
+		// item with the same key, as long as no item between there and the end overlaps it.
+		std::vector<int> order_draws(const std::vector<SortItem>& items)
+		{
+			std::vector<int> order;
+			order.reserve(items.size());
+			for(int n = 0; n != static_cast<int>(items.size()); ++n) {
+				const SortItem& item = items[n];
+				auto insert_at = order.end();
+				if(!item.barrier) {
+					const int stop = std::max(0, static_cast<int>(order.size()) - max_lookback);
+					for(int m = static_cast<int>(order.size()) - 1; m >= stop; --m) {
+						const SortItem& placed = items[order[m]];
+						if(placed.barrier || placed.space != item.space) {
+							break;
+						}
+						if(placed.key == item.key) {
+							insert_at = order.begin() + m + 1;
+							break;
+						}
+						if(overlaps(placed.bounds, item.bounds)) {
+							break;
+						}
+					}
+				}
+				order.insert(insert_at, n);
+			}
+			return order;
+		}
+
+		uint64_t mix_key(uint64_t key, uint64_t value)
+		{
+			// FNV-1a style. A collision only costs a chance to batch, never a wrong result.
+			return (key ^ value) * 0x100000001b3ULL;
+		}
+
+		uint64_t state_key(const Renderable* r)
+		{
+			uint64_t key = 0xcbf29ce484222325ULL;
+			key = mix_key(key, reinterpret_cast<uintptr_t>(r->getShader().get()));
+			auto tex = r->getTexture();
+			key = mix_key(key, tex ? tex->id() : 0);
+			key = mix_key(key, r->isBlendStateSet() ? (r->isBlendEnabled() ? 1 : 2) : 0);
+			if(r->isBlendModeSet()) {
+				key = mix_key(key, (static_cast<uint64_t>(r->getBlendMode().src()) << 8) | static_cast<uint64_t>(r->getBlendMode().dst()));
+			}
+			if(r->isBlendEquationSet()) {
+				key = mix_key(key, (static_cast<uint64_t>(r->getBlendEquation().getRgbEquation()) << 8) | static_cast<uint64_t>(r->getBlendEquation().getAlphaEquation()));
+			}
+			key = mix_key(key, r->isDepthEnableStateSet() && r->isDepthEnabled() ? 1 : 0);
+			return key;
+		}
+
+		SortItem make_sort_item(const Renderable* r, const glm::mat4& global_model, const CameraPtr& default_cam)
+		{
+			const CameraPtr& cam = r->getCamera() ? r->getCamera() : default_cam;
+			// Overlap is tested on the x/y plane, which only holds for an orthogonal camera.
+			if(!r->hasLocalBounds() || r->hasClipSettings() || r->getRenderTarget() 
+				|| cam == nullptr || cam->getType() != Camera::CAMERA_ORTHOGONAL) {
+				return SortItem();
+			}
+
+			const glm::mat4 m = r->ignoreGlobalModelMatrix() ? r->getModelMatrix() : global_model * r->getModelMatrix();
+			const rectf& b = r->getLocalBounds();
+			const glm::vec4 corners[] = {
+				m * glm::vec4(b.x1(), b.y1(), 0.0f, 1.0f),
+				m * glm::vec4(b.x2(), b.y1(), 0.0f, 1.0f),
+				m * glm::vec4(b.x1(), b.y2(), 0.0f, 1.0f),
+				m * glm::vec4(b.x2(), b.y2(), 0.0f, 1.0f),
+			};
+			glm::vec2 lo(corners[0]);
+			glm::vec2 hi(corners[0]);
+			for(auto& c : corners) {
+				lo = glm::min(lo, glm::vec2(c));
+				hi = glm::max(hi, glm::vec2(c));
+			}
+
+			// Lines and points are drawn wider than their vertices.
+			for(auto& as : r->getAttributeSet()) {
+				const DrawMode dm = as->getDrawMode();
+				if(dm == DrawMode::POINTS || dm == DrawMode::LINES || dm == DrawMode::LINE_STRIP || dm == DrawMode::LINE_LOOP) {
+					lo -= glm::vec2(1.0f);
+					hi += glm::vec2(1.0f);
+					break;
+				}
+			}
+			return SortItem(state_key(r), rectf::from_coordinates(lo.x, lo.y, hi.x, hi.y), cam.get());
+		}
+	}
+
 	RenderQueue::RenderQueue(const std::string& name) 
 		: name_(name)
 	{
@@ -71,4 +203,113 @@ namespace KRE
 		}
 		renderables_.clear();
 	}
+
+	void RenderQueue::addDraw(const Renderable* r)
+	{
+		Draw d;
+		d.r = r;
+		d.global_model = get_global_model_matrix();
+		d.color = ColorScope::getCurrentColor();
+		d.camera = DisplayDevice::getCurrent()->getDefaultCamera();
+		draws_.emplace_back(d);
+	}
+
+	void RenderQueue::flush(const WindowPtr& wnd)
+	{
+		if(draws_.empty()) {
+			return;
+		}
+
+		std::vector<int> order;
+		if(isSortingEnabled() && draws_.size() > 1) {
+			std::vector<SortItem> items;
+			items.reserve(draws_.size());
+			for(auto& d : draws_) {
+				items.emplace_back(make_sort_item(d.r, d.global_model, d.camera));
+			}
+			order = order_draws(items);
+		} else {
+			order.resize(draws_.size());
+			for(int n = 0; n != static_cast<int>(order.size()); ++n) {
+				order[n] = n;
+			}
+		}
+
+		auto display = DisplayDevice::getCurrent();
+		const glm::mat4 saved_model = get_global_model_matrix();
+		const CameraPtr saved_cam = display->getDefaultCamera();
+		CameraPtr current_cam = saved_cam;
+		for(int n : order) {
+			const Draw& d = draws_[n];
+			if(d.camera != current_cam) {
+				display->setDefaultCamera(d.camera);
+				current_cam = d.camera;
+			}
+			set_global_model_matrix(d.global_model);
+			ColorScope cs(d.color);
+			wnd->render(d.r);
+		}
+		if(current_cam != saved_cam) {
+			display->setDefaultCamera(saved_cam);
+		}
+		set_global_model_matrix(saved_model);
+		draws_.clear();
+	}
+
+	RenderQueue* RenderQueue::getCurrent()
+	{
+		return get_queue_stack().empty() ? nullptr : get_queue_stack().back();
+	}
+
+	void RenderQueue::setSortingEnabled(bool en)
+	{
+		get_sorting_enabled() = en;
+	}
+
+	bool RenderQueue::isSortingEnabled()
+	{
+		return get_sorting_enabled();
+	}
+
+	RenderQueue::Scope::Scope(RenderQueue& queue, const WindowPtr& wnd)
+		: queue_(queue),
+		  wnd_(wnd)
+	{
+		get_queue_stack().emplace_back(&queue_);
+	}
+
+	RenderQueue::Scope::~Scope()
+	{
+		ASSERT_LOG(!get_queue_stack().empty() && get_queue_stack().back() == &queue_, "RenderQueue(" << queue_.name() << ") scopes ended out of order.");
+		get_queue_stack().pop_back();
+		queue_.flush(wnd_);
+	}
+}
+
+UNIT_TEST(render_queue_order)
+{
+	using namespace KRE;
+	int space = 0;
+	std::vector<SortItem> items;
+	// Two textures alternating across non-overlapping tiles.
+	items.emplace_back(1, rectf(0, 0, 10, 10), &space);
+	items.emplace_back(2, rectf(10, 0, 10, 10), &space);
+	items.emplace_back(1, rectf(20, 0, 10, 10), &space);
+	items.emplace_back(2, rectf(30, 0, 10, 10), &space);
+	// Overlaps item 3, so it can't be moved in front of it to join item 2.
+	items.emplace_back(1, rectf(35, 5, 10, 10), &space);
+	// A barrier, then one that would otherwise join item 0.
+	items.emplace_back();
+	items.emplace_back(1, rectf(100, 0, 10, 10), &space);
+	// Same key but in another space.
+	int other_space = 0;
+	items.emplace_back(1, rectf(200, 0, 10, 10), &other_space);
+	items.emplace_back(1, rectf(300, 0, 10, 10), &space);
+
+	const std::vector<int> expected = { 0, 2, 1, 3, 4, 5, 6, 7, 8 };
+	const std::vector<int> order = order_draws(items);
+	CHECK_EQ(order.size(), expected.size());
+	for(size_t n = 0; n != expected.size(); ++n) {
+		CHECK_EQ(order[n], expected[n]);
+	}
 }
@@ -25,8 +25,11 @@
 
 #include <map>
 #include <cstdint>
+#include <vector>
 
+#include "Color.hpp"
 #include "RenderFwd.hpp"
+#include "SceneFwd.hpp"
 #include "WindowManagerFwd.hpp"
 
 namespace KRE
@@ -45,9 +48,45 @@ namespace KRE
 		void postRender(const WindowPtr& wm);
 
 		static RenderQueuePtr create(const std::string& name);
+
+		// Deferred drawing. Draws added while the queue is current are held back until flush(),
+		// which replays them grouped by shader, texture and blend state. A draw is only moved
+		// in front of earlier ones it doesn't overlap, so the result looks the same as drawing
+		// them in order. The renderables have to outlive the flush.
+		void addDraw(const Renderable* r);
+		void flush(const WindowPtr& wnd);
+		size_t getDrawCount() const { return draws_.size(); }
+
+		// The queue draws should be added to, or nullptr when drawing straight away.
+		static RenderQueue* getCurrent();
+		static void setSortingEnabled(bool en);
+		static bool isSortingEnabled();
+
+		// Makes a queue current, flushing it when the scope ends.
+		class Scope
+		{
+		public:
+			Scope(RenderQueue& queue, const WindowPtr& wnd);
+			~Scope();
+		private:
+			RenderQueue& queue_;
+			const WindowPtr& wnd_;
+			Scope(const Scope&);
+			void operator=(const Scope&);
+		};
 	private:
+		// The scoped state a draw was added with, restored when it is replayed.
+		struct Draw
+		{
+			const Renderable* r;
+			glm::mat4 global_model;
+			Color color;
+			CameraPtr camera;
+		};
+
 		std::map<uint64_t, RenderablePtr> renderables_;
 		std::string name_;
+		std::vector<Draw> draws_;
 		RenderQueue();
 		RenderQueue(const RenderQueue&);
 	};
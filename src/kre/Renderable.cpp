@@ -48,7 +48,10 @@ namespace KRE
 		  ignore_global_model_(false),
 		  derived_position_(0.0f),
 		  derived_rotation_(),
-		  derived_scale_(1.0f)
+		  derived_scale_(1.0f),
+		  local_bounds_(),
+		  has_local_bounds_(false),
+		  bounds_generation_(0)
 	{
 	}
 
@@ -64,7 +67,10 @@ namespace KRE
 		  ignore_global_model_(false),
 		  derived_position_(0.0f),
 		  derived_rotation_(),
-		  derived_scale_(1.0f)
+		  derived_scale_(1.0f),
+		  local_bounds_(),
+		  has_local_bounds_(false),
+		  bounds_generation_(0)
 	{
 	}
 
@@ -80,7 +86,10 @@ namespace KRE
 		  ignore_global_model_(false),
 		  derived_position_(0.0f),
 		  derived_rotation_(),
-		  derived_scale_(1.0f)
+		  derived_scale_(1.0f),
+		  local_bounds_(),
+		  has_local_bounds_(false),
+		  bounds_generation_(0)
 	{
 		if(!node.is_map()) {
 			return;
@@ -193,44 +202,73 @@ namespace KRE
 
 	void Renderable::setDerivedModel(const glm::vec3& p, const glm::quat& r, const glm::vec3& s)
 	{
-		derived_position_ = p;
-		derived_rotation_ = r;
-		derived_scale_ = s;
+		if(p != derived_position_ || r != derived_rotation_ || s != derived_scale_) {
+			derived_position_ = p;
+			derived_rotation_ = r;
+			derived_scale_ = s;
+			boundsChanged();
+		}
 	}
 
 	void Renderable::setPosition(const glm::vec3& position) 
 	{
 		position_ = position;
+		boundsChanged();
 	}
 
 	void Renderable::setPosition(float x, float y, float z) 
 	{
 		position_ = glm::vec3(x, y, z);
+		boundsChanged();
 	}
 
 	void Renderable::setPosition(int x, int y, int z) 
 	{
 		position_ = glm::vec3(float(x), float(y), float(z));
+		boundsChanged();
 	}
 
 	void Renderable::setRotation(float angle, const glm::vec3& axis) 
 	{
 		rotation_ = glm::angleAxis(glm::radians(angle), axis);
+		boundsChanged();
 	}
 
 	void Renderable::setRotation(const glm::quat& rot) 
 	{
 		rotation_ = rot;
+		boundsChanged();
 	}
 
 	void Renderable::setScale(float xs, float ys, float zs) 
 	{
 		scale_ = glm::vec3(xs, ys, zs);
+		boundsChanged();
 	}
 
 	void Renderable::setScale(const glm::vec3& scale) 
 	{
 		scale_ = scale;
+		boundsChanged();
+	}
+
+	namespace
+	{
+		size_t& latest_bounds_generation()
+		{
+			static size_t res = 0;
+			return res;
+		}
+	}
+
+	void Renderable::boundsChanged()
+	{
+		bounds_generation_ = ++latest_bounds_generation();
+	}
+
+	size_t Renderable::getLatestBoundsGeneration()
+	{
+		return latest_bounds_generation();
 	}
 
 	glm::mat4 Renderable::getModelMatrix() const 
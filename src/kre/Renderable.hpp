@@ -26,6 +26,7 @@
 #include <glm/gtx/quaternion.hpp>
 
 #include "AlignedAllocator.hpp"
+#include "geometry.hpp"
 #include "RenderQueue.hpp"
 #include "SceneFwd.hpp"
 #include "ScopeableValue.hpp"
@@ -100,6 +101,16 @@ namespace KRE
 		void enable(bool en=true) { enabled_ = en; }
 		void disable() { enabled_ = false; }
 
+		// Model space bounds of the vertices, which a RenderQueue uses to tell whether two draws
+		// overlap. Renderables without bounds are never moved past other draws.
+		bool hasLocalBounds() const { return has_local_bounds_; }
+		const rectf& getLocalBounds() const { return local_bounds_; }
+		// Changes whenever the local bounds or the model matrix change. Values come from a counter
+		// shared by all renderables, so a cache built at getLatestBoundsGeneration() is still valid
+		// for every renderable with a generation no newer than that.
+		size_t getBoundsGeneration() const { return bounds_generation_; }
+		static size_t getLatestBoundsGeneration();
+
 		virtual void preRender(const WindowPtr& wm) {}
 		virtual void postRender(const WindowPtr& wm) {}
 
@@ -108,8 +119,27 @@ namespace KRE
 		virtual void renderBegin() {}
 		// Called after draw commands have been sent before anything is torn down.
 		virtual void renderEnd() {}
+	protected:
+		void setLocalBounds(const rectf& r) { local_bounds_ = r; has_local_bounds_ = true; boundsChanged(); }
+		void clearLocalBounds() { has_local_bounds_ = false; boundsChanged(); }
+		// Grows the bounds to take in the positions pos_fn returns for [first, last).
+		template<typename It, typename Fn>
+		void extendLocalBounds(It first, It last, Fn pos_fn) {
+			if(first == last) {
+				return;
+			}
+			glm::vec2 lo = has_local_bounds_ ? glm::vec2(local_bounds_.x1(), local_bounds_.y1()) : glm::vec2(pos_fn(*first));
+			glm::vec2 hi = has_local_bounds_ ? glm::vec2(local_bounds_.x2(), local_bounds_.y2()) : lo;
+			for(; first != last; ++first) {
+				const glm::vec2 pos(pos_fn(*first));
+				lo = glm::min(lo, pos);
+				hi = glm::max(hi, pos);
+			}
+			setLocalBounds(rectf::from_coordinates(lo.x, lo.y, hi.x, hi.y));
+		}
 	private:
 		virtual void onTextureChanged() {}
+		void boundsChanged();
 
 		size_t order_;
 		glm::vec3 position_;
@@ -132,5 +162,9 @@ namespace KRE
 		//std::vector<UniformBufferBase> uniforms_;
 		bool enabled_;
 		bool ignore_global_model_;
+
+		rectf local_bounds_;
+		bool has_local_bounds_;
+		size_t bounds_generation_;
 	};
 }
@@ -21,6 +21,7 @@
 	   distribution.
 */
 
+#include "AttributeSet.hpp"
 #include "CameraObject.hpp"
 #include "BlendModeScope.hpp"
 #include "ClipScope.hpp"
@@ -30,10 +31,12 @@
 #include "ModelMatrixScope.hpp"
 #include "Renderable.hpp"
 #include "RenderManager.hpp"
+#include "RenderQueue.hpp"
 #include "RenderTarget.hpp"
 #include "SceneObject.hpp"
 #include "SceneTree.hpp"
 #include "WindowManager.hpp"
+#include "unit_test.hpp"
 #include "variant_utils.hpp"
 
 namespace KRE
@@ -99,6 +102,84 @@ namespace KRE
 			}
 			glm::mat4 last_matrix;			
 		};
+
+		bool& get_culling_enabled()
+		{
+			static bool res = true;
+			return res;
+		}
+
+		// The area, in the same space as the global model matrix, that draws from the node being 
+		// rendered can land in. Only tracked for orthogonal cameras.
+		struct CullState
+		{
+			CullState() : active(false), viewport(), visible() {}
+			bool active;
+			rectf viewport;
+			rectf visible;
+		};
+
+		CullState& get_cull_state()
+		{
+			static CullState res;
+			return res;
+		}
+
+		int& get_render_depth()
+		{
+			static int res = 0;
+			return res;
+		}
+
+		struct CullScope
+		{
+			CullScope() : saved(get_cull_state()) { ++get_render_depth(); }
+			~CullScope() 
+			{ 
+				get_cull_state() = saved; 
+				--get_render_depth(); 
+			}
+			CullState saved;
+		};
+
+		rectf transform_bounds(const glm::mat4& m, float x1, float y1, float x2, float y2)
+		{
+			const glm::vec4 corners[] = {
+				m * glm::vec4(x1, y1, 0.0f, 1.0f),
+				m * glm::vec4(x2, y1, 0.0f, 1.0f),
+				m * glm::vec4(x1, y2, 0.0f, 1.0f),
+				m * glm::vec4(x2, y2, 0.0f, 1.0f),
+			};
+			glm::vec2 lo(corners[0]);
+			glm::vec2 hi(corners[0]);
+			for(auto& c : corners) {
+				lo = glm::min(lo, glm::vec2(c));
+				hi = glm::max(hi, glm::vec2(c));
+			}
+			return rectf::from_coordinates(lo.x, lo.y, hi.x, hi.y);
+		}
+
+		rectf union_bounds(const rectf& a, const rectf& b)
+		{
+			return rectf::from_coordinates(std::min(a.x1(), b.x1()), std::min(a.y1(), b.y1()), 
+				std::max(a.x2(), b.x2()), std::max(a.y2(), b.y2()));
+		}
+
+		rectf intersect_bounds(const rectf& a, const rectf& b)
+		{
+			const float x1 = std::max(a.x1(), b.x1());
+			const float y1 = std::max(a.y1(), b.y1());
+			return rectf::from_coordinates(x1, y1, std::max(x1, std::min(a.x2(), b.x2())), std::max(y1, std::min(a.y2(), b.y2())));
+		}
+
+		void set_viewport(CullState& cs, const CameraPtr& cam)
+		{
+			cs.active = cam != nullptr && cam->getType() == Camera::CAMERA_ORTHOGONAL;
+			if(cs.active) {
+				const glm::mat4 inv_pv = glm::inverse(cam->getProjectionMat() * cam->getViewMat());
+				cs.viewport = cs.visible = transform_bounds(inv_pv, -1.0f, -1.0f, 1.0f, 1.0f);
+			}
+		}
 	}
 
 	SceneTree::SceneTree(const SceneTreePtr& parent)
@@ -117,6 +198,10 @@ namespace KRE
 		  model_changed_(true),
 		  model_matrix_(1.0f),
 		  cached_model_matrix_(1.0f),
+		  bounds_state_(BoundsState::DIRTY),
+		  world_bounds_(),
+		  bounds_parent_global_(1.0f),
+		  bounds_generation_(0),
 		  color_(nullptr),
 		  pre_render_fn_()
 	{
@@ -138,66 +223,104 @@ namespace KRE
 		objects_.erase(std::remove_if(objects_.begin(), objects_.end(), [obj](const SceneObjectPtr& object) {
 			return object == obj;
 		}), objects_.end());
+		invalidateBounds();
+	}
+
+	void SceneTree::setModelMatrix(const glm::mat4& m)
+	{
+		if(m != model_matrix_) {
+			model_matrix_ = m;
+			model_changed_ = true;
+			invalidateBounds();
+		}
+	}
+
+	void SceneTree::invalidateBounds()
+	{
+		bounds_state_ = BoundsState::DIRTY;
+		for(auto p = parent_.lock(); p != nullptr; p = p->parent_.lock()) {
+			p->bounds_state_ = BoundsState::DIRTY;
+		}
+	}
+
+	void SceneTree::setCullingEnabled(bool en)
+	{
+		get_culling_enabled() = en;
+	}
+
+	bool SceneTree::isCullingEnabled()
+	{
+		return get_culling_enabled();
 	}
 
 	void SceneTree::setPosition(const glm::vec3& position) 
 	{
 		position_ = position;
 		model_changed_ = true;
+		invalidateBounds();
 	}
 
 	void SceneTree::setPosition(float x, float y, float z) 
 	{
 		position_ = glm::vec3(x, y, z);
 		model_changed_ = true;
+		invalidateBounds();
 	}
 
 	void SceneTree::setPosition(int x, int y, int z) 
 	{
 		position_ = glm::vec3(static_cast<float>(x), static_cast<float>(y), static_cast<float>(z));
 		model_changed_ = true;
+		invalidateBounds();
 	}
 
 	void SceneTree::offsetPosition(const glm::vec3 & position)
 	{
 		offset_position_ = position;
 		model_changed_ = true;
+		invalidateBounds();
 	}
 
 	void SceneTree::offsetPosition(float x, float y, float z)
 	{
 		offset_position_ = glm::vec3(x, y, z);
 		model_changed_ = true;
+		invalidateBounds();
 	}
 
 	void SceneTree::offsetPosition(int x, int y, int z)
 	{
 		offset_position_ = glm::vec3(static_cast<float>(x), static_cast<float>(y), static_cast<float>(z));
 		model_changed_ = true;
+		invalidateBounds();
 	}
 
 	void SceneTree::setRotation(float angle, const glm::vec3& axis) 
 	{
 		rotation_ = glm::angleAxis(glm::radians(angle), axis);
 		model_changed_ = true;
+		invalidateBounds();
 	}
 
 	void SceneTree::setRotation(const glm::quat& rot) 
 	{
 		rotation_ = rot;
 		model_changed_ = true;
+		invalidateBounds();
 	}
 
 	void SceneTree::setScale(float xs, float ys, float zs) 
 	{
 		scale_ = glm::vec3(xs, ys, zs);
 		model_changed_ = true;
+		invalidateBounds();
 	}
 
 	void SceneTree::setScale(const glm::vec3& scale) 
 	{
 		scale_ = scale;
 		model_changed_ = true;
+		invalidateBounds();
 	}
 
 	void SceneTree::preRender(const WindowPtr& wnd)
@@ -243,17 +366,151 @@ namespace KRE
 		}
 	}
 
-	void SceneTree::render(const WindowPtr& wnd) const
+	void SceneTree::updateModelMatrix() const
 	{
-		//if(scopeable_.isBlendEnabled()) {
-		//}
-
 		if(model_changed_) {
 			model_changed_ = false;
 			glm::mat4 m = glm::scale(model_matrix_, scale_);
 			m = glm::toMat4(rotation_) * m;
 			cached_model_matrix_ = glm::translate(m, position_ + offset_position_);
 		}
+	}
+
+	SceneTree::BoundsState SceneTree::updateWorldBounds(const glm::mat4& parent_global) const
+	{
+		updateModelMatrix();
+		// Objects can move or reshape themselves without telling us, i.e. text that is rebuilt 
+		// once its glyphs have been rasterized.
+		const size_t latest_generation = Renderable::getLatestBoundsGeneration();
+		if(bounds_state_ != BoundsState::DIRTY && bounds_parent_global_ == parent_global 
+			&& (bounds_generation_ == latest_generation || !boundsChangedSince(bounds_generation_))) {
+			return bounds_state_;
+		}
+		bounds_parent_global_ = parent_global;
+		bounds_generation_ = latest_generation;
+		bounds_state_ = BoundsState::UNBOUNDED;
+		if(!render_targets_.empty()) {
+			return bounds_state_;
+		}
+
+		const glm::mat4 global = parent_global * cached_model_matrix_;
+		bool empty = true;
+		rectf bounds;
+		auto add_bounds = [&empty, &bounds](const rectf& r) {
+			bounds = empty ? r : union_bounds(bounds, r);
+			empty = false;
+		};
+		for(auto objs : { &objects_, &objects_end_ }) {
+			for(auto& obj : *objs) {
+				if(!obj->hasLocalBounds() || obj->getCamera() || obj->ignoreGlobalModelMatrix() 
+					|| obj->hasClipSettings() || obj->getRenderTarget()) {
+					return bounds_state_;
+				}
+				const rectf& lb = obj->getLocalBounds();
+				rectf r = transform_bounds(global * obj->getModelMatrix(), lb.x1(), lb.y1(), lb.x2(), lb.y2());
+				// Lines and points are drawn wider than their vertices.
+				for(auto& as : obj->getAttributeSet()) {
+					const DrawMode dm = as->getDrawMode();
+					if(dm == DrawMode::POINTS || dm == DrawMode::LINES || dm == DrawMode::LINE_STRIP || dm == DrawMode::LINE_LOOP) {
+						r = rectf::from_coordinates(r.x1() - 1.0f, r.y1() - 1.0f, r.x2() + 1.0f, r.y2() + 1.0f);
+						break;
+					}
+				}
+				add_bounds(r);
+			}
+		}
+
+		for(auto& child : children_) {
+			const BoundsState bs = child->updateWorldBounds(global);
+			// A child with its own camera is bounded in a different space.
+			if(bs == BoundsState::UNBOUNDED || (bs == BoundsState::BOUNDED && child->camera_)) {
+				return bounds_state_;
+			}
+			if(bs == BoundsState::BOUNDED) {
+				add_bounds(child->world_bounds_);
+			}
+		}
+
+		world_bounds_ = bounds;
+		bounds_state_ = empty ? BoundsState::EMPTY : BoundsState::BOUNDED;
+		return bounds_state_;
+	}
+
+	// Subtrees found to be unchanged are marked as valid up to the latest generation, so they 
+	// aren't walked again.
+	bool SceneTree::boundsChangedSince(size_t generation) const
+	{
+		for(auto objs : { &objects_, &objects_end_ }) {
+			for(auto& obj : *objs) {
+				if(obj->getBoundsGeneration() > generation) {
+					return true;
+				}
+			}
+		}
+		for(auto& child : children_) {
+			if(child->boundsChangedSince(generation)) {
+				return true;
+			}
+		}
+		bounds_generation_ = Renderable::getLatestBoundsGeneration();
+		return false;
+	}
+
+	bool SceneTree::isOutside(const rectf& visible, const glm::mat4& parent_global) const
+	{
+		return updateWorldBounds(parent_global) == BoundsState::BOUNDED && !rects_intersect(world_bounds_, visible);
+	}
+
+	void SceneTree::render(const WindowPtr& wnd) const
+	{
+		//if(scopeable_.isBlendEnabled()) {
+		//}
+
+		updateModelMatrix();
+
+		// Work out the area our draws can land in. Clip rects are drawn into the stencil with our 
+		// parent's model matrix and replace any outer clip, so they don't intersect with it.
+		CullScope cull_scope;
+		CullState& cull = get_cull_state();
+		if(camera_ != nullptr || get_render_depth() == 1) {
+			set_viewport(cull, camera_ ? camera_ : DisplayDevice::getCurrent()->getDefaultCamera());
+		}
+		if(cull.active) {
+			const glm::mat4& parent_global = get_global_model_matrix();
+			if(clip_rect_) {
+				const rect& cr = *clip_rect_;
+				cull.visible = intersect_bounds(cull.viewport, transform_bounds(parent_global, 
+					static_cast<float>(cr.x1()), static_cast<float>(cr.y1()), static_cast<float>(cr.x2()), static_cast<float>(cr.y2())));
+			} else if(clip_shape_) {
+				cull.visible = cull.viewport;
+			}
+
+			if(isCullingEnabled() && isOutside(cull.visible, parent_global)) {
+				++DisplayDevice::getRenderStats().culled_subtrees;
+				return;
+			}
+		}
+		// Our children are rendered into the render target with its own projection.
+		if(!render_targets_.empty()) {
+			cull.active = false;
+		}
+
+		// Draws go through the current render queue so they can be replayed grouped by state. Render
+		// targets and clipping change where draws land, so draws queued before this node are flushed
+		// first and this node's draws get a queue of their own, flushed inside those scopes.
+		RenderQueue* outer_queue = RenderQueue::getCurrent();
+		const bool isolate = !render_targets_.empty() || clip_shape_ != nullptr || clip_rect_ != nullptr;
+		if(outer_queue != nullptr && isolate) {
+			outer_queue->flush(wnd);
+		}
+		auto render_obj = [&wnd](const Renderable* r) {
+			RenderQueue* queue = RenderQueue::getCurrent();
+			if(queue != nullptr) {
+				queue->addDraw(r);
+			} else {
+				wnd->render(r);
+			}
+		};
 
 		{
 			CameraScope cs(camera_);
@@ -279,8 +536,15 @@ namespace KRE
 				auto rt = !render_targets_.empty() ? render_targets_.front() : nullptr;
 				RenderTarget::RenderScope rs(rt, rect(0, 0, rt ? rt->width() : 0, rt ? rt->height() : 0));
 
+				std::unique_ptr<RenderQueue> queue;
+				std::unique_ptr<RenderQueue::Scope> queue_scope;
+				if(RenderQueue::isSortingEnabled() && (outer_queue == nullptr || isolate)) {
+					queue.reset(new RenderQueue("scene-tree"));
+					queue_scope.reset(new RenderQueue::Scope(*queue, wnd));
+				}
+
 				for(auto& obj : objects_) {
-					wnd->render(obj.get());
+					render_obj(obj.get());
 				}
 
 				for(auto& child : children_) {
@@ -288,7 +552,7 @@ namespace KRE
 				}
 
 				for(auto& obj : objects_end_) {
-					wnd->render(obj.get());
+					render_obj(obj.get());
 				}
 			}
 
@@ -302,7 +566,53 @@ namespace KRE
 
 		// Output the last render target
 		if(!render_targets_.empty()) {
-			wnd->render(render_targets_.back().get());
+			render_obj(render_targets_.back().get());
 		}
 	}
 }
+
+namespace
+{
+	struct BoundsTestObject : public KRE::SceneObject
+	{
+		BoundsTestObject() : KRE::SceneObject("bounds-test") {}
+		void setBounds(const rectf& r) { setLocalBounds(r); }
+		void clearBounds() { clearLocalBounds(); }
+	};
+}
+
+UNIT_TEST(scene_tree_bounds_helpers)
+{
+	using namespace KRE;
+	const glm::mat4 m = glm::scale(glm::translate(glm::mat4(1.0f), glm::vec3(10.0f, 20.0f, 0.0f)), glm::vec3(2.0f, -1.0f, 1.0f));
+	CHECK_EQ(transform_bounds(m, 0.0f, 0.0f, 5.0f, 5.0f), rectf::from_coordinates(10.0f, 15.0f, 20.0f, 20.0f));
+	CHECK_EQ(intersect_bounds(rectf(0.0f, 0.0f, 10.0f, 10.0f), rectf(5.0f, -5.0f, 10.0f, 10.0f)), rectf::from_coordinates(5.0f, 0.0f, 10.0f, 5.0f));
+	// Disjoint rects give an empty rect rather than an inverted one.
+	const rectf r = intersect_bounds(rectf(0.0f, 0.0f, 10.0f, 10.0f), rectf(20.0f, 20.0f, 10.0f, 10.0f));
+	CHECK(r.w() == 0.0f && r.h() == 0.0f, "intersection of disjoint rects isn't empty: " << r);
+}
+
+UNIT_TEST(scene_tree_cull_reshaped_object)
+{
+	using namespace KRE;
+	DisplayDevice::factory("null", nullptr);
+	auto root = SceneTree::create(nullptr);
+	auto child = SceneTree::create(root);
+	root->addChild(child);
+	auto obj = std::make_shared<BoundsTestObject>();
+	obj->setBounds(rectf(0.0f, 0.0f, 10.0f, 10.0f));
+	child->addObject(obj);
+
+	const rectf visible(0.0f, 0.0f, 100.0f, 100.0f);
+	const glm::mat4 identity(1.0f);
+	CHECK(!root->isOutside(visible, identity), "visible object culled");
+	CHECK(root->isOutside(visible, glm::translate(identity, glm::vec3(500.0f, 0.0f, 0.0f))), "object outside the visible area not culled");
+
+	// Changes made to the object directly have to be picked up without invalidateBounds().
+	obj->setBounds(rectf(200.0f, 0.0f, 10.0f, 10.0f));
+	CHECK(root->isOutside(visible, identity), "cached bounds not updated when the object was reshaped");
+	obj->setPosition(-150.0f, 0.0f);
+	CHECK(!root->isOutside(visible, identity), "cached bounds not updated when the object was moved");
+	obj->clearBounds();
+	CHECK(!root->isOutside(visible, identity), "object without bounds culled");
+}
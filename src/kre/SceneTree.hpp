@@ -49,11 +49,11 @@ namespace KRE
 		SceneTreePtr getParent() const { return parent_.lock(); }
 		SceneTreePtr getRoot() const { return root_.lock(); }
 
-		void addObject(const SceneObjectPtr& obj) { objects_.emplace_back(obj); }
-		void addEndObject(const SceneObjectPtr& obj) { objects_end_.emplace_back(obj); }
-		void clearObjects() { objects_.clear(); objects_end_.clear(); }
+		void addObject(const SceneObjectPtr& obj) { objects_.emplace_back(obj); invalidateBounds(); }
+		void addEndObject(const SceneObjectPtr& obj) { objects_end_.emplace_back(obj); invalidateBounds(); }
+		void clearObjects() { objects_.clear(); objects_end_.clear(); invalidateBounds(); }
 		void removeObject(const SceneObjectPtr& obj);
-		void addChild(const SceneTreePtr& child) { children_.emplace_back(child); }
+		void addChild(const SceneTreePtr& child) { children_.emplace_back(child); invalidateBounds(); }
 
 		void preRender(const WindowPtr& wnd);
 		void render(const WindowPtr& wnd) const;
@@ -75,16 +75,16 @@ namespace KRE
 		void setScale(const glm::vec3& scale);
 		const glm::vec3& getScale() const { return scale_; }
 
-		void clearRenderTargets() { render_targets_.clear(); }
-		void addRenderTarget(const RenderTargetPtr& render_target) { render_targets_.emplace_back(render_target); }
+		void clearRenderTargets() { render_targets_.clear(); invalidateBounds(); }
+		void addRenderTarget(const RenderTargetPtr& render_target) { render_targets_.emplace_back(render_target); invalidateBounds(); }
 		const std::vector<RenderTargetPtr>& getRenderTargets() const { return render_targets_; }
 
-		void setCamera(const CameraPtr& cam) { camera_ = cam; }
+		void setCamera(const CameraPtr& cam) { camera_ = cam; invalidateBounds(); }
 		const CameraPtr& getCamera() const { return camera_; }
 
 		// This is a third party matrix set, it is applied to content *before* any translation/rotation/scaling set on us.
 		const glm::mat4& getModelMatrix() const { return model_matrix_; }
-		void setModelMatrix(const glm::mat4& m) { model_matrix_ = m; model_changed_ = true; }
+		void setModelMatrix(const glm::mat4& m);
 
 		// recursively clear objects and render targets.
 		void clear();
@@ -96,13 +96,35 @@ namespace KRE
 		void setClipShape(const RenderablePtr& r) { clip_shape_ = r; }
 		void clearClipShape() { clip_shape_ = nullptr; }
 
+		// The world space bounds of our objects and children are cached and used to skip rendering
+		// subtrees outside the visible area. They track changes made through this class and to the
+		// objects' bounds and model matrices, anything else that changes where the subtree draws
+		// needs to call this.
+		void invalidateBounds();
+		// True if nothing in the subtree, rendered with parent_global as the global model matrix,
+		// can land inside visible.
+		bool isOutside(const rectf& visible, const glm::mat4& parent_global) const;
+
 		static SceneTreePtr create(SceneTreePtr parent);
 
+		static void setCullingEnabled(bool en);
+		static bool isCullingEnabled();
+
 		// callback used during pre-render.
 		prerender_fn setOnPreRenderFunction(prerender_fn fn) { auto current_fn = pre_render_fn_ ; pre_render_fn_ = fn; return current_fn; }
 	protected:
 		explicit SceneTree(const SceneTreePtr& parent);
 	private:
+		enum class BoundsState {
+			DIRTY,
+			// Something in the subtree can't be bounded, so it is never culled.
+			UNBOUNDED,
+			EMPTY,
+			BOUNDED,
+		};
+		void updateModelMatrix() const;
+		BoundsState updateWorldBounds(const glm::mat4& parent_global) const;
+		bool boundsChangedSince(size_t generation) const;
 
 		WeakSceneTreePtr root_;
 		WeakSceneTreePtr parent_;
@@ -129,6 +151,13 @@ namespace KRE
 		glm::mat4 model_matrix_;
 		mutable glm::mat4 cached_model_matrix_;
 
+		mutable BoundsState bounds_state_;
+		mutable rectf world_bounds_;
+		// global model matrix of our parent when world_bounds_ was calculated.
+		mutable glm::mat4 bounds_parent_global_;
+		// Renderable bounds generation that world_bounds_ is known to be valid for.
+		mutable size_t bounds_generation_;
+
 		ColorPtr color_;
 
 		prerender_fn pre_render_fn_;
@@ -24,6 +24,7 @@
 #include <GL/glew.h>
 #include <stack>
 #include "ScissorOGL.hpp"
+#include "StateTrackerOGL.hpp"
 
 namespace KRE
 {
@@ -48,6 +49,7 @@ namespace KRE
 
 	void ScissorOGL::apply() 
 	{
+		StateTrackerOGL::getInstance().flushPendingDraws();
 		if(get_scissor_stack().empty()) {
 			glEnable(GL_SCISSOR_TEST);
 		}
@@ -57,6 +59,7 @@ namespace KRE
 
 	void ScissorOGL::clear() 
 	{
+		StateTrackerOGL::getInstance().flushPendingDraws();
 		get_scissor_stack().pop();
 		if(get_scissor_stack().empty()) {
 			glDisable(GL_SCISSOR_TEST);
@@ -26,6 +26,17 @@
 
 namespace KRE
 {
+	namespace
+	{
+		std::string& get_program_cache_dir()
+		{
+			static std::string res;
+			return res;
+		}
+	}
+
+	ShaderProgram::BuildStats ShaderProgram::build_stats_;
+
 	ShaderProgram::ShaderProgram(const std::string& name, const variant& node)
 		: name_(name),
 		  node_(node)
@@ -98,4 +109,14 @@ namespace KRE
 	{
 		return DisplayDevice::getCurrent()->createGaussianShader(radius);
 	}
+
+	void ShaderProgram::setProgramCacheDir(const std::string& dir)
+	{
+		get_program_cache_dir() = dir;
+	}
+
+	const std::string& ShaderProgram::getProgramCacheDir()
+	{
+		return get_program_cache_dir();
+	}
 }
@@ -28,6 +28,8 @@
 #include <memory>
 #include <string>
 
+#include <glm/glm.hpp>
+
 #include "DisplayDeviceFwd.hpp"
 #include "Util.hpp"
 
@@ -125,6 +127,13 @@ namespace KRE
 		virtual int getPUniform() const = 0;
 		virtual int getMvpUniform() const = 0;
 		virtual int getTexMapUniform() const = 0;
+		virtual int getMUniform() const = 0;
+
+		// Sets the transform for a draw, the program being active. Programs using the standard
+		// camera block share the projection and view, which are only uploaded when they change,
+		// and just take the model matrix per draw. Others are given p * v * m as their mvp.
+		virtual void setMvpMatrix(const glm::mat4& p, const glm::mat4& v, const glm::mat4& m) const = 0;
+		virtual bool usesCameraBlock() const = 0;
 
 		virtual int getColorAttribute() const = 0;
 		virtual int getVertexAttribute() const = 0;
@@ -156,6 +165,26 @@ namespace KRE
 		const std::string& getName() const { return name_; }
 
 		static ShaderProgramPtr createGaussianShader(int radius);
+
+		// Time spent building programs since startup, and how many were loaded as driver
+		// binaries from the program cache instead of being compiled from source.
+		struct BuildStats
+		{
+			BuildStats() : programs_built(0), cache_hits(0), cache_rejects(0), build_time_ms(0) {}
+			int programs_built;
+			int cache_hits;
+			// Binaries the driver refused, e.g. after an update, which were built from source.
+			int cache_rejects;
+			double build_time_ms;
+		};
+		static const BuildStats& getBuildStats() { return build_stats_; }
+
+		// Directory where backends may keep compiled programs between runs. Empty, the
+		// default, means programs are always built from source.
+		static void setProgramCacheDir(const std::string& dir);
+		static const std::string& getProgramCacheDir();
+	protected:
+		static BuildStats build_stats_;
 	private:
 		ShaderProgram();
 
@@ -21,6 +21,10 @@
 	   distribution.
 */
 
+#include <chrono>
+#include <cstring>
+#include <sstream>
+
 #include <glm/glm.hpp>
 #include <glm/gtc/type_ptr.hpp>
 
@@ -28,7 +32,9 @@
 #include "variant_utils.hpp"
 #include "AttributeSet.hpp"
 #include "DisplayDevice.hpp"
+#include "ProgramCacheOGL.hpp"
 #include "ShadersOGL.hpp"
+#include "StateTrackerOGL.hpp"
 #include "TextureOGL.hpp"
 #include "UniformBufferOGL.hpp"
 
@@ -41,15 +47,74 @@ namespace KRE
 			struct uniform_mapping { const char* alt_name; const char* name; };
 			struct attribute_mapping { const char* alt_name; const char* name; };
 
+			// The standard camera include, '#include "camera"' at the top of a vertex shader (after
+			// any #version). Vertices are transformed by u_pv_matrix * u_m_matrix, the projection
+			// and view coming from CameraUniformsOGL and the model matrix being set per draw.
+			const char* const camera_include_directive = "#include \"camera\"";
+			const char* const camera_include_block = 
+				"#extension GL_ARB_uniform_buffer_object : require\n"
+				"layout(std140) uniform u_camera\n"
+				"{\n"
+				"    mat4 u_proj_matrix;\n"
+				"    mat4 u_view_matrix;\n"
+				"    mat4 u_pv_matrix;\n"
+				"};\n"
+				"uniform mat4 u_m_matrix;\n";
+			const char* const camera_include_uniforms = 
+				"uniform mat4 u_proj_matrix;\n"
+				"uniform mat4 u_view_matrix;\n"
+				"uniform mat4 u_pv_matrix;\n"
+				"uniform mat4 u_m_matrix;\n";
+
+			// Bytes the setUniformValue() overloads taking a pointer upload for the uniform, zero
+			// for types they don't handle.
+			size_t uniform_value_size(const Actives& u)
+			{
+				switch(u.type) {
+					case GL_INT:
+					case GL_BOOL:
+					case GL_SAMPLER_2D:
+					case GL_SAMPLER_CUBE:	return sizeof(GLint);
+					// Only the first element is set for these.
+					case GL_INT_VEC2:
+					case GL_BOOL_VEC2:		return 2 * sizeof(GLint);
+					case GL_INT_VEC3:
+					case GL_BOOL_VEC3:		return 3 * sizeof(GLint) * u.num_elements;
+					case GL_INT_VEC4:
+					case GL_BOOL_VEC4:		return 4 * sizeof(GLint) * u.num_elements;
+					case GL_FLOAT:			return sizeof(GLfloat) * u.num_elements;
+					case GL_FLOAT_VEC2:		return 2 * sizeof(GLfloat) * u.num_elements;
+					case GL_FLOAT_VEC3:		return 3 * sizeof(GLfloat) * u.num_elements;
+					case GL_FLOAT_VEC4:
+					case GL_FLOAT_MAT2:		return 4 * sizeof(GLfloat) * u.num_elements;
+					case GL_FLOAT_MAT3:		return 9 * sizeof(GLfloat) * u.num_elements;
+					case GL_FLOAT_MAT4:		return 16 * sizeof(GLfloat) * u.num_elements;
+					default: break;
+				}
+				return 0;
+			}
+
+			std::string expand_includes(const std::string& code)
+			{
+				const std::string directive = camera_include_directive;
+				auto pos = code.find(directive);
+				if(pos == std::string::npos) {
+					return code;
+				}
+				std::string res = code;
+				res.replace(pos, directive.size(), CameraUniformsOGL::isSupported() ? camera_include_block : camera_include_uniforms);
+				return res;
+			}
+
 			const char* const default_vs = 
-				"uniform mat4 u_mvp_matrix;\n"
+				"#include \"camera\"\n"
 				"attribute vec2 a_position;\n"
 				"attribute vec2 a_texcoord;\n"
 				"varying vec2 v_texcoord;\n"
 				"void main()\n"
 				"{\n"
 				"    v_texcoord = a_texcoord;\n"
-				"    gl_Position = u_mvp_matrix * vec4(a_position,0.0,1.0);\n"
+				"    gl_Position = u_pv_matrix * u_m_matrix * vec4(a_position,0.0,1.0);\n"
 				"}\n";
 			const char* const default_fs =
 				"uniform sampler2D u_tex_map;\n"
@@ -81,7 +146,7 @@ namespace KRE
 
 			const uniform_mapping default_uniform_mapping[] =
 			{
-				{"mvp_matrix", "u_mvp_matrix"},
+				{"m_matrix", "u_m_matrix"},
 				{"color", "u_color"},
 				{"discard", "u_discard"},
 				{"tex_map", "u_tex_map"},
@@ -100,13 +165,13 @@ namespace KRE
 			};
 
 			const char* const simple_vs = 
-				"uniform mat4 u_mvp_matrix;\n"
+				"#include \"camera\"\n"
 				"uniform float u_point_size;\n"
 				"attribute vec2 a_position;\n"
 				"void main()\n"
 				"{\n"
 				"    gl_PointSize = u_point_size;\n"
-				"    gl_Position = u_mvp_matrix * vec4(a_position, 0.0, 1.0);\n"
+				"    gl_Position = u_pv_matrix * u_m_matrix * vec4(a_position, 0.0, 1.0);\n"
 				"}\n";
 			const char* const simple_fs =
 				"uniform bool u_discard;\n"
@@ -121,7 +186,7 @@ namespace KRE
 
 			const uniform_mapping simple_uniform_mapping[] =
 			{
-				{"mvp_matrix", "u_mvp_matrix"},
+				{"m_matrix", "u_m_matrix"},
 				{"color", "u_color"},
 				{"discard", "u_discard"},
 				{"point_size", "u_point_size"},
@@ -135,12 +200,12 @@ namespace KRE
 
 			// circle shader definition starts
 			const char* const circle_vs = 
-				"uniform mat4 u_mvp_matrix;\n"
+				"#include \"camera\"\n"
 				"attribute vec2 a_position;\n"
 				"varying vec2 v_position;\n"
 				"void main()\n"
 				"{\n"
-				"	gl_Position = u_mvp_matrix * vec4(a_position, 0.0, 1.0);\n"
+				"	gl_Position = u_pv_matrix * u_m_matrix * vec4(a_position, 0.0, 1.0);\n"
 				"	v_position = a_position;\n"
 				"}\n";
 			const char* const circle_fs =
@@ -169,7 +234,7 @@ namespace KRE
 
 			const uniform_mapping circle_uniform_mapping[] =
 			{
-				{"mvp_matrix", "u_mvp_matrix"},
+				{"m_matrix", "u_m_matrix"},
 				{"color", "u_color"},
 				{"discard", "u_discard"},
 				{"outer_radius", "u_outer_radius"},
@@ -236,7 +301,7 @@ namespace KRE
 			};
 
 			const char* const attr_color_vs = 
-				"uniform mat4 u_mvp_matrix;\n"
+				"#include \"camera\"\n"
 				"uniform float u_point_size;\n"
 				"attribute vec2 a_position;\n"
 				"attribute vec4 a_color;\n"
@@ -245,7 +310,7 @@ namespace KRE
 				"{\n"
 				"	 v_color = a_color;\n"
 				"    gl_PointSize = u_point_size;\n"
-				"    gl_Position = u_mvp_matrix * vec4(a_position,0.0,1.0);\n"
+				"    gl_Position = u_pv_matrix * u_m_matrix * vec4(a_position,0.0,1.0);\n"
 				"}\n";
 			const char* const attr_color_fs =
 				"uniform bool u_discard;\n"
@@ -261,7 +326,7 @@ namespace KRE
 
 			const uniform_mapping attr_color_uniform_mapping[] =
 			{
-				{"mvp_matrix", "u_mvp_matrix"},
+				{"m_matrix", "u_m_matrix"},
 				{"color", "u_color"},
 				{"discard", "u_discard"},
 				{"point_size", "u_point_size"},
@@ -275,7 +340,7 @@ namespace KRE
 			};
 
 			const char* const vtc_vs = 
-				"uniform mat4 u_mvp_matrix;\n"
+				"#include \"camera\"\n"
 				"attribute vec2 a_position;\n"
 				"attribute vec2 a_texcoord;\n"
 				"attribute vec4 a_color;\n"
@@ -285,7 +350,7 @@ namespace KRE
 				"{\n"
 				"    v_color = a_color;\n"
 				"    v_texcoord = a_texcoord;\n"
-				"    gl_Position = u_mvp_matrix * vec4(a_position,0.0,1.0);\n"
+				"    gl_Position = u_pv_matrix * u_m_matrix * vec4(a_position,0.0,1.0);\n"
 				"}\n";
 			const char* const vtc_fs =
 				"uniform sampler2D u_tex_map;\n"
@@ -300,7 +365,7 @@ namespace KRE
 
 			const uniform_mapping vtc_uniform_mapping[] =
 			{
-				{"mvp_matrix", "u_mvp_matrix"},
+				{"m_matrix", "u_m_matrix"},
 				{"color", "u_color"},
 				{"tex_map", "u_tex_map"},
 				{"tex_map0", "u_tex_map"},
@@ -315,13 +380,13 @@ namespace KRE
 			};
 
 			const char* const point_shader_vs = 
-				"uniform mat4 u_mvp_matrix;\n"
+				"#include \"camera\"\n"
 				"uniform float u_point_size;\n"
 				"attribute vec2 a_position;\n"
 				"void main()\n"
 				"{\n"
 				"    gl_PointSize = u_point_size;\n"
-				"    gl_Position = u_mvp_matrix * vec4(a_position,0.0,1.0);\n"
+				"    gl_Position = u_pv_matrix * u_m_matrix * vec4(a_position,0.0,1.0);\n"
 				"}\n";
 			const char* const point_shader_fs = 
 				"#version 120\n"
@@ -336,7 +401,7 @@ namespace KRE
 				"}\n";
 			const uniform_mapping point_shader_uniform_mapping[] = 
 			{
-				{"mvp_matrix", "u_mvp_matrix"},
+				{"m_matrix", "u_m_matrix"},
 				{"color", "u_color"},
 				{"point_size", "u_point_size"},
 				{"", ""},
@@ -355,7 +420,7 @@ namespace KRE
 			const char* const font_shader_vs_layout = 
 				"#version 150\n"
 				"#extension GL_ARB_explicit_attrib_location : enable\n"
-				"uniform mat4 u_mvp_matrix;\n"
+				"#include \"camera\"\n"
 				"layout(location = 1) in vec4 a_color;\n"
 				"in vec2 a_position;\n"
 				"in vec2 a_texcoord;\n"
@@ -365,11 +430,11 @@ namespace KRE
 				"{\n"
 				"    v_texcoord = a_texcoord;\n"
 				"    v_color = a_color;\n"
-				"    gl_Position = u_mvp_matrix * vec4(a_position,0.0,1.0);\n"
+				"    gl_Position = u_pv_matrix * u_m_matrix * vec4(a_position,0.0,1.0);\n"
 				"}\n";
 			const char* const font_shader_vs = 
 				"#version 120\n"
-				"uniform mat4 u_mvp_matrix;\n"
+				"#include \"camera\"\n"
 				"attribute vec2 a_position;\n"
 				"attribute vec2 a_texcoord;\n"
 				"attribute vec4 a_color;\n"
@@ -379,7 +444,7 @@ namespace KRE
 				"{\n"
 				"    v_texcoord = a_texcoord;\n"
 				"    v_color = a_color;\n"
-				"    gl_Position = u_mvp_matrix * vec4(a_position,0.0,1.0);\n"
+				"    gl_Position = u_pv_matrix * u_m_matrix * vec4(a_position,0.0,1.0);\n"
 				"}\n";
 			const char* const font_shader_fs = 
 				"#version 120\n"
@@ -398,7 +463,7 @@ namespace KRE
 				"}\n";
 			const uniform_mapping font_shader_uniform_mapping[] = 
 			{
-				{"mvp_matrix", "u_mvp_matrix"},
+				{"m_matrix", "u_m_matrix"},
 				{"color", "u_color"},
 				{"tex_map", "u_tex_map"},
 				{"", ""},
@@ -412,14 +477,14 @@ namespace KRE
 			};
 
 			const char* const blur_vs =
-				"uniform mat4 u_mvp_matrix;\n"
+				"#include \"camera\"\n"
 				"attribute vec2 a_position;\n"
 				"attribute vec2 a_texcoord;\n"
 				"varying vec2 v_texcoords;\n"
 				"\n"
 				"void main()\n"
 				"{\n"
-				"    gl_Position = u_mvp_matrix * vec4(a_position, 0.0, 1.0);\n"
+				"    gl_Position = u_pv_matrix * u_m_matrix * vec4(a_position, 0.0, 1.0);\n"
 				"    v_texcoords = a_texcoord;\n"
 				"}\n";
 			const char* const blur7_fs =
@@ -449,7 +514,7 @@ namespace KRE
 				"}\n";
 			const uniform_mapping blur_uniform_mapping[] = 
 			{
-				{"mvp_matrix", "u_mvp_matrix"},
+				{"m_matrix", "u_m_matrix"},
 				{"tex_map", "u_tex_map"},
 				{"tex_map1", "u_tex_map1"},
 				{"color", "u_color"},
@@ -463,14 +528,14 @@ namespace KRE
 			};
 
 			const char* const overlay_vs =
-				"uniform mat4 u_mvp_matrix;\n"
+				"#include \"camera\"\n"
 				"attribute vec2 a_position;\n"
 				"attribute vec2 a_texcoord;\n"
 				"varying vec2 v_texcoords;\n"
 				"\n"
 				"void main()\n"
 				"{\n"
-				"    gl_Position = u_mvp_matrix * vec4(a_position, 0.0, 1.0);\n"
+				"    gl_Position = u_pv_matrix * u_m_matrix * vec4(a_position, 0.0, 1.0);\n"
 				"    v_texcoords = a_texcoord;\n"
 				"}\n";
 			const char* const overlay_fs =
@@ -493,7 +558,7 @@ namespace KRE
 				"}\n";
 			const uniform_mapping overlay_uniform_mapping[] = 
 			{
-				{"mvp_matrix", "u_mvp_matrix"},
+				{"m_matrix", "u_m_matrix"},
 				{"tex_map", "u_tex_map"},
 				{"tex_map1", "u_tex_map1"},
 				{"color", "u_color"},
@@ -508,14 +573,14 @@ namespace KRE
 
 
 			const char* const filter_vs =
-				"uniform mat4 u_mvp_matrix;\n"
+				"#include \"camera\"\n"
 				"attribute vec2 a_position;\n"
 				"attribute vec2 a_texcoord;\n"
 				"varying vec2 v_texcoords;\n"
 				"\n"
 				"void main()\n"
 				"{\n"
-				"    gl_Position = u_mvp_matrix * vec4(a_position, 0.0, 1.0);\n"
+				"    gl_Position = u_pv_matrix * u_m_matrix * vec4(a_position, 0.0, 1.0);\n"
 				"    v_texcoords = a_texcoord;\n"
 				"}\n";
 			const char* const filter_fs =
@@ -595,7 +660,7 @@ namespace KRE
 				"}\n";
 			const uniform_mapping filter_uniform_mapping[] = 
 			{
-				{"mvp_matrix", "u_mvp_matrix"},
+				{"m_matrix", "u_m_matrix"},
 				{"tex_map", "u_tex_map"},
 				{"color", "u_color"},
 				{"", ""},
@@ -609,14 +674,14 @@ namespace KRE
 
 			// converts the alpha map to a white version
 			const char* const alphaizer_vs =
-				"uniform mat4 u_mvp_matrix;\n"
+				"#include \"camera\"\n"
 				"attribute vec2 a_position;\n"
 				"attribute vec2 a_texcoord;\n"
 				"varying vec2 v_texcoords;\n"
 				"\n"
 				"void main()\n"
 				"{\n"
-				"    gl_Position = u_mvp_matrix * vec4(a_position, 0.0, 1.0);\n"
+				"    gl_Position = u_pv_matrix * u_m_matrix * vec4(a_position, 0.0, 1.0);\n"
 				"    v_texcoords = a_texcoord;\n"
 				"}\n";
 			const char* const alphaizer_fs =
@@ -632,7 +697,7 @@ namespace KRE
 				"}\n";
 			const uniform_mapping alphaizer_uniform_mapping[] = 
 			{
-				{"mvp_matrix", "u_mvp_matrix"},
+				{"m_matrix", "u_m_matrix"},
 				{"tex_map", "u_tex_map"},
 				{"", ""},
 			};
@@ -667,32 +732,42 @@ namespace KRE
 				{ "alphaizer", "alphaizer_vs", alphaizer_vs, "alphaizer_fs", alphaizer_fs, alphaizer_uniform_mapping, alphaizer_attribute_mapping },				
 			};
 
+			void set_alternate_names(const ShaderProgramPtr& spp, const uniform_mapping* um, const attribute_mapping* am)
+			{
+				while(strlen(um->alt_name) > 0) {
+					spp->setAlternateUniformName(um->name, um->alt_name);
+					++um;
+				}
+				while(strlen(am->alt_name) > 0) {
+					spp->setAlternateAttributeName(am->name, am->alt_name);
+					++am;
+				}
+				spp->setActives();
+			}
+
 			typedef std::map<std::string, ShaderProgramPtr> shader_factory_map;
 			shader_factory_map& get_shader_factory()
 			{
 				static shader_factory_map res;
-				if(res.empty()) {
-					// XXX load some default shaders here.
-					for(auto& def : shader_defs) {
-						
+				return res;
+			}
+
+			// Built-in programs are only compiled the first time they're asked for, most pages
+			// using just a few of them.
+			ShaderProgramPtr create_builtin_shader(const std::string& name)
+			{
+				for(auto& def : shader_defs) {
+					if(name == def.shader_name) {
 						auto spp = std::make_shared<OpenGL::ShaderProgram>(def.shader_name, 
 							ShaderDef(def.vertex_shader_name, def.vertex_shader_data),
 							ShaderDef(def.fragment_shader_name, def.fragment_shader_data),
 							variant());
-						res[def.shader_name] = spp;
-						auto um = def.u_mapping;
-						while(strlen(um->alt_name) > 0) {
-							spp->setAlternateUniformName(um->name, um->alt_name);
-							++um;
-						}
-						auto am = def.a_mapping;
-						while(strlen(am->alt_name) > 0) {
-							spp->setAlternateAttributeName(am->name, am->alt_name);
-							++am;
-						}
-						spp->setActives();
+						set_alternate_names(spp, def.u_mapping, def.a_mapping);
+						return spp;
 					}
+				}
 
+				if(name == "font_shader") {
 					// special case for font-shader to work around amd bug.
 					std::string font_shader_vertex_shader;
 					variant node;
@@ -712,20 +787,24 @@ namespace KRE
 						ShaderDef("font_shader_vs", font_shader_vertex_shader),
 						ShaderDef("font_shader_fs", font_shader_fs),
 						node);
-					res["font_shader"] = spp;
-					auto um = font_shader_uniform_mapping;
-					while(strlen(um->alt_name) > 0) {
-						spp->setAlternateUniformName(um->name, um->alt_name);
-						++um;
-					}
-					auto am = font_shader_attribute_mapping;
-					while(strlen(am->alt_name) > 0) {
-						spp->setAlternateAttributeName(am->name, am->alt_name);
-						++am;
-					}
-					spp->setActives();
+					set_alternate_names(spp, font_shader_uniform_mapping, font_shader_attribute_mapping);
+					return spp;
 				}
-				return res;
+				return ShaderProgramPtr();
+			}
+
+			ShaderProgramPtr find_shader(const std::string& name)
+			{
+				auto& sf = get_shader_factory();
+				auto it = sf.find(name);
+				if(it != sf.end()) {
+					return it->second;
+				}
+				auto spp = create_builtin_shader(name);
+				if(spp != nullptr) {
+					sf[name] = spp;
+				}
+				return spp;
 			}
 
 			GLenum convert_render_variable_type(AttrFormat type)
@@ -750,12 +829,6 @@ namespace KRE
 				return GL_NONE;
 			}
 
-			GLuint& get_current_active_shader()
-			{
-				static GLuint res = -1;
-				return res;
-			}
-
 			GLenum get_shader_type(ProgramType type)
 			{
 				switch(type) {
@@ -787,13 +860,14 @@ namespace KRE
 			}
 		}
 
-		Shader::Shader(GLenum type, const std::string& name, const std::string& code)
+		Shader::Shader(GLenum type, const std::string& name, const std::string& source)
 			: type_(type), 
 			  shader_(0), 
 			  name_(name)
 		{
 			std::string working_version_str;
 
+			const std::string code = expand_includes(source);
 			bool compiled_ok = compile(code);
 			if(compiled_ok == false && code.find("#version") == std::string::npos) {
 				for(int n = 120; n <= 150; n += 10) {
@@ -853,6 +927,7 @@ namespace KRE
               uniforms_(),
               v_uniforms_(),
               v_attribs_(),
+              uniform_shadow_(),
               uniform_alternate_name_map_(),
               attribute_alternate_name_map_(),
 			  u_mvp_(-1),
@@ -861,6 +936,7 @@ namespace KRE
 			  u_color_(-1),
 			  u_line_width_(-1),
 			  u_tex_(-1),
+			  u_m_(-1),
 			  a_vertex_(-1),
 			  a_texcoord_(-1),
 			  a_color_(-1),
@@ -871,6 +947,11 @@ namespace KRE
 			  u_palette_map_(-1),
 			  u_mix_palettes_(-1),
 			  u_mix_(-1),
+			  camera_block_(CameraBlock::NONE),
+			  u_camera_p_(-1),
+			  u_camera_v_(-1),
+			  u_camera_pv_(-1),
+			  camera_generation_(0),
 			  enabled_attribs_()
 		{
 			init(name, vs, fs);
@@ -887,6 +968,7 @@ namespace KRE
               uniforms_(),
               v_uniforms_(),
               v_attribs_(),
+              uniform_shadow_(),
               uniform_alternate_name_map_(),
               attribute_alternate_name_map_(),
 			  u_mvp_(-1),
@@ -895,6 +977,7 @@ namespace KRE
 			  u_color_(-1),
 			  u_line_width_(-1),
 			  u_tex_(-1),
+			  u_m_(-1),
 			  a_vertex_(-1),
 			  a_texcoord_(-1),
 			  a_color_(-1),
@@ -905,13 +988,18 @@ namespace KRE
 			  u_palette_map_(-1),
 			  u_mix_palettes_(-1),
 			  u_mix_(-1),
+			  camera_block_(CameraBlock::NONE),
+			  u_camera_p_(-1),
+			  u_camera_v_(-1),
+			  u_camera_pv_(-1),
+			  camera_generation_(0),
 			  enabled_attribs_()
 		{
-			std::vector<Shader> shader_programs;
+			std::vector<ShaderStage> stages;
 			for(auto& sd : shader_data) {
-				shader_programs.emplace_back(get_shader_type(sd.type), name + "-" + get_shader_type_abbrev(sd.type), sd.shader_data);
+				stages.emplace_back(get_shader_type(sd.type), name + "-" + get_shader_type_abbrev(sd.type), sd.shader_data);
 			}
-			bool linked_ok = link(shader_programs);
+			bool linked_ok = link(stages);
 			ASSERT_LOG(linked_ok == true, "Error linking program: " << name_);
 			
 			for(auto& um : uniform_map) {
@@ -935,10 +1023,10 @@ namespace KRE
 		{
 			//vs_.reset(new Shader(GL_VERTEX_SHADER, vs.first, vs.second));
 			//fs_.reset(new Shader(GL_FRAGMENT_SHADER, fs.first, fs.second));
-			std::vector<Shader> shader_programs;
-			shader_programs.emplace_back(GL_VERTEX_SHADER, vs.first, vs.second);
-			shader_programs.emplace_back(GL_FRAGMENT_SHADER, fs.first, fs.second);
-			bool linked_ok = link(shader_programs);
+			std::vector<ShaderStage> stages;
+			stages.emplace_back(GL_VERTEX_SHADER, vs.first, vs.second);
+			stages.emplace_back(GL_FRAGMENT_SHADER, fs.first, fs.second);
+			bool linked_ok = link(stages);
 			ASSERT_LOG(linked_ok == true, "Error linking program: " << name_);
 		}
 
@@ -979,7 +1067,7 @@ namespace KRE
 		{
 			auto it = uniforms_.find(attr);
 			if(it != uniforms_.end()) {
-				return it->second.location;
+				return it->second;
 			}
 			auto alt_name_it = uniform_alternate_name_map_.find(attr);
 			if(alt_name_it == uniform_alternate_name_map_.end()) {
@@ -991,12 +1079,14 @@ namespace KRE
 				//LOG_WARN("Uniform \"" << alt_name_it->second << "\" not found in list, looked up from symbol " << attr << " in shader: " << name_);
 				return ShaderProgram::INVALID_UNIFORM;
 			}
-			return it->second.location;
+			return it->second;
 		}
 
-		bool ShaderProgram::link(const std::vector<Shader>& shader_programs)
+		bool ShaderProgram::link(const std::vector<ShaderStage>& stages)
 		{
+			const auto start_time = std::chrono::steady_clock::now();
 			if(object_) {
+				StateTrackerOGL::getInstance().programDeleted(object_);
 				glDeleteProgram(object_);
 				object_ = 0;
 			}
@@ -1006,21 +1096,63 @@ namespace KRE
 			// Pre-link hook to configure any fixed bound locations.
 			// has to occur before glLinkProgram to have any effect.
 			auto& v = getShaderVariant();
+			std::ostringstream binds;
 			if(v.has_key("binds") && v["binds"].is_map()) {
 				for(auto& kv : v["binds"].as_map()) {
 					ASSERT_LOG(kv.first.is_string() && kv.second.is_int(), "Expected binds to be a map of { string : integer } data.");
 					const std::string attrib_str = kv.first.as_string();
 					const int location = kv.second.as_int32();
 					glBindAttribLocation(object_, location, attrib_str.c_str());
+					binds << attrib_str << "=" << location << ";";
 				}
 			}
 
-			for(auto sp : shader_programs) {
-				glAttachShader(object_, sp.get());
+			// The program binary depends on everything that went into linking it, including
+			// how the camera include expands.
+			auto& cache = ProgramCacheOGL::getInstance();
+			std::string cache_key;
+			auto cached = ProgramCacheOGL::LoadResult::MISSING;
+			if(cache.isEnabled()) {
+				std::vector<std::string> key_parts;
+				key_parts.emplace_back(CameraUniformsOGL::isSupported() ? "camera-block" : "camera-uniforms");
+				key_parts.emplace_back(binds.str());
+				for(auto& stage : stages) {
+					std::ostringstream type;
+					type << stage.type;
+					key_parts.emplace_back(type.str());
+					key_parts.emplace_back(stage.source);
+				}
+				cache_key = cache.makeKey(key_parts);
+				cached = cache.load(object_, cache_key);
 			}
-			glLinkProgram(object_);
-			GLint linked = 0;
-			glGetProgramiv(object_, GL_LINK_STATUS, &linked);
+
+			GLint linked = cached == ProgramCacheOGL::LoadResult::LOADED ? 1 : 0;
+			if(!linked) {
+				std::vector<Shader> shader_programs;
+				for(auto& stage : stages) {
+					shader_programs.emplace_back(stage.type, stage.name, stage.source);
+				}
+				for(auto sp : shader_programs) {
+					glAttachShader(object_, sp.get());
+				}
+				if(!cache_key.empty()) {
+					cache.prepare(object_);
+				}
+				glLinkProgram(object_);
+				glGetProgramiv(object_, GL_LINK_STATUS, &linked);
+				if(linked && !cache_key.empty()) {
+					cache.store(object_, cache_key);
+				}
+			}
+
+			++build_stats_.programs_built;
+			if(cached == ProgramCacheOGL::LoadResult::LOADED) {
+				++build_stats_.cache_hits;
+			} else if(cached == ProgramCacheOGL::LoadResult::REJECTED) {
+				++build_stats_.cache_rejects;
+			}
+			build_stats_.build_time_ms += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start_time).count();
+
 			if(!linked) {
 				GLint info_len = 0;
 				glGetProgramiv(object_, GL_INFO_LOG_LENGTH, &info_len);
@@ -1031,11 +1163,16 @@ namespace KRE
 					std::string s(info_log.begin(), info_log.end());
 					LOG_ERROR("Error linking object: " << s);
 				}
+				StateTrackerOGL::getInstance().programDeleted(object_);
 				glDeleteProgram(object_);
 				object_ = 0;
 				return false;
 			}
-			return queryUniforms() && queryAttributes();
+			if(!queryUniforms() || !queryAttributes()) {
+				return false;
+			}
+			queryCamera();
+			return true;
 		}
 
 		bool ShaderProgram::queryUniforms()
@@ -1047,6 +1184,8 @@ namespace KRE
 			std::vector<char> name;
 			name.resize(uniform_max_len+1);
 			LOG_DEBUG("actives(uniforms) for shader: " << name_);
+			uniforms_.clear();
+			v_uniforms_.clear();
 			for(int i = 0; i < active_uniforms; i++) {
 				Actives u;
 				GLsizei size;
@@ -1060,11 +1199,26 @@ namespace KRE
 				}
 		
 				u.location = glGetUniformLocation(object_, u.name.c_str());
+				if(u.location < 0 && CameraUniformsOGL::isSupported()) {
+					// Members of uniform blocks have no location, they're set through the block's buffer.
+					const GLuint index = i;
+					GLint block_index = -1;
+					glGetActiveUniformsiv(object_, 1, &index, GL_UNIFORM_BLOCK_INDEX, &block_index);
+					if(block_index >= 0) {
+						continue;
+					}
+				}
 				ASSERT_LOG(u.location >= 0, "Unable to determine the location of the uniform: " << u.name);
-				uniforms_[u.name] = u;
-				v_uniforms_[u.location] = u;
+				uniforms_[u.name] = static_cast<int>(v_uniforms_.size());
+				v_uniforms_.emplace_back(u);
 				LOG_DEBUG("    " << u.name << " loc: " << u.location << ", num elements: " << u.num_elements << ", type: " << u.type);
 			}
+
+			// A newly linked program starts with nothing known about its uniforms.
+			uniform_shadow_ = std::make_shared<UniformShadow>(v_uniforms_.size());
+			for(size_t n = 0; n != v_uniforms_.size(); ++n) {
+				(*uniform_shadow_)[n].reserve(uniform_value_size(v_uniforms_[n]));
+			}
 			return true;
 		}
 
@@ -1074,6 +1228,8 @@ namespace KRE
 			glGetProgramiv(object_, GL_ACTIVE_ATTRIBUTES, &active_attribs);
 			GLint attributes_max_len;
 			glGetProgramiv(object_, GL_ACTIVE_ATTRIBUTE_MAX_LENGTH, &attributes_max_len);
+			attribs_.clear();
+			v_attribs_.clear();
 			std::vector<char> name;
 			name.resize(attributes_max_len+1);
 			for(int i = 0; i < active_attribs; i++) {
@@ -1085,26 +1241,110 @@ namespace KRE
 				ASSERT_LOG(a.location >= 0, "Unable to determine the location of the attribute: " << a.name);
 				ASSERT_LOG(a.num_elements == 1, "More than one element was found for an attribute(" << a.name << ") in shader(" << this->name() << "): " << a.num_elements);
 				attribs_[a.name] = a;
+				if(a.location >= static_cast<int>(v_attribs_.size())) {
+					Actives unused;
+					unused.type = GL_NONE;
+					unused.num_elements = 0;
+					unused.location = -1;
+					v_attribs_.resize(a.location + 1, unused);
+				}
 				v_attribs_[a.location] = a;
 			}
 			return true;
 		}
 
+		void ShaderProgram::queryCamera()
+		{
+			camera_block_ = CameraBlock::NONE;
+			u_m_ = getUniform("u_m_matrix");
+			u_camera_p_ = getUniform("u_proj_matrix");
+			u_camera_v_ = getUniform("u_view_matrix");
+			u_camera_pv_ = getUniform("u_pv_matrix");
+			camera_generation_ = 0;
+
+			if(CameraUniformsOGL::isSupported()) {
+				const GLuint index = glGetUniformBlockIndex(object_, "u_camera");
+				if(index != GL_INVALID_INDEX) {
+					glUniformBlockBinding(object_, index, CameraUniformsOGL::BindingPoint);
+					camera_block_ = CameraBlock::BUFFER;
+					return;
+				}
+			}
+			if(u_camera_p_ != INVALID_UNIFORM || u_camera_v_ != INVALID_UNIFORM || u_camera_pv_ != INVALID_UNIFORM) {
+				camera_block_ = CameraBlock::UNIFORMS;
+			}
+		}
+
+		void ShaderProgram::setMvpMatrix(const glm::mat4& p, const glm::mat4& v, const glm::mat4& m) const
+		{
+			if(camera_block_ == CameraBlock::NONE) {
+				if(u_mvp_ != INVALID_UNIFORM) {
+					setUniformValue(u_mvp_, glm::value_ptr(p * v * m));
+				}
+				return;
+			}
+
+			auto& camera = CameraUniformsOGL::getInstance();
+			camera.set(p, v);
+			if(camera_block_ == CameraBlock::UNIFORMS && camera_generation_ != camera.getGeneration()) {
+				if(u_camera_p_ != INVALID_UNIFORM) {
+					setUniformValue(u_camera_p_, glm::value_ptr(camera.getProjection()));
+				}
+				if(u_camera_v_ != INVALID_UNIFORM) {
+					setUniformValue(u_camera_v_, glm::value_ptr(camera.getView()));
+				}
+				if(u_camera_pv_ != INVALID_UNIFORM) {
+					setUniformValue(u_camera_pv_, glm::value_ptr(camera.getPV()));
+				}
+				camera_generation_ = camera.getGeneration();
+				++DisplayDevice::getRenderStats().camera_uploads;
+			}
+			if(u_m_ != INVALID_UNIFORM) {
+				setUniformValue(u_m_, glm::value_ptr(m));
+			}
+		}
+
+		const Actives& ShaderProgram::getActiveUniform(int uid) const
+		{
+			ASSERT_LOG(uid >= 0 && uid < static_cast<int>(v_uniforms_.size()), "Couldn't find handle " << uid << " on the uniform list.");
+			return v_uniforms_[uid];
+		}
+
+		const Actives& ShaderProgram::getActiveAttribute(int aid) const
+		{
+			ASSERT_LOG(aid >= 0 && aid < static_cast<int>(v_attribs_.size()) && v_attribs_[aid].location >= 0, 
+				"Couldn't find location " << aid << " on the attribute list.");
+			return v_attribs_[aid];
+		}
+
+		bool ShaderProgram::updateUniformShadow(int uid, const void* value, size_t size) const
+		{
+			auto& stats = DisplayDevice::getRenderStats();
+			if(size == 0) {
+				// A type we don't know the size of, so always upload it.
+				++stats.uniform_uploads;
+				return true;
+			}
+			auto& shadow = (*uniform_shadow_)[uid];
+			const char* bytes = static_cast<const char*>(value);
+			if(shadow.size() == size && std::memcmp(shadow.data(), bytes, size) == 0) {
+				++stats.uniform_uploads_skipped;
+				return false;
+			}
+			shadow.assign(bytes, bytes + size);
+			++stats.uniform_uploads;
+			return true;
+		}
+
 		void ShaderProgram::makeActive()
 		{
-			//if(get_current_active_shader() == object_) {
-			//	return;
-			//}
-			glUseProgram(object_);
-			get_current_active_shader() = object_;
+			StateTrackerOGL::getInstance().useProgram(object_);
 		}
 
 
 		void ShaderProgram::setAttributeValue(int aid, const int value) const 
 		{
-			auto it = v_attribs_.find(aid);
-			ASSERT_LOG(it != v_attribs_.end(), "Couldn't find location " << aid << " on the uniform list.");
-			const Actives& a = it->second;
+			const Actives& a = getActiveAttribute(aid);
 			switch(a.type) {
 				case GL_INT:
 				case GL_BOOL:
@@ -1116,15 +1356,13 @@ namespace KRE
 					glVertexAttrib1f(a.location, static_cast<float>(value));
 					break;
 				default:
-					ASSERT_LOG(false, "Unhandled attribute type: " << it->second.type);
+					ASSERT_LOG(false, "Unhandled attribute type: " << a.type);
 			}
 		}
 
 		void ShaderProgram::setAttributeValue(int aid, const float value) const 
 		{
-			auto it = v_attribs_.find(aid);
-			ASSERT_LOG(it != v_attribs_.end(), "Couldn't find location " << aid << " on the uniform list.");
-			const Actives& a = it->second;
+			const Actives& a = getActiveAttribute(aid);
 			switch(a.type) {
 				case GL_INT:
 				case GL_BOOL:
@@ -1136,7 +1374,7 @@ namespace KRE
 					glVertexAttrib1f(a.location, value);
 					break;
 				default:
-					ASSERT_LOG(false, "Unhandled attribute type: " << it->second.type);
+					ASSERT_LOG(false, "Unhandled attribute type: " << a.type);
 			}
 		}
 
@@ -1146,9 +1384,7 @@ namespace KRE
 				LOG_WARN("Tried to set value for invalid attribute iterator.");
 				return;
 			}
-			auto it = v_attribs_.find(aid);
-			ASSERT_LOG(it != v_attribs_.end(), "Couldn't find location " << aid << " on the uniform list.");
-			const Actives& a = it->second;
+			const Actives& a = getActiveAttribute(aid);
 			ASSERT_LOG(value != nullptr, "setAttributeValue(): value is nullptr");
 			switch(a.type) {
 				case GL_FLOAT:
@@ -1164,7 +1400,7 @@ namespace KRE
 					glVertexAttrib4fv(a.location, value);
 					break;
 				default:
-					ASSERT_LOG(false, "Unhandled uniform type: " << it->second.type);
+					ASSERT_LOG(false, "Unhandled uniform type: " << a.type);
 			}
 		}
 
@@ -1174,9 +1410,7 @@ namespace KRE
 				LOG_WARN("Tried to set value for invalid attribute iterator.");
 				return;
 			}
-			auto it = v_attribs_.find(aid);
-			ASSERT_LOG(it != v_attribs_.end(), "Couldn't find location " << aid << " on the uniform list.");
-			const Actives& a = it->second;
+			const Actives& a = getActiveAttribute(aid);
 			ASSERT_LOG(value != nullptr, "setAttributeValue(): value is nullptr");
 			switch(a.type) {
 				case GL_INT:
@@ -1201,7 +1435,7 @@ namespace KRE
 					glVertexAttrib1f(a.location, static_cast<float>(*value));
 					break;
 				default:
-					ASSERT_LOG(false, "Unhandled uniform type: " << it->second.type);
+					ASSERT_LOG(false, "Unhandled uniform type: " << a.type);
 			}
 		}
 
@@ -1211,16 +1445,14 @@ namespace KRE
 				LOG_WARN("Tried to set value for invalid attribute iterator.");
 				return;
 			}
-			auto it = v_attribs_.find(aid);
-			ASSERT_LOG(it != v_attribs_.end(), "Couldn't find location " << aid << " on the uniform list.");
-			const Actives& a = it->second;
+			const Actives& a = getActiveAttribute(aid);
 			ASSERT_LOG(value != nullptr, "setAttributeValue(): value is nullptr");
 			switch(a.type) {
 				case GL_FLOAT_VEC4:
 					glVertexAttrib4ubv(a.location, value);
 					break;
 				default:
-					ASSERT_LOG(false, "Unhandled uniform type: " << it->second.type);
+					ASSERT_LOG(false, "Unhandled uniform type: " << a.type);
 			}
 		}
 
@@ -1240,10 +1472,11 @@ namespace KRE
 				LOG_WARN("Tried to set value for invalid uniform iterator.");
 				return;
 			}
-			auto it = v_uniforms_.find(uid);
-			ASSERT_LOG(it != v_uniforms_.end(), "Couldn't find location " << uid << " on the uniform list.");
-			const Actives& u = it->second;
+			const Actives& u = getActiveUniform(uid);
 			ASSERT_LOG(value != nullptr, "setUniformValue(): value is nullptr");
+			if(!updateUniformShadow(uid, value, uniform_value_size(u))) {
+				return;
+			}
 			switch(u.type) {
 			case GL_INT:
 			case GL_BOOL:
@@ -1297,7 +1530,7 @@ namespace KRE
 				break;
 			}
 			default:
-				ASSERT_LOG(false, "Unhandled uniform type: " << it->second.type);
+				ASSERT_LOG(false, "Unhandled uniform type: " << u.type);
 			}
 		}
 
@@ -1307,21 +1540,25 @@ namespace KRE
 				LOG_WARN("Tried to set value for invalid uniform iterator.");
 				return;
 			}
-			auto it = v_uniforms_.find(uid);
-			ASSERT_LOG(it != v_uniforms_.end(), "Couldn't find location " << uid << " on the uniform list.");
-			const Actives& u = it->second;
+			const Actives& u = getActiveUniform(uid);
 			switch(u.type) {
 			case GL_INT:
 			case GL_BOOL:
 			case GL_SAMPLER_2D:
 			case GL_SAMPLER_CUBE:	
-				glUniform1i(u.location, value); 
+				if(updateUniformShadow(uid, &value, sizeof(value))) {
+					glUniform1i(u.location, value); 
+				}
 				break;
-			case GL_FLOAT:
-				glUniform1f(u.location, static_cast<float>(value));
+			case GL_FLOAT: {
+				const GLfloat f = static_cast<float>(value);
+				if(updateUniformShadow(uid, &f, sizeof(f))) {
+					glUniform1f(u.location, f);
+				}
 				break;
+			}
 			default:
-				ASSERT_LOG(false, "Unhandled uniform type: " << it->second.type);
+				ASSERT_LOG(false, "Unhandled uniform type: " << u.type);
 			}
 		}
 
@@ -1331,16 +1568,16 @@ namespace KRE
 				LOG_WARN("Tried to set value for invalid uniform iterator.");
 				return;
 			}
-			auto it = v_uniforms_.find(uid);
-			ASSERT_LOG(it != v_uniforms_.end(), "Couldn't find location " << uid << " on the uniform list.");
-			const Actives& u = it->second;
+			const Actives& u = getActiveUniform(uid);
 			switch(u.type) {
 			case GL_FLOAT: {
-				glUniform1f(u.location, value);
+				if(updateUniformShadow(uid, &value, sizeof(value))) {
+					glUniform1f(u.location, value);
+				}
 				break;
 			}
 			default:
-				ASSERT_LOG(false, "Unhandled uniform type: " << it->second.type);
+				ASSERT_LOG(false, "Unhandled uniform type: " << u.type);
 			}	
 		}
 
@@ -1350,10 +1587,15 @@ namespace KRE
 				LOG_WARN("Tried to set value for invalid uniform iterator.");
 				return;
 			}
-			auto it = v_uniforms_.find(uid);
-			ASSERT_LOG(it != v_uniforms_.end(), "Couldn't find location " << uid << " on the uniform list.");
-			const Actives& u = it->second;
+			const Actives& u = getActiveUniform(uid);
 			ASSERT_LOG(value != nullptr, "set_uniform(): value is nullptr");
+			if(u.type == GL_FLOAT) {
+				setUniformValue(uid, static_cast<float>(*value));
+				return;
+			}
+			if(!updateUniformShadow(uid, value, uniform_value_size(u))) {
+				return;
+			}
 			switch(u.type) {
 			case GL_INT:
 			case GL_BOOL:
@@ -1373,11 +1615,8 @@ namespace KRE
 			case GL_BOOL_VEC4:
 				glUniform4iv(u.location, u.num_elements, value); 
 				break;
-			case GL_FLOAT:
-				glUniform1f(u.location, static_cast<float>(*value));
-				break;
 			default:
-				ASSERT_LOG(false, "Unhandled uniform type: " << it->second.type);
+				ASSERT_LOG(false, "Unhandled uniform type: " << u.type);
 			}
 		}
 
@@ -1387,10 +1626,11 @@ namespace KRE
 				LOG_WARN("Tried to set value for invalid uniform iterator.");
 				return;
 			}
-			auto it = v_uniforms_.find(uid);
-			ASSERT_LOG(it != v_uniforms_.end(), "Couldn't find location " << uid << " on the uniform list.");
-			const Actives& u = it->second;
+			const Actives& u = getActiveUniform(uid);
 			ASSERT_LOG(value != nullptr, "setUniformValue(): value is nullptr");
+			if(!updateUniformShadow(uid, value, uniform_value_size(u))) {
+				return;
+			}
 			switch(u.type) {
 			case GL_FLOAT: {
 				if(u.num_elements > 1) {
@@ -1425,7 +1665,7 @@ namespace KRE
 				break;
 			}
 			default:
-				ASSERT_LOG(false, "Unhandled uniform type: " << it->second.type);
+				ASSERT_LOG(false, "Unhandled uniform type: " << u.type);
 			}	
 		}
 
@@ -1435,16 +1675,17 @@ namespace KRE
 				LOG_WARN("Tried to set value for invalid uniform iterator.");
 				return;
 			}
-			auto it = v_uniforms_.find(uid);
-			ASSERT_LOG(it != v_uniforms_.end(), "Couldn't find location " << uid << " on the uniform list.");
-			const Actives& u = it->second;
+			const Actives& u = getActiveUniform(uid);
 			if(value.is_null()) {
 				ASSERT_LOG(false, "setUniformFromVariant(): value is null. shader='" << getName() << "', uid: " << uid << " : '" << u.name << "'");
 			}
 			switch(u.type) {
 			case GL_FLOAT: {
 				if(u.num_elements == 1) {
-					glUniform1f(u.location, value.as_float());
+					const GLfloat v = value.as_float();
+					if(updateUniformShadow(uid, &v, sizeof(v))) {
+						glUniform1f(u.location, v);
+					}
 				} else {
 					ASSERT_LOG(u.num_elements == value.num_elements(), "Incorrect number of elements for uniform array: " << u.num_elements << " vs " << value.num_elements());
 					std::vector<float> v(u.num_elements);
@@ -1452,7 +1693,9 @@ namespace KRE
 						v[n] = value[n].as_float();
 					}
 
-					glUniform1fv(u.location, u.num_elements, &v[0]);
+					if(updateUniformShadow(uid, &v[0], v.size() * sizeof(float))) {
+						glUniform1fv(u.location, u.num_elements, &v[0]);
+					}
 				}
 				break;
 			}
@@ -1464,7 +1707,9 @@ namespace KRE
 				for(int n = 0; n < value.num_elements(); ++n) {
 					v[n] = value[n].as_float();
 				}
-				glUniform2fv(u.location, static_cast<GLsizei>(v.size()/2), &v[0]);
+				if(updateUniformShadow(uid, &v[0], v.size() * sizeof(float))) {
+					glUniform2fv(u.location, static_cast<GLsizei>(v.size()/2), &v[0]);
+				}
 				break;
 			}
 			case GL_FLOAT_VEC3: {
@@ -1475,7 +1720,9 @@ namespace KRE
 				for(int n = 0; n < value.num_elements(); ++n) {
 					v[n] = value[n].as_float();
 				}
-				glUniform3fv(u.location, static_cast<GLsizei>(v.size()/3), &v[0]);
+				if(updateUniformShadow(uid, &v[0], v.size() * sizeof(float))) {
+					glUniform3fv(u.location, static_cast<GLsizei>(v.size()/3), &v[0]);
+				}
 				break;
 			}
 			case GL_FLOAT_VEC4: {
@@ -1486,14 +1733,19 @@ namespace KRE
 				for(int n = 0; n < value.num_elements(); ++n) {
 					v[n] = value[n].as_float();
 				}
-				glUniform4fv(u.location, static_cast<GLsizei>(v.size()/4), &v[0]);
+				if(updateUniformShadow(uid, &v[0], v.size() * sizeof(float))) {
+					glUniform4fv(u.location, static_cast<GLsizei>(v.size()/4), &v[0]);
+				}
 				break;
 			}
 			
 			case GL_BOOL:
 			case GL_INT: {
 				if(u.num_elements == 1) {
-					glUniform1i(u.location, value.as_int32());
+					const GLint v = value.as_int32();
+					if(updateUniformShadow(uid, &v, sizeof(v))) {
+						glUniform1i(u.location, v);
+					}
 				} else {
 					ASSERT_LOG(u.num_elements == value.num_elements(), "Incorrect number of elements for uniform array: " << u.num_elements << " vs " << value.num_elements());
 					std::vector<int> v(u.num_elements);
@@ -1501,7 +1753,9 @@ namespace KRE
 						v[n] = value[n].as_int32();
 					}
 
-					glUniform1iv(u.location, u.num_elements, &v[0]);
+					if(updateUniformShadow(uid, &v[0], v.size() * sizeof(int))) {
+						glUniform1iv(u.location, u.num_elements, &v[0]);
+					}
 				}
 				break;
 			}
@@ -1514,7 +1768,9 @@ namespace KRE
 				for(int n = 0; n < value.num_elements(); ++n) {
 					v[n] = value[n].as_int32();
 				}
-				glUniform2iv(u.location, static_cast<GLsizei>(v.size()/2), &v[0]);
+				if(updateUniformShadow(uid, &v[0], v.size() * sizeof(int))) {
+					glUniform2iv(u.location, static_cast<GLsizei>(v.size()/2), &v[0]);
+				}
 				break;
 			}
 			case GL_BOOL_VEC3:	
@@ -1526,7 +1782,9 @@ namespace KRE
 				for(int n = 0; n < value.num_elements(); ++n) {
 					v[n] = value[n].as_int32();
 				}
-				glUniform3iv(u.location, static_cast<GLsizei>(v.size()/3), &v[0]);
+				if(updateUniformShadow(uid, &v[0], v.size() * sizeof(int))) {
+					glUniform3iv(u.location, static_cast<GLsizei>(v.size()/3), &v[0]);
+				}
 				break;
 			}
 			case GL_BOOL_VEC4:
@@ -1538,7 +1796,9 @@ namespace KRE
 				for(int n = 0; n < value.num_elements(); ++n) {
 					v[n] = value[n].as_int32();
 				}
-				glUniform2iv(u.location, static_cast<GLsizei>(v.size()/4), &v[0]);
+				if(updateUniformShadow(uid, &v[0], v.size() * sizeof(int))) {
+					glUniform2iv(u.location, static_cast<GLsizei>(v.size()/4), &v[0]);
+				}
 				break;
 			}
 			
@@ -1548,7 +1808,9 @@ namespace KRE
 				for(int n = 0; n < value.num_elements(); ++n) {
 					v[n] = value[n].as_float();
 				}
-				glUniformMatrix2fv(u.location, u.num_elements, GL_FALSE, &v[0]);
+				if(updateUniformShadow(uid, v, sizeof(v))) {
+					glUniformMatrix2fv(u.location, u.num_elements, GL_FALSE, &v[0]);
+				}
 				break;
 			}
 			case GL_FLOAT_MAT3: {
@@ -1557,7 +1819,9 @@ namespace KRE
 				for(int n = 0; n < value.num_elements(); ++n) {
 					v[n] = GLfloat(value[n].as_float());
 				}
-				glUniformMatrix3fv(u.location, u.num_elements, GL_FALSE, &v[0]);
+				if(updateUniformShadow(uid, v, sizeof(v))) {
+					glUniformMatrix3fv(u.location, u.num_elements, GL_FALSE, &v[0]);
+				}
 				break;
 			}
 			case GL_FLOAT_MAT4: {
@@ -1566,15 +1830,23 @@ namespace KRE
 				for(int n = 0; n < value.num_elements(); ++n) {
 					v[n] = GLfloat(value[n].as_float());
 				}
-				glUniformMatrix4fv(u.location, u.num_elements, GL_FALSE, &v[0]);
+				if(updateUniformShadow(uid, v, sizeof(v))) {
+					glUniformMatrix4fv(u.location, u.num_elements, GL_FALSE, &v[0]);
+				}
 				break;
 			}
 
-			case GL_SAMPLER_2D:		glUniform1i(u.location, value.as_int32()); break;
+			case GL_SAMPLER_2D: {
+				const GLint v = value.as_int32();
+				if(updateUniformShadow(uid, &v, sizeof(v))) {
+					glUniform1i(u.location, v);
+				}
+				break;
+			}
 
 			case GL_SAMPLER_CUBE:
 			default:
-				LOG_DEBUG("Unhandled uniform type: " << it->second.type);
+				LOG_DEBUG("Unhandled uniform type: " << u.type);
 			}
 		}
 
@@ -1594,7 +1866,7 @@ namespace KRE
 
 		void ShaderProgram::setActives()
 		{
-			glUseProgram(object_);
+			StateTrackerOGL::getInstance().useProgram(object_);
 			// Cache some frequently used uniforms.
 			u_mvp_ = getUniform("mvp_matrix");
 			u_mv_ = getUniform("mv_matrix");
@@ -1622,10 +1894,9 @@ namespace KRE
 
 		ShaderProgramPtr ShaderProgram::factory(const std::string& name)
 		{
-			auto& sf = get_shader_factory();
-			auto it = sf.find(name);
-			ASSERT_LOG(it != sf.end(), "Shader '" << name << "' not found in the list of shaders.");
-			return it->second;
+			auto spp = find_shader(name);
+			ASSERT_LOG(spp != nullptr, "Shader '" << name << "' not found in the list of shaders.");
+			return spp;
 		}
 
 		ShaderProgramPtr ShaderProgram::factory(const variant& node)
@@ -1635,10 +1906,9 @@ namespace KRE
 
 		ShaderProgramPtr ShaderProgram::defaultSystemShader()
 		{
-			auto& sf = get_shader_factory();
-			auto it = sf.find("default");
-			ASSERT_LOG(it != sf.end(), "No 'default' shader found in the list of shaders.");
-			return it->second;
+			auto spp = find_shader("default");
+			ASSERT_LOG(spp != nullptr, "No 'default' shader found in the list of shaders.");
+			return spp;
 		}
 
 		ShaderProgramPtr ShaderProgram::getProgramFromVariant(const variant& node)
@@ -1647,9 +1917,9 @@ namespace KRE
 
 			if(node.has_key("name") && !node.has_key("vertex") && !node.has_key("fragment")) {
 				std::string name = node["name"].as_string();
-				auto it = sf.find(name);
-				ASSERT_LOG(it != sf.end(), "Unable to find shader '" << name << "'");
-				return it->second;
+				auto spp = find_shader(name);
+				ASSERT_LOG(spp != nullptr, "Unable to find shader '" << name << "'");
+				return spp;
 			}
 
 			ASSERT_LOG(node.is_map(), "instance must be a map.");
@@ -1660,16 +1930,16 @@ namespace KRE
 			const std::string& vert_data = node["vertex"].as_string();
 			const std::string& frag_data = node["fragment"].as_string();
 
-			auto it = sf.find(name);
-			if(it != sf.end()) {
-				return it->second;
+			auto existing = find_shader(name);
+			if(existing != nullptr) {
+				return existing;
 			}
 
 			auto spp = std::make_shared<OpenGL::ShaderProgram>(name, 
 				ShaderDef(name + "_vs", vert_data),
 				ShaderDef(name + "_fs", frag_data),
 				node);
-			it = sf.find(name);
+			auto it = sf.find(name);
 			if(it != sf.end()) {
 				LOG_WARN("Overwriting shader with name: " << name);
 			}
@@ -1872,17 +2142,8 @@ namespace KRE
 				<< "}\n";
 
 			auto spp = std::make_shared<OpenGL::ShaderProgram>(shader_name, ShaderDef("blur_fs", blur_vs), ShaderDef(fs_name, fs.str()), variant());
-			auto um = blur_uniform_mapping;
-			while(strlen(um->alt_name) > 0) {
-				spp->setAlternateUniformName(um->name, um->alt_name);
-				++um;
-			}
-			auto am = blur_attribute_mapping;
-			while(strlen(am->alt_name) > 0) {
-				spp->setAlternateAttributeName(am->name, am->alt_name);
-				++am;
-			}
-			spp->setActives();
+			set_alternate_names(spp, blur_uniform_mapping, blur_attribute_mapping);
+			sf[shader_name] = spp;
 			return spp;
 		}
 	}
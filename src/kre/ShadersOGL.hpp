@@ -41,7 +41,7 @@ namespace KRE
 		class Shader
 		{
 		public:
-			explicit Shader(GLenum type, const std::string& name, const std::string& code);
+			explicit Shader(GLenum type, const std::string& name, const std::string& source);
 			GLuint get() const { return shader_; }
 			std::string name() const { return name_; }
 		protected:
@@ -68,6 +68,15 @@ namespace KRE
 
 		typedef std::pair<std::string,std::string> ShaderDef;
 
+		// Source for one stage of a program, compiled when the program is linked.
+		struct ShaderStage
+		{
+			explicit ShaderStage(GLenum t, const std::string& n, const std::string& src) : type(t), name(n), source(src) {}
+			GLenum type;
+			std::string name;
+			std::string source;
+		};
+
 		typedef std::map<std::string, Actives> ActivesMap;
 
 		class ShaderProgram;
@@ -135,6 +144,10 @@ namespace KRE
 			int getPUniform() const override { return u_p_; }
 			int getMvpUniform() const override { return u_mvp_; }
 			int getTexMapUniform() const override { return u_tex_; }
+			int getMUniform() const override { return u_m_; }
+
+			void setMvpMatrix(const glm::mat4& p, const glm::mat4& v, const glm::mat4& m) const override;
+			bool usesCameraBlock() const override { return camera_block_ != CameraBlock::NONE; }
 			
 			int getColorAttribute() const override { return a_color_; }
 			int getVertexAttribute() const override { return a_vertex_; }
@@ -148,9 +161,18 @@ namespace KRE
 
 			KRE::ShaderProgramPtr clone() override;
 		protected:
-			bool link(const std::vector<Shader>& shader_programs);
+			// Loads the program from the program binary cache if it's there, otherwise compiles
+			// the stages and links them.
+			bool link(const std::vector<ShaderStage>& stages);
 			bool queryUniforms();
 			bool queryAttributes();
+			void queryCamera();
+
+			const Actives& getActiveUniform(int uid) const;
+			const Actives& getActiveAttribute(int aid) const;
+			// Records the bytes about to be uploaded to a uniform, returning false if the uniform
+			// already holds them so the upload can be skipped.
+			bool updateUniformShadow(int uid, const void* value, size_t size) const;
 
 			std::vector<GLint> active_attributes_;
 		private:
@@ -159,9 +181,15 @@ namespace KRE
 			std::string name_;
 			GLuint object_;
 			ActivesMap attribs_;
-			ActivesMap uniforms_;
-			std::unordered_map<int, Actives> v_uniforms_;
-			std::unordered_map<int, Actives> v_attribs_;
+			// Uniform handles are indexes into v_uniforms_, assigned when the program is linked.
+			// Attribute handles are their locations, which are small enough to index v_attribs_.
+			std::map<std::string, int> uniforms_;
+			std::vector<Actives> v_uniforms_;
+			std::vector<Actives> v_attribs_;
+			// The values last uploaded to each uniform, by handle. Shared with clones, which use
+			// the same program object.
+			typedef std::vector<std::vector<char>> UniformShadow;
+			std::shared_ptr<UniformShadow> uniform_shadow_;
 			std::map<std::string, std::string> uniform_alternate_name_map_;
 			std::map<std::string, std::string> attribute_alternate_name_map_;
 
@@ -172,6 +200,7 @@ namespace KRE
 			int u_color_;
 			int u_line_width_;
 			int u_tex_;
+			int u_m_;
 			int a_vertex_;
 			int a_texcoord_;
 			int a_color_;
@@ -184,6 +213,15 @@ namespace KRE
 			int u_mix_palettes_;
 			int u_mix_;
 
+			// How the program gets the camera from the standard camera include, if it does.
+			enum class CameraBlock { NONE, BUFFER, UNIFORMS };
+			CameraBlock camera_block_;
+			int u_camera_p_;
+			int u_camera_v_;
+			int u_camera_pv_;
+			// The CameraUniformsOGL generation last uploaded, when the program has its own copy.
+			mutable unsigned camera_generation_;
+
 			std::vector<GLuint> enabled_attribs_;
 		};
 	}
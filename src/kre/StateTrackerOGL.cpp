@@ -0,0 +1,234 @@
+/*
+	Copyright (C) 2016 by Kristina Simpson <sweet.kristas@gmail.com>
+	
+	This software is provided 'as-is', without any express or implied
+	warranty. In no event will the authors be held liable for any damages
+	arising from the use of this software.
+
+	Permission is granted to anyone to use this software for any purpose,
+	including commercial applications, and to alter it and redistribute it
+	freely, subject to the following restrictions:
+
+	   1. The origin of this software must not be misrepresented; you must not
+	   claim that you wrote the original software. If you use this software
+	   in a product, an acknowledgment in the product documentation would be
+	   appreciated but is not required.
+
+	   2. Altered source versions must be plainly marked as such, and must not be
+	   misrepresented as being the original software.
+
+	   3. This notice may not be removed or altered from any source
+	   distribution.
+*/
+
+#include "asserts.hpp"
+#include "DisplayDevice.hpp"
+#include "StateTrackerOGL.hpp"
+
+namespace KRE
+{
+	namespace
+	{
+		const GLuint unknown_id = static_cast<GLuint>(-1);
+
+		void count_change(bool changed)
+		{
+			if(changed) {
+				++DisplayDevice::getRenderStats().state_changes;
+			} else {
+				++DisplayDevice::getRenderStats().state_changes_skipped;
+			}
+		}
+	}
+
+	StateTrackerOGL::StateTrackerOGL()
+		: blend_(1),
+		  blend_src_(GL_SRC_ALPHA),
+		  blend_dst_(GL_ONE_MINUS_SRC_ALPHA),
+		  blend_eqn_rgb_(GL_FUNC_ADD),
+		  blend_eqn_alpha_(GL_FUNC_ADD),
+		  depth_test_(0),
+		  pending_draws_fn_(nullptr)
+	{
+		reset();
+	}
+
+	StateTrackerOGL& StateTrackerOGL::getInstance()
+	{
+		static StateTrackerOGL res;
+		return res;
+	}
+
+	void StateTrackerOGL::reset()
+	{
+		program_ = unknown_id;
+		active_unit_ = -1;
+		for(auto& tex : textures_) {
+			tex = unknown_id;
+		}
+		array_buffer_ = unknown_id;
+		element_buffer_ = unknown_id;
+
+		// The requested state is kept, so the next applyState() sets all of it again.
+		applied_blend_ = -1;
+		applied_blend_src_ = applied_blend_dst_ = GL_NONE;
+		applied_blend_eqn_rgb_ = applied_blend_eqn_alpha_ = GL_NONE;
+		applied_depth_test_ = -1;
+	}
+
+	void StateTrackerOGL::useProgram(GLuint program)
+	{
+		const bool changed = program != program_;
+		count_change(changed);
+		if(changed) {
+			glUseProgram(program);
+			program_ = program;
+		}
+	}
+
+	bool StateTrackerOGL::bindTexture(int unit, GLenum target, GLuint id)
+	{
+		ASSERT_LOG(unit >= 0 && unit < MaxTextureUnits, "Texture unit out of range: " << unit);
+		const bool changed = textures_[unit] != id;
+		count_change(changed);
+		if(changed) {
+			if(active_unit_ != unit) {
+				glActiveTexture(GL_TEXTURE0 + unit);
+				active_unit_ = unit;
+			}
+			glBindTexture(target, id);
+			textures_[unit] = id;
+		}
+		return changed;
+	}
+
+	void StateTrackerOGL::bindTexture(GLenum target, GLuint id)
+	{
+		if(active_unit_ < 0) {
+			glBindTexture(target, id);
+			count_change(true);
+			return;
+		}
+		bindTexture(active_unit_, target, id);
+	}
+
+	void StateTrackerOGL::bindBuffer(GLenum target, GLuint id)
+	{
+		GLuint* current = nullptr;
+		if(target == GL_ARRAY_BUFFER) {
+			current = &array_buffer_;
+		} else if(target == GL_ELEMENT_ARRAY_BUFFER) {
+			current = &element_buffer_;
+		}
+		const bool changed = current == nullptr || *current != id;
+		count_change(changed);
+		if(changed) {
+			glBindBuffer(target, id);
+			if(current != nullptr) {
+				*current = id;
+			}
+		}
+	}
+
+	void StateTrackerOGL::setBlendEnabled(bool en)
+	{
+		if(blend_ != (en ? 1 : 0)) {
+			flushPendingDraws();
+		}
+		blend_ = en ? 1 : 0;
+	}
+
+	void StateTrackerOGL::setBlendFunc(GLenum src, GLenum dst)
+	{
+		if(blend_src_ != src || blend_dst_ != dst) {
+			flushPendingDraws();
+		}
+		blend_src_ = src;
+		blend_dst_ = dst;
+	}
+
+	void StateTrackerOGL::setBlendEquation(GLenum rgb, GLenum alpha)
+	{
+		if(blend_eqn_rgb_ != rgb || blend_eqn_alpha_ != alpha) {
+			flushPendingDraws();
+		}
+		blend_eqn_rgb_ = rgb;
+		blend_eqn_alpha_ = alpha;
+	}
+
+	void StateTrackerOGL::setDepthTest(bool en)
+	{
+		if(depth_test_ != (en ? 1 : 0)) {
+			flushPendingDraws();
+		}
+		depth_test_ = en ? 1 : 0;
+	}
+
+	void StateTrackerOGL::applyState()
+	{
+		bool changed = blend_ != applied_blend_;
+		count_change(changed);
+		if(changed) {
+			if(blend_) {
+				glEnable(GL_BLEND);
+			} else {
+				glDisable(GL_BLEND);
+			}
+			applied_blend_ = blend_;
+		}
+
+		changed = blend_src_ != applied_blend_src_ || blend_dst_ != applied_blend_dst_;
+		count_change(changed);
+		if(changed) {
+			glBlendFunc(blend_src_, blend_dst_);
+			applied_blend_src_ = blend_src_;
+			applied_blend_dst_ = blend_dst_;
+		}
+
+		changed = blend_eqn_rgb_ != applied_blend_eqn_rgb_ || blend_eqn_alpha_ != applied_blend_eqn_alpha_;
+		count_change(changed);
+		if(changed) {
+			glBlendEquationSeparate(blend_eqn_rgb_, blend_eqn_alpha_);
+			applied_blend_eqn_rgb_ = blend_eqn_rgb_;
+			applied_blend_eqn_alpha_ = blend_eqn_alpha_;
+		}
+
+		changed = depth_test_ != applied_depth_test_;
+		count_change(changed);
+		if(changed) {
+			if(depth_test_) {
+				glEnable(GL_DEPTH_TEST);
+			} else {
+				glDisable(GL_DEPTH_TEST);
+			}
+			applied_depth_test_ = depth_test_;
+		}
+	}
+
+	void StateTrackerOGL::programDeleted(GLuint program)
+	{
+		if(program_ == program) {
+			program_ = unknown_id;
+		}
+	}
+
+	void StateTrackerOGL::textureDeleted(GLuint id)
+	{
+		// Deleting a bound texture binds 0 in its place.
+		for(auto& tex : textures_) {
+			if(tex == id) {
+				tex = 0;
+			}
+		}
+	}
+
+	void StateTrackerOGL::bufferDeleted(GLuint id)
+	{
+		if(array_buffer_ == id) {
+			array_buffer_ = 0;
+		}
+		if(element_buffer_ == id) {
+			element_buffer_ = 0;
+		}
+	}
+}
@@ -0,0 +1,99 @@
+/*
+	Copyright (C) 2016 by Kristina Simpson <sweet.kristas@gmail.com>
+	
+	This software is provided 'as-is', without any express or implied
+	warranty. In no event will the authors be held liable for any damages
+	arising from the use of this software.
+
+	Permission is granted to anyone to use this software for any purpose,
+	including commercial applications, and to alter it and redistribute it
+	freely, subject to the following restrictions:
+
+	   1. The origin of this software must not be misrepresented; you must not
+	   claim that you wrote the original software. If you use this software
+	   in a product, an acknowledgment in the product documentation would be
+	   appreciated but is not required.
+
+	   2. Altered source versions must be plainly marked as such, and must not be
+	   misrepresented as being the original software.
+
+	   3. This notice may not be removed or altered from any source
+	   distribution.
+*/
+
+#pragma once
+
+#include <GL/glew.h>
+
+namespace KRE
+{
+	// Shadows the OpenGL state that changes most between draws so calls that wouldn't change
+	// anything are skipped. Program, texture and buffer bindings are made straight away since the
+	// calls that follow them depend on them. Blend and depth state are only applied by applyState()
+	// just before drawing, so a scope restoring the state and the next draw setting it again cost
+	// nothing. All of the OpenGL backend has to change this state through here.
+	class StateTrackerOGL
+	{
+	public:
+		static StateTrackerOGL& getInstance();
+
+		// Forgets all of the shadowed state, for when it may have been changed behind our back.
+		void reset();
+
+		void useProgram(GLuint program);
+		// Returns true if the texture had to be bound.
+		bool bindTexture(int unit, GLenum target, GLuint id);
+		// Binds to the active unit, for uploading to the texture.
+		void bindTexture(GLenum target, GLuint id);
+		void bindBuffer(GLenum target, GLuint id);
+
+		void setBlendEnabled(bool en);
+		void setBlendFunc(GLenum src, GLenum dst);
+		void setBlendEquation(GLenum rgb, GLenum alpha);
+		void setDepthTest(bool en);
+		// Makes the pending blend and depth state current. Call before every draw.
+		void applyState();
+
+		// Draws held back to be submitted together have to go out before the state they were made
+		// under changes. Blend and depth changes here flush them, code changing other state directly
+		// (stencil, scissor, framebuffer, clears) calls flushPendingDraws() first.
+		typedef void (*FlushFn)();
+		void setPendingDrawsFn(FlushFn fn) { pending_draws_fn_ = fn; }
+		void flushPendingDraws() const { if(pending_draws_fn_ != nullptr) pending_draws_fn_(); }
+
+		// GL re-uses the names of deleted objects so they have to be forgotten.
+		void programDeleted(GLuint program);
+		void textureDeleted(GLuint id);
+		void bufferDeleted(GLuint id);
+	private:
+		StateTrackerOGL();
+		StateTrackerOGL(const StateTrackerOGL&);
+		void operator=(const StateTrackerOGL&);
+
+		enum { MaxTextureUnits = 32 };
+
+		GLuint program_;
+		int active_unit_;
+		GLuint textures_[MaxTextureUnits];
+		GLuint array_buffer_;
+		GLuint element_buffer_;
+
+		// State requested, which starts as the defaults set up by the display device.
+		int blend_;
+		GLenum blend_src_;
+		GLenum blend_dst_;
+		GLenum blend_eqn_rgb_;
+		GLenum blend_eqn_alpha_;
+		int depth_test_;
+
+		// State last applied, -1 or GL_NONE when not known.
+		int applied_blend_;
+		GLenum applied_blend_src_;
+		GLenum applied_blend_dst_;
+		GLenum applied_blend_eqn_rgb_;
+		GLenum applied_blend_eqn_alpha_;
+		int applied_depth_test_;
+
+		FlushFn pending_draws_fn_;
+	};
+}
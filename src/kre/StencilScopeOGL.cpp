@@ -25,6 +25,7 @@
 
 #include <stack>
 #include "StencilScopeOGL.hpp"
+#include "StateTrackerOGL.hpp"
 
 namespace KRE
 {
@@ -90,6 +91,7 @@ namespace KRE
 
 	StencilScopeOGL::~StencilScopeOGL()
 	{
+		StateTrackerOGL::getInstance().flushPendingDraws();
 		get_stencil_stack().pop();
 		if(get_stencil_stack().empty()) {
 			glDisable(GL_STENCIL_TEST);
@@ -101,6 +103,7 @@ namespace KRE
 
 	void StencilScopeOGL::applySettings(const StencilSettings& settings)
 	{
+		StateTrackerOGL::getInstance().flushPendingDraws();
 		if(settings.enabled()) {
 			glEnable(GL_STENCIL_TEST);
 			if(settings.face() == StencilFace::FRONT_AND_BACK) {
@@ -127,6 +130,7 @@ namespace KRE
 
 	void StencilScopeOGL::handleUpdatedMask()
 	{
+		StateTrackerOGL::getInstance().flushPendingDraws();
 		if(getSettings().enabled()) {
 			if(getSettings().face() == StencilFace::FRONT_AND_BACK) {
 				glStencilMask(getSettings().mask());
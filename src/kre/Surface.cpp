@@ -21,12 +21,21 @@
 	   distribution.
 */
 
+#include <atomic>
+#include <cstring>
 #include <future>
+#include <mutex>
 #include <thread>
 #include <tuple>
 
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define SURFACE_SWIZZLE_SSE2
+#include <emmintrin.h>
+#endif
+
 #include "Surface.hpp"
 #include "stb_rect_pack.h"
+#include "unit_test.hpp"
 
 namespace KRE
 {
@@ -39,16 +48,25 @@ namespace KRE
 			return res;
 		}
 
-		typedef std::map<std::string, SurfacePtr> SurfaceCacheType;
+		const size_t default_surface_cache_budget = 128 * 1024 * 1024;
+
+		typedef LruCache<std::string, Surface> SurfaceCacheType;
 		SurfaceCacheType& get_surface_cache()
 		{
-			static SurfaceCacheType res;
+			static SurfaceCacheType res(default_surface_cache_budget);
+			return res;
+		}
+
+		// Images may be loaded from the decode threads, as well as the main one.
+		std::mutex& get_surface_cache_mutex()
+		{
+			static std::mutex res;
 			return res;
 		}
 
 		unsigned get_next_id()
 		{
-			static unsigned id = 1;
+			static std::atomic<unsigned> id(1);
 			return id++;
 		}
 
@@ -63,6 +81,7 @@ namespace KRE
 		  pf_(nullptr),
 		  alpha_map_(nullptr),
 		  name_(),
+		  from_file_(false),
 		  id_(get_next_id()),
 		  alpha_borders_{}
 	{
@@ -100,8 +119,7 @@ namespace KRE
 
 	void Surface::convertInPlace(PixelFormat::PF fmt, SurfaceConvertFn convert)
 	{
-		auto surf = handleConvert(fmt, convert);
-		*this = *surf.get();
+		handleConvertInPlace(fmt, convert);
 	}
 
 	bool Surface::registerSurfaceCreator(const std::string& name, 
@@ -125,18 +143,24 @@ namespace KRE
 		ASSERT_LOG(get_surface_creator().empty() == false, "No resources registered to surfaces images from files.");
 		auto create_fn_tuple = get_surface_creator().begin()->second;
 		if(!(flags & SurfaceFlags::NO_CACHE)) {
-			auto it = get_surface_cache().find(filename);
-			if(it != get_surface_cache().end()) {
-				return it->second;
+			{
+				std::lock_guard<std::mutex> lock(get_surface_cache_mutex());
+				auto cached = get_surface_cache().get(filename);
+				if(cached != nullptr) {
+					return cached;
+				}
 			}
 			auto surface = std::get<0>(create_fn_tuple)(filename, fmt, flags, convert);
 			surface->name_ = filename;
-			get_surface_cache()[filename] = surface;
+			surface->from_file_ = true;
 			surface->init();
+			std::lock_guard<std::mutex> lock(get_surface_cache_mutex());
+			get_surface_cache().put(filename, surface, surface->rowPitch() * surface->height(), filename);
 			return surface;
 		} 
 		auto surf = std::get<0>(create_fn_tuple)(filename, fmt, flags, convert);
 		surf->name_ = filename;
+		surf->from_file_ = true;
 		surf->init();
 		return surf;
 	}
@@ -201,40 +225,45 @@ namespace KRE
 
 	void Surface::createAlphaMap()
 	{
-		const int npixels = width() * height();
-		alpha_map_ = std::make_shared<std::vector<bool>>();
-		alpha_map_->resize(npixels);
+		alpha_map_ = std::make_shared<AlphaMap>(width(), height());
+		auto pf = getPixelFormat();
+		uint32_t color_key = 0;
+		const bool has_color_key = getColorKey(&color_key);
+		// Indexed formats get their alpha from the palette, so only RGB formats without an
+		// alpha channel or color key are known to be opaque.
+		const bool indexed = PixelFormat::isIndexedFormat(pf->getFormat());
+		if(!pf->hasAlphaChannel() && !indexed && !has_color_key) {
+			alpha_map_->setOpaque();
+			return;
+		}
 
-		if(getPixelFormat()->hasAlphaChannel()) {
-			SurfaceLock lck(shared_from_this());
-			auto pf = getPixelFormat();
-			uint32_t alpha_mask = pf->getAlphaMask();
-			if(bytesPerPixel() == 4 && rowPitch() % 4 == 0) {
-				// Optimization for a common case. Operates ~25 faster than default case.
-				const uint32_t* px = reinterpret_cast<const uint32_t*>(pixels());
-				auto it = alpha_map_->begin();
-				for(int n = 0; n != npixels; ++n) {
-					*it++ = (*px++ & alpha_mask) ? false : true;
+		SurfaceLock lck(shared_from_this());
+		if(has_color_key && !indexed) {
+			// Key pixels are transparent, anything else keeps the alpha it has.
+			int kr = 0, kg = 0, kb = 0, ka = 0;
+			pf->extractRGBA(&color_key, 0, kr, kg, kb, ka);
+			auto& am = *alpha_map_;
+			std::vector<uint8_t> alpha(width());
+			visitRows([&](int x, int y, const PixelRGBA* px, int count) {
+				for(int n = 0; n != count; ++n) {
+					alpha[n] = px[n].r == kr && px[n].g == kg && px[n].b == kb ? 0 : px[n].a;
 				}
-			} else {
-				std::fill(alpha_map_->begin(), alpha_map_->end(), false);
-				int w = width();
-				auto& am = *alpha_map_;
-				iterateOverSurface([&am, w](int x, int y, int r, int g, int b, int a) {
-					if(a == 0) {
-						am[x + y * w] = true;
-					}
-				});
+				am.setAlphaSpan(x, y, alpha.data(), 1, count);
+			});
+			return;
+		}
+		const uint32_t alpha_shift = pf->hasAlphaChannel() ? pf->getAlphaShift() : 0;
+		if(pf->hasAlphaChannel() && bytesPerPixel() == 4 && pf->getAlphaMask() == 0xffU << alpha_shift) {
+			// Common case, done a row at a time with SIMD.
+			for(int y = 0; y != height(); ++y) {
+				alpha_map_->setRow32(y, reinterpret_cast<const uint32_t*>(static_cast<const uint8_t*>(pixels()) + y * rowPitch()), alpha_shift);
 			}
+		} else {
+			auto& am = *alpha_map_;
+			visitRows([&am](int x, int y, const PixelRGBA* px, int count) {
+				am.setAlphaSpan(x, y, &px->a, sizeof(PixelRGBA), count);
+			});
 		}
-
-		//if(getPixelFormat()->hasAlphaChannel()) {
-			//int w = width();
-			//auto& am = alpha_map_;
-			//iterateOverSurface([&am, w](int x, int y, int r, int g, int b, int a) {
-			//	am[x + y * w] = a == 0 ? true : false;
-			//});
-		//}
 	}
 
 	void Surface::stripAlphaBorders(int threshold)
@@ -301,9 +330,28 @@ namespace KRE
 
 	void Surface::resetSurfaceCache()
 	{
+		std::lock_guard<std::mutex> lock(get_surface_cache_mutex());
 		get_surface_cache().clear();
 	}
 
+	void Surface::setCacheBudget(size_t bytes)
+	{
+		std::lock_guard<std::mutex> lock(get_surface_cache_mutex());
+		get_surface_cache().setBudget(bytes);
+	}
+
+	CacheStats Surface::getCacheStats()
+	{
+		std::lock_guard<std::mutex> lock(get_surface_cache_mutex());
+		return get_surface_cache().getStats();
+	}
+
+	void Surface::dumpCache(std::ostream& os)
+	{
+		std::lock_guard<std::mutex> lock(get_surface_cache_mutex());
+		get_surface_cache().dump(os);
+	}
+
 	void Surface::fillRect(const rect& dst_rect, const Color& color)
 	{
 		// XXX do we need to consider ARGB/RGBA ordering issues here.
@@ -347,18 +395,21 @@ namespace KRE
 	color_histogram_type Surface::getColorHistogram(ColorCountFlags flags)
 	{
 		color_histogram_type res;
-		iterateOverSurface([&res](int x, int y, int r, int g, int b, int a) {
-			//Color color(r, g, b, a);
-			color_histogram_type::key_type color = (static_cast<uint32_t>(r) << 24)
-				| (static_cast<uint32_t>(g) << 16)
-				| (static_cast<uint32_t>(b) << 8)
-				| (static_cast<uint32_t>(a));
-			//ASSERT_LOG(color >= 18446744072937384447UL, "ugh: " << r << "," << g << "," << b << "," << a);
-			auto it = res.find(color);
-			if(it == res.end()) {
-				res[color] = 1;
-			} else {
-				it->second += 1;
+		visitRows([&res](int x, int y, const PixelRGBA* px, int count) {
+			// Runs of the same color are common, so count those up before touching the map.
+			int n = 0;
+			while(n != count) {
+				const PixelRGBA& p = px[n];
+				int run = 1;
+				while(n + run != count && std::memcmp(&px[n + run], &p, sizeof(PixelRGBA)) == 0) {
+					++run;
+				}
+				const color_histogram_type::key_type color = (static_cast<uint32_t>(p.r) << 24)
+					| (static_cast<uint32_t>(p.g) << 16)
+					| (static_cast<uint32_t>(p.b) << 8)
+					| (static_cast<uint32_t>(p.a));
+				res[color] += run;
+				n += run;
 			}
 		});
 		//for(auto px : *this) {
@@ -428,6 +479,27 @@ namespace KRE
 	{
 	}
 
+	bool PixelFormat::getChannelShifts32(std::array<int, 4>* shifts)
+	{
+		if(bytesPerPixel() != 4 || hasPalette() || !isRGB()) {
+			return false;
+		}
+		const bool present[4] = { hasRedChannel(), hasGreenChannel(), hasBlueChannel(), hasAlphaChannel() };
+		const uint32_t masks[4] = { getRedMask(), getGreenMask(), getBlueMask(), getAlphaMask() };
+		const uint32_t channel_shifts[4] = { getRedShift(), getGreenShift(), getBlueShift(), getAlphaShift() };
+		for(int c = 0; c != 4; ++c) {
+			if(!present[c]) {
+				(*shifts)[c] = -1;
+				continue;
+			}
+			if(channel_shifts[c] % 8 != 0 || masks[c] != 0xffU << channel_shifts[c]) {
+				return false;
+			}
+			(*shifts)[c] = static_cast<int>(channel_shifts[c]);
+		}
+		return true;
+	}
+
 	bool PixelFormat::isIndexedFormat(PixelFormat::PF pf)
 	{
 		switch(pf) {
@@ -444,21 +516,20 @@ namespace KRE
 
 	bool Surface::isAlpha(unsigned x, unsigned y) const
 	{ 
-		ASSERT_LOG(alpha_map_ != nullptr && alpha_map_->size() > 0, "No alpha map found.");
-		ASSERT_LOG(x + y* width() < static_cast<int>(alpha_map_->size()), "Index exceeds alpha map size.");
-		return (*alpha_map_)[y*width()+x]; 
+		ASSERT_LOG(alpha_map_ != nullptr, "No alpha map found.");
+		ASSERT_LOG(static_cast<int>(x) < alpha_map_->width() && static_cast<int>(y) < alpha_map_->height(), "Index exceeds alpha map size.");
+		return alpha_map_->isTransparent(x, y); 
 	}
 
-	std::vector<bool>::const_iterator Surface::getAlphaRow(int x, int y) const 
-	{ 
-		ASSERT_LOG(alpha_map_ != nullptr && alpha_map_->size() > 0, "No alpha map found.");
-		ASSERT_LOG(x + y* width() < static_cast<int>(alpha_map_->size()), "Index exceeds alpha map size.");
-		return alpha_map_->begin() + y * width() + x; 
+	bool Surface::isOpaque() const
+	{
+		return alpha_map_ != nullptr && alpha_map_->getCoverage() == AlphaCoverage::Opaque;
 	}
 
-	std::vector<bool>::const_iterator Surface::endAlpha() const 
-	{ 
-		return alpha_map_->end(); 
+	AlphaCoverage Surface::getAlphaCoverage(const rect& r) const
+	{
+		ASSERT_LOG(alpha_map_ != nullptr, "No alpha map found.");
+		return alpha_map_->getCoverage(r);
 	}
 
 	void Surface::iterateOverSurface(surface_iterator_fn fn)
@@ -473,32 +544,135 @@ namespace KRE
 
 	void Surface::iterateOverSurface(int sx, int sy, int sw, int sh, surface_iterator_fn iterator_fn)
 	{
-		SurfaceLock lck(shared_from_this());
+		visitRows(sx, sy, sw, sh, [&iterator_fn](int x, int y, const PixelRGBA* px, int count) {
+			for(int n = 0; n != count; ++n) {
+				iterator_fn(x + n, y, px[n].r, px[n].g, px[n].b, px[n].a);
+			}
+		});
+	}
+
+	std::vector<PixelRGBA> Surface::getPaletteRGBA()
+	{
+		std::vector<PixelRGBA> colors;
+		if(!PixelFormat::isIndexedFormat(getPixelFormat()->getFormat())) {
+			return colors;
+		}
+		const auto& palette = getPalette();
+		colors.reserve(palette.size());
+		for(auto& c : palette) {
+			colors.push_back(PixelRGBA{ static_cast<uint8_t>(c.r_int()), static_cast<uint8_t>(c.g_int()), static_cast<uint8_t>(c.b_int()), static_cast<uint8_t>(c.a_int()) });
+		}
+		uint32_t color_key = 0;
+		if(getColorKey(&color_key) && color_key < colors.size()) {
+			colors[color_key].a = 0;
+		}
+		return colors;
+	}
+
+	void Surface::readRow(int x, int y, int count, PixelRGBA* out, const std::vector<PixelRGBA>& colors)
+	{
 		auto pf = getPixelFormat();
-		if(pf->getFormat() == PixelFormat::PF::PIXELFORMAT_INDEX1LSB 
-			|| pf->getFormat() == PixelFormat::PF::PIXELFORMAT_INDEX1MSB 
-			|| pf->getFormat() == PixelFormat::PF::PIXELFORMAT_INDEX4LSB 
-			|| pf->getFormat() == PixelFormat::PF::PIXELFORMAT_INDEX4MSB) {
-			int cnt = (pf->getFormat() == PixelFormat::PF::PIXELFORMAT_INDEX1LSB || pf->getFormat() == PixelFormat::PF::PIXELFORMAT_INDEX1MSB) ? 8 : 2;
-			for(int y = sy; y != sh; ++y) {
-				for(int x = sx; x != sw; ++x) {
-					for(int n = 0; n != cnt; ++n) {
-						int red = 0, green = 0, blue = 0, alpha = 0;
-						const uint8_t* px = &reinterpret_cast<const uint8_t*>(pixels())[x * bytesPerPixel() + y * rowPitch()];
-						pf->extractRGBA(px, n, red, green, blue, alpha);
-						iterator_fn(x, y, red, green, blue, alpha);
-					}
+		const uint8_t* row = static_cast<const uint8_t*>(pixels()) + y * rowPitch();
+		std::array<int, 4> shifts;
+		if(pf->getChannelShifts32(&shifts)) {
+			swizzle_pixels32(reinterpret_cast<const uint32_t*>(row) + x, shifts, reinterpret_cast<uint32_t*>(out), pixel_rgba_shifts(), count);
+			return;
+		}
+
+		if(PixelFormat::isIndexedFormat(pf->getFormat())) {
+			const int bits = bitsPerPixel();
+			const bool msb_first = pf->getFormat() == PixelFormat::PF::PIXELFORMAT_INDEX1MSB || pf->getFormat() == PixelFormat::PF::PIXELFORMAT_INDEX4MSB;
+			for(int n = 0; n != count; ++n) {
+				const int bit = (x + n) * bits;
+				int index = row[bit / 8];
+				if(bits < 8) {
+					index = (msb_first ? index >> (8 - bits - bit % 8) : index >> (bit % 8)) & ((1 << bits) - 1);
 				}
+				ASSERT_LOG(index < static_cast<int>(colors.size()), "Index into palette invalid. " << index << " >= " << colors.size());
+				out[n] = colors[index];
 			}
-		} else {
-			for(int y = sy; y != sh; ++y) {
-				for(int x = sx; x != sw; ++x) {
-					int red = 0, green = 0, blue = 0, alpha = 0;
-					const uint8_t* px = &reinterpret_cast<const uint8_t*>(pixels())[x * bytesPerPixel() + y * rowPitch()];
-					pf->extractRGBA(px, 0, red, green, blue, alpha);
-					iterator_fn(x, y, red, green, blue, alpha);
-				}
+			return;
+		}
+
+		const int bpp = bytesPerPixel();
+		for(int n = 0; n != count; ++n) {
+			int red = 0, green = 0, blue = 0, alpha = 0;
+			pf->extractRGBA(row + (x + n) * bpp, 0, red, green, blue, alpha);
+			out[n] = PixelRGBA{ static_cast<uint8_t>(red), static_cast<uint8_t>(green), static_cast<uint8_t>(blue), static_cast<uint8_t>(alpha) };
+		}
+	}
+
+	void Surface::writeRow(int x, int y, int count, const PixelRGBA* in)
+	{
+		auto pf = getPixelFormat();
+		uint8_t* row = static_cast<uint8_t*>(pixelsWriteable()) + y * rowPitch();
+		std::array<int, 4> shifts;
+		if(pf->getChannelShifts32(&shifts)) {
+			swizzle_pixels32(reinterpret_cast<const uint32_t*>(in), pixel_rgba_shifts(), reinterpret_cast<uint32_t*>(row) + x, shifts, count);
+			return;
+		}
+		const int bpp = bytesPerPixel();
+		for(int n = 0; n != count; ++n) {
+			pf->encodeRGBA(row + (x + n) * bpp, in[n].r, in[n].g, in[n].b, in[n].a);
+		}
+	}
+
+	const std::array<int, 4>& pixel_rgba_shifts()
+	{
+		static const std::array<int, 4> res = []() {
+			const uint32_t probe = 1;
+			const bool little_endian = *reinterpret_cast<const uint8_t*>(&probe) == 1;
+			return little_endian ? std::array<int, 4>{{ 0, 8, 16, 24 }} : std::array<int, 4>{{ 24, 16, 8, 0 }};
+		}();
+		return res;
+	}
+
+	void swizzle_pixels32(const uint32_t* src, const std::array<int, 4>& src_shifts, uint32_t* dst, const std::array<int, 4>& dst_shifts, int count)
+	{
+		// Work out which channels move where, and the constant part from channels missing in the source.
+		int from[4];
+		int to[4];
+		int moves = 0;
+		uint32_t fill = 0;
+		for(int c = 0; c != 4; ++c) {
+			if(dst_shifts[c] < 0) {
+				continue;
+			}
+			if(src_shifts[c] < 0) {
+				fill |= c == 3 ? 0xffU << dst_shifts[c] : 0;
+				continue;
+			}
+			from[moves] = src_shifts[c];
+			to[moves] = dst_shifts[c];
+			++moves;
+		}
+
+		int n = 0;
+#if defined(SURFACE_SWIZZLE_SSE2)
+		const __m128i byte_mask = _mm_set1_epi32(0xff);
+		const __m128i fill_value = _mm_set1_epi32(static_cast<int>(fill));
+		__m128i from_count[4];
+		__m128i to_count[4];
+		for(int m = 0; m != moves; ++m) {
+			from_count[m] = _mm_cvtsi32_si128(from[m]);
+			to_count[m] = _mm_cvtsi32_si128(to[m]);
+		}
+		for(; n + 4 <= count; n += 4) {
+			const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + n));
+			__m128i res = fill_value;
+			for(int m = 0; m != moves; ++m) {
+				res = _mm_or_si128(res, _mm_sll_epi32(_mm_and_si128(_mm_srl_epi32(v, from_count[m]), byte_mask), to_count[m]));
+			}
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(dst + n), res);
+		}
+#endif
+		for(; n != count; ++n) {
+			const uint32_t v = src[n];
+			uint32_t res = fill;
+			for(int m = 0; m != moves; ++m) {
+				res |= ((v >> from[m]) & 0xff) << to[m];
 			}
+			dst[n] = res;
 		}
 	}
 
@@ -614,3 +788,61 @@ namespace KRE
 		return out;
 	}
 }
+
+UNIT_TEST(swizzle_pixels32)
+{
+	// ARGB8888 to the PixelRGBA layout and back, with an odd count so the tail is exercised too.
+	const std::array<int, 4> argb = {{ 16, 8, 0, 24 }};
+	const std::array<int, 4> xrgb = {{ 16, 8, 0, -1 }};
+	std::vector<uint32_t> src;
+	for(uint32_t n = 0; n != 11; ++n) {
+		src.push_back(0x01020304U * (n + 1) + (n << 28));
+	}
+	std::vector<uint32_t> rgba(src.size());
+	KRE::swizzle_pixels32(src.data(), argb, rgba.data(), KRE::pixel_rgba_shifts(), static_cast<int>(src.size()));
+	for(size_t n = 0; n != src.size(); ++n) {
+		const KRE::PixelRGBA* p = reinterpret_cast<const KRE::PixelRGBA*>(&rgba[n]);
+		CHECK_EQ(static_cast<uint32_t>(p->r), (src[n] >> 16) & 0xff);
+		CHECK_EQ(static_cast<uint32_t>(p->g), (src[n] >> 8) & 0xff);
+		CHECK_EQ(static_cast<uint32_t>(p->b), src[n] & 0xff);
+		CHECK_EQ(static_cast<uint32_t>(p->a), src[n] >> 24);
+	}
+	std::vector<uint32_t> back(src.size());
+	KRE::swizzle_pixels32(rgba.data(), KRE::pixel_rgba_shifts(), back.data(), argb, static_cast<int>(src.size()));
+	CHECK(back == src, "ARGB8888 round trip changed the pixels");
+
+	// No alpha in the source reads as opaque.
+	KRE::swizzle_pixels32(src.data(), xrgb, back.data(), argb, static_cast<int>(src.size()));
+	for(size_t n = 0; n != src.size(); ++n) {
+		CHECK_EQ(back[n], src[n] | 0xff000000U);
+	}
+}
+
+UNIT_TEST(lru_cache)
+{
+	KRE::LruCache<std::string, int> cache(100);
+	auto held = std::make_shared<int>(1);
+	cache.put("a", held, 60);
+	cache.put("b", std::make_shared<int>(2), 30);
+	CHECK(cache.get("b") != nullptr, "b should be cached");
+	CHECK(cache.get("c") == nullptr, "c should not be cached");
+
+	// Over budget, "a" is least recently used but still referenced so "b" goes instead.
+	cache.put("c", std::make_shared<int>(3), 30);
+	CHECK(cache.get("a") != nullptr, "a was evicted while in use");
+	CHECK(cache.get("b") == nullptr, "b should have been evicted");
+
+	auto stats = cache.getStats();
+	CHECK_EQ(stats.evictions, 1);
+	CHECK_EQ(stats.entries, 2);
+	CHECK_EQ(stats.bytes, size_t(90));
+	CHECK_EQ(stats.in_use_bytes, size_t(60));
+	CHECK_EQ(stats.hits, 2);
+	CHECK_EQ(stats.misses, 2);
+
+	held.reset();
+	CHECK(cache.get("c") != nullptr, "c should be cached");
+	cache.setBudget(50);
+	CHECK(cache.get("a") == nullptr, "a should be evicted once released");
+	CHECK(cache.get("c") != nullptr, "c fits in the budget");
+}
@@ -23,15 +23,19 @@
 
 #pragma once
 
+#include <array>
 #include <cstdint>
 #include <functional>
 #include <map>
 #include <memory>
 #include <tuple>
 #include <unordered_map>
+#include <vector>
 
 #include "geometry.hpp"
+#include "AlphaMap.hpp"
 #include "Cursor.hpp"
+#include "LruCache.hpp"
 #include "PixelFormat.hpp"
 #include "WindowManagerFwd.hpp"
 
@@ -50,6 +54,8 @@ namespace KRE
 		// If this is supplied then any rows/columns of the image that contain pure alpha pixels are stripped
 		// until we generate an image that is minimal in size.
 		STRIP_ALPHA_BORDERS = 4,
+		// Multiply the color channels by alpha when loading.
+		PREMULTIPLY_ALPHA	= 8,
 
 		// Special internal code to indicate that we are not loading from a file, but the image data is inside
 		// the passed in string.
@@ -110,6 +116,19 @@ namespace KRE
 
 	typedef std::function<void(int,int,int,int,int,int)> surface_iterator_fn;
 
+	// A pixel with 8-bit channels, the form that rows are handed out in by Surface::visitRows().
+	struct PixelRGBA
+	{
+		uint8_t r, g, b, a;
+	};
+
+	// Channel shifts (see PixelFormat::getChannelShifts32()) of a PixelRGBA read as a uint32_t.
+	const std::array<int, 4>& pixel_rgba_shifts();
+
+	// Moves the channels of count 32-bit pixels from one layout of 8-bit channels to another. A
+	// channel missing from the source reads as 0, or 255 for alpha. src and dst may be the same.
+	void swizzle_pixels32(const uint32_t* src, const std::array<int, 4>& src_shifts, uint32_t* dst, const std::array<int, 4>& dst_shifts, int count);
+
 	class Surface : public std::enable_shared_from_this<Surface>
 	{
 	public:
@@ -128,6 +147,24 @@ namespace KRE
 
 		void init();
 
+		// Calls fn(x, y, const PixelRGBA* pixels, int count) for each row of the given area, with
+		// the pixels unpacked to 8-bit channels. The surface is locked while doing so.
+		template<typename F> void visitRows(int x, int y, int w, int h, F fn);
+		template<typename F> void visitRows(F fn) { visitRows(0, 0, width(), height(), fn); }
+		// Calls fn(x, y, r, g, b, a) for every pixel.
+		template<typename F> void visitPixels(F fn);
+
+		// Unpacks or packs count pixels starting at (x, y). Formats with 8-bit channels in 32-bit
+		// pixels are converted in bulk, anything else a pixel at a time through the pixel format. 
+		// Indexed formats are looked up in palette, as returned by getPaletteRGBA(). The surface
+		// must be locked.
+		void readRow(int x, int y, int count, PixelRGBA* out, const std::vector<PixelRGBA>& palette);
+		void writeRow(int x, int y, int count, const PixelRGBA* in);
+		// The palette unpacked for readRow(), empty unless the surface has an indexed format. 
+		// The color key entry, if there is one, has zero alpha.
+		std::vector<PixelRGBA> getPaletteRGBA();
+
+		// As visitPixels(), but calling through a std::function.
 		void iterateOverSurface(surface_iterator_fn fn);
 		void iterateOverSurface(rect r, surface_iterator_fn fn);
 		void iterateOverSurface(int x, int y, int w, int h, surface_iterator_fn fn);
@@ -178,6 +215,9 @@ namespace KRE
 		size_t getColorCount(ColorCountFlags flags=ColorCountFlags::NONE);
 
 		virtual const std::vector<Color>& getPalette() = 0;
+		// Sets key to the raw pixel value (palette index for indexed formats) that is drawn as 
+		// transparent, returns false if the surface has no color key.
+		virtual bool getColorKey(uint32_t* key) const = 0;
 
 		static bool registerSurfaceCreator(const std::string& name, 
 			SurfaceCreatorFileFn file_fn, 
@@ -205,6 +245,10 @@ namespace KRE
 		static SurfacePtr create(int width, int height, PixelFormat::PF fmt);
 
 		static void resetSurfaceCache();
+		// Surfaces loaded from files are kept until the cache goes over budget and nothing else is using them.
+		static void setCacheBudget(size_t bytes);
+		static CacheStats getCacheStats();
+		static void dumpCache(std::ostream& os);
 
 		static void setFileFilter(FileFilterType type, file_filter fn);
 		static file_filter getFileFilter(FileFilterType type);
@@ -220,15 +264,18 @@ namespace KRE
 
 		virtual const unsigned char* colorAt(int x, int y) const { return nullptr; }
 		bool isAlpha(unsigned x, unsigned y) const;
-		std::vector<bool>::const_iterator getAlphaRow(int x, int y) const;
-		std::vector<bool>::const_iterator endAlpha() const;
+		// True if every pixel has full alpha, so the surface can be drawn without blending.
+		bool isOpaque() const;
+		AlphaCoverage getAlphaCoverage(const rect& r) const;
 
 		void createAlphaMap();
 
 		const std::string& getName() const { return name_; }
+		// True if the surface was loaded from the file named by getName().
+		bool isFromFile() const { return from_file_; }
 
-		std::shared_ptr<std::vector<bool>> getAlphaMap() { return alpha_map_; }
-		void setAlphaMap(std::shared_ptr<std::vector<bool>> am) { alpha_map_ = am; }
+		AlphaMapPtr getAlphaMap() { return alpha_map_; }
+		void setAlphaMap(AlphaMapPtr am) { alpha_map_ = am; }
 
 		const std::array<int, 4>& getAlphaBorders() const { return alpha_borders_; }
 
@@ -249,13 +296,38 @@ namespace KRE
 		virtual void stripAlphaBorders(int threshold = 0);
 	private:
 		virtual SurfacePtr handleConvert(PixelFormat::PF fmt, SurfaceConvertFn convert) = 0;
+		virtual void handleConvertInPlace(PixelFormat::PF fmt, SurfaceConvertFn convert) = 0;
 		SurfaceFlags flags_;
 		PixelFormatPtr pf_;
-		std::shared_ptr<std::vector<bool>> alpha_map_;
+		AlphaMapPtr alpha_map_;
 		std::string name_;
+		bool from_file_;
 		unsigned id_;
 		// If STRIP_ALPHA_BORDERS was given this is the number of pixels stripped off each side.
 		// ordered left, top, right, bottom.
 		std::array<int, 4> alpha_borders_;
 	};
+
+	template<typename F> void Surface::visitRows(int x, int y, int w, int h, F fn)
+	{
+		if(w <= 0 || h <= 0) {
+			return;
+		}
+		SurfaceLock lck(shared_from_this());
+		const std::vector<PixelRGBA> palette = getPaletteRGBA();
+		std::vector<PixelRGBA> row(w);
+		for(int n = y; n != y + h; ++n) {
+			readRow(x, n, w, row.data(), palette);
+			fn(x, n, static_cast<const PixelRGBA*>(row.data()), w);
+		}
+	}
+
+	template<typename F> void Surface::visitPixels(F fn)
+	{
+		visitRows([&fn](int x, int y, const PixelRGBA* px, int count) {
+			for(int n = 0; n != count; ++n) {
+				fn(x + n, y, px[n].r, px[n].g, px[n].b, px[n].a);
+			}
+		});
+	}
 }
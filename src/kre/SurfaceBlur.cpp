@@ -21,9 +21,15 @@
 	   distribution.
 */
 
+#include <algorithm>
+#include <cstring>
+#include <vector>
+
 #include "profile_timer.hpp"
+#include "unit_test.hpp"
 
 #include "SurfaceBlur.hpp"
+#include "ThreadPool.hpp"
 
 namespace KRE
 {
@@ -92,22 +98,139 @@ namespace KRE
 			}
 		}
 
+		// The functions below are the same filter as blur_cols()/blur_rows() and give identical
+		// results, but are arranged to be cache friendly and to split up over threads.
+
+		inline void blur_step(int& z, unsigned char& p, int alpha)
+		{
+			z += (alpha * (((int)(p) << ZPREC) - z)) >> APREC;
+			p = (unsigned char)(z >> ZPREC);
+		}
+
+		// Blurs along each of the rows [y0, y1). Four rows are filtered together so that the 
+		// four independent filter chains can be overlapped by the CPU.
+		void blur_horizontal(unsigned char* pixels, int w, int y0, int y1, int stride, int alpha, int aoffs, int Bpp)
+		{
+			int y = y0;
+			for(; y + 4 <= y1; y += 4) {
+				unsigned char* r0 = pixels + y * stride + aoffs;
+				unsigned char* r1 = r0 + stride;
+				unsigned char* r2 = r1 + stride;
+				unsigned char* r3 = r2 + stride;
+				int z0 = 0, z1 = 0, z2 = 0, z3 = 0;
+				for(int x = Bpp; x < w*Bpp; x += Bpp) {
+					blur_step(z0, r0[x], alpha);
+					blur_step(z1, r1[x], alpha);
+					blur_step(z2, r2[x], alpha);
+					blur_step(z3, r3[x], alpha);
+				}
+				r0[(w-1)*Bpp] = r1[(w-1)*Bpp] = r2[(w-1)*Bpp] = r3[(w-1)*Bpp] = 0;
+				z0 = z1 = z2 = z3 = 0;
+				for(int x = (w-2)*Bpp; x >= 0; x -= Bpp) {
+					blur_step(z0, r0[x], alpha);
+					blur_step(z1, r1[x], alpha);
+					blur_step(z2, r2[x], alpha);
+					blur_step(z3, r3[x], alpha);
+				}
+				r0[0] = r1[0] = r2[0] = r3[0] = 0;
+			}
+			if(y < y1) {
+				blur_cols(pixels + y * stride, w, y1 - y, stride, alpha, aoffs, Bpp);
+			}
+		}
+
+		// Number of columns filtered together by blur_vertical(), keeps the filter state
+		// in the L1 cache while each row is read sequentially.
+		const int vertical_block_width = 256;
+
+		// Blurs down each of the columns [x0, x1). Rather than walking down one column at a 
+		// time a block of columns is processed a row at a time, with the filter state for
+		// each column kept in z.
+		void blur_vertical(unsigned char* pixels, int h, int x0, int x1, int stride, int alpha, int aoffs, int Bpp)
+		{
+			int z[vertical_block_width];
+			for(int bx = x0; bx < x1; bx += vertical_block_width) {
+				const int bw = std::min(vertical_block_width, x1 - bx);
+				unsigned char* col = pixels + bx * Bpp + aoffs;
+
+				std::fill(z, z + bw, 0);
+				for(int y = 1; y < h; ++y) {
+					unsigned char* row = col + y * stride;
+					for(int n = 0; n != bw; ++n) {
+						blur_step(z[n], row[n*Bpp], alpha);
+					}
+				}
+				unsigned char* last_row = col + (h-1) * stride;
+				for(int n = 0; n != bw; ++n) {
+					last_row[n*Bpp] = 0;
+				}
+
+				std::fill(z, z + bw, 0);
+				for(int y = h-2; y >= 0; --y) {
+					unsigned char* row = col + y * stride;
+					for(int n = 0; n != bw; ++n) {
+						blur_step(z[n], row[n*Bpp], alpha);
+					}
+				}
+				for(int n = 0; n != bw; ++n) {
+					col[n*Bpp] = 0;
+				}
+			}
+		}
+
+		int blur_alpha_from_radius(float blur)
+		{
+			const float sigma = blur * 0.57735f; // 1 / sqrt(3)
+			return static_cast<int>((1<<APREC) * (1.0f - expf(-2.3f / (sigma+1.0f))));
+		}
+
+		void alpha_blur(unsigned char* dst, int w, int h, int stride, int alpha, int aoffs, int Bpp)
+		{
+			if(w <= 0 || h <= 0) {
+				return;
+			}
+			// Don't split into pieces of less than about 16K pixels, the threading overhead isn't worth it.
+			const int min_pixels = 16384;
+			const int min_rows = std::max(4, min_pixels / w);
+			const int min_cols = std::max(vertical_block_width, min_pixels / h);
+			auto& pool = ThreadPool::getInstance();
+			for(int pass = 0; pass != 2; ++pass) {
+				pool.parallelFor(w, min_cols, [=](int x0, int x1) {
+					blur_vertical(dst, h, x0, x1, stride, alpha, aoffs, Bpp);
+				});
+				pool.parallelFor(h, min_rows, [=](int y0, int y1) {
+					blur_horizontal(dst, w, y0, y1, stride, alpha, aoffs, Bpp);
+				});
+			}
+		}
 	}
 
 	void pixels_alpha_blur(void* pixels, int w, int h, int stride, float blur)
+	{
+		pixels_alpha_blur(pixels, w, h, stride, 1, 0, blur);
+	}
+
+	void pixels_alpha_blur(void* pixels, int w, int h, int stride, int bpp, int alpha_offset, float blur)
 	{
 		profile::manager pman("pixels_alpha_blur");
 		if(blur < 1.0f || blur > 128.0f) {
 			return;
 		}
-		const float sigma = blur * 0.57735f; // 1 / sqrt(3)
-		const int alpha = static_cast<int>((1<<APREC) * (1.0f - expf(-2.3f / (sigma+1.0f))));
+		alpha_blur(reinterpret_cast<uint8_t*>(pixels), w, h, stride, blur_alpha_from_radius(blur), alpha_offset, bpp);
+	}
+
+	void pixels_alpha_blur_reference(void* pixels, int w, int h, int stride, int bpp, int alpha_offset, float blur)
+	{
+		if(blur < 1.0f || blur > 128.0f) {
+			return;
+		}
+		const int alpha = blur_alpha_from_radius(blur);
 		uint8_t* dst = reinterpret_cast<uint8_t*>(pixels);
 		
-		blur_rows(dst, w, h, stride, alpha, 0, 1);
-		blur_cols(dst, w, h, stride, alpha, 0, 1);
-		blur_rows(dst, w, h, stride, alpha, 0, 1);
-		blur_cols(dst, w, h, stride, alpha, 0, 1);
+		blur_rows(dst, w, h, stride, alpha, alpha_offset, bpp);
+		blur_cols(dst, w, h, stride, alpha, alpha_offset, bpp);
+		blur_rows(dst, w, h, stride, alpha, alpha_offset, bpp);
+		blur_cols(dst, w, h, stride, alpha, alpha_offset, bpp);
 	}
 
 	void surface_alpha_blur(const SurfacePtr& surface, float blur)
@@ -116,18 +239,31 @@ namespace KRE
 		if(blur < 1.0f || blur > 128.0f) {
 			return;
 		}
-		const float sigma = blur * 0.57735f; // 1 / sqrt(3)
-		const int alpha = static_cast<int>((1<<APREC) * (1.0f - expf(-2.3f / (sigma+1.0f))));
-		const int w = surface->width();
-		const int h = surface->height();
-		const int stride = surface->rowPitch();
 		const int alpha_offset = surface->getPixelFormat()->getAlphaShift() / 8;
 		const int Bpp = surface->getPixelFormat()->bytesPerPixel();
-		uint8_t* dst = reinterpret_cast<uint8_t*>(surface->pixelsWriteable());
-		
-		blur_rows(dst, w, h, stride, alpha, alpha_offset, Bpp);
-		blur_cols(dst, w, h, stride, alpha, alpha_offset, Bpp);
-		blur_rows(dst, w, h, stride, alpha, alpha_offset, Bpp);
-		blur_cols(dst, w, h, stride, alpha, alpha_offset, Bpp);
+		alpha_blur(reinterpret_cast<uint8_t*>(surface->pixelsWriteable()), surface->width(), surface->height(), surface->rowPitch(), 
+			blur_alpha_from_radius(blur), alpha_offset, Bpp);
+	}
+}
+
+UNIT_TEST(pixels_alpha_blur)
+{
+	// The tiled/threaded blur has to match the original exactly.
+	const int sizes[][3] = { { 1, 1, 1 }, { 7, 3, 1 }, { 61, 97, 4 }, { 600, 37, 4 }, { 300, 300, 1 } };
+	unsigned seed = 12345;
+	for(auto& sz : sizes) {
+		const int w = sz[0];
+		const int h = sz[1];
+		const int bpp = sz[2];
+		const int stride = w * bpp + 3;
+		std::vector<uint8_t> pixels(stride * h);
+		for(auto& p : pixels) {
+			seed = seed * 1103515245 + 12345;
+			p = static_cast<uint8_t>(seed >> 16);
+		}
+		std::vector<uint8_t> expected = pixels;
+		KRE::pixels_alpha_blur_reference(expected.data(), w, h, stride, bpp, bpp - 1, 5.0f);
+		KRE::pixels_alpha_blur(pixels.data(), w, h, stride, bpp, bpp - 1, 5.0f);
+		CHECK(pixels == expected, "blurred pixels differ for " << w << "x" << h << "x" << bpp);
 	}
 }
@@ -29,6 +29,12 @@ namespace KRE
 {
 	// N.B. Operates only an array of alpha values 0-255.
 	void pixels_alpha_blur(void* pixels, int w, int h, int stride, float blur);
+	// Blurs the alpha channel of pixels that are bpp bytes in size, with the alpha value 
+	// alpha_offset bytes into each pixel.
+	void pixels_alpha_blur(void* pixels, int w, int h, int stride, int bpp, int alpha_offset, float blur);
+	// The original single threaded version of the above, the results are identical. Kept
+	// to test and benchmark against.
+	void pixels_alpha_blur_reference(void* pixels, int w, int h, int stride, int bpp, int alpha_offset, float blur);
 
 	void surface_alpha_blur(const SurfacePtr& surface, float blur);
 }
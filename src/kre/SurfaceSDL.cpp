@@ -21,6 +21,8 @@
 	   distribution.
 */
 
+#pragma comment(lib, "libpng16-16")
+
 #ifndef _USE_MATH_DEFINES
 #	define _USE_MATH_DEFINES	1
 #endif 
@@ -28,10 +30,15 @@
 #	define HAVE_M_PI
 #endif 
 
+#include <csetjmp>
+
+#include <png.h>
+
 #include "SDL_image.h"
 
 #include "asserts.hpp"
 #include "formatter.hpp"
+#include "unit_test.hpp"
 #include "SurfaceSDL.hpp"
 
 enum {
@@ -99,6 +106,218 @@ namespace KRE
 			return SDL_PIXELFORMAT_ABGR8888;
 		}
 
+		// Channel shifts of a 32-bit SDL format with 8-bit channels, alpha is -1 if there isn't any.
+		bool get_format_shifts32(Uint32 sdl_fmt, std::array<int, 4>* shifts)
+		{
+			int bpp = 0;
+			Uint32 masks[4] = { 0, 0, 0, 0 };
+			if(!SDL_PixelFormatEnumToMasks(sdl_fmt, &bpp, &masks[0], &masks[1], &masks[2], &masks[3]) || bpp != 32) {
+				return false;
+			}
+			for(int c = 0; c != 4; ++c) {
+				(*shifts)[c] = -1;
+				for(int shift = 0; shift != 32 && masks[c] != 0; shift += 8) {
+					if(masks[c] == 0xffU << shift) {
+						(*shifts)[c] = shift;
+					}
+				}
+				if(masks[c] != 0 && (*shifts)[c] < 0) {
+					return false;
+				}
+			}
+			return (*shifts)[0] >= 0 && (*shifts)[1] >= 0 && (*shifts)[2] >= 0;
+		}
+
+		// Zeroes pixels the alpha filter matches and/or premultiplies the rest.
+		void process_pixels32(uint32_t* px, int count, const std::array<int, 4>& shifts, const alpha_filter& filter, bool premultiply)
+		{
+			for(int n = 0; n != count; ++n) {
+				const uint32_t p = px[n];
+				if(filter && filter((p >> shifts[0]) & 0xff, (p >> shifts[1]) & 0xff, (p >> shifts[2]) & 0xff)) {
+					px[n] = 0;
+					continue;
+				}
+				const uint32_t a = (p >> shifts[3]) & 0xff;
+				if(!premultiply || shifts[3] < 0 || a == 255) {
+					continue;
+				}
+				uint32_t res = a << shifts[3];
+				for(int c = 0; c != 3; ++c) {
+					// Rounded division by 255.
+					const uint32_t v = ((p >> shifts[c]) & 0xff) * a + 128;
+					res |= ((v + (v >> 8)) >> 8) << shifts[c];
+				}
+				px[n] = res;
+			}
+		}
+
+		// State for libpng's callbacks, anything changed after the setjmp() lives here too.
+		struct PngReader
+		{
+			PngReader(SDL_RWops* r) : rw(r), error(), surface(nullptr) {}
+			SDL_RWops* rw;
+			std::string error;
+			SDL_Surface* surface;
+		};
+
+		void png_read_rw(png_structp png, png_bytep out, png_size_t count)
+		{
+			auto reader = static_cast<PngReader*>(png_get_io_ptr(png));
+			if(SDL_RWread(reader->rw, out, 1, count) != count) {
+				png_error(png, "Unexpected end of PNG data");
+			}
+		}
+
+		void png_error_handler(png_structp png, png_const_charp msg)
+		{
+			static_cast<PngReader*>(png_get_error_ptr(png))->error = msg;
+			png_longjmp(png, 1);
+		}
+
+		void png_warning_handler(png_structp png, png_const_charp msg)
+		{
+		}
+
+		// Decodes a PNG straight into a new surface of a 32-bit format, with libpng doing the 
+		// conversion and the alpha filter and premultiplication done as each row is read. So there
+		// is no intermediate copy of the image as there is with IMG_Load() and then converting it.
+		// Returns nullptr, with rw rewound, if the data isn't a PNG or can't be written in that format
+		// (or is paletted and expand_palette is false). If decoding fails error is set.
+		SDL_Surface* decode_png(SDL_RWops* rw, Uint32 sdl_fmt, bool expand_palette, const alpha_filter& filter, bool premultiply, std::string* error)
+		{
+			std::array<int, 4> shifts;
+			if(!get_format_shifts32(sdl_fmt, &shifts)) {
+				return nullptr;
+			}
+			// libpng writes R,G,B,A bytes, optionally with the alpha first and/or B and R swapped.
+			int byte_pos[4];
+			for(int c = 0; c != 4; ++c) {
+#if SDL_BYTEORDER == SDL_LIL_ENDIAN
+				byte_pos[c] = shifts[c] / 8;
+#else
+				byte_pos[c] = 3 - shifts[c] / 8;
+#endif
+			}
+			const bool alpha_first = shifts[3] >= 0 ? byte_pos[3] == 0 : byte_pos[0] != 0 && byte_pos[2] != 0;
+			const bool bgr = byte_pos[2] < byte_pos[0];
+			const int first_color = alpha_first ? 1 : 0;
+			if(byte_pos[0] != first_color + (bgr ? 2 : 0) || byte_pos[1] != first_color + 1 || byte_pos[2] != first_color + (bgr ? 0 : 2)) {
+				return nullptr;
+			}
+
+			const Sint64 start = SDL_RWtell(rw);
+			png_byte sig[8];
+			if(SDL_RWread(rw, sig, 1, sizeof(sig)) != sizeof(sig) || png_sig_cmp(sig, 0, sizeof(sig)) != 0) {
+				SDL_RWseek(rw, start, RW_SEEK_SET);
+				return nullptr;
+			}
+
+			PngReader reader(rw);
+			png_structp png = png_create_read_struct(PNG_LIBPNG_VER_STRING, &reader, png_error_handler, png_warning_handler);
+			png_infop info = png != nullptr ? png_create_info_struct(png) : nullptr;
+			if(png == nullptr || info == nullptr) {
+				png_destroy_read_struct(&png, &info, nullptr);
+				SDL_RWseek(rw, start, RW_SEEK_SET);
+				return nullptr;
+			}
+			if(setjmp(png_jmpbuf(png))) {
+				png_destroy_read_struct(&png, &info, nullptr);
+				if(reader.surface != nullptr) {
+					SDL_FreeSurface(reader.surface);
+				}
+				*error = reader.error;
+				return nullptr;
+			}
+			png_set_read_fn(png, &reader, png_read_rw);
+			png_set_error_fn(png, &reader, png_error_handler, png_warning_handler);
+			png_set_sig_bytes(png, sizeof(sig));
+			png_read_info(png, info);
+
+			png_uint_32 width = 0;
+			png_uint_32 height = 0;
+			int depth = 0;
+			int color_type = 0;
+			png_get_IHDR(png, info, &width, &height, &depth, &color_type, nullptr, nullptr, nullptr);
+			if(color_type == PNG_COLOR_TYPE_PALETTE && !expand_palette) {
+				png_destroy_read_struct(&png, &info, nullptr);
+				SDL_RWseek(rw, start, RW_SEEK_SET);
+				return nullptr;
+			}
+
+			if(depth == 16) {
+				png_set_strip_16(png);
+			}
+			if(color_type == PNG_COLOR_TYPE_PALETTE) {
+				png_set_palette_to_rgb(png);
+			}
+			if(color_type == PNG_COLOR_TYPE_GRAY && depth < 8) {
+				png_set_expand_gray_1_2_4_to_8(png);
+			}
+			if(color_type == PNG_COLOR_TYPE_GRAY || color_type == PNG_COLOR_TYPE_GRAY_ALPHA) {
+				png_set_gray_to_rgb(png);
+			}
+			const bool has_trns = png_get_valid(png, info, PNG_INFO_tRNS) != 0;
+			if(has_trns) {
+				png_set_tRNS_to_alpha(png);
+			}
+			if(!(color_type & PNG_COLOR_MASK_ALPHA) && !has_trns) {
+				png_set_filler(png, 0xff, alpha_first ? PNG_FILLER_BEFORE : PNG_FILLER_AFTER);
+			} else if(alpha_first) {
+				png_set_swap_alpha(png);
+			}
+			if(bgr) {
+				png_set_bgr(png);
+			}
+			const int passes = png_set_interlace_handling(png);
+			png_read_update_info(png, info);
+
+			Uint32 masks[4] = { 0, 0, 0, 0 };
+			int bpp = 0;
+			SDL_PixelFormatEnumToMasks(sdl_fmt, &bpp, &masks[0], &masks[1], &masks[2], &masks[3]);
+			reader.surface = SDL_CreateRGBSurface(0, width, height, 32, masks[0], masks[1], masks[2], masks[3]);
+			if(reader.surface == nullptr) {
+				png_error(png, SDL_GetError());
+			}
+			const bool process = filter || (premultiply && shifts[3] >= 0);
+			auto row = [&reader](png_uint_32 y) { return static_cast<uint8_t*>(reader.surface->pixels) + y * reader.surface->pitch; };
+			for(int pass = 0; pass != passes; ++pass) {
+				for(png_uint_32 y = 0; y != height; ++y) {
+					png_read_row(png, row(y), nullptr);
+					if(process && passes == 1) {
+						process_pixels32(reinterpret_cast<uint32_t*>(row(y)), width, shifts, filter, premultiply);
+					}
+				}
+			}
+			// Interlaced rows aren't complete until the last pass.
+			if(process && passes > 1) {
+				for(png_uint_32 y = 0; y != height; ++y) {
+					process_pixels32(reinterpret_cast<uint32_t*>(row(y)), width, shifts, filter, premultiply);
+				}
+			}
+			png_read_end(png, nullptr);
+			png_destroy_read_struct(&png, &info, nullptr);
+			return reader.surface;
+		}
+
+		// Premultiplies a surface that wasn't decoded by decode_png().
+		SurfacePtr premultiply_surface(const SurfacePtr& surf)
+		{
+			std::array<int, 4> shifts;
+			if(!surf->getPixelFormat()->getChannelShifts32(&shifts)) {
+				return surf->convert(PixelFormat::PF::PIXELFORMAT_ARGB8888, [](int& r, int& g, int& b, int& a) {
+					r = (r * a + 127) / 255;
+					g = (g * a + 127) / 255;
+					b = (b * a + 127) / 255;
+				});
+			}
+			SurfaceLock lck(surf);
+			for(int y = 0; y != surf->height(); ++y) {
+				auto px = reinterpret_cast<uint32_t*>(static_cast<uint8_t*>(surf->pixelsWriteable()) + y * surf->rowPitch());
+				process_pixels32(px, surf->width(), shifts, nullptr, true);
+			}
+			return surf;
+		}
+
 		class CursorSDL : public Cursor
 		{
 			public:
@@ -167,6 +386,22 @@ namespace KRE
 		  palette_()
 	{
 		auto filter = Surface::getFileFilter(FileFilterType::LOAD);
+		SDL_RWops* rw = SDL_RWFromFile(filter(filename).c_str(), "rb");
+		if(rw != nullptr) {
+			std::string error;
+			surface_ = decode_png(rw, SDL_PIXELFORMAT_RGBA8888, true, nullptr, false, &error);
+			SDL_RWclose(rw);
+			if(!error.empty()) {
+				throw ImageLoadError(formatter() << "Failed to load image file: '" << filename << "' : " << error);
+			}
+		}
+		if(surface_ != nullptr) {
+			auto pf = std::make_shared<SDLPixelFormat>(surface_->format->format);
+			setPixelFormat(PixelFormatPtr(pf));
+			createPalette();
+			return;
+		}
+
 		auto surf = IMG_Load(filter(filename).c_str());
 		if(surf == nullptr) {
 			LOG_ERROR("Failed to load image file: '" << filename << "' : " << IMG_GetError());
@@ -176,6 +411,7 @@ namespace KRE
 		}
 		
 		surface_ = SDL_ConvertSurfaceFormat(surf, SDL_PIXELFORMAT_RGBA8888, 0);
+		SDL_FreeSurface(surf);
 		if(surface_ == nullptr) {
 			std::stringstream ss;
 			ss << "Failed to convert image file format: '" << filename << "' : " << IMG_GetError();
@@ -425,6 +661,11 @@ namespace KRE
 		return BLEND_MODE_NONE;
 	}
 
+	bool SurfaceSDL::getColorKey(uint32_t* key) const
+	{
+		return surface_ != nullptr && SDL_GetColorKey(surface_, key) == 0;
+	}
+
 	void SurfaceSDL::fillRect(const rect& dst_rect, const Color& color)
 	{
 		SDL_Rect r = {dst_rect.x(), dst_rect.y(), dst_rect.w(), dst_rect.h() };
@@ -717,13 +958,51 @@ namespace KRE
 
 	SurfacePtr SurfaceSDL::createFromFile(const std::string& filename, PixelFormat::PF fmt, SurfaceFlags flags, SurfaceConvertFn fn)
 	{
-		SDL_Surface* s = nullptr;
+		SDL_RWops* rw = nullptr;
 		if(flags & SurfaceFlags::FROM_DATA) {
-			s = IMG_Load_RW(SDL_RWFromConstMem(filename.c_str(), static_cast<int>(filename.size())), 0);
+			rw = SDL_RWFromConstMem(filename.c_str(), static_cast<int>(filename.size()));
 		} else {
 			auto filter = Surface::getFileFilter(FileFilterType::LOAD);
-			s = IMG_Load(filter(filename).c_str());
+			rw = SDL_RWFromFile(filter(filename).c_str(), "rb");
 		}
+		if(rw == nullptr) {
+			std::stringstream ss;
+			ss << "Failed to load image file: '" << filename << "' : " << SDL_GetError();
+			LOG_ERROR(ss.str());
+			throw ImageLoadError(ss.str());
+		}
+
+		const bool premultiply = flags & SurfaceFlags::PREMULTIPLY_ALPHA;
+		auto alpha_fn = flags & SurfaceFlags::NO_ALPHA_FILTER ? alpha_filter() : Surface::getAlphaFilter();
+		SDL_Surface* s = nullptr;
+		if(fn == nullptr) {
+			// Decode PNGs directly into the format the surface would end up in, which is what the
+			// alpha filter converts to, or the requested format, or else RGBA byte order which 
+			// uploads as-is.
+			Uint32 target = SDL_BYTEORDER == SDL_LIL_ENDIAN ? SDL_PIXELFORMAT_ABGR8888 : SDL_PIXELFORMAT_RGBA8888;
+			if(alpha_fn) {
+				target = SDL_PIXELFORMAT_ARGB8888;
+			} else if(fmt != PixelFormat::PF::PIXELFORMAT_UNKNOWN) {
+				target = get_sdl_pixel_format(fmt);
+			}
+			std::string error;
+			s = decode_png(rw, target, fmt != PixelFormat::PF::PIXELFORMAT_UNKNOWN, alpha_fn, premultiply, &error);
+			if(!error.empty()) {
+				SDL_RWclose(rw);
+				std::stringstream ss;
+				ss << "Failed to load image file: '" << filename << "' : " << error;
+				LOG_ERROR(ss.str());
+				throw ImageLoadError(ss.str());
+			}
+			if(s != nullptr) {
+				SDL_RWclose(rw);
+				auto surf = std::make_shared<SurfaceSDL>(s);
+				surf->setFlags(flags);
+				return surf;
+			}
+		}
+
+		s = IMG_Load_RW(rw, 1);
 		if(s == nullptr) {
 			std::stringstream ss;
 			ss << "Failed to load image file: '" << filename << "' : " << IMG_GetError();
@@ -734,10 +1013,10 @@ namespace KRE
 			auto surf = std::make_shared<SurfaceSDL>(s);
 			surf->setFlags(flags);
 			// format means don't convert the surface from the loaded format.
-			if(fmt != PixelFormat::PF::PIXELFORMAT_UNKNOWN) {
-				return surf->convert(fmt, fn)->runGlobalAlphaFilter();
-			}
-			return surf->runGlobalAlphaFilter();
+			SurfacePtr res = fmt != PixelFormat::PF::PIXELFORMAT_UNKNOWN 
+				? surf->convert(fmt, fn)->runGlobalAlphaFilter() 
+				: surf->runGlobalAlphaFilter();
+			return premultiply ? premultiply_surface(res) : res;
 		} catch(ImageLoadError& e) {
 			throw ImageLoadError(formatter() << "Failed to load image file: '" << filename << "' : " << e.what());
 		}
@@ -956,7 +1235,12 @@ namespace KRE
 	SurfacePtr SurfaceSDL::handleConvert(PixelFormat::PF fmt, SurfaceConvertFn convert)
 	{
 		ASSERT_LOG(fmt != PixelFormat::PF::PIXELFORMAT_UNKNOWN, "unknown pixel format to convert to.");
-		if(convert == nullptr) {
+		std::array<int, 4> src_shifts;
+		std::array<int, 4> dst_shifts;
+		const bool swizzle = convert == nullptr 
+			&& getPixelFormat()->getChannelShifts32(&src_shifts) 
+			&& SDLPixelFormat(get_sdl_pixel_format(fmt)).getChannelShifts32(&dst_shifts);
+		if(convert == nullptr && !swizzle) {
 			SDL_PixelFormat* pf = SDL_AllocFormat(get_sdl_pixel_format(fmt));
 			ASSERT_LOG(pf != nullptr, "error allocating pixel format: " << SDL_GetError());
 			auto surface = new SurfaceSDL(SDL_ConvertSurface(surface_, pf, 0));
@@ -967,20 +1251,44 @@ namespace KRE
 		// Create a destination surface
 		ASSERT_LOG(PixelFormat::isIndexedFormat(fmt) == false, "Indexed format can't be handled right now for conversion.");
 		auto dst = std::make_shared<SurfaceSDL>(width(), height(), fmt);
-		int dst_size = dst->rowPitch() * dst->height();
-		void* dst_pixels = new uint8_t[dst_size];
-
-		int dst_bpp = dst->getPixelFormat()->bytesPerPixel();
-		iterateOverSurface([&](int x, int y, int r, int g, int b, int a) {
-			uint8_t* dst_pixel_ptr = static_cast<uint8_t*>(dst_pixels) + y * dst->rowPitch() + x * dst_bpp;
-			convert(r, g, b, a);
-			dst->getPixelFormat()->encodeRGBA(dst_pixel_ptr, r, g, b, a);
+		SurfaceLock src_lock(shared_from_this());
+		SurfaceLock dst_lock(dst);
+
+		if(swizzle) {
+			// Both formats have 8-bit channels in 32-bit pixels, so it's just moving bytes around.
+			for(int y = 0; y != height(); ++y) {
+				const uint8_t* src_row = static_cast<const uint8_t*>(pixels()) + y * rowPitch();
+				uint8_t* dst_row = static_cast<uint8_t*>(dst->pixelsWriteable()) + y * dst->rowPitch();
+				swizzle_pixels32(reinterpret_cast<const uint32_t*>(src_row), src_shifts, reinterpret_cast<uint32_t*>(dst_row), dst_shifts, width());
+			}
+			return dst;
+		}
+
+		std::vector<PixelRGBA> converted(width());
+		visitRows([&](int x, int y, const PixelRGBA* px, int count) {
+			for(int n = 0; n != count; ++n) {
+				int r = px[n].r, g = px[n].g, b = px[n].b, a = px[n].a;
+				if(convert) {
+					convert(r, g, b, a);
+				}
+				converted[n] = PixelRGBA{ static_cast<uint8_t>(r), static_cast<uint8_t>(g), static_cast<uint8_t>(b), static_cast<uint8_t>(a) };
+			}
+			dst->writeRow(x, y, count, converted.data());
 		});
-		dst->writePixels(dst_pixels, dst_size);
-		delete[] static_cast<uint8_t*>(dst_pixels);
 		return dst;
 	}
 
+	void SurfaceSDL::handleConvertInPlace(PixelFormat::PF fmt, SurfaceConvertFn convert)
+	{
+		auto dst = std::static_pointer_cast<SurfaceSDL>(handleConvert(fmt, convert));
+		std::swap(surface_, dst->surface_);
+		std::swap(palette_, dst->palette_);
+		setPixelFormat(dst->getPixelFormat());
+		if(getAlphaMap() != nullptr) {
+			createAlphaMap();
+		}
+	}
+
 	std::string SurfaceSDL::savePng(const std::string& filename)
 	{
 		auto filter = Surface::getFileFilter(FileFilterType::SAVE)(filename);
@@ -1030,3 +1338,33 @@ namespace KRE
 		return std::unique_ptr<CursorSDL>(new CursorSDL(s));
 	}
 }
+
+UNIT_TEST(surface_alpha_map_indexed_color_key)
+{
+	SDL_Surface* s = SDL_CreateRGBSurface(0, 40, 20, 8, 0, 0, 0, 0);
+	CHECK(s != nullptr && s->format->palette != nullptr, "Unable to create an indexed surface: " << SDL_GetError());
+	const SDL_Color colors[] = { { 255, 0, 255, 255 }, { 10, 20, 30, 255 }, { 40, 50, 60, 128 } };
+	SDL_SetPaletteColors(s->format->palette, colors, 0, 3);
+	for(int y = 0; y != s->h; ++y) {
+		memset(static_cast<uint8_t*>(s->pixels) + y * s->pitch, 1, s->w);
+	}
+	static_cast<uint8_t*>(s->pixels)[2 * s->pitch + 3] = 0;
+	SDL_SetColorKey(s, SDL_TRUE, 0);
+
+	auto surf = std::make_shared<KRE::SurfaceSDL>(s);
+	surf->createAlphaMap();
+	CHECK(!surf->isOpaque(), "Color keyed indexed surface was marked opaque");
+	CHECK(surf->isAlpha(3, 2), "Color key pixel should be transparent");
+	CHECK(!surf->isAlpha(4, 2), "Pixel next to the color key should be solid");
+	CHECK_EQ(static_cast<int>(surf->getPaletteRGBA()[0].a), 0);
+	CHECK_EQ(static_cast<int>(surf->getPaletteRGBA()[1].a), 255);
+
+	// Without the key only the palette alpha counts.
+	SDL_SetColorKey(s, SDL_FALSE, 0);
+	surf->createAlphaMap();
+	CHECK(surf->isOpaque(), "Indexed surface with only opaque palette entries should be opaque");
+	static_cast<uint8_t*>(s->pixels)[5 * s->pitch + 30] = 2;
+	surf->createAlphaMap();
+	CHECK(!surf->isOpaque(), "Translucent palette entry was ignored");
+	CHECK(surf->getAlphaCoverage(rect(0, 0, 16, 16)) == KRE::AlphaCoverage::Opaque, "Untouched tile should stay opaque");
+}
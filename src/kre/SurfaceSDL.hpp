@@ -164,6 +164,7 @@ namespace KRE
 		void blitToScaled(SurfacePtr src, const rect& src_rect, const rect& dst_rect) override;
 
 		const std::vector<Color>& getPalette() override { return palette_; }
+		bool getColorKey(uint32_t* key) const override;
 
 		void setBlendMode(BlendMode bm) override;
 		BlendMode getBlendMode() const override;
@@ -205,6 +206,7 @@ namespace KRE
 		const SDL_Surface* get() const { return surface_; }
 	private:
 		SurfacePtr handleConvert(PixelFormat::PF fmt, SurfaceConvertFn convert) override;
+		void handleConvertInPlace(PixelFormat::PF fmt, SurfaceConvertFn convert) override;
 		SurfacePtr runGlobalAlphaFilter() override;
 		void createPalette();
 
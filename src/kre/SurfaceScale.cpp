@@ -21,7 +21,21 @@
 	   distribution.
 */
 
+#include <algorithm>
+#include <array>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define SURFACE_SCALE_SSE2
+#include <emmintrin.h>
+#endif
+
+#include "unit_test.hpp"
+
 #include "SurfaceScale.hpp"
+#include "ThreadPool.hpp"
 
 namespace KRE
 {
@@ -44,6 +58,244 @@ namespace KRE
 				}
 				return inp;
 			}
+
+			SurfacePtr create_scaled_surface(const SurfacePtr& inp, const int scale, void (*fn)(const uint32_t*, int, int, int, uint32_t*))
+			{
+				int new_image_width = 0;
+				int new_image_height = 0;
+				scaled_size(inp->width(), inp->height(), scale, &new_image_width, &new_image_height);
+				ASSERT_LOG(new_image_width > 0 && new_image_height > 0, "New image size would be less than 0 pixels: " << new_image_width << "x" << new_image_height);
+
+				std::unique_ptr<uint32_t[]> new_pixels(new uint32_t[new_image_width * new_image_height]);
+				fn(static_cast<const uint32_t*>(inp->pixels()), inp->width(), inp->height(), scale, new_pixels.get());
+				return Surface::create(new_image_width, new_image_height, 32, 4*new_image_width, 0x00ff0000, 0x0000ff00, 0x000000ff, 0xff000000, new_pixels.get());
+			}
+
+			// Don't hand less than about 16K output pixels to a thread.
+			int min_rows_per_job(int width)
+			{
+				return std::max(4, 16384 / std::max(1, width));
+			}
+
+			// For every output column (or row) the source indices and weights that contribute to it, 
+			// stored as 'taps' consecutive entries.
+			struct FilterTaps
+			{
+				FilterTaps(int t, int size) : taps(t), index(t * size), weight(t * size) {}
+				int taps;
+				std::vector<int> index;
+				std::vector<float> weight;
+			};
+
+			FilterTaps bilinear_taps(int src_size, int dst_size)
+			{
+				// Same sample positions as the reference implementation.
+				const double ratio = (src_size - 1.0) / dst_size;
+				FilterTaps res(2, dst_size);
+				for(int n = 0; n != dst_size; ++n) {
+					const int p = static_cast<int>(ratio * n);
+					const double d = ratio * n - p;
+					res.index[n*2+0] = p;
+					res.index[n*2+1] = std::min(p + 1, src_size - 1);
+					res.weight[n*2+0] = static_cast<float>(1.0 - d);
+					res.weight[n*2+1] = static_cast<float>(d);
+				}
+				return res;
+			}
+
+			FilterTaps bicubic_taps(int src_size, int dst_size)
+			{
+				const double ratio = (src_size - 1.0) / dst_size;
+				FilterTaps res(4, dst_size);
+				for(int n = 0; n != dst_size; ++n) {
+					const int p = static_cast<int>(ratio * n);
+					const double t = ratio * n - p;
+					const double t2 = t * t;
+					const double t3 = t2 * t;
+					// Expansion of cubic_hermite() in terms of the four samples.
+					const double w[4] = {
+						-t3 / 2.0 + t2 - t / 2.0,
+						(3.0 * t3) / 2.0 - (5.0 * t2) / 2.0 + 1.0,
+						-(3.0 * t3) / 2.0 + 2.0 * t2 + t / 2.0,
+						t3 / 2.0 - t2 / 2.0,
+					};
+					for(int k = 0; k != 4; ++k) {
+						res.index[n*4+k] = std::max(0, std::min(p + k - 1, src_size - 1));
+						res.weight[n*4+k] = static_cast<float>(w[k]);
+					}
+				}
+				return res;
+			}
+
+			// Applies the horizontal taps to one row of source pixels, giving dst_width pixels of 
+			// four float channels each. tmp needs room for width*4 floats.
+			void filter_row(const uint32_t* src_row, int width, const FilterTaps& xt, int dst_width, float* tmp, float* out)
+			{
+				const uint8_t* s = reinterpret_cast<const uint8_t*>(src_row);
+				for(int n = 0; n != width * 4; ++n) {
+					tmp[n] = s[n];
+				}
+				const int taps = xt.taps;
+				for(int x = 0; x != dst_width; ++x) {
+					const int* idx = &xt.index[x * taps];
+					const float* wt = &xt.weight[x * taps];
+#if defined(SURFACE_SCALE_SSE2)
+					__m128 acc = _mm_mul_ps(_mm_loadu_ps(tmp + idx[0] * 4), _mm_set1_ps(wt[0]));
+					for(int k = 1; k != taps; ++k) {
+						acc = _mm_add_ps(acc, _mm_mul_ps(_mm_loadu_ps(tmp + idx[k] * 4), _mm_set1_ps(wt[k])));
+					}
+					_mm_storeu_ps(out + x * 4, acc);
+#else
+					for(int c = 0; c != 4; ++c) {
+						float acc = 0;
+						for(int k = 0; k != taps; ++k) {
+							acc += tmp[idx[k] * 4 + c] * wt[k];
+						}
+						out[x * 4 + c] = acc;
+					}
+#endif
+				}
+			}
+
+			// Weighted sum of 'taps' filtered rows, clamped and truncated to bytes.
+			void combine_rows(const float* const* rows, const float* wt, int taps, int count, uint8_t* out)
+			{
+#if defined(SURFACE_SCALE_SSE2)
+				const __m128 zero = _mm_setzero_ps();
+				const __m128 max_value = _mm_set1_ps(255.0f);
+				for(int n = 0; n != count; n += 4) {
+					__m128 acc = _mm_mul_ps(_mm_loadu_ps(rows[0] + n), _mm_set1_ps(wt[0]));
+					for(int k = 1; k != taps; ++k) {
+						acc = _mm_add_ps(acc, _mm_mul_ps(_mm_loadu_ps(rows[k] + n), _mm_set1_ps(wt[k])));
+					}
+					acc = _mm_min_ps(_mm_max_ps(acc, zero), max_value);
+					const __m128i v = _mm_cvttps_epi32(acc);
+					const __m128i packed = _mm_packus_epi16(_mm_packs_epi32(v, v), _mm_setzero_si128());
+					const int32_t pixel = _mm_cvtsi128_si32(packed);
+					std::memcpy(out + n, &pixel, 4);
+				}
+#else
+				for(int n = 0; n != count; ++n) {
+					float acc = 0;
+					for(int k = 0; k != taps; ++k) {
+						acc += rows[k][n] * wt[k];
+					}
+					out[n] = acc < 0 ? 0 : acc > 255.0f ? 255 : static_cast<uint8_t>(acc);
+				}
+#endif
+			}
+
+			// Separable resampling of output rows [y0, y1). Horizontally filtered source rows are kept 
+			// around while they are still needed, so each is only filtered once per range.
+			void resample_rows(const uint32_t* src, int w, uint32_t* dst, int dw, const FilterTaps& xt, const FilterTaps& yt, int y0, int y1)
+			{
+				const int taps = yt.taps;
+				std::vector<float> tmp(w * 4);
+				std::vector<float> cache(taps * dw * 4);
+				std::vector<int> cache_row(taps, -1);
+				std::vector<const float*> rows(taps);
+
+				for(int y = y0; y != y1; ++y) {
+					for(int k = 0; k != taps; ++k) {
+						const int sy = yt.index[y * taps + k];
+						auto it = std::find(cache_row.begin(), cache_row.end(), sy);
+						if(it == cache_row.end()) {
+							// Source rows needed only ever increase, so the lowest cached row is no longer used.
+							it = std::min_element(cache_row.begin(), cache_row.end());
+							*it = sy;
+							filter_row(src + sy * w, w, xt, dw, tmp.data(), &cache[(it - cache_row.begin()) * dw * 4]);
+						}
+						rows[k] = &cache[(it - cache_row.begin()) * dw * 4];
+					}
+					combine_rows(rows.data(), &yt.weight[y * taps], taps, dw * 4, reinterpret_cast<uint8_t*>(dst + y * dw));
+				}
+			}
+
+			void resample(const uint32_t* src, int w, int h, uint32_t* dst, int dw, int dh, const FilterTaps& xt, const FilterTaps& yt)
+			{
+				ThreadPool::getInstance().parallelFor(dh, min_rows_per_job(dw), [&](int y0, int y1) {
+					resample_rows(src, w, dst, dw, xt, yt, y0, y1);
+				});
+			}
+		}
+
+		void scaled_size(int width, int height, const int scale, int* new_width, int* new_height)
+		{
+			const double ratio = 100.0 / static_cast<double>(scale);
+			*new_width = static_cast<int>(width / ratio);
+			*new_height = static_cast<int>(height / ratio);
+		}
+
+		void nearest_neighbour(const uint32_t* src, int w, int h, const int scale, uint32_t* dst)
+		{
+			int dw, dh;
+			scaled_size(w, h, scale, &dw, &dh);
+			const double ratio = 100.0 / static_cast<double>(scale);
+			std::vector<int> columns(dw);
+			for(int x = 0; x != dw; ++x) {
+				columns[x] = static_cast<int>(ratio * x);
+			}
+			ThreadPool::getInstance().parallelFor(dh, min_rows_per_job(dw), [&](int y0, int y1) {
+				for(int y = y0; y != y1; ++y) {
+					const uint32_t* src_row = src + static_cast<int>(ratio * y) * w;
+					uint32_t* dst_row = dst + y * dw;
+					for(int x = 0; x != dw; ++x) {
+						dst_row[x] = src_row[columns[x]];
+					}
+				}
+			});
+		}
+
+		void bilinear(const uint32_t* src, int w, int h, const int scale, uint32_t* dst)
+		{
+			int dw, dh;
+			scaled_size(w, h, scale, &dw, &dh);
+			resample(src, w, h, dst, dw, dh, bilinear_taps(w, dw), bilinear_taps(h, dh));
+		}
+
+		void bicubic(const uint32_t* src, int w, int h, const int scale, uint32_t* dst)
+		{
+			int dw, dh;
+			scaled_size(w, h, scale, &dw, &dh);
+			resample(src, w, h, dst, dw, dh, bicubic_taps(w, dw), bicubic_taps(h, dh));
+		}
+
+		void epx(const uint32_t* src, int w, int h, uint32_t* dst)
+		{
+			const int dw = w * 2;
+			// Source column for each output pixel pair, and its clamped left/right neighbours, 
+			// matching the sampling of the reference version.
+			const double ratio_x = (w - 1.0) / dw;
+			const double ratio_y = (h - 1.0) / (h * 2);
+			std::vector<std::array<int, 3>> columns(w);
+			for(int n = 0; n != w; ++n) {
+				const int px = static_cast<int>(ratio_x * n * 2);
+				columns[n][0] = std::max(px - 1, 0);
+				columns[n][1] = px;
+				columns[n][2] = std::min(px + 1, w - 1);
+			}
+			ThreadPool::getInstance().parallelFor(h, min_rows_per_job(dw * 2), [&](int r0, int r1) {
+				for(int r = r0; r != r1; ++r) {
+					const int py = static_cast<int>(ratio_y * r * 2);
+					const uint32_t* above = src + std::max(py - 1, 0) * w;
+					const uint32_t* row = src + py * w;
+					const uint32_t* below = src + std::min(py + 1, h - 1) * w;
+					uint32_t* out0 = dst + r * 2 * dw;
+					uint32_t* out1 = out0 + dw;
+					for(int n = 0; n != w; ++n) {
+						const auto& col = columns[n];
+						const uint32_t P = row[col[1]];
+						const uint32_t A = above[col[1]];
+						const uint32_t B = row[col[2]];
+						const uint32_t C = row[col[0]];
+						const uint32_t D = below[col[1]];
+						out0[n*2+0] = C == A && C != D && A != B ? A : P;
+						out0[n*2+1] = A == B && A != C && B != D ? B : P;
+						out1[n*2+0] = D == C && D != B && C != A ? C : P;
+						out1[n*2+1] = B == D && B != A && D != C ? D : P;
+					}
+				}
+			});
 		}
 
 		// scale is a value from 1 to 10000, such that a value of 100 is a scale factor of 1 (i.e. not scaled).
@@ -53,31 +305,55 @@ namespace KRE
 			if(scale == 100) {
 				return input_surf;
 			}
+			return create_scaled_surface(check_input(input_surf, scale), scale, nearest_neighbour);
+		}
 
-			SurfacePtr inp = check_input(input_surf, scale);
+		SurfacePtr bilinear(const SurfacePtr& input_surf, const int scale)
+		{
+			if(scale == 100) {
+				return input_surf;
+			}
+			return create_scaled_surface(check_input(input_surf, scale), scale, bilinear);
+		}
 
-			const int old_image_width = inp->width();
-			const double ratio_x = 100.0 / static_cast<double>(scale);
-			const double ratio_y = ratio_x;
-			const int new_image_width = static_cast<int>(inp->width() / ratio_x);
-			const int new_image_height = static_cast<int>(inp->height() / ratio_y);
+		SurfacePtr bicubic(const SurfacePtr& input_surf, const int scale)
+		{
+			if(scale == 100) {
+				return input_surf;
+			}
+			return create_scaled_surface(check_input(input_surf, scale), scale, bicubic);
+		}
 
+		SurfacePtr epx(const SurfacePtr& input_surf)
+		{
+			SurfacePtr inp = check_input(input_surf, 200);
+			const int new_image_width = inp->width() * 2;
+			const int new_image_height = inp->height() * 2;
 			ASSERT_LOG(new_image_width > 0 && new_image_height > 0, "New image size would be less than 0 pixels: " << new_image_width << "x" << new_image_height);
 
 			std::unique_ptr<uint32_t[]> new_pixels(new uint32_t[new_image_width * new_image_height]);
-			const uint32_t* old_pixels = static_cast<const uint32_t*>(inp->pixels());
+			epx(static_cast<const uint32_t*>(inp->pixels()), inp->width(), inp->height(), new_pixels.get());
+			return Surface::create(new_image_width, new_image_height, 32, 4*new_image_width, 0x00ff0000, 0x0000ff00, 0x000000ff, 0xff000000, new_pixels.get());
+		}
 
-			for(int y = 0; y != new_image_height; ++y) {
-				for(int x = 0; x != new_image_width; ++x) {
-					const int px = static_cast<int>(ratio_x * x);
-					const int py = static_cast<int>(ratio_y * y);
-					new_pixels[y * new_image_width + x] = old_pixels[py * old_image_width + px];
+		namespace reference
+		{
+			void nearest_neighbour(const uint32_t* old_pixels, int old_image_width, int old_image_height, const int scale, uint32_t* new_pixels)
+			{
+				const double ratio_x = 100.0 / static_cast<double>(scale);
+				const double ratio_y = ratio_x;
+				const int new_image_width = static_cast<int>(old_image_width / ratio_x);
+				const int new_image_height = static_cast<int>(old_image_height / ratio_y);
+
+				for(int y = 0; y != new_image_height; ++y) {
+					for(int x = 0; x != new_image_width; ++x) {
+						const int px = static_cast<int>(ratio_x * x);
+						const int py = static_cast<int>(ratio_y * y);
+						new_pixels[y * new_image_width + x] = old_pixels[py * old_image_width + px];
+					}
 				}
 			}
 
-			return Surface::create(new_image_width, new_image_height, 32, 4*new_image_width, 0x00ff0000, 0x0000ff00, 0x000000ff, 0xff000000, new_pixels.get());
-		}
-
 #define BILINEAR_ALPHA(a,b,c,d,xd,yd)	\
 	(static_cast<int>(((a)>>24)*(1.0-(xd))*(1.0-(yd))) + \
 	static_cast<int>(((b)>>24)*(xd)*(1.0-(yd))) + \
@@ -99,216 +375,229 @@ namespace KRE
 	static_cast<int>((((c)&0xff))*(1.0-(xd))*(yd)) + \
 	static_cast<int>((((d)&0xff))*(xd)*(yd)))
 
-
-		SurfacePtr bilinear(const SurfacePtr& input_surf, const int scale)
-		{
-			if(scale == 100) {
-				return input_surf;
-			}
-
-			SurfacePtr inp = check_input(input_surf, scale);
-
-			const int old_image_width = inp->width();
-			double ratio_x = 100.0 / static_cast<double>(scale);
-			double ratio_y = ratio_x;
-			const int new_image_width = static_cast<int>(inp->width() / ratio_x);
-			const int new_image_height = static_cast<int>(inp->height() / ratio_y);
-
-			ratio_x = (inp->width()-1.0) / new_image_width;
-			ratio_y = (inp->height()-1.0) / new_image_height;
-
-			ASSERT_LOG(new_image_width > 0 && new_image_height > 0, "New image size would be less than 0 pixels: " << new_image_width << "x" << new_image_height);
-
-			std::unique_ptr<uint32_t[]> new_pixels(new uint32_t[new_image_width * new_image_height]);
-			const uint32_t* old_pixels = static_cast<const uint32_t*>(inp->pixels());
-
-			for(int y = 0; y != new_image_height; ++y) {
-				for(int x = 0; x != new_image_width; ++x) {
-					const int px = static_cast<int>(ratio_x * x);
-					const int py = static_cast<int>(ratio_y * y);
-					const double xd = ratio_x * x - px;
-					const double yd = ratio_y * y - py;
-					const int pix_index = py * old_image_width + px;
-					const uint32_t a = old_pixels[pix_index];
-					const uint32_t b = old_pixels[pix_index+1];
-					const uint32_t c = old_pixels[pix_index+old_image_width];
-					const uint32_t d = old_pixels[pix_index+old_image_width+1];
-
-					const uint8_t alpha = BILINEAR_ALPHA(a, b, c, d, xd, yd);
-					const uint8_t red = BILINEAR_RED(a, b, c, d, xd, yd);
-					const uint8_t green = BILINEAR_GREEN(a, b, c, d, xd, yd);
-					const uint8_t blue = BILINEAR_BLUE(a, b, c, d, xd, yd);
-
-					new_pixels[y * new_image_width + x] 
-						= (static_cast<uint32_t>(alpha) << 24) 
-						+ (static_cast<uint32_t>(red) << 16) 
-						+ (static_cast<uint32_t>(green) << 8) 
-						+ static_cast<uint32_t>(blue);
+			void bilinear(const uint32_t* old_pixels, int old_image_width, int old_image_height, const int scale, uint32_t* new_pixels)
+			{
+				double ratio_x = 100.0 / static_cast<double>(scale);
+				double ratio_y = ratio_x;
+				const int new_image_width = static_cast<int>(old_image_width / ratio_x);
+				const int new_image_height = static_cast<int>(old_image_height / ratio_y);
+
+				ratio_x = (old_image_width-1.0) / new_image_width;
+				ratio_y = (old_image_height-1.0) / new_image_height;
+
+				for(int y = 0; y != new_image_height; ++y) {
+					for(int x = 0; x != new_image_width; ++x) {
+						const int px = static_cast<int>(ratio_x * x);
+						const int py = static_cast<int>(ratio_y * y);
+						const double xd = ratio_x * x - px;
+						const double yd = ratio_y * y - py;
+						const int pix_index = py * old_image_width + px;
+						const uint32_t a = old_pixels[pix_index];
+						const uint32_t b = old_pixels[pix_index+1];
+						const uint32_t c = old_pixels[pix_index+old_image_width];
+						const uint32_t d = old_pixels[pix_index+old_image_width+1];
+
+						const uint8_t alpha = BILINEAR_ALPHA(a, b, c, d, xd, yd);
+						const uint8_t red = BILINEAR_RED(a, b, c, d, xd, yd);
+						const uint8_t green = BILINEAR_GREEN(a, b, c, d, xd, yd);
+						const uint8_t blue = BILINEAR_BLUE(a, b, c, d, xd, yd);
+
+						new_pixels[y * new_image_width + x] 
+							= (static_cast<uint32_t>(alpha) << 24) 
+							+ (static_cast<uint32_t>(red) << 16) 
+							+ (static_cast<uint32_t>(green) << 8) 
+							+ static_cast<uint32_t>(blue);
+					}
 				}
 			}
 
-			return Surface::create(new_image_width, new_image_height, 32, 4*new_image_width, 0x00ff0000, 0x0000ff00, 0x000000ff, 0xff000000, new_pixels.get());
-		}
-
-		namespace
-		{
-			double cubic_hermite(double a, double b, double c, double d, double t)
+			namespace
 			{
-				const double a0 = -a / 2.0 + (3.0 * b) / 2.0 - (3.0 * c) / 2.0 + d / 2.0;
-				const double b0 = a - (5.0 * b) / 2.0 + 2.0 * c - d / 2.0;
-				const double c0 = -a / 2.0 + c / 2.0;
-				const double d0 = b; 
+				double cubic_hermite(double a, double b, double c, double d, double t)
+				{
+					const double a0 = -a / 2.0 + (3.0 * b) / 2.0 - (3.0 * c) / 2.0 + d / 2.0;
+					const double b0 = a - (5.0 * b) / 2.0 + 2.0 * c - d / 2.0;
+					const double c0 = -a / 2.0 + c / 2.0;
+					const double d0 = b; 
 			
-				return t * ((a0 * t + b0) * t + c0) + d0;
-			}
+					return t * ((a0 * t + b0) * t + c0) + d0;
+				}
 
-			std::array<double, 4> cubic_hermite4(uint32_t a, uint32_t b, uint32_t c, uint32_t d, double t)
-			{
-				std::array<double, 4> ret_val;
-				double au[4];
-				double bu[4];
-				double cu[4];
-				double du[4]; 
-
-				for(int n = 0; n != 4; ++n) {
-					const double A = a & 0xff;
-					const double B = b & 0xff;
-					const double C = c & 0xff;
-					const double D = d & 0xff;
-					a >>= 8; b >>= 8; c >>= 8; d >>= 8;
-					au[n] = -A / 2.0 + (3.0 * B) / 2.0 - (3.0 * C) / 2.0 + D / 2.0;
-					bu[n] =  A - (5.0 * B) / 2.0 + 2.0 * C - D / 2.0;
-					cu[n] = -A / 2.0 + C / 2.0;
-					du[n] = B;
-
-					ret_val[n] = t * ((au[n] * t + bu[n]) * t + cu[n]) + du[n];
+				std::array<double, 4> cubic_hermite4(uint32_t a, uint32_t b, uint32_t c, uint32_t d, double t)
+				{
+					std::array<double, 4> ret_val;
+					double au[4];
+					double bu[4];
+					double cu[4];
+					double du[4]; 
+
+					for(int n = 0; n != 4; ++n) {
+						const double A = a & 0xff;
+						const double B = b & 0xff;
+						const double C = c & 0xff;
+						const double D = d & 0xff;
+						a >>= 8; b >>= 8; c >>= 8; d >>= 8;
+						au[n] = -A / 2.0 + (3.0 * B) / 2.0 - (3.0 * C) / 2.0 + D / 2.0;
+						bu[n] =  A - (5.0 * B) / 2.0 + 2.0 * C - D / 2.0;
+						cu[n] = -A / 2.0 + C / 2.0;
+						du[n] = B;
+
+						ret_val[n] = t * ((au[n] * t + bu[n]) * t + cu[n]) + du[n];
+					}
+					return ret_val;
 				}
-				return ret_val;
 			}
-		}
 
 #define CLAMP_XY(x, y, w, h)	(((x) < 0 ? 0 : (x) > (w)-1 ? (w)-1 : (x)) + ((y) < 0 ? 0 : (y) > (h)-1 ? (h)-1 : (y)) * (w))
 
-		SurfacePtr bicubic(const SurfacePtr& input_surf, const int scale)
-		{
-			if(scale == 100) {
-				return input_surf;
-			}
-
-			SurfacePtr inp = check_input(input_surf, scale);
-
-			const int old_image_width = inp->width();
-			const int old_image_height = inp->height();
-			double ratio_x = 100.0 / static_cast<double>(scale);
-			double ratio_y = ratio_x;
-			const int new_image_width = static_cast<int>(inp->width() / ratio_x);
-			const int new_image_height = static_cast<int>(inp->height() / ratio_y);
-
-			ratio_x = (inp->width()-1.0) / new_image_width;
-			ratio_y = (inp->height()-1.0) / new_image_height;
-
-			ASSERT_LOG(new_image_width > 0 && new_image_height > 0, "New image size would be less than 0 pixels: " << new_image_width << "x" << new_image_height);
-
-			std::unique_ptr<uint32_t[]> new_pixels(new uint32_t[new_image_width * new_image_height]);
-			const uint32_t* old_pixels = static_cast<const uint32_t*>(inp->pixels());
-
-			for(int y = 0; y != new_image_height; ++y) {
-				for(int x = 0; x != new_image_width; ++x) {
-					const int px = static_cast<int>(ratio_x * x);
-					const int py = static_cast<int>(ratio_y * y);
-					const double xd = ratio_x * x - px;
-					const double yd = ratio_y * y - py;
-					const int pix_index = py * old_image_width + px;
-
-					uint32_t pix[4][4];
+			void bicubic(const uint32_t* old_pixels, int old_image_width, int old_image_height, const int scale, uint32_t* new_pixels)
+			{
+				double ratio_x = 100.0 / static_cast<double>(scale);
+				double ratio_y = ratio_x;
+				const int new_image_width = static_cast<int>(old_image_width / ratio_x);
+				const int new_image_height = static_cast<int>(old_image_height / ratio_y);
+
+				ratio_x = (old_image_width-1.0) / new_image_width;
+				ratio_y = (old_image_height-1.0) / new_image_height;
+
+				for(int y = 0; y != new_image_height; ++y) {
+					for(int x = 0; x != new_image_width; ++x) {
+						const int px = static_cast<int>(ratio_x * x);
+						const int py = static_cast<int>(ratio_y * y);
+						const double xd = ratio_x * x - px;
+						const double yd = ratio_y * y - py;
+
+						uint32_t pix[4][4];
+
+						for(int j = 0; j != 4; ++j) {
+							for(int i = 0; i != 4; ++i) {
+								pix[j][i] = old_pixels[CLAMP_XY(px+i-1, py+j-1, old_image_width, old_image_height)];
+							}
+						}
 
-					for(int j = 0; j != 4; ++j) {
-						for(int i = 0; i != 4; ++i) {
-							pix[j][i] = old_pixels[CLAMP_XY(px+i-1, py+j-1, old_image_width, old_image_height)];
+						// Interpolate down each column, then across the results.
+						const auto col0 = cubic_hermite4(pix[0][0], pix[1][0], pix[2][0], pix[3][0], yd);
+						const auto col1 = cubic_hermite4(pix[0][1], pix[1][1], pix[2][1], pix[3][1], yd);
+						const auto col2 = cubic_hermite4(pix[0][2], pix[1][2], pix[2][2], pix[3][2], yd);
+						const auto col3 = cubic_hermite4(pix[0][3], pix[1][3], pix[2][3], pix[3][3], yd);
+						uint32_t pix_value = 0;
+						for(int n = 0; n != 4; n++) {
+							const double value = cubic_hermite(col0[n], col1[n], col2[n], col3[n], xd);
+							pix_value >>= 8;
+							pix_value |= static_cast<uint32_t>(value < 0 ? 0 : value > 255 ? 255 : static_cast<uint8_t>(value)) << 24;
 						}
-					}
 
-					const auto col0 = cubic_hermite4(pix[0][0], pix[1][0], pix[2][0], pix[3][0], xd);
-					const auto col1 = cubic_hermite4(pix[0][1], pix[1][1], pix[2][1], pix[3][1], xd);
-					const auto col2 = cubic_hermite4(pix[0][2], pix[1][2], pix[2][2], pix[3][2], xd);
-					const auto col3 = cubic_hermite4(pix[0][3], pix[1][3], pix[2][3], pix[3][3], xd);
-					uint32_t pix_value = 0;
-					for(int n = 0; n != 4; n++) {
-						const double value = cubic_hermite(col0[n], col1[n], col2[n], col3[n], yd);
-						pix_value >>= 8;
-						pix_value |= (value < 0 ? 0 : value > 255 ? 255 : static_cast<uint8_t>(value)) << 24;
+						new_pixels[y * new_image_width + x] = pix_value;
 					}
-
-					new_pixels[y * new_image_width + x] = pix_value;
 				}
 			}
 
-			return Surface::create(new_image_width, new_image_height, 32, 4*new_image_width, 0x00ff0000, 0x0000ff00, 0x000000ff, 0xff000000, new_pixels.get());
-		}
-
-		SurfacePtr epx(const SurfacePtr& input_surf)
-		{
-			SurfacePtr inp = check_input(input_surf, 200);
-
-			const int old_image_width = inp->width();
-			const int old_image_height = inp->height();
-			double ratio_x = 0.5;
-			double ratio_y = ratio_x;
-			const int new_image_width = static_cast<int>(inp->width() / ratio_x);
-			const int new_image_height = static_cast<int>(inp->height() / ratio_y);
-
-			ratio_x = (inp->width()-1.0) / new_image_width;
-			ratio_y = (inp->height()-1.0) / new_image_height;
-
-			ASSERT_LOG(new_image_width > 0 && new_image_height > 0, "New image size would be less than 0 pixels: " << new_image_width << "x" << new_image_height);
-
-			std::unique_ptr<uint32_t[]> new_pixels(new uint32_t[new_image_width * new_image_height]);
-			const uint32_t* old_pixels = static_cast<const uint32_t*>(inp->pixels());
-
-			for(int y = 0; y != new_image_height; y += 2) {
-				for(int x = 0; x != new_image_width; x += 2) {
-					const int px = static_cast<int>(ratio_x * x);
-					const int py = static_cast<int>(ratio_y * y);
-					const int pix_index = py * old_image_width + px;
-
-					const uint32_t P = old_pixels[CLAMP_XY(px+1-1, py+1-1 ,old_image_width, old_image_height)];
-
-					const uint32_t A = old_pixels[CLAMP_XY(px+1-1, py+0-1 ,old_image_width, old_image_height)];
-					const uint32_t B = old_pixels[CLAMP_XY(px+2-1, py+1-1 ,old_image_width, old_image_height)];
-					const uint32_t C = old_pixels[CLAMP_XY(px+0-1, py+1-1 ,old_image_width, old_image_height)];
-					const uint32_t D = old_pixels[CLAMP_XY(px+1-1, py+2-1 ,old_image_width, old_image_height)];
-
-					/*
-						  A    --\ 1 2
-						C P B  --/ 3 4
-						  D
-						1=P; 2=P; 3=P; 4=P;
-						IF C==A AND C!=D AND A!=B => 1=A
-						IF A==B AND A!=C AND B!=D => 2=B
-						IF B==D AND B!=A AND D!=C => 4=D
-						IF D==C AND D!=B AND C!=A => 3=C
-					*/
-					uint32_t outp[4] = { P, P, P, P };
-					if(C == A && C != D && A != B) {
-						outp[0] = A;
-					}
-					if(A == B && A != C && B != D) {
-						outp[1] = B;
-					}
-					if(B == D && B != A && D != C) {
-						outp[3] = D;
-					}
-					if(D == C && D != B && C != A) {
-						outp[2] = C;
+			void epx(const uint32_t* old_pixels, int old_image_width, int old_image_height, uint32_t* new_pixels)
+			{
+				double ratio_x = 0.5;
+				double ratio_y = ratio_x;
+				const int new_image_width = static_cast<int>(old_image_width / ratio_x);
+				const int new_image_height = static_cast<int>(old_image_height / ratio_y);
+
+				ratio_x = (old_image_width-1.0) / new_image_width;
+				ratio_y = (old_image_height-1.0) / new_image_height;
+
+				for(int y = 0; y != new_image_height; y += 2) {
+					for(int x = 0; x != new_image_width; x += 2) {
+						const int px = static_cast<int>(ratio_x * x);
+						const int py = static_cast<int>(ratio_y * y);
+
+						const uint32_t P = old_pixels[CLAMP_XY(px+1-1, py+1-1 ,old_image_width, old_image_height)];
+
+						const uint32_t A = old_pixels[CLAMP_XY(px+1-1, py+0-1 ,old_image_width, old_image_height)];
+						const uint32_t B = old_pixels[CLAMP_XY(px+2-1, py+1-1 ,old_image_width, old_image_height)];
+						const uint32_t C = old_pixels[CLAMP_XY(px+0-1, py+1-1 ,old_image_width, old_image_height)];
+						const uint32_t D = old_pixels[CLAMP_XY(px+1-1, py+2-1 ,old_image_width, old_image_height)];
+
+						/*
+							  A    --\ 1 2
+							C P B  --/ 3 4
+							  D
+							1=P; 2=P; 3=P; 4=P;
+							IF C==A AND C!=D AND A!=B => 1=A
+							IF A==B AND A!=C AND B!=D => 2=B
+							IF B==D AND B!=A AND D!=C => 4=D
+							IF D==C AND D!=B AND C!=A => 3=C
+						*/
+						uint32_t outp[4] = { P, P, P, P };
+						if(C == A && C != D && A != B) {
+							outp[0] = A;
+						}
+						if(A == B && A != C && B != D) {
+							outp[1] = B;
+						}
+						if(B == D && B != A && D != C) {
+							outp[3] = D;
+						}
+						if(D == C && D != B && C != A) {
+							outp[2] = C;
+						}
+						new_pixels[y * new_image_width + x]		  = outp[0];
+						new_pixels[y * new_image_width + x + 1]   = outp[1];
+						new_pixels[(y+1) * new_image_width + x]   = outp[2];
+						new_pixels[(y+1) * new_image_width + x+1] = outp[3];
 					}
-					new_pixels[y * new_image_width + x]		  = outp[0];
-					new_pixels[y * new_image_width + x + 1]   = outp[1];
-					new_pixels[(y+1) * new_image_width + x]   = outp[2];
-					new_pixels[(y+1) * new_image_width + x+1] = outp[3];
 				}
 			}
+		}
+	}
+}
 
-			return Surface::create(new_image_width, new_image_height, 32, 4*new_image_width, 0x00ff0000, 0x0000ff00, 0x000000ff, 0xff000000, new_pixels.get());
+UNIT_TEST(surface_scale)
+{
+	// The table driven scalers have to give the same results as the reference ones. Bilinear 
+	// differs by up to 3, since the reference truncates each of the four products separately, 
+	// bicubic by 1 from being done in single precision.
+	const int sizes[][2] = { { 2, 2 }, { 3, 7 }, { 37, 23 }, { 64, 64 }, { 129, 65 }, { 300, 200 } };
+	const int scales[] = { 10, 33, 50, 75, 133, 200, 350 };
+	unsigned seed = 12345;
+	for(auto& sz : sizes) {
+		const int w = sz[0];
+		const int h = sz[1];
+		std::vector<uint32_t> pixels(w * h);
+		for(auto& p : pixels) {
+			seed = seed * 1103515245 + 12345;
+			p = (seed >> 16) | (seed << 16);
+			// Make some neighbouring pixels equal so epx has something to do.
+			if((seed >> 28) == 0 && &p != &pixels[0]) {
+				p = *(&p - 1);
+			}
+		}
+		for(int scale : scales) {
+			int dw, dh;
+			KRE::scale::scaled_size(w, h, scale, &dw, &dh);
+			if(dw <= 0 || dh <= 0) {
+				continue;
+			}
+			std::vector<uint32_t> expected(dw * dh), res(dw * dh);
+			KRE::scale::reference::nearest_neighbour(pixels.data(), w, h, scale, expected.data());
+			KRE::scale::nearest_neighbour(pixels.data(), w, h, scale, res.data());
+			CHECK(res == expected, "nearest_neighbour differs for " << w << "x" << h << " at " << scale);
+
+			typedef void (*scale_fn)(const uint32_t*, int, int, int, uint32_t*);
+			const scale_fn reference_fns[] = { KRE::scale::reference::bilinear, KRE::scale::reference::bicubic };
+			const scale_fn fns[] = { KRE::scale::bilinear, KRE::scale::bicubic };
+			const int tolerance[] = { 3, 1 };
+			for(int f = 0; f != 2; ++f) {
+				reference_fns[f](pixels.data(), w, h, scale, expected.data());
+				fns[f](pixels.data(), w, h, scale, res.data());
+				const uint8_t* e = reinterpret_cast<const uint8_t*>(expected.data());
+				const uint8_t* r = reinterpret_cast<const uint8_t*>(res.data());
+				int max_diff = 0;
+				for(int n = 0; n != dw * dh * 4; ++n) {
+					max_diff = std::max(max_diff, std::abs(e[n] - r[n]));
+				}
+				CHECK_LE(max_diff, tolerance[f]);
+			}
 		}
+		std::vector<uint32_t> expected(w * h * 4), res(w * h * 4);
+		KRE::scale::reference::epx(pixels.data(), w, h, expected.data());
+		KRE::scale::epx(pixels.data(), w, h, res.data());
+		CHECK(res == expected, "epx differs for " << w << "x" << h);
 	}
 }
@@ -25,17 +25,36 @@
 
 #include "Surface.hpp"
 
-// Simple routines for doing scaling of surfaces. N.B. This is software scaling and not optimized for speed
-// i.e. only suitable for offline use.
+// Routines for scaling surfaces in software. The scalers are table driven and split the work
+// over the ThreadPool, the reference namespace holds the original per-pixel versions.
 namespace KRE
 {
 	namespace scale
 	{
+		// scale is a percentage from 1 to 10000, 100 being unscaled.
 		SurfacePtr nearest_neighbour(const SurfacePtr& input_surf, const int scale);
 		SurfacePtr bilinear(const SurfacePtr& input_surf, const int scale);
 		SurfacePtr bicubic(const SurfacePtr& input_surf, const int scale);
 
 		// 2x scaling
 		SurfacePtr epx(const SurfacePtr& input_surf);
+
+		// Size of a width x height image after scaling.
+		void scaled_size(int width, int height, const int scale, int* new_width, int* new_height);
+
+		// Versions working on packed 32-bit pixels. dst must have room for the number of pixels
+		// given by scaled_size(), or 2w x 2h for epx.
+		void nearest_neighbour(const uint32_t* src, int w, int h, const int scale, uint32_t* dst);
+		void bilinear(const uint32_t* src, int w, int h, const int scale, uint32_t* dst);
+		void bicubic(const uint32_t* src, int w, int h, const int scale, uint32_t* dst);
+		void epx(const uint32_t* src, int w, int h, uint32_t* dst);
+
+		namespace reference
+		{
+			void nearest_neighbour(const uint32_t* src, int w, int h, const int scale, uint32_t* dst);
+			void bilinear(const uint32_t* src, int w, int h, const int scale, uint32_t* dst);
+			void bicubic(const uint32_t* src, int w, int h, const int scale, uint32_t* dst);
+			void epx(const uint32_t* src, int w, int h, uint32_t* dst);
+		}
 	}
 }
@@ -42,6 +42,8 @@ namespace KRE
 			static std::set<Texture*>* value = new std::set<Texture*>;
 			return *value;
 		}
+
+		const size_t default_upload_cache_budget = 256 * 1024 * 1024;
 	}
 
 	const std::set<Texture*>& Texture::getAllTextures() {
@@ -491,20 +493,31 @@ namespace KRE
 		if(n < 0) {
 			for(auto tp = texture_params_.begin(); tp != texture_params_.end(); ++tp) {
 				tp->src_rect_norm = r;
-				tp->src_rect = rect::from_coordinates(static_cast<int>(round(r.x() * tp->width)),
-					static_cast<int>(round(r.y() * tp->height)),
-					static_cast<int>(round(r.x2() * tp->width)),
-					static_cast<int>(round(r.y2() * tp->height)));
+				tp->src_rect = rect::from_coordinates(static_cast<int>(round(r.x() * tp->width)) - tp->atlas_offset.x,
+					static_cast<int>(round(r.y() * tp->height)) - tp->atlas_offset.y,
+					static_cast<int>(round(r.x2() * tp->width)) - tp->atlas_offset.x,
+					static_cast<int>(round(r.y2() * tp->height)) - tp->atlas_offset.y);
 			}
 		} else {
 			texture_params_[n].src_rect_norm = r;
-			texture_params_[n].src_rect = rect::from_coordinates(static_cast<int>(round(r.x() * texture_params_[n].width)),
-				static_cast<int>(round(r.y() * texture_params_[n].height)),
-				static_cast<int>(round(r.x2() * texture_params_[n].width)),
-				static_cast<int>(round(r.y2() * texture_params_[n].height)));
+			auto& tp = texture_params_[n];
+			tp.src_rect = rect::from_coordinates(static_cast<int>(round(r.x() * tp.width)) - tp.atlas_offset.x,
+				static_cast<int>(round(r.y() * tp.height)) - tp.atlas_offset.y,
+				static_cast<int>(round(r.x2() * tp.width)) - tp.atlas_offset.x,
+				static_cast<int>(round(r.y2() * tp.height)) - tp.atlas_offset.y);
 		}
 	}
 
+	void Texture::setAtlasArea(int n, const rect& r)
+	{
+		ASSERT_LOG(n >= 0 && n < static_cast<int>(texture_params_.size()), "index exceeds number of textures present.");
+		auto& tp = texture_params_[n];
+		tp.atlas_offset = point(r.x(), r.y());
+		tp.surface_width = r.w();
+		tp.surface_height = r.h();
+		setSourceRect(n, rect(0, 0, r.w(), r.h()));
+	}
+
 	void Texture::addPalette(int index, const SurfacePtr& palette)
 	{
 		if(palette == nullptr) {
@@ -635,6 +648,28 @@ namespace KRE
 		clearTextures();
 	}
 
+	Texture::UploadCache& Texture::getUploadCache()
+	{
+		// Never destroyed, the backend may have gone by the time static destructors run.
+		static UploadCache* res = new UploadCache(default_upload_cache_budget);
+		return *res;
+	}
+
+	void Texture::setCacheBudget(size_t bytes)
+	{
+		getUploadCache().setBudget(bytes);
+	}
+
+	CacheStats Texture::getCacheStats()
+	{
+		return getUploadCache().getStats();
+	}
+
+	void Texture::dumpCache(std::ostream& os)
+	{
+		getUploadCache().dump(os);
+	}
+
 	std::vector<SurfacePtr> Texture::getSurfaces() const
 	{
 		std::vector<SurfacePtr> res;
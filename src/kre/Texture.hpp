@@ -108,6 +108,10 @@ namespace KRE
 
 		static void rebuildAll();
 		static void clearTextures();
+		// Uploaded images are kept for reuse until the cache goes over budget and no texture is using them.
+		static void setCacheBudget(size_t bytes);
+		static CacheStats getCacheStats();
+		static void dumpCache(std::ostream& os);
 
 		virtual SurfacePtr extractTextureToSurface(int n = 0) const = 0;
 
@@ -149,11 +153,11 @@ namespace KRE
 
 		template<typename N, typename T>
 		const N getNormalisedTextureCoordW(int n, const T& x) const {
-			return static_cast<N>(x) * texture_params_[n].w_ratio;
+			return (static_cast<N>(x) + static_cast<N>(texture_params_[n].atlas_offset.x)) * texture_params_[n].w_ratio;
 		}
 		template<typename N, typename T>
 		const N getNormalisedTextureCoordH(int n, const T& y) const {
-			return static_cast<N>(y) * texture_params_[n].h_ratio;
+			return (static_cast<N>(y) + static_cast<N>(texture_params_[n].atlas_offset.y)) * texture_params_[n].h_ratio;
 		}
 		template<typename N, typename T>
 		const N getNormalizedTextureCoordW(int n, const T& x) const {
@@ -208,6 +212,9 @@ namespace KRE
 		void setSourceRect(int n, const rect& r);
 		// Set source rect in normalised co-ordinates.
 		void setSourceRectNormalised(int n, const rectf& r);
+		// Restricts the texture to area r of the underlying texture, with source rects and 
+		// co-ordinates then relative to it. Used for images packed into an atlas.
+		void setAtlasArea(int n, const rect& r);
 
 		const rectf& getSourceRectNormalised(int n = 0) const { return texture_params_[n].src_rect_norm; }
 		const rect& getSourceRect(int n = 0) const { return texture_params_[n].src_rect; }
@@ -257,6 +264,10 @@ namespace KRE
 		Texture(const Texture& other);
 		void addSurface(SurfacePtr surf);
 		void replaceSurface(int n, SurfacePtr surf);
+
+		// Backend texture objects created from surfaces, keyed by surface id.
+		typedef LruCache<unsigned, void> UploadCache;
+		static UploadCache& getUploadCache();
 	private:
 		Texture();
 		virtual void rebuild() = 0;
@@ -281,7 +292,8 @@ namespace KRE
 				  h_ratio(1.0f),
 				  w_ratio(1.0f),
 				  src_rect(),
-				  src_rect_norm(0.0f, 0.0f, 1.0f, 1.0f)
+				  src_rect_norm(0.0f, 0.0f, 1.0f, 1.0f),
+				  atlas_offset()
 			{
 			}
 			SurfacePtr surface;
@@ -311,6 +323,9 @@ namespace KRE
 
 			rect src_rect;
 			rectf src_rect_norm;
+
+			// Position of the image in the underlying texture when it's part of an atlas.
+			point atlas_offset;
 		};
 		std::vector<TextureParams> texture_params_;
 		typedef std::vector<TextureParams>::iterator texture_params_iterator;
@@ -0,0 +1,165 @@
+/*
+	Copyright (C) 2016 by Kristina Simpson <sweet.kristas@gmail.com>
+	
+	This software is provided 'as-is', without any express or implied
+	warranty. In no event will the authors be held liable for any damages
+	arising from the use of this software.
+
+	Permission is granted to anyone to use this software for any purpose,
+	including commercial applications, and to alter it and redistribute it
+	freely, subject to the following restrictions:
+
+	   1. The origin of this software must not be misrepresented; you must not
+	   claim that you wrote the original software. If you use this software
+	   in a product, an acknowledgment in the product documentation would be
+	   appreciated but is not required.
+
+	   2. Altered source versions must be plainly marked as such, and must not be
+	   misrepresented as being the original software.
+
+	   3. This notice may not be removed or altered from any source
+	   distribution.
+*/
+
+#include <algorithm>
+
+#include "asserts.hpp"
+#include "TextureAtlas.hpp"
+
+namespace KRE
+{
+	namespace
+	{
+		const int page_size = 1024;
+		const int max_pages = 4;
+		// Images with either side larger than this get a texture of their own.
+		const int max_image_size = 128;
+		// Each image is surrounded by a copy of its edge pixels, so filtering doesn't pull in its neighbours.
+		const int padding = 1;
+
+		bool& atlas_enabled()
+		{
+			static bool res = true;
+			return res;
+		}
+	}
+
+	TextureAtlas::TextureAtlas()
+		: pages_(),
+		  images_(),
+		  rejected_(0)
+	{
+	}
+
+	TextureAtlas& TextureAtlas::getInstance()
+	{
+		// Never destroyed, the pages can't be released once the display device has gone.
+		static TextureAtlas* res = new TextureAtlas();
+		return *res;
+	}
+
+	void TextureAtlas::setEnabled(bool en)
+	{
+		atlas_enabled() = en;
+	}
+
+	bool TextureAtlas::isEnabled()
+	{
+		return atlas_enabled();
+	}
+
+	TexturePtr TextureAtlas::createTexture(const SurfacePtr& surface)
+	{
+		if(isEnabled()) {
+			auto tex = getInstance().add(surface);
+			if(tex != nullptr) {
+				return tex;
+			}
+		}
+		return Texture::createTexture(surface);
+	}
+
+	TexturePtr TextureAtlas::add(const SurfacePtr& surface)
+	{
+		ASSERT_LOG(surface != nullptr, "No surface given to add to the texture atlas.");
+		const int w = surface->width();
+		const int h = surface->height();
+		if(w <= 0 || h <= 0 || w > max_image_size || h > max_image_size) {
+			return nullptr;
+		}
+		const ImageKey key = imageKey(surface);
+		auto it = images_.find(key);
+		if(it != images_.end()) {
+			return it->second->clone();
+		}
+
+		stbrp_rect r;
+		r.id = 0;
+		r.w = w + padding * 2;
+		r.h = h + padding * 2;
+		Page* page = nullptr;
+		for(auto& p : pages_) {
+			stbrp_pack_rects(&p->context, &r, 1);
+			if(r.was_packed) {
+				page = p.get();
+				break;
+			}
+		}
+		if(page == nullptr) {
+			if(static_cast<int>(pages_.size()) >= max_pages) {
+				++rejected_;
+				return nullptr;
+			}
+			std::unique_ptr<Page> p(new Page);
+			p->texture = Texture::createTexture2D(page_size, page_size, PixelFormat::PF::PIXELFORMAT_RGBA8888);
+			p->nodes.resize(page_size);
+			stbrp_init_target(&p->context, page_size, page_size, p->nodes.data(), static_cast<int>(p->nodes.size()));
+			stbrp_pack_rects(&p->context, &r, 1);
+			ASSERT_LOG(r.was_packed, "Image of " << w << "x" << h << " didn't fit in an empty atlas page.");
+			page = p.get();
+			pages_.emplace_back(std::move(p));
+		}
+
+		// Unpack the image into the middle of the padded area then extend the edges outwards.
+		const int stride = r.w;
+		std::vector<PixelRGBA> pixels(r.w * r.h);
+		surface->visitRows([&pixels, stride](int x, int y, const PixelRGBA* px, int count) {
+			PixelRGBA* row = &pixels[(y + padding) * stride];
+			std::copy(px, px + count, row + padding);
+			row[0] = px[0];
+			row[count + padding] = px[count - 1];
+		});
+		std::copy(pixels.begin() + stride, pixels.begin() + stride * 2, pixels.begin());
+		std::copy(pixels.begin() + stride * h, pixels.begin() + stride * (h + 1), pixels.begin() + stride * (h + 1));
+		page->texture->update2D(0, r.x, r.y, r.w, r.h, stride * 4, pixels.data());
+
+		auto tex = page->texture->clone();
+		tex->setAtlasArea(0, rect(r.x + padding, r.y + padding, w, h));
+		images_[key] = tex;
+		return tex->clone();
+	}
+
+	TextureAtlas::ImageKey TextureAtlas::imageKey(const SurfacePtr& surface)
+	{
+		if(surface->isFromFile()) {
+			return ImageKey(surface->getName(), surface->getFlags(), surface->width(), surface->height(), 0);
+		}
+		return ImageKey(std::string(), SurfaceFlags::NONE, 0, 0, surface->id());
+	}
+
+	void TextureAtlas::clear()
+	{
+		pages_.clear();
+		images_.clear();
+		rejected_ = 0;
+	}
+
+	AtlasStats TextureAtlas::getStats() const
+	{
+		AtlasStats stats;
+		stats.pages = static_cast<int>(pages_.size());
+		stats.images = static_cast<int>(images_.size());
+		stats.rejected = rejected_;
+		return stats;
+	}
+}
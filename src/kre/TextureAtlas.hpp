@@ -0,0 +1,87 @@
+/*
+	Copyright (C) 2016 by Kristina Simpson <sweet.kristas@gmail.com>
+	
+	This software is provided 'as-is', without any express or implied
+	warranty. In no event will the authors be held liable for any damages
+	arising from the use of this software.
+
+	Permission is granted to anyone to use this software for any purpose,
+	including commercial applications, and to alter it and redistribute it
+	freely, subject to the following restrictions:
+
+	   1. The origin of this software must not be misrepresented; you must not
+	   claim that you wrote the original software. If you use this software
+	   in a product, an acknowledgment in the product documentation would be
+	   appreciated but is not required.
+
+	   2. Altered source versions must be plainly marked as such, and must not be
+	   misrepresented as being the original software.
+
+	   3. This notice may not be removed or altered from any source
+	   distribution.
+*/
+
+#pragma once
+
+#include <map>
+#include <memory>
+#include <string>
+#include <tuple>
+#include <vector>
+
+#include "stb_rect_pack.h"
+#include "Texture.hpp"
+
+namespace KRE
+{
+	struct AtlasStats
+	{
+		AtlasStats() : pages(0), images(0), rejected(0) {}
+		int pages;
+		int images;
+		// Small images that didn't fit because every page was full.
+		int rejected;
+	};
+
+	// Packs small images into a few large textures as they are loaded, so that drawing lots of 
+	// them (icons and such) doesn't need a texture bind for each one. Space isn't reclaimed 
+	// until clear() is called, when the pages run out images get textures of their own.
+	class TextureAtlas
+	{
+	public:
+		static TextureAtlas& getInstance();
+		static void setEnabled(bool en);
+		static bool isEnabled();
+
+		// Returns a texture for the surface, from an atlas page if it's small enough. Atlased 
+		// textures only cover their image, so can't use the wrapping address modes.
+		static TexturePtr createTexture(const SurfacePtr& surface);
+
+		// Returns nullptr if the surface is too large or there isn't any room for it.
+		TexturePtr add(const SurfacePtr& surface);
+		void clear();
+
+		AtlasStats getStats() const;
+	private:
+		TextureAtlas();
+
+		struct Page
+		{
+			TexturePtr texture;
+			stbrp_context context;
+			std::vector<stbrp_node> nodes;
+		};
+		std::vector<std::unique_ptr<Page>> pages_;
+		// Images loaded from files are keyed by file name, flags and size so that they are found
+		// again after the surface cache has dropped and reloaded them. Anything else uses the 
+		// surface id.
+		typedef std::tuple<std::string, SurfaceFlags, int, int, unsigned> ImageKey;
+		static ImageKey imageKey(const SurfacePtr& surface);
+		// Image to the area of the page holding it.
+		std::map<ImageKey, TexturePtr> images_;
+		int rejected_;
+
+		TextureAtlas(const TextureAtlas&);
+		void operator=(const TextureAtlas&);
+	};
+}
@@ -24,6 +24,7 @@
 #include "asserts.hpp"
 #include "profile_timer.hpp"
 #include "DisplayDevice.hpp"
+#include "StateTrackerOGL.hpp"
 #include "TextureOGL.hpp"
 
 namespace KRE
@@ -54,18 +55,28 @@ namespace KRE
 			return GL_TEXTURE_2D;
 		}
 
-		typedef std::map<unsigned, std::weak_ptr<GLuint>> texture_id_cache;
-		texture_id_cache& get_id_cache()
+#if defined(ENABLE_PROFILING)
+		// Size of a pixel given to glTex(Sub)Image, for counting uploaded bytes.
+		int bytes_per_pixel(GLenum format, GLenum type)
 		{
-			static texture_id_cache res;
-			return res;
-		}
-
-		GLuint& get_current_bound_texture()
-		{
-			static GLuint res = -1;
-			return res;
+			int components = 4;
+			switch(format) {
+				case GL_RED: case GL_ALPHA: case GL_LUMINANCE: case GL_RED_INTEGER:	components = 1; break;
+				case GL_RG: case GL_LUMINANCE_ALPHA: case GL_RG_INTEGER:			components = 2; break;
+				case GL_RGB: case GL_BGR: case GL_RGB_INTEGER: case GL_BGR_INTEGER:	components = 3; break;
+				default: break;
+			}
+			switch(type) {
+				case GL_BYTE: case GL_UNSIGNED_BYTE:						return components;
+				case GL_SHORT: case GL_UNSIGNED_SHORT: case GL_HALF_FLOAT:	return components * 2;
+				case GL_INT: case GL_UNSIGNED_INT: case GL_FLOAT:			return components * 4;
+				case GL_UNSIGNED_SHORT_5_6_5: case GL_UNSIGNED_SHORT_4_4_4_4: case GL_UNSIGNED_SHORT_5_5_5_1:	return 2;
+				default: break;
+			}
+			// The remaining packed formats.
+			return 4;
 		}
+#endif
 	}
 
 	OpenGLTexture::OpenGLTexture(const variant& node, const std::vector<SurfacePtr>& surfaces)
@@ -137,8 +148,7 @@ namespace KRE
 	{
 		auto& td = texture_data_[n];
 		ASSERT_LOG(is_yuv_planar_ == false, "Use updateYUV to update a YUV texture.");
-		glBindTexture(GetGLTextureType(getType(n)), *td.id);
-		get_current_bound_texture() = *td.id;
+		StateTrackerOGL::getInstance().bindTexture(GetGLTextureType(getType(n)), *td.id);
 		ASSERT_LOG(getType(n) == TextureType::TEXTURE_1D, "Tried to do 1D texture update on non-1D texture");
 		if(getUnpackAlignment(n) != 4) {
 			glPixelStorei(GL_UNPACK_ALIGNMENT, getUnpackAlignment(n));
@@ -154,14 +164,14 @@ namespace KRE
 	{
 		ASSERT_LOG(is_yuv_planar_ == false, "Use updateYUV to update a YUV texture.");
 		auto& td = texture_data_[n];
-		glBindTexture(GetGLTextureType(getType(n)), *td.id);
-		get_current_bound_texture() = *td.id;
+		StateTrackerOGL::getInstance().bindTexture(GetGLTextureType(getType(n)), *td.id);
 		ASSERT_LOG(getType(n) == TextureType::TEXTURE_2D, "Tried to do 2D texture update on non-2D texture: " << static_cast<int>(getType(n)));
 		if(getUnpackAlignment(n) != 4) {
 			glPixelStorei(GL_UNPACK_ALIGNMENT, getUnpackAlignment(n));
 		}
 		//glPixelStorei(GL_UNPACK_ROW_LENGTH, stride);
 		glTexSubImage2D(GetGLTextureType(getType(n)), 0, x, y, width, height, td.format, td.type, pixels);
+		PROFILE_COUNT(UPLOADED_BYTES, width * height * bytes_per_pixel(td.format, td.type));
 		//glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
 		if(getUnpackAlignment(n) != 4) {
 			glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
@@ -172,13 +182,13 @@ namespace KRE
 	{
 		ASSERT_LOG(is_yuv_planar_ == false, "Use updateYUV to update a YUV texture.");
 		auto& td = texture_data_[n];
-		glBindTexture(GetGLTextureType(getType(n)), *td.id);
-		get_current_bound_texture() = *td.id;
+		StateTrackerOGL::getInstance().bindTexture(GetGLTextureType(getType(n)), *td.id);
 		ASSERT_LOG(getType(n) == TextureType::TEXTURE_2D, "Tried to do 2D texture update on non-2D texture: " << static_cast<int>(getType(n)));
 		if(getUnpackAlignment(n) != 4) {
 			glPixelStorei(GL_UNPACK_ALIGNMENT, getUnpackAlignment(n));
 		}
 		glTexSubImage2D(GetGLTextureType(getType(n)), 0, x, y, width, height, td.format, td.type, pixels);
+		PROFILE_COUNT(UPLOADED_BYTES, width * height * bytes_per_pixel(td.format, td.type));
 		if(getUnpackAlignment(n) != 4) {
 			glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
 		}
@@ -190,9 +200,7 @@ namespace KRE
 		ASSERT_LOG(is_yuv_planar_, "updateYUV called on non YUV planar texture.");
 		for(int n = 2; n >= 0; --n) {
 			auto& td = texture_data_[n];
-			glActiveTexture(GL_TEXTURE0 + n);
-			glBindTexture(GetGLTextureType(getType(n)), *td.id);
-			get_current_bound_texture() = *td.id;
+			StateTrackerOGL::getInstance().bindTexture(n, GetGLTextureType(getType(n)), *td.id);
 			if(static_cast<int>(stride.size()) > n) {
 				glPixelStorei(GL_UNPACK_ROW_LENGTH, stride[n]);
 			}
@@ -230,8 +238,7 @@ namespace KRE
 	{
 		ASSERT_LOG(is_yuv_planar_ == false, "3D Texture Update function called on YUV planar format.");
 		auto& td = texture_data_[n];
-		glBindTexture(GetGLTextureType(getType(n)), *td.id);
-		get_current_bound_texture() = *td.id;
+		StateTrackerOGL::getInstance().bindTexture(GetGLTextureType(getType(n)), *td.id);
 		if(getUnpackAlignment(n) != 4) {
 			glPixelStorei(GL_UNPACK_ALIGNMENT, getUnpackAlignment());
 		}
@@ -295,7 +302,7 @@ namespace KRE
 
 			auto& td = texture_data_[0];
 			td.palette.clear();
-			getSurface(0)->iterateOverSurface([&new_pixels, rp, &td](int x, int y, int r, int g, int b, int a){
+			getSurface(0)->visitPixels([&new_pixels, rp, &td](int x, int y, int r, int g, int b, int a){
 				color_histogram_type::key_type color = (static_cast<uint32_t>(r) << 24)
 					| (static_cast<uint32_t>(g) << 16)
 					| (static_cast<uint32_t>(b) << 8)
@@ -594,27 +601,22 @@ namespace KRE
 		}
 
 		if(surf != nullptr) {
-			auto it = get_id_cache().find(surf->id());
-			if(it != get_id_cache().end()) {
-				auto cached_id = it->second.lock();
-				if(cached_id != nullptr) {
-					texture_data_[n].id = cached_id;
-					return;
-				}
-				// if we couldn't lock the id fall through and create a new one
+			auto cached_id = std::static_pointer_cast<GLuint>(getUploadCache().get(surf->id()));
+			if(cached_id != nullptr) {
+				texture_data_[n].id = cached_id;
+				return;
 			}
 		}
 
 		GLuint new_id;
 		glGenTextures(1, &new_id);
-		auto id_ptr = std::shared_ptr<GLuint>(new GLuint(new_id), [](GLuint* id) { glDeleteTextures(1, id); delete id; });
+		auto id_ptr = std::shared_ptr<GLuint>(new GLuint(new_id), [](GLuint* id) { StateTrackerOGL::getInstance().textureDeleted(*id); glDeleteTextures(1, id); delete id; });
 		td.id = id_ptr;
 		if(surf) {
-			get_id_cache()[surf->id()] = id_ptr;
+			getUploadCache().put(surf->id(), id_ptr, actualWidth(n) * actualHeight(n) * surf->getPixelFormat()->bytesPerPixel(), surf->getName());
 		}
 
-		glBindTexture(GetGLTextureType(getType(n)), *td.id);
-		get_current_bound_texture() = *td.id;
+		StateTrackerOGL::getInstance().bindTexture(GetGLTextureType(getType(n)), *td.id);
 
 		unsigned w = is_yuv_planar_ && n>0 ? surfaceWidth(n)/2 : surfaceWidth(n);
 		unsigned h = is_yuv_planar_ && n>0 ? surfaceHeight(n)/2 : surfaceHeight(n);
@@ -638,6 +640,7 @@ namespace KRE
 					glTexImage2D(GL_TEXTURE_2D, 0, td.internal_format, w, h, 0, td.format, td.type, 0);
 				} else {
 					glTexImage2D(GL_TEXTURE_2D, 0, td.internal_format, surf->width(), surf->height(), 0, td.format, td.type, pixels);
+					PROFILE_COUNT(UPLOADED_BYTES, surf->height() * surf->rowPitch());
 				}
 				break;
 			case TextureType::TEXTURE_3D:
@@ -674,8 +677,7 @@ namespace KRE
 		auto& td = texture_data_[n];
 		GLenum type = GetGLTextureType(getType(n));
 
-		glBindTexture(type, *td.id);
-		get_current_bound_texture() = *td.id;
+		StateTrackerOGL::getInstance().bindTexture(type, *td.id);
 
 		glTexParameteri(type, GL_TEXTURE_WRAP_S, GetGLAddressMode(getAddressModeU(n)));
 		if(getAddressModeU(n) == AddressMode::BORDER) {
@@ -746,17 +748,13 @@ namespace KRE
 
 	void OpenGLTexture::bind(int binding_point) 
 	{
-		// XXX fix this fore multiple texture binding.
-		if(get_current_bound_texture() == *texture_data_[0].id) {
-			return;
-		}
+		bool bound = false;
 		int n = static_cast<int>(texture_data_.size() - 1);
 		for(auto it = texture_data_.rbegin(); it != texture_data_.rend(); ++it, --n) {
-			glActiveTexture(GL_TEXTURE0 + n + binding_point);
-			glBindTexture(GetGLTextureType(getType(n)), *it->id);
+			bound |= StateTrackerOGL::getInstance().bindTexture(n + binding_point, GetGLTextureType(getType(n)), *it->id);
 		}
-		if(binding_point == 0) {
-			get_current_bound_texture() = *texture_data_[0].id;
+		if(bound) {
+			++DisplayDevice::getRenderStats().texture_binds;
 		}
 	}
 
@@ -798,7 +796,7 @@ namespace KRE
 
 	void OpenGLTexture::handleClearTextures()
 	{
-		get_id_cache().clear();
+		getUploadCache().clear();
 	}
 
 	SurfacePtr OpenGLTexture::extractTextureToSurface(int n) const
@@ -811,8 +809,7 @@ namespace KRE
 
 		new_data.resize(h * stride);
 		std::fill(new_data.begin(), new_data.end(), 0xcd);
-		glBindTexture(GetGLTextureType(getType(n)), *td.id);
-		get_current_bound_texture() = *td.id;
+		StateTrackerOGL::getInstance().bindTexture(GetGLTextureType(getType(n)), *td.id);
 		glGetTexImage(GetGLTextureType(getType(n)), 
 			0,
 			GL_BGRA,
@@ -0,0 +1,155 @@
+/*
+	Copyright (C) 2016 by Kristina Simpson <sweet.kristas@gmail.com>
+	
+	This software is provided 'as-is', without any express or implied
+	warranty. In no event will the authors be held liable for any damages
+	arising from the use of this software.
+
+	Permission is granted to anyone to use this software for any purpose,
+	including commercial applications, and to alter it and redistribute it
+	freely, subject to the following restrictions:
+
+	   1. The origin of this software must not be misrepresented; you must not
+	   claim that you wrote the original software. If you use this software
+	   in a product, an acknowledgment in the product documentation would be
+	   appreciated but is not required.
+
+	   2. Altered source versions must be plainly marked as such, and must not be
+	   misrepresented as being the original software.
+
+	   3. This notice may not be removed or altered from any source
+	   distribution.
+*/
+
+#include <algorithm>
+
+#include "asserts.hpp"
+#include "profile_timer.hpp"
+#include "ThreadPool.hpp"
+
+namespace KRE
+{
+	namespace
+	{
+		bool& thread_pool_enabled()
+		{
+			static bool res = true;
+			return res;
+		}
+	}
+
+	ThreadPool::ThreadPool()
+		: workers_(),
+		  mutex_(),
+		  job_cond_(),
+		  done_cond_(),
+		  jobs_(),
+		  running_(true)
+	{
+		const int hw_threads = static_cast<int>(std::thread::hardware_concurrency());
+		const int worker_count = std::max(0, std::min(hw_threads, 8) - 1);
+		for(int n = 0; n != worker_count; ++n) {
+			workers_.emplace_back(&ThreadPool::run, this);
+		}
+	}
+
+	ThreadPool::~ThreadPool()
+	{
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			running_ = false;
+		}
+		job_cond_.notify_all();
+		for(auto& worker : workers_) {
+			if(worker.joinable()) {
+				worker.join();
+			}
+		}
+	}
+
+	ThreadPool& ThreadPool::getInstance()
+	{
+		static ThreadPool res;
+		return res;
+	}
+
+	void ThreadPool::setEnabled(bool en)
+	{
+		thread_pool_enabled() = en;
+	}
+
+	bool ThreadPool::isEnabled()
+	{
+		return thread_pool_enabled();
+	}
+
+	void ThreadPool::parallelFor(int count, int min_range, const range_fn& fn)
+	{
+		if(count <= 0) {
+			return;
+		}
+		const int ranges = isEnabled() ? std::min(getThreadCount(), count / std::max(1, min_range)) : 1;
+		if(ranges <= 1) {
+			fn(0, count);
+			return;
+		}
+
+		int remaining = ranges - 1;
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			for(int n = 1; n != ranges; ++n) {
+				const int begin = static_cast<int>(static_cast<long long>(count) * n / ranges);
+				const int end = static_cast<int>(static_cast<long long>(count) * (n + 1) / ranges);
+				jobs_.emplace_back([this, &fn, &remaining, begin, end]() {
+					fn(begin, end);
+					std::lock_guard<std::mutex> lock(mutex_);
+					if(--remaining == 0) {
+						done_cond_.notify_all();
+					}
+				});
+			}
+		}
+		job_cond_.notify_all();
+		// Wake any threads waiting in parallelFor() so they can help as well.
+		done_cond_.notify_all();
+
+		fn(0, static_cast<int>(static_cast<long long>(count) / ranges));
+
+		// Help with any queued jobs while waiting, so that nested calls can't deadlock.
+		std::unique_lock<std::mutex> lock(mutex_);
+		while(remaining > 0) {
+			if(!runOneJob(lock)) {
+				done_cond_.wait(lock, [this, &remaining]() { return remaining == 0 || !jobs_.empty(); });
+			}
+		}
+	}
+
+	bool ThreadPool::runOneJob(std::unique_lock<std::mutex>& lock)
+	{
+		if(jobs_.empty()) {
+			return false;
+		}
+		auto job = jobs_.front();
+		jobs_.pop_front();
+		lock.unlock();
+		{
+			PROFILE_SCOPE("pool job");
+			job();
+		}
+		lock.lock();
+		return true;
+	}
+
+	void ThreadPool::run()
+	{
+		PROFILE_THREAD_NAME("thread pool");
+		std::unique_lock<std::mutex> lock(mutex_);
+		for(;;) {
+			job_cond_.wait(lock, [this]() { return !jobs_.empty() || !running_; });
+			if(!running_) {
+				return;
+			}
+			runOneJob(lock);
+		}
+	}
+}
@@ -0,0 +1,69 @@
+/*
+	Copyright (C) 2016 by Kristina Simpson <sweet.kristas@gmail.com>
+	
+	This software is provided 'as-is', without any express or implied
+	warranty. In no event will the authors be held liable for any damages
+	arising from the use of this software.
+
+	Permission is granted to anyone to use this software for any purpose,
+	including commercial applications, and to alter it and redistribute it
+	freely, subject to the following restrictions:
+
+	   1. The origin of this software must not be misrepresented; you must not
+	   claim that you wrote the original software. If you use this software
+	   in a product, an acknowledgment in the product documentation would be
+	   appreciated but is not required.
+
+	   2. Altered source versions must be plainly marked as such, and must not be
+	   misrepresented as being the original software.
+
+	   3. This notice may not be removed or altered from any source
+	   distribution.
+*/
+
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace KRE
+{
+	// Pool of worker threads for splitting CPU bound pixel work (blurs, scaling, ...) 
+	// into ranges. Jobs must not touch any GL state.
+	class ThreadPool
+	{
+	public:
+		typedef std::function<void(int, int)> range_fn;
+		~ThreadPool();
+
+		static ThreadPool& getInstance();
+		// When disabled parallelFor() runs everything on the calling thread.
+		static void setEnabled(bool en);
+		static bool isEnabled();
+
+		// Calls fn(begin, end) on sub-ranges covering [0, count), with each range at least
+		// min_range long, and waits for them all to finish. The calling thread does some of 
+		// the work itself.
+		void parallelFor(int count, int min_range, const range_fn& fn);
+		// Number of threads that work is split between, including the caller.
+		int getThreadCount() const { return static_cast<int>(workers_.size()) + 1; }
+	private:
+		ThreadPool();
+		void run();
+		bool runOneJob(std::unique_lock<std::mutex>& lock);
+
+		std::vector<std::thread> workers_;
+		std::mutex mutex_;
+		std::condition_variable job_cond_;
+		std::condition_variable done_cond_;
+		std::deque<std::function<void()>> jobs_;
+		bool running_;
+
+		ThreadPool(const ThreadPool&);
+		void operator=(const ThreadPool&);
+	};
+}
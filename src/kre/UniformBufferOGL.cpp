@@ -21,6 +21,9 @@
 	   distribution.
 */
 
+#include <cstring>
+
+#include "profile_timer.hpp"
 #include "DisplayDeviceOGL.hpp"
 #include "UniformBufferOGL.hpp"
 
@@ -28,7 +31,8 @@ namespace KRE
 {
 	UniformHardwareOGL::UniformHardwareOGL(const std::string& name)
 		: UniformHardwareInterface(name),
-		  ubo_(0)
+		  ubo_(0),
+		  size_(0)
 	{
 		glGenBuffers(1, &ubo_);
 	}
@@ -40,10 +44,85 @@ namespace KRE
 
 	void UniformHardwareOGL::update(void* buffer, int size)
 	{
-		// XXX
 		glBindBuffer(GL_UNIFORM_BUFFER, ubo_);
-		GLvoid* p = glMapBuffer(GL_UNIFORM_BUFFER, GL_WRITE_ONLY);
-		std::memcpy(p, buffer, size);
-		glUnmapBuffer(GL_UNIFORM_BUFFER);
+		PROFILE_COUNT(UPLOADED_BYTES, size);
+		if(size != size_) {
+			glBufferData(GL_UNIFORM_BUFFER, size, buffer, GL_DYNAMIC_DRAW);
+			size_ = size;
+		} else {
+			glBufferSubData(GL_UNIFORM_BUFFER, 0, size, buffer);
+		}
+	}
+
+	void UniformHardwareOGL::bindBase(GLuint binding_point)
+	{
+		glBindBufferBase(GL_UNIFORM_BUFFER, binding_point, ubo_);
+	}
+
+	namespace
+	{
+		// std140 layout of the camera block, three column major mat4's need no padding.
+		struct CameraBlock
+		{
+			float p[16];
+			float v[16];
+			float pv[16];
+		};
+	}
+
+	CameraUniformsOGL::CameraUniformsOGL()
+		: ubo_(),
+		  valid_(false),
+		  generation_(0),
+		  p_(1.0f),
+		  v_(1.0f),
+		  pv_(1.0f)
+	{
+	}
+
+	CameraUniformsOGL& CameraUniformsOGL::getInstance()
+	{
+		// Never destroyed, the context is gone by the time statics are.
+		static CameraUniformsOGL* res = new CameraUniformsOGL();
+		return *res;
+	}
+
+	bool CameraUniformsOGL::isSupported()
+	{
+		return GLEW_ARB_uniform_buffer_object != 0;
+	}
+
+	void CameraUniformsOGL::reset()
+	{
+		// Called before anything else is created in the new context.
+		ubo_.reset();
+		valid_ = false;
+		++generation_;
+	}
+
+	bool CameraUniformsOGL::set(const glm::mat4& p, const glm::mat4& v)
+	{
+		if(valid_ && p == p_ && v == v_) {
+			return false;
+		}
+		p_ = p;
+		v_ = v;
+		pv_ = p * v;
+		valid_ = true;
+		++generation_;
+
+		if(isSupported()) {
+			if(ubo_ == nullptr) {
+				ubo_.reset(new UniformHardwareOGL("u_camera"));
+				ubo_->bindBase(BindingPoint);
+			}
+			CameraBlock block;
+			std::memcpy(block.p, &p_[0][0], sizeof(block.p));
+			std::memcpy(block.v, &v_[0][0], sizeof(block.v));
+			std::memcpy(block.pv, &pv_[0][0], sizeof(block.pv));
+			ubo_->update(&block, sizeof(block));
+			++DisplayDevice::getRenderStats().camera_uploads;
+		}
+		return true;
 	}
 }
@@ -23,7 +23,10 @@
 
 #pragma once
 
+#include <memory>
+
 #include <GL/glew.h>
+#include <glm/glm.hpp>
 
 #include "Shaders.hpp"
 #include "UniformBuffer.hpp"
@@ -38,8 +41,47 @@ namespace KRE
 		~UniformHardwareOGL();
 		void update(void* buffer, int size) override;
 		void mapToShader(ShaderProgramPtr shader);
+		// Attaches the buffer to an indexed binding point, which programs' blocks are pointed at.
+		void bindBase(GLuint binding_point);
 	private:
 		UniformHardwareOGL();
 		GLuint ubo_;
+		// Storage is only allocated once, later updates of the same size replace the contents.
+		int size_;
+	};
+
+	// The projection and view matrices shared by every program that uses the standard camera
+	// include. With uniform buffer objects they live in one buffer bound for all programs, so
+	// they are uploaded once per camera change rather than once per draw. Without them each
+	// program uploads its own copy, but only when the camera has changed since it last did.
+	class CameraUniformsOGL
+	{
+	public:
+		static CameraUniformsOGL& getInstance();
+		static bool isSupported();
+
+		enum { BindingPoint = 0 };
+
+		// For a new context, the buffer is created again on the next set().
+		void reset();
+		// Returns true if the matrices differ from the last ones set.
+		bool set(const glm::mat4& p, const glm::mat4& v);
+
+		const glm::mat4& getProjection() const { return p_; }
+		const glm::mat4& getView() const { return v_; }
+		const glm::mat4& getPV() const { return pv_; }
+		// Changes each time the matrices do, for programs keeping their own copy.
+		unsigned getGeneration() const { return generation_; }
+	private:
+		CameraUniformsOGL();
+		CameraUniformsOGL(const CameraUniformsOGL&);
+		void operator=(const CameraUniformsOGL&);
+
+		std::unique_ptr<UniformHardwareOGL> ubo_;
+		bool valid_;
+		unsigned generation_;
+		glm::mat4 p_;
+		glm::mat4 v_;
+		glm::mat4 pv_;
 	};
 }
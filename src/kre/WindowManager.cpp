@@ -82,7 +82,8 @@ namespace KRE
 			  renderer_(nullptr),
 			  context_(nullptr),
 			  nonfs_width_(width),
-			  nonfs_height_(height)
+			  nonfs_height_(height),
+			  hidden_(hints["hidden"].as_bool(false))
 		{
 			if(hints.has_key("renderer")) {
 				if(hints["renderer"].is_string()) {
@@ -117,6 +118,15 @@ namespace KRE
 			}
 			ASSERT_LOG(getDisplayDevice() != nullptr, "No display driver was created.");
 
+			if(getDisplayDevice()->ID() == DisplayDevice::DISPLAY_DEVICE_NULL) {
+				// Nothing gets drawn, so we don't need a window or a context. Which means
+				// this works without a display.
+				getDisplayDevice()->init(width(), height());
+				getDisplayDevice()->printDeviceInfo();
+				getDisplayDevice()->setClearColor(clear_color_);
+				return;
+			}
+
 			if(getDisplayDevice()->ID() == DisplayDevice::DISPLAY_DEVICE_OPENGL) {
 				// We need to do extra SDL set-up for an OpenGL context.
 				// Since these parameter's need to be set-up before context
@@ -189,6 +199,11 @@ namespace KRE
 				wnd_flags |= SDL_WINDOW_BORDERLESS;
 			}
 
+			// For rendering off-screen, we still need a window to get a context from.
+			if(hidden_) {
+				wnd_flags |= SDL_WINDOW_HIDDEN;
+			}
+
 			int x = SDL_WINDOWPOS_CENTERED;
 			int y = SDL_WINDOWPOS_CENTERED;
 			int w = width();
@@ -257,6 +272,7 @@ namespace KRE
 			// So we use that.
 			if(getDisplayDevice()->ID() == DisplayDevice::DISPLAY_DEVICE_OPENGL || getDisplayDevice()->ID() == DisplayDevice::DISPLAY_DEVICE_OPENGLES) {
 				SDL_GL_SwapWindow(window_.get());
+				getDisplayDevice()->swap();
 			} else {
 				// default to delegating to the display device.
 				getDisplayDevice()->swap();
@@ -264,10 +280,13 @@ namespace KRE
 		}
 
 		unsigned getWindowID() const override {
-			return SDL_GetWindowID(window_.get());
+			return window_ != nullptr ? SDL_GetWindowID(window_.get()) : 0;
 		}
 
 		void setWindowIcon(const std::string& name) override {
+			if(window_ == nullptr) {
+				return;
+			}
 			SurfaceSDL icon(name);
 			SDL_SetWindowIcon(window_.get(), icon.get());
 		}
@@ -415,6 +434,8 @@ namespace KRE
 		// Height of the window before changing to full-screen mode
 		int nonfs_height_;
 
+		bool hidden_;
+
 		SDLWindow(const SDLWindow&);
 	};
 
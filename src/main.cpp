@@ -23,6 +23,10 @@
 
 #include <clocale>
 #include <locale>
+#include <map>
+#include <sstream>
+
+#include <boost/filesystem.hpp>
 
 #include "asserts.hpp"
 #include "filesystem.hpp"
@@ -32,6 +36,7 @@
 #include "ClipScope.hpp"
 #include "Font.hpp"
 #include "RenderManager.hpp"
+#include "RenderQueue.hpp"
 #include "RenderTarget.hpp"
 #include "SceneGraph.hpp"
 #include "SceneNode.hpp"
@@ -45,9 +50,13 @@
 
 #include "css_parser.hpp"
 #include "FontDriver.hpp"
+#include "FontIndex.hpp"
+#include "FontRasterQueue.hpp"
+#include "ImageDecodeQueue.hpp"
 #include "scrollable.hpp"
 #include "xtext_edit.hpp"
 #include "xhtml.hpp"
+#include "xhtml_background_info.hpp"
 #include "xhtml_layout_engine.hpp"
 #include "xhtml_root_box.hpp"
 #include "xhtml_style_tree.hpp"
@@ -55,17 +64,15 @@
 #include "xhtml_render_ctx.hpp"
 
 #include "SurfaceScale.hpp"
+#include "TextureAtlas.hpp"
 
 #if defined(_MSC_VER)
 #define WIN32_LEAN_AND_MEAN
 #include <Windows.h>
 #endif
 
-xhtml::DocumentPtr load_xhtml(const std::string& ua_ss, const std::string& test_doc)
+xhtml::DocumentPtr load_xhtml(const css::StyleSheetPtr& user_agent_style_sheet, const std::string& test_doc)
 {
-	auto user_agent_style_sheet = std::make_shared<css::StyleSheet>();
-	css::Parser::parse(user_agent_style_sheet, sys::read_file(ua_ss));
-
 	auto doc = xhtml::Document::create(user_agent_style_sheet);
 	auto doc_frag = xhtml::parse_from_file(test_doc, doc);
 	doc->addChild(doc_frag, doc);
@@ -76,6 +83,146 @@ xhtml::DocumentPtr load_xhtml(const std::string& ua_ss, const std::string& test_
 	return doc;
 }
 
+xhtml::DocumentPtr load_xhtml(const std::string& ua_ss, const std::string& test_doc)
+{
+	auto user_agent_style_sheet = std::make_shared<css::StyleSheet>();
+	css::Parser::parse(user_agent_style_sheet, sys::read_file(ua_ss));
+	return load_xhtml(user_agent_style_sheet, test_doc);
+}
+
+struct BatchJob
+{
+	std::string doc;
+	int width;
+	int height;
+	std::string output;
+};
+
+// Each line of the list is "<document> <width>x<height> [output.png]". Blank lines and lines starting
+// with '#' are skipped. Without an output name one is made from the document name and size.
+std::vector<BatchJob> read_batch_list(const std::string& list_file, const std::string& data_path, const std::string& out_dir)
+{
+	std::vector<BatchJob> res;
+	std::istringstream list(sys::read_file(list_file));
+	std::string line;
+	while(std::getline(list, line)) {
+		std::istringstream ss(line);
+		BatchJob job;
+		std::string size;
+		if(!(ss >> job.doc) || job.doc[0] == '#') {
+			continue;
+		}
+		char x = 0;
+		ss >> size;
+		std::istringstream size_ss(size);
+		ASSERT_LOG((size_ss >> job.width >> x >> job.height) && x == 'x' && job.width > 0 && job.height > 0, 
+			"Expected <width>x<height> after '" << job.doc << "' in " << list_file << ", found: '" << size << "'");
+		if(!(ss >> job.output)) {
+			auto start = job.doc.find_last_of("/\\");
+			auto name = job.doc.substr(start == std::string::npos ? 0 : start + 1);
+			name = name.substr(0, name.find_last_of('.'));
+			job.output = out_dir + "/" + name + "-" + size + ".png";
+		}
+		if(!sys::file_exists(job.doc)) {
+			job.doc = data_path + job.doc;
+		}
+		res.emplace_back(job);
+	}
+	return res;
+}
+
+void log_shader_build_stats()
+{
+	auto& stats = KRE::ShaderProgram::getBuildStats();
+	LOG_INFO("shaders: " << stats.programs_built << " programs built in " << stats.build_time_ms << "ms, " 
+		<< stats.cache_hits << " loaded from the program cache, " << stats.cache_rejects << " cached programs rejected");
+}
+
+// Renders each document into an off-screen render target and saves it as a PNG. Writes the time 
+// taken by each phase to timings.csv in out_dir. The readback time includes waiting for the GPU
+// to finish drawing.
+int run_batch(const std::vector<BatchJob>& jobs, const std::string& ua_ss, const std::string& out_dir)
+{
+	using namespace KRE;
+	auto wnd = WindowManager::getMainWindow();
+
+	boost::system::error_code ec;
+	boost::filesystem::create_directories(out_dir, ec);
+	ASSERT_LOG(!ec, "Unable to create output directory '" << out_dir << "': " << ec.message());
+
+	auto user_agent_style_sheet = std::make_shared<css::StyleSheet>();
+	css::Parser::parse(user_agent_style_sheet, sys::read_file(ua_ss));
+
+	enum { PARSE, LAYOUT, RENDER, READBACK, ENCODE, PHASE_COUNT };
+	double totals[PHASE_COUNT] = {};
+	std::ostringstream timings;
+	timings << "document,width,height,parse_ms,layout_ms,render_ms,readback_ms,encode_ms,draw_calls\n";
+
+	// Render targets are kept for reuse, since pages tend to come in only a few sizes.
+	std::map<std::pair<int,int>, RenderTargetPtr> targets;
+	profile::timer tm;
+	for(auto& job : jobs) {
+		double phase[PHASE_COUNT];
+		DisplayDevice::resetRenderStats();
+
+		tm.start();
+		auto doc = load_xhtml(user_agent_style_sheet, job.doc);
+		phase[PARSE] = tm.check();
+
+		tm.start();
+		xhtml::StyleNodePtr style_tree = nullptr;
+		auto scene_tree = doc->process(style_tree, 0, 0, job.width, job.height);
+		KRE::FontDriver::commitPendingGlyphs();
+		phase[LAYOUT] = tm.check();
+
+		tm.start();
+		auto& rt = targets[std::make_pair(job.width, job.height)];
+		if(rt == nullptr) {
+			rt = RenderTarget::create(job.width, job.height);
+			rt->setClearColor(Color::colorWhite());
+		}
+		DisplayDevice::getCurrent()->setDefaultCamera(std::make_shared<Camera>("batch", 0, job.width, 0, job.height));
+		{
+			RenderTarget::RenderScope rs(rt, rect(0, 0, job.width, job.height));
+			if(scene_tree != nullptr) {
+				scene_tree->preRender(wnd);
+				scene_tree->render(wnd);
+			}
+		}
+		phase[RENDER] = tm.check();
+
+		tm.start();
+		auto surf = rt->readToSurface();
+		phase[READBACK] = tm.check();
+
+		tm.start();
+		surf->savePng(job.output);
+		phase[ENCODE] = tm.check();
+		// Each document counts as a frame.
+		PROFILE_FRAME();
+
+		timings << job.doc << "," << job.width << "," << job.height;
+		for(int n = 0; n != PHASE_COUNT; ++n) {
+			timings << "," << phase[n] * 1000.0;
+			totals[n] += phase[n];
+		}
+		timings << "," << DisplayDevice::getRenderStats().draw_calls << "\n";
+		LOG_INFO(job.output << ": parse " << phase[PARSE] * 1000.0 << "ms, layout " << phase[LAYOUT] * 1000.0 << "ms, render " 
+			<< phase[RENDER] * 1000.0 << "ms, readback " << phase[READBACK] * 1000.0 << "ms, encode " << phase[ENCODE] * 1000.0 << "ms");
+	}
+	sys::write_file(out_dir + "/timings.csv", timings.str());
+
+	if(!jobs.empty()) {
+		const double total = totals[PARSE] + totals[LAYOUT] + totals[RENDER] + totals[READBACK] + totals[ENCODE];
+		LOG_INFO("batch: " << jobs.size() << " documents in " << total << "s, " << (total > 0 ? jobs.size() * 3600.0 / total : 0.0) << " per hour. "
+			<< "average parse " << totals[PARSE] * 1000.0 / jobs.size() << "ms, layout " << totals[LAYOUT] * 1000.0 / jobs.size() 
+			<< "ms, render " << totals[RENDER] * 1000.0 / jobs.size() << "ms, readback " << totals[READBACK] * 1000.0 / jobs.size() 
+			<< "ms, encode " << totals[ENCODE] * 1000.0 / jobs.size() << "ms");
+	}
+	log_shader_build_stats();
+	return 0;
+}
+
 KRE::SceneObjectPtr test_filter_shader(const std::string& filename)
 {
 	using namespace KRE;
@@ -170,6 +317,23 @@ std::string wide_string_to_utf8(const std::wstring& ws)
 }
 #endif
 
+// The per-user cache directory, or an empty string if there isn't one.
+std::string get_cache_dir()
+{
+#if defined(_MSC_VER)
+	if(const char* local_app_data = getenv("LOCALAPPDATA")) {
+		return local_app_data;
+	}
+#else
+	if(const char* xdg_cache = getenv("XDG_CACHE_HOME")) {
+		return xdg_cache;
+	} else if(const char* home = getenv("HOME")) {
+		return std::string(home) + "/.cache";
+	}
+#endif
+	return std::string();
+}
+
 void read_system_fonts(sys::file_path_map* res)
 {
 #if defined(_MSC_VER)
@@ -216,35 +380,82 @@ void read_system_fonts(sys::file_path_map* res)
 		// could try %windir%\fonts as a backup
 	}
 #elif defined(linux) || defined(__linux__)
-	// use maybe XListFonts or fontconfig
+	const std::string cache_dir = get_cache_dir();
+	KRE::FontIndex& font_index = KRE::FontIndex::getInstance();
+	font_index.load(cache_dir.empty() ? std::string() : cache_dir + "/xhtml/font-index.cache");
+	font_index.getFilePaths(res);
 #else
 #endif
 }
 
 int main(int argc, char* argv[])
 {
+	profile::timer startup_timer;
+	startup_timer.start();
+
 	std::vector<std::string> args;
+	bool dump_caches = false;
+	bool shader_cache = true;
+	std::string batch_list;
+	std::string out_dir = ".";
+	std::string renderer = "opengl";
+	std::string trace_file;
 	for(int i = 1; i < argc; ++i) {
 		if(argv[i] == std::string("--display-tree")) {
 			xhtml::Document::enableDebug(xhtml::DebugFlags::DISPLAY_PARSE_TREE);
+		} else if(argv[i] == std::string("--verify-shadow-cache")) {
+			xhtml::BackgroundInfo::setBoxShadowCacheVerify(true);
+		} else if(argv[i] == std::string("--sync-image-decode")) {
+			KRE::ImageDecodeQueue::setEnabled(false);
+		} else if(argv[i] == std::string("--no-atlas")) {
+			KRE::TextureAtlas::setEnabled(false);
+		} else if(argv[i] == std::string("--dump-caches")) {
+			dump_caches = true;
+		} else if(argv[i] == std::string("--no-draw-sort")) {
+			KRE::RenderQueue::setSortingEnabled(false);
+		} else if(argv[i] == std::string("--no-cull")) {
+			KRE::SceneTree::setCullingEnabled(false);
+		} else if(argv[i] == std::string("--no-shader-cache")) {
+			shader_cache = false;
+		} else if(argv[i] == std::string("--batch") && i + 1 < argc) {
+			batch_list = argv[++i];
+		} else if(argv[i] == std::string("--out-dir") && i + 1 < argc) {
+			out_dir = argv[++i];
+		} else if(argv[i] == std::string("--renderer") && i + 1 < argc) {
+			renderer = argv[++i];
+		} else if(argv[i] == std::string("--trace") && i + 1 < argc) {
+			trace_file = argv[++i];
 		} else {
 			args.emplace_back(argv[i]);
 		}
 	}
-	if(args.empty()) {
+	const bool batch = !batch_list.empty();
+	if(args.empty() && !batch) {
 		std::cout << "Usage: xhtml <filename>\n";
+		std::cout << "       xhtml --batch <list> [--out-dir <dir>]\n";
 		return 0;
 	}
+	if(batch) {
+		// Pages have to be complete when they're rendered, so don't leave any work for later frames.
+		KRE::ImageDecodeQueue::setEnabled(false);
+		KRE::FontRasterQueue::setEnabled(false);
+	}
+
+	const std::string cache_dir = get_cache_dir();
+	if(shader_cache && !cache_dir.empty()) {
+		KRE::ShaderProgram::setProgramCacheDir(cache_dir + "/xhtml/shaders");
+	}
 
 	int width = 1024;
 	int height = 768;
 
 	using namespace KRE;
-	SDL::SDL_ptr manager(new SDL::SDL());
+	// The null device doesn't need a display, so don't ask SDL for one.
+	SDL::SDL_ptr manager(new SDL::SDL(renderer == "null" ? 0 : SDL_INIT_VIDEO));
 	SDL_LogSetPriority(SDL_LOG_CATEGORY_APPLICATION, SDL_LOG_PRIORITY_INFO);
 	//SDL_LogSetPriority(SDL_LOG_CATEGORY_APPLICATION, SDL_LOG_PRIORITY_DEBUG);
 
-	if(!test::run_tests()) {
+	if(!batch && !test::run_tests()) {
 		// Just exit if some tests failed.
 		exit(1);
 	}
@@ -254,7 +465,7 @@ int main(int argc, char* argv[])
 #else
 	const std::string data_path = "../data/";
 #endif
-	const std::string test_doc = data_path + args[0];
+	const std::string test_doc = batch ? std::string() : data_path + args[0];
 	//const std::string test_doc = data_path + "storyboard.xhtml";
 	const std::string ua_ss = data_path + "user_agent.css";
 
@@ -264,18 +475,32 @@ int main(int argc, char* argv[])
 	KRE::FontDriver::setAvailableFonts(font_files);
 	KRE::FontDriver::setFontProvider("stb");
 
+	std::vector<BatchJob> batch_jobs;
+	if(batch) {
+		batch_jobs = read_batch_list(batch_list, data_path, out_dir);
+		if(!batch_jobs.empty()) {
+			width = batch_jobs.front().width;
+			height = batch_jobs.front().height;
+		}
+	}
+
 #if 1
 	WindowManager wm("SDL");
 
 	variant_builder hints;
-	hints.add("renderer", "opengl");
-	hints.add("dpi_aware", true);
-	hints.add("use_vsync", true);
-	hints.add("resizeable", true);
+	hints.add("renderer", renderer);
+	if(batch) {
+		// Software GL drivers, e.g. Mesa's llvmpipe, work fine here for machines without a GPU.
+		hints.add("hidden", true);
+	} else {
+		hints.add("dpi_aware", true);
+		hints.add("use_vsync", true);
+		hints.add("resizeable", true);
+	}
 
 	LOG_DEBUG("Creating window of size: " << width << "x" << height);
 	auto main_wnd = wm.createWindow(width, height, hints.build());
-	main_wnd->enableVsync(true);
+	main_wnd->enableVsync(!batch);
 	const float aspect_ratio = static_cast<float>(width) / height;
 
 #if defined(__linux__)
@@ -289,6 +514,19 @@ int main(int argc, char* argv[])
 #endif
 	Font::setAvailableFonts(font_files);
 
+	if(batch) {
+		// Output paths are given in full.
+		Surface::setFileFilter(FileFilterType::SAVE, [](const std::string& fname) { return fname; });
+		const int res = run_batch(batch_jobs, ua_ss, out_dir);
+#if defined(ENABLE_PROFILING)
+		LOG_INFO(profile::get_frame_summary());
+		if(!trace_file.empty()) {
+			profile::write_chrome_trace(trace_file);
+		}
+#endif
+		return res;
+	}
+
 	SceneGraphPtr scene = SceneGraph::create("main");
 	SceneNodePtr root = scene->getRootNode();
 	root->setNodeName("root_node");
@@ -315,8 +553,12 @@ int main(int argc, char* argv[])
 	SDL_Event e;
 	bool done = false;
 	Uint32 last_tick_time = SDL_GetTicks();
+	int frames = 0;
+	RenderStats total_render_stats;
 	SDL_StartTextInput();
+	PROFILE_THREAD_NAME("main");
 	while(!done) {
+		PROFILE_FRAME();
 		while(SDL_PollEvent(&e)) {
 			// XXX we need to add some keyboard/mouse callback handling here for "doc".
 			if(e.type == SDL_KEYUP) {
@@ -365,9 +607,17 @@ int main(int argc, char* argv[])
 		//main_wnd->setClearColor(KRE::Color::colorWhite());
 		main_wnd->clear(ClearFlags::ALL);
 
-		auto st = doc->process(style_tree, layout_x, layout_y, width/2, height/2);
-		if(st != nullptr) {
-			scene_tree = st;
+		// Swap in any images that finished decoding, their boxes may have changed size.
+		if(KRE::ImageDecodeQueue::getInstance().commit() != 0) {
+			doc->triggerLayout();
+		}
+
+		{
+			PROFILE_SCOPE("process");
+			auto st = doc->process(style_tree, layout_x, layout_y, width/2, height/2);
+			if(st != nullptr) {
+				scene_tree = st;
+			}
 		}
 
 		// Called once a cycle before rendering.
@@ -379,24 +629,90 @@ int main(int argc, char* argv[])
 		scene->process(dt);
 		last_tick_time = current_tick_time;
 
-		if(scene_tree != nullptr) {
-			ClipScope::Manager clipper(rect(0, 0, width, height));
-			scene_tree->preRender(main_wnd);
-			scene_tree->render(main_wnd);
-		}
+		// Any glyphs that finished rasterizing in the background get uploaded here.
+		KRE::FontDriver::commitPendingGlyphs();
+
+		{
+			// Canvas drawing during the frame is batched, whatever is left goes out before the swap.
+			Canvas::BatchScope canvas_batch;
+			if(scene_tree != nullptr) {
+				PROFILE_SCOPE("draw");
+				ClipScope::Manager clipper(rect(0, 0, width, height));
+				scene_tree->preRender(main_wnd);
+				scene_tree->render(main_wnd);
+			}
 
-		if(te != nullptr) {
-			te->preRender(main_wnd);
-			main_wnd->render(te.get());
+			if(te != nullptr) {
+				te->preRender(main_wnd);
+				main_wnd->render(te.get());
 
-			auto& r = te->getRenderable();
-			if(r != nullptr) {
-				r->preRender(main_wnd);
-				main_wnd->render(r.get());
+				auto& r = te->getRenderable();
+				if(r != nullptr) {
+					r->preRender(main_wnd);
+					main_wnd->render(r.get());
+				}
 			}
 		}
 
-		main_wnd->swap();
+		{
+			PROFILE_SCOPE("swap");
+			main_wnd->swap();
+		}
+
+		if(++frames == 1) {
+			LOG_INFO("first frame after " << startup_timer.check() * 1000.0 << "ms");
+			log_shader_build_stats();
+		}
+#if defined(ENABLE_PROFILING)
+		if(frames % 600 == 0) {
+			LOG_INFO(profile::get_frame_summary());
+		}
+#endif
+		total_render_stats.draw_calls += DisplayDevice::getRenderStats().draw_calls;
+		total_render_stats.texture_binds += DisplayDevice::getRenderStats().texture_binds;
+		total_render_stats.state_changes += DisplayDevice::getRenderStats().state_changes;
+		total_render_stats.state_changes_skipped += DisplayDevice::getRenderStats().state_changes_skipped;
+		total_render_stats.camera_uploads += DisplayDevice::getRenderStats().camera_uploads;
+		total_render_stats.uniform_uploads += DisplayDevice::getRenderStats().uniform_uploads;
+		total_render_stats.uniform_uploads_skipped += DisplayDevice::getRenderStats().uniform_uploads_skipped;
+		total_render_stats.culled_subtrees += DisplayDevice::getRenderStats().culled_subtrees;
+		total_render_stats.canvas_draws_batched += DisplayDevice::getRenderStats().canvas_draws_batched;
+		DisplayDevice::resetRenderStats();
+	}
+
+	auto shadow_stats = xhtml::BackgroundInfo::getBoxShadowCacheStats();
+	LOG_INFO("box-shadow cache: " << shadow_stats.hits << " hits, " << shadow_stats.misses << " misses, " 
+		<< shadow_stats.entries << " entries, " << shadow_stats.mismatches << " mismatches");
+	auto decode_stats = KRE::ImageDecodeQueue::getInstance().getStats();
+	LOG_INFO("image decode: " << decode_stats.completed << " decoded, " << decode_stats.failed << " failed, " 
+		<< decode_stats.average_latency_ms << "ms average latency, " << decode_stats.max_latency_ms << "ms max latency, " 
+		<< decode_stats.max_queue_depth << " max queue depth");
+	auto surface_stats = KRE::Surface::getCacheStats();
+	LOG_INFO("surface cache: " << surface_stats.hits << " hits, " << surface_stats.misses << " misses, " << surface_stats.evictions << " evictions, " 
+		<< surface_stats.entries << " entries, " << surface_stats.bytes << " of " << surface_stats.budget << " bytes");
+	auto texture_stats = KRE::Texture::getCacheStats();
+	LOG_INFO("texture cache: " << texture_stats.hits << " hits, " << texture_stats.misses << " misses, " << texture_stats.evictions << " evictions, " 
+		<< texture_stats.entries << " entries, " << texture_stats.bytes << " of " << texture_stats.budget << " bytes");
+	auto atlas_stats = KRE::TextureAtlas::getInstance().getStats();
+	LOG_INFO("texture atlas: " << atlas_stats.images << " images in " << atlas_stats.pages << " pages, " << atlas_stats.rejected << " didn't fit");
+	if(frames > 0) {
+		LOG_INFO("per frame: " << total_render_stats.draw_calls / frames << " draw calls, " << total_render_stats.texture_binds / frames << " texture binds, " 
+			<< total_render_stats.state_changes / frames << " state changes, " << total_render_stats.state_changes_skipped / frames << " state changes skipped, " 
+			<< total_render_stats.camera_uploads / frames << " camera uploads, " 
+			<< total_render_stats.uniform_uploads / frames << " uniform uploads, " << total_render_stats.uniform_uploads_skipped / frames << " uniform uploads skipped, " 
+			<< total_render_stats.culled_subtrees / frames << " culled subtrees, " 
+			<< total_render_stats.canvas_draws_batched / frames << " canvas draws batched");
+	}
+#if defined(ENABLE_PROFILING)
+	if(!trace_file.empty()) {
+		profile::write_chrome_trace(trace_file);
+	}
+#endif
+	if(dump_caches) {
+		std::cout << "surface cache:\n";
+		KRE::Surface::dumpCache(std::cout);
+		std::cout << "texture cache:\n";
+		KRE::Texture::dumpCache(std::cout);
 	}
 #endif
 	SDL_StopTextInput();
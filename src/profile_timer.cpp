@@ -0,0 +1,484 @@
+/*
+	Copyright (C) 2016 by Kristina Simpson <sweet.kristas@gmail.com>
+	
+	This software is provided 'as-is', without any express or implied
+	warranty. In no event will the authors be held liable for any damages
+	arising from the use of this software.
+
+	Permission is granted to anyone to use this software for any purpose,
+	including commercial applications, and to alter it and redistribute it
+	freely, subject to the following restrictions:
+
+	   1. The origin of this software must not be misrepresented; you must not
+	   claim that you wrote the original software. If you use this software
+	   in a product, an acknowledgement in the product documentation would be
+	   appreciated but is not required.
+
+	   2. Altered source versions must be plainly marked as such, and must not be
+	   misrepresented as being the original software.
+
+	   3. This notice may not be removed or altered from any source
+	   distribution.
+*/
+
+
+#include "profile_timer.hpp"
+
+#if defined(ENABLE_PROFILING)
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <exception>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "asserts.hpp"
+#include "unit_test.hpp"
+
+#if defined(_MSC_VER) && _MSC_VER < 1900
+#define PROFILE_THREAD_LOCAL __declspec(thread)
+#else
+#define PROFILE_THREAD_LOCAL thread_local
+#endif
+
+namespace profile
+{
+	namespace
+	{
+		enum class EventType : unsigned char { BEGIN, END, COUNTER };
+
+		struct Event
+		{
+			unsigned long long ts;
+			// Scope or counter name, unused for END.
+			const char* name;
+			long long value;
+			EventType type;
+		};
+
+		// Power of two, so the write position can just be masked.
+		const unsigned long long ring_size = 1 << 15;
+		const int max_summary_scopes = 16;
+		const int summary_frames = 120;
+
+		const char* const counter_names[] = 
+		{
+			"restyled_nodes",
+			"boxes_laid_out",
+			"draw_calls",
+			"uploaded_bytes",
+		};
+		static_assert(sizeof(counter_names) / sizeof(counter_names[0]) == static_cast<int>(Counter::COUNT), "A name is needed for every counter.");
+
+		struct ThreadRing
+		{
+			ThreadRing(int id) : events(new Event[ring_size]), written(0), tid(id), name(nullptr) {}
+			std::unique_ptr<Event[]> events;
+			// Only the owning thread writes. Exporting reads up to here.
+			std::atomic<unsigned long long> written;
+			int tid;
+			std::atomic<const char*> name;
+		};
+
+		struct FrameRecord
+		{
+			unsigned long long duration;
+			long long counters[static_cast<int>(Counter::COUNT)];
+			int scope_count;
+			const char* scope_names[max_summary_scopes];
+			unsigned long long scope_ns[max_summary_scopes];
+		};
+
+		const std::chrono::steady_clock::time_point& get_epoch()
+		{
+			static std::chrono::steady_clock::time_point res = std::chrono::steady_clock::now();
+			return res;
+		}
+		// So the epoch is set before any thread records.
+		const auto& start_epoch = get_epoch();
+
+		std::mutex& get_rings_mutex()
+		{
+			static std::mutex res;
+			return res;
+		}
+
+		// Rings outlive their threads so nothing recorded is lost.
+		std::vector<std::unique_ptr<ThreadRing>>& get_rings()
+		{
+			static std::vector<std::unique_ptr<ThreadRing>> res;
+			return res;
+		}
+
+		ThreadRing* create_ring()
+		{
+			std::lock_guard<std::mutex> lock(get_rings_mutex());
+			auto& rings = get_rings();
+			rings.emplace_back(new ThreadRing(static_cast<int>(rings.size())));
+			return rings.back().get();
+		}
+
+		PROFILE_THREAD_LOCAL ThreadRing* thread_ring = nullptr;
+
+		inline ThreadRing& get_thread_ring()
+		{
+			if(thread_ring == nullptr) {
+				thread_ring = create_ring();
+			}
+			return *thread_ring;
+		}
+
+		inline void record(EventType type, const char* name, long long value)
+		{
+			ThreadRing& ring = get_thread_ring();
+			const unsigned long long pos = ring.written.load(std::memory_order_relaxed);
+			Event& e = ring.events[pos & (ring_size - 1)];
+			e.ts = now_ns();
+			e.name = name;
+			e.value = value;
+			e.type = type;
+			ring.written.store(pos + 1, std::memory_order_release);
+		}
+
+		std::atomic<long long> counters[static_cast<int>(Counter::COUNT)];
+
+		// Only touched by the thread calling frame().
+		FrameRecord frame_history[summary_frames];
+		int frames_recorded = 0;
+		bool frame_open = false;
+		unsigned long long frame_start_ts = 0;
+		unsigned long long frame_start_pos = 0;
+
+		void add_scope_time(FrameRecord* rec, const char* name, unsigned long long ns)
+		{
+			for(int n = 0; n != rec->scope_count; ++n) {
+				if(rec->scope_names[n] == name || std::strcmp(rec->scope_names[n], name) == 0) {
+					rec->scope_ns[n] += ns;
+					return;
+				}
+			}
+			if(rec->scope_count < max_summary_scopes) {
+				rec->scope_names[rec->scope_count] = name;
+				rec->scope_ns[rec->scope_count] = ns;
+				++rec->scope_count;
+			}
+		}
+
+		void write_json_string(std::ostream& os, const char* str)
+		{
+			os << '"';
+			for(; *str != '\0'; ++str) {
+				if(*str == '"' || *str == '\\') {
+					os << '\\';
+				}
+				os << *str;
+			}
+			os << '"';
+		}
+	}
+
+	unsigned long long now_ns()
+	{
+		return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start_epoch).count();
+	}
+
+	void begin(const char* name)
+	{
+		record(EventType::BEGIN, name, 0);
+	}
+
+	void end()
+	{
+		record(EventType::END, nullptr, 0);
+	}
+
+	void count(Counter counter, long long n)
+	{
+		counters[static_cast<int>(counter)].fetch_add(n, std::memory_order_relaxed);
+	}
+
+	void set_thread_name(const char* name)
+	{
+		get_thread_ring().name.store(name);
+	}
+
+	void frame()
+	{
+		ThreadRing& ring = get_thread_ring();
+		if(frame_open) {
+			end();
+			const unsigned long long written = ring.written.load(std::memory_order_relaxed);
+			FrameRecord& rec = frame_history[frames_recorded % summary_frames];
+			rec.duration = ring.events[(written - 1) & (ring_size - 1)].ts - frame_start_ts;
+			rec.scope_count = 0;
+
+			// Time in the frame's outermost scopes. If the frame overflowed the ring only the
+			// part still there is counted.
+			int depth = 0;
+			const char* outer_name = nullptr;
+			unsigned long long outer_start = 0;
+			for(unsigned long long pos = std::max(frame_start_pos, written > ring_size ? written - ring_size : 0); pos + 1 < written; ++pos) {
+				const Event& e = ring.events[pos & (ring_size - 1)];
+				if(e.type == EventType::BEGIN) {
+					if(depth++ == 0) {
+						outer_name = e.name;
+						outer_start = e.ts;
+					}
+				} else if(e.type == EventType::END && depth > 0) {
+					if(--depth == 0) {
+						add_scope_time(&rec, outer_name, e.ts - outer_start);
+					}
+				}
+			}
+
+			for(int n = 0; n != static_cast<int>(Counter::COUNT); ++n) {
+				rec.counters[n] = counters[n].exchange(0);
+				record(EventType::COUNTER, counter_names[n], rec.counters[n]);
+			}
+			++frames_recorded;
+		} else {
+			for(auto& c : counters) {
+				c.store(0);
+			}
+		}
+		begin("frame");
+		frame_open = true;
+		frame_start_pos = ring.written.load(std::memory_order_relaxed);
+		frame_start_ts = ring.events[(frame_start_pos - 1) & (ring_size - 1)].ts;
+	}
+
+	std::string get_frame_summary()
+	{
+		const int frames = std::min(frames_recorded, summary_frames);
+		if(frames == 0) {
+			return "no frames recorded";
+		}
+		unsigned long long total_ns = 0;
+		unsigned long long max_ns = 0;
+		long long counter_totals[static_cast<int>(Counter::COUNT)] = {};
+		FrameRecord scopes;
+		scopes.scope_count = 0;
+		for(int n = 0; n != frames; ++n) {
+			const FrameRecord& rec = frame_history[n];
+			total_ns += rec.duration;
+			max_ns = std::max(max_ns, rec.duration);
+			for(int c = 0; c != static_cast<int>(Counter::COUNT); ++c) {
+				counter_totals[c] += rec.counters[c];
+			}
+			for(int s = 0; s != rec.scope_count; ++s) {
+				add_scope_time(&scopes, rec.scope_names[s], rec.scope_ns[s]);
+			}
+		}
+
+		std::ostringstream ss;
+		ss << "last " << frames << " frames: " << total_ns / 1e6 / frames << "ms average, " << max_ns / 1e6 << "ms worst";
+		for(int s = 0; s != scopes.scope_count; ++s) {
+			ss << ", " << scopes.scope_names[s] << " " << scopes.scope_ns[s] / 1e6 / frames << "ms";
+		}
+		for(int c = 0; c != static_cast<int>(Counter::COUNT); ++c) {
+			ss << ", " << counter_totals[c] / frames << " " << counter_names[c];
+		}
+		return ss.str();
+	}
+
+	bool write_chrome_trace(const std::string& filename)
+	{
+		std::ofstream file(filename, std::ios_base::binary | std::ios_base::trunc);
+		if(!file.is_open()) {
+			LOG_ERROR("Unable to write trace: " << filename);
+			return false;
+		}
+
+		// Chrome wants microseconds, the fraction keeps the nanoseconds.
+		file << "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n";
+		file << "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"args\":{\"name\":\"xhtml\"}}";
+
+		std::lock_guard<std::mutex> lock(get_rings_mutex());
+		std::vector<Event> events;
+		for(auto& ring : get_rings()) {
+			const char* name = ring->name.load();
+			if(name != nullptr) {
+				file << ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << ring->tid << ",\"args\":{\"name\":";
+				write_json_string(file, name);
+				file << "}}";
+			}
+
+			// Other threads may still be recording, so anything they could have overwritten
+			// while it was being copied is dropped.
+			const unsigned long long written = ring->written.load(std::memory_order_acquire);
+			const unsigned long long first = written > ring_size ? written - ring_size : 0;
+			events.assign(written - first, Event());
+			for(unsigned long long pos = first; pos != written; ++pos) {
+				events[pos - first] = ring->events[pos & (ring_size - 1)];
+			}
+			const unsigned long long now_written = ring->written.load(std::memory_order_acquire);
+			const unsigned long long valid = now_written > ring_size ? now_written - ring_size : 0;
+
+			// Ends whose begins were overwritten would close the wrong scopes.
+			int depth = 0;
+			for(unsigned long long pos = std::max(first, valid); pos != written; ++pos) {
+				const Event& e = events[pos - first];
+				std::ostringstream ts;
+				ts.precision(3);
+				ts << std::fixed << e.ts / 1000.0;
+				switch(e.type) {
+					case EventType::BEGIN:
+						++depth;
+						file << ",\n{\"name\":";
+						write_json_string(file, e.name);
+						file << ",\"ph\":\"B\",\"pid\":1,\"tid\":" << ring->tid << ",\"ts\":" << ts.str() << "}";
+						break;
+					case EventType::END:
+						if(depth > 0) {
+							--depth;
+							file << ",\n{\"ph\":\"E\",\"pid\":1,\"tid\":" << ring->tid << ",\"ts\":" << ts.str() << "}";
+						}
+						break;
+					case EventType::COUNTER:
+						file << ",\n{\"name\":";
+						write_json_string(file, e.name);
+						file << ",\"ph\":\"C\",\"pid\":1,\"tid\":" << ring->tid << ",\"ts\":" << ts.str() << ",\"args\":{\"value\":" << e.value << "}}";
+						break;
+				}
+			}
+		}
+		file << "\n]}\n";
+		return true;
+	}
+
+	namespace
+	{
+		const FrameRecord& last_frame()
+		{
+			return frame_history[(frames_recorded - 1) % summary_frames];
+		}
+
+		bool has_scope(const FrameRecord& rec, const std::string& name)
+		{
+			for(int n = 0; n != rec.scope_count; ++n) {
+				if(name == rec.scope_names[n]) {
+					return true;
+				}
+			}
+			return false;
+		}
+
+		void profile_test_body(int* tid)
+		{
+			*tid = get_thread_ring().tid;
+			frame();
+			begin("test_outer");
+			begin("test_inner");
+			end();
+			end();
+			begin("test_sibling");
+			end();
+			count(Counter::DRAW_CALLS, 3);
+			frame();
+			CHECK(has_scope(last_frame(), "test_outer") && has_scope(last_frame(), "test_sibling"), "outermost scopes missing from the frame");
+			CHECK(!has_scope(last_frame(), "test_inner"), "nested scope counted as outermost");
+			CHECK_EQ(last_frame().counters[static_cast<int>(Counter::DRAW_CALLS)], 3);
+
+			begin("test_outer");
+			end();
+			count(Counter::DRAW_CALLS, 5);
+			frame();
+			// Counters start again from zero each frame.
+			CHECK_EQ(last_frame().counters[static_cast<int>(Counter::DRAW_CALLS)], 5);
+			const std::string summary = get_frame_summary();
+			CHECK(summary.find("last 2 frames") == 0, "unexpected summary: " << summary);
+			CHECK(summary.find(", test_outer ") != std::string::npos && summary.find(", test_inner ") == std::string::npos, "unexpected summary: " << summary);
+			CHECK(summary.find(", 4 draw_calls") != std::string::npos, "unexpected summary: " << summary);
+
+			// Overflow the ring so the begin of the outer scope is overwritten, leaving its end unmatched.
+			begin("test_overflow");
+			for(unsigned long long n = 0; n != ring_size; ++n) {
+				begin("test_inner");
+				end();
+			}
+			end();
+			frame();
+			CHECK(!has_scope(last_frame(), "test_overflow"), "overwritten scope counted");
+			CHECK(has_scope(last_frame(), "test_inner"), "scopes left in the ring not counted");
+
+			// Only the most recent frames are summarised.
+			for(int n = 0; n != summary_frames; ++n) {
+				frame();
+			}
+			CHECK(get_frame_summary().find("last " + std::to_string(summary_frames) + " frames") == 0, "unexpected summary: " << get_frame_summary());
+		}
+	}
+}
+
+UNIT_TEST(profile_frame_summary_and_trace)
+{
+	using namespace profile;
+	// Recorded on a thread of its own, so it has a fresh ring.
+	int tid = -1;
+	std::exception_ptr error;
+	std::thread t([&tid, &error]() {
+		try {
+			profile_test_body(&tid);
+		} catch(...) {
+			error = std::current_exception();
+		}
+	});
+	t.join();
+
+	const std::string trace_file = "profile_test_trace.json";
+	const bool written = error == nullptr && write_chrome_trace(trace_file);
+
+	// Leave nothing behind for the real recording.
+	{
+		std::lock_guard<std::mutex> lock(get_rings_mutex());
+		auto& rings = get_rings();
+		rings.erase(std::remove_if(rings.begin(), rings.end(), [tid](const std::unique_ptr<ThreadRing>& r) { return r->tid == tid; }), rings.end());
+	}
+	frames_recorded = 0;
+	frame_open = false;
+	for(auto& c : counters) {
+		c.store(0);
+	}
+	if(error != nullptr) {
+		std::rethrow_exception(error);
+	}
+	CHECK(written, "trace wasn't written");
+
+	std::ifstream file(trace_file);
+	std::vector<std::string> lines;
+	for(std::string line; std::getline(file, line); ) {
+		lines.emplace_back(line);
+	}
+	file.close();
+	std::remove(trace_file.c_str());
+
+	CHECK(lines.size() > 2, "trace is empty");
+	CHECK_EQ(lines.front(), "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[");
+	CHECK_EQ(lines.back(), "]}");
+	const std::string tid_field = "\"tid\":" + std::to_string(tid) + ",";
+	int depth = 0;
+	for(size_t n = 1; n + 1 != lines.size(); ++n) {
+		const std::string& line = lines[n];
+		const bool last = n + 2 == lines.size();
+		CHECK(line.front() == '{' && line.substr(line.size() - (last ? 1 : 2)) == (last ? "}" : "},"), "malformed trace line: " << line);
+		CHECK_EQ(std::count(line.begin(), line.end(), '{'), std::count(line.begin(), line.end(), '}'));
+		if(line.find(tid_field) == std::string::npos) {
+			continue;
+		}
+		if(line.find("\"ph\":\"B\"") != std::string::npos) {
+			++depth;
+		} else if(line.find("\"ph\":\"E\"") != std::string::npos) {
+			CHECK(--depth >= 0, "unmatched end event written to the trace");
+		}
+	}
+}
+
+#endif
@@ -27,28 +27,76 @@
 #include <string>
 #include "SDL.h"
 
+// Scope profiler. Scopes are recorded as begin/end events with nanosecond timestamps in a
+// fixed-size ring buffer per thread, so recording never allocates or takes a lock, and the
+// oldest events are overwritten once a ring is full. The recording can be written out in
+// Chrome's trace_event format, to be opened in chrome://tracing or Perfetto. Counters are
+// totalled per frame and a summary of the last few frames' scopes and counters is kept.
+// Use the macros, which compile to nothing unless ENABLE_PROFILING is defined. Scope names
+// have to be string literals as only the pointer is kept.
+#if defined(ENABLE_PROFILING)
+#define PROFILE_CONCAT_(a, b) a ## b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_(a, b)
+#define PROFILE_SCOPE(name) profile::scope PROFILE_CONCAT(profile_scope_, __LINE__)(name)
+#define PROFILE_COUNT(counter, n) profile::count(profile::Counter::counter, n)
+#define PROFILE_FRAME() profile::frame()
+#define PROFILE_THREAD_NAME(name) profile::set_thread_name(name)
+#else
+#define PROFILE_SCOPE(name)
+#define PROFILE_COUNT(counter, n)
+#define PROFILE_FRAME()
+#define PROFILE_THREAD_NAME(name)
+#endif
+
 namespace profile 
 {
+#if defined(ENABLE_PROFILING)
+	enum class Counter
+	{
+		RESTYLED_NODES,
+		BOXES_LAID_OUT,
+		DRAW_CALLS,
+		// Texture and buffer data given to the display device.
+		UPLOADED_BYTES,
+		COUNT,
+	};
+
+	// Nanoseconds since the profiler started.
+	unsigned long long now_ns();
+
+	void begin(const char* name);
+	void end();
+	void count(Counter counter, long long n);
+	// Name shown for the calling thread in traces.
+	void set_thread_name(const char* name);
+
+	// Ends the current frame on the calling thread, which should be the one drawing. 
+	// Counters are totalled per frame, and the time in each of the frame's outermost scopes
+	// goes into the summary.
+	void frame();
+	// Average and worst frame times, counters and top-level scope times over recent frames.
+	std::string get_frame_summary();
+
+	// Writes everything still in the ring buffers as Chrome trace_event JSON.
+	bool write_chrome_trace(const std::string& filename);
+
+	struct scope
+	{
+		explicit scope(const char* name) { begin(name); }
+		~scope() { end(); }
+	private:
+		scope(const scope&);
+		void operator=(const scope&);
+	};
+
+	// Older name for a scope.
+	typedef scope manager;
+#else
 	struct manager
 	{
-		Uint64 frequency;
-		Uint64 t1, t2;
-		double elapsedTime;
-		const char* name;
-
-		manager(const char* const str) : name(str)
-		{
-			frequency = SDL_GetPerformanceFrequency();
-			t1 = SDL_GetPerformanceCounter();
-		}
-
-		~manager()
-		{
-			t2 = SDL_GetPerformanceCounter();
-			elapsedTime = (t2 - t1) * 1000.0 / frequency;
-			std::cerr << name << ": " << elapsedTime << " milliseconds" << std::endl;
-		}
+		explicit manager(const char* const) {}
 	};
+#endif
 
 	struct timer
 	{
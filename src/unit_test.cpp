@@ -15,8 +15,10 @@
 */
 
 #include <chrono>
+#include <iomanip>
 #include <iostream>
 #include <map>
+#include <sstream>
 
 #include "asserts.hpp"
 #include "unit_test.hpp"
@@ -31,6 +33,21 @@ namespace test {
 			static test_map map;
 			return map;
 		}
+
+		typedef std::map<std::string, benchmark_test> benchmark_map;
+		benchmark_map& get_benchmark_map()
+		{
+			static benchmark_map map;
+			return map;
+		}
+
+		// Minimum time a benchmark run needs to take for the results to be reported.
+		const long long min_benchmark_time_ns = 250000000LL;
+		const int max_benchmark_iterations = 1000000000;
+
+		int benchmark_units = 0;
+		std::string benchmark_unit_name;
+		const std::atomic<unsigned long long>* allocation_counter = nullptr;
 	}
 
 	int register_test(const std::string& name, unit_test test)
@@ -74,4 +91,84 @@ namespace test {
 			return true;
 		}
 	}
+
+	int register_benchmark(const std::string& name, benchmark_test test)
+	{
+		get_benchmark_map()[name] = test;
+		return 0;
+	}
+
+	void set_benchmark_units(int units_per_iteration, const std::string& unit_name)
+	{
+		benchmark_units = units_per_iteration;
+		benchmark_unit_name = unit_name;
+	}
+
+	void set_allocation_counter(const std::atomic<unsigned long long>* counter)
+	{
+		allocation_counter = counter;
+	}
+
+	std::string run_benchmark(const std::string& name, benchmark_test fn)
+	{
+		LOG_INFO("RUNNING BENCHMARK " << name << "...");
+		// warm up caches, and let the benchmark declare its units.
+		benchmark_units = 0;
+		benchmark_unit_name.clear();
+		fn(1);
+
+		int iterations = 1;
+		for(;;) {
+			const unsigned long long allocs_start = allocation_counter ? allocation_counter->load(std::memory_order_relaxed) : 0;
+			const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+			fn(iterations);
+			const std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
+			const unsigned long long allocs = allocation_counter ? allocation_counter->load(std::memory_order_relaxed) - allocs_start : 0;
+			const long long time_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+
+			if(time_ns < min_benchmark_time_ns && iterations < max_benchmark_iterations / 10) {
+				iterations *= 10;
+				continue;
+			}
+
+			std::ostringstream ss;
+			ss << std::fixed << std::setprecision(2) << "BENCH " << name << ": " << iterations << " iterations, " 
+				<< (static_cast<double>(time_ns) / iterations) << "ns/iteration";
+			if(allocation_counter) {
+				ss << ", " << (static_cast<double>(allocs) / iterations) << " allocs/iteration";
+			}
+			if(benchmark_units > 0) {
+				const double units = static_cast<double>(benchmark_units) * iterations;
+				ss << "; " << (time_ns / units) << "ns/" << benchmark_unit_name;
+				if(allocation_counter) {
+					ss << ", " << (allocs / units) << " allocs/" << benchmark_unit_name;
+				}
+			}
+			return ss.str();
+		}
+	}
+
+	void run_benchmarks(const std::vector<std::string>* benchmarks)
+	{
+		std::vector<std::string> all_benchmarks;
+		if(!benchmarks) {
+			for(benchmark_map::const_iterator i = get_benchmark_map().begin(); i != get_benchmark_map().end(); ++i) {
+				all_benchmarks.push_back(i->first);
+			}
+			benchmarks = &all_benchmarks;
+		}
+
+		std::vector<std::string> results;
+		for(const auto& benchmark : *benchmarks) {
+			auto it = get_benchmark_map().find(benchmark);
+			if(it == get_benchmark_map().end()) {
+				LOG_ERROR("No benchmark named '" << benchmark << "'");
+				continue;
+			}
+			results.emplace_back(run_benchmark(it->first, it->second));
+		}
+		for(const auto& res : results) {
+			std::cout << res << "\n";
+		}
+	}
 }
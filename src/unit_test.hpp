@@ -16,6 +16,7 @@
 
 #pragma once
 
+#include <atomic>
 #include <functional>
 
 #include <iostream>
@@ -33,6 +34,24 @@ namespace test
 	int register_test(const std::string& name, unit_test test);
 	
 	bool run_tests(const std::vector<std::string>* tests=NULL);
+
+	typedef std::function<void (int)> benchmark_test;
+
+	int register_benchmark(const std::string& name, benchmark_test test);
+
+	// Runs the benchmark with an increasing number of iterations until it runs for long
+	// enough to time, returns a one line summary of the results.
+	std::string run_benchmark(const std::string& name, benchmark_test fn);
+
+	void run_benchmarks(const std::vector<std::string>* benchmarks=NULL);
+
+	// Called from inside a benchmark to say how many units of work (i.e. glyphs) 
+	// a single iteration does, so that the results can be reported per unit.
+	void set_benchmark_units(int units_per_iteration, const std::string& unit_name);
+
+	// If set the allocation count is sampled around each benchmark run and reported
+	// per iteration. The counter is expected to be bumped by an instrumented operator new.
+	void set_allocation_counter(const std::atomic<unsigned long long>* counter);
 }
 
 #define CHECK(cond, msg) if(!(cond)) { std::cerr << __FILE__ << ":" << __LINE__ << ": TEST CHECK FAILED: " << #cond << ": " << msg << "\n"; throw test::failure_exception(); }
@@ -53,3 +72,23 @@ namespace test
 	void debug_fn_##name() { std::cerr << TEST_VAR_##name << "\n"; } \
     }                   \
 	void test::TEST_##name()
+
+#define BENCHMARK(name) \
+	namespace test {    \
+	void BENCHMARK_##name(int benchmark_iterations); \
+	static int BENCHMARK_VAR_##name = register_benchmark(#name, BENCHMARK_##name); \
+	}                   \
+	void test::BENCHMARK_##name(int benchmark_iterations)
+
+#define BENCHMARK_LOOP while(benchmark_iterations--)
+
+#define BENCHMARK_ARG(name, arg) \
+	namespace test {    \
+	void BENCHMARK_ARG_##name(int benchmark_iterations, arg); \
+	}                   \
+	void test::BENCHMARK_ARG_##name(int benchmark_iterations, arg)
+
+#define BENCHMARK_ARG_CALL(name, id, arg) \
+	namespace test {    \
+	static int BENCHMARK_ARG_VAR_##name##_##id = register_benchmark(#name " " #id, std::bind(BENCHMARK_ARG_##name, std::placeholders::_1, arg)); \
+	}
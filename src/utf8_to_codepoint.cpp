@@ -0,0 +1,191 @@
+/*
+	Copyright (C) 2016 by Kristina Simpson <sweet.kristas@gmail.com>
+	
+	This software is provided 'as-is', without any express or implied
+	warranty. In no event will the authors be held liable for any damages
+	arising from the use of this software.
+
+	Permission is granted to anyone to use this software for any purpose,
+	including commercial applications, and to alter it and redistribute it
+	freely, subject to the following restrictions:
+
+	   1. The origin of this software must not be misrepresented; you must not
+	   claim that you wrote the original software. If you use this software
+	   in a product, an acknowledgment in the product documentation would be
+	   appreciated but is not required.
+
+	   2. Altered source versions must be plainly marked as such, and must not be
+	   misrepresented as being the original software.
+
+	   3. This notice may not be removed or altered from any source
+	   distribution.
+*/
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define UTF8_DECODE_SSE2
+#include <emmintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+#endif
+
+#include "asserts.hpp"
+#include "unit_test.hpp"
+#include "utf8_to_codepoint.hpp"
+
+namespace utils
+{
+	namespace 
+	{
+		const char32_t replacement_char = 0xfffd;
+
+		inline bool is_continuation(uint8_t c) 
+		{
+			return (c & 0xc0) == 0x80;
+		}
+
+		// Decodes a single non-ascii sequence starting at p, returning the number of bytes used.
+		inline int decode_multibyte(const uint8_t* p, const uint8_t* end, char32_t* cp)
+		{
+			const uint8_t c = p[0];
+			const auto left = end - p;
+			if(c >= 0xc2 && c < 0xe0) {
+				if(left >= 2 && is_continuation(p[1])) {
+					*cp = (static_cast<char32_t>(c & 0x1f) << 6) | (p[1] & 0x3f);
+					return 2;
+				}
+			} else if(c >= 0xe0 && c < 0xf0) {
+				if(left >= 3 && is_continuation(p[1]) && is_continuation(p[2])) {
+					*cp = (static_cast<char32_t>(c & 0x0f) << 12) | (static_cast<char32_t>(p[1] & 0x3f) << 6) | (p[2] & 0x3f);
+					return 3;
+				}
+			} else if(c >= 0xf0 && c < 0xf5) {
+				if(left >= 4 && is_continuation(p[1]) && is_continuation(p[2]) && is_continuation(p[3])) {
+					*cp = (static_cast<char32_t>(c & 0x07) << 18) | (static_cast<char32_t>(p[1] & 0x3f) << 12) 
+						| (static_cast<char32_t>(p[2] & 0x3f) << 6) | (p[3] & 0x3f);
+					return 4;
+				}
+			}
+			// Stray continuation byte, invalid lead byte or a truncated sequence.
+			*cp = replacement_char;
+			return 1;
+		}
+
+#if defined(UTF8_DECODE_SSE2)
+		inline int count_trailing_zeros(unsigned mask)
+		{
+#if defined(_MSC_VER)
+			unsigned long ndx;
+			_BitScanForward(&ndx, mask);
+			return static_cast<int>(ndx);
+#else
+			return __builtin_ctz(mask);
+#endif
+		}
+
+		// Widens 16 ascii bytes to 16 codepoints.
+		inline void widen_ascii16(__m128i v, char32_t* dst)
+		{
+			const __m128i zero = _mm_setzero_si128();
+			const __m128i lo = _mm_unpacklo_epi8(v, zero);
+			const __m128i hi = _mm_unpackhi_epi8(v, zero);
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(dst + 0), _mm_unpacklo_epi16(lo, zero));
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(dst + 4), _mm_unpackhi_epi16(lo, zero));
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(dst + 8), _mm_unpacklo_epi16(hi, zero));
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(dst + 12), _mm_unpackhi_epi16(hi, zero));
+		}
+#endif
+
+		// Decodes from p until at least chunk_end, writing codepoints to dst. Sequences 
+		// may run past chunk_end but never past end. Returns the new position in the input.
+		const uint8_t* decode_chunk(const uint8_t* p, const uint8_t* chunk_end, const uint8_t* end, char32_t** dst_ptr)
+		{
+			char32_t* dst = *dst_ptr;
+			while(p < chunk_end) {
+#if defined(UTF8_DECODE_SSE2)
+				// Handle 32 then 16 bytes at a time while the text is ascii.
+				while(chunk_end - p >= 32) {
+					const __m128i v0 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+					const __m128i v1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + 16));
+					if(_mm_movemask_epi8(_mm_or_si128(v0, v1)) != 0) {
+						break;
+					}
+					widen_ascii16(v0, dst);
+					widen_ascii16(v1, dst + 16);
+					p += 32;
+					dst += 32;
+				}
+				if(chunk_end - p >= 16) {
+					const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+					const unsigned mask = static_cast<unsigned>(_mm_movemask_epi8(v));
+					// Widen the whole block, then keep only the ascii prefix.
+					widen_ascii16(v, dst);
+					if(mask == 0) {
+						p += 16;
+						dst += 16;
+						continue;
+					}
+					const int ascii_prefix = count_trailing_zeros(mask);
+					p += ascii_prefix;
+					dst += ascii_prefix;
+				}
+#endif
+				// Decode runs of multi-byte sequences without going back to the vector loop
+				// for every codepoint, stopping at the next ascii byte.
+				while(p < chunk_end) {
+					if(*p < 0x80) {
+						*dst++ = *p++;
+						break;
+					}
+					p += decode_multibyte(p, end, dst++);
+				}
+			}
+			*dst_ptr = dst;
+			return p;
+		}
+	}
+
+	void utf8_to_codepoints(const char* str, std::size_t len, std::vector<char32_t>* out)
+	{
+		ASSERT_LOG(out != nullptr, "No output given for decoded codepoints.");
+		// There are never more codepoints than bytes. Decoding goes through a small buffer so 
+		// the output doesn't have to be zero filled by resizing it up front.
+		const int chunk_size = 512;
+		char32_t buffer[chunk_size];
+		out->reserve(out->size() + len);
+
+		const uint8_t* p = reinterpret_cast<const uint8_t*>(str);
+		const uint8_t* const end = p + len;
+		while(p < end) {
+			const uint8_t* chunk_end = end - p > chunk_size ? p + chunk_size : end;
+			char32_t* dst = buffer;
+			p = decode_chunk(p, chunk_end, end, &dst);
+			out->insert(out->end(), buffer, dst);
+		}
+	}
+}
+
+UNIT_TEST(utf8_to_codepoints)
+{
+	// Compare against the iterator decoder on a mix of ascii and 1-4 byte sequences, 
+	// long enough to cover the vector and scalar paths.
+	std::string s;
+	for(int n = 0; n != 8; ++n) {
+		s += "The quick brown fox jumps over the lazy dog. ";
+		s += utils::codepoint_to_utf8(0xe9);
+		s += utils::codepoint_to_utf8(0x4e2d);
+		s += utils::codepoint_to_utf8(0x1f600);
+		s += std::string(n, 'x');
+	}
+	utils::utf8_to_codepoint cp_conv(s);
+	std::vector<char32_t> expected(cp_conv.begin(), cp_conv.end());
+	CHECK_EQ(utils::utf8_to_codepoints(s) == expected, true);
+
+	std::vector<char32_t> res{ 'a' };
+	utils::utf8_to_codepoints(s, &res);
+	CHECK_EQ(res.size(), expected.size() + 1);
+
+	// truncated and invalid sequences decode to the replacement character.
+	CHECK_EQ(utils::utf8_to_codepoints(std::string("a\xe4\xb8")) == std::vector<char32_t>({ 'a', 0xfffd, 0xfffd }), true);
+	CHECK_EQ(utils::utf8_to_codepoints(std::string("\x80z")) == std::vector<char32_t>({ 0xfffd, 'z' }), true);
+}
@@ -26,6 +26,7 @@
 #include <exception>
 #include <iterator>
 #include <string>
+#include <vector>
 #include <cstdint>
 
 namespace utils
@@ -122,6 +123,23 @@ namespace utils
 		utf8_to_codepoint();
 	};
     
+	// Decodes a whole utf-8 buffer at once, appending the codepoints to out. This is 
+	// much faster than utf8_to_codepoint for ascii heavy text. Malformed or truncated 
+	// sequences are decoded as U+FFFD.
+	void utf8_to_codepoints(const char* str, std::size_t len, std::vector<char32_t>* out);
+
+	inline void utf8_to_codepoints(const std::string& s, std::vector<char32_t>* out)
+	{
+		utf8_to_codepoints(s.data(), s.size(), out);
+	}
+
+	inline std::vector<char32_t> utf8_to_codepoints(const std::string& s)
+	{
+		std::vector<char32_t> res;
+		utf8_to_codepoints(s.data(), s.size(), &res);
+		return res;
+	}
+
     inline std::string codepoint_to_utf8(const char32_t cp) 
     {
 		char utf8_str[4];		// max length of a utf-8 encoded string is 4 bytes, as per RFC-3629
@@ -238,7 +238,9 @@ namespace css
 		// Replace CR, FF and CR/LF pairs with LF
 		// Replace U+0000 with U+FFFD
 		bool is_lf = false;
-		for(auto ch : utils::utf8_to_codepoint(inp)) {
+		const std::vector<char32_t> inp_cp = utils::utf8_to_codepoints(inp);
+		cp_string_.reserve(inp_cp.size());
+		for(auto ch : inp_cp) {
 			switch(ch) {
 				case NULL_CP: 
 					if(is_lf) {
@@ -26,6 +26,7 @@
 
 #include "asserts.hpp"
 #include "Gradients.hpp"
+#include "ImageDecodeQueue.hpp"
 #include "Shaders.hpp"
 
 #include "css_styles.hpp"
@@ -846,7 +847,9 @@ namespace css
 	UriStyle::UriStyle(const std::string uri) 
 		: is_none_(false), 
 		  uri_(uri),
-		  handler_(nullptr)
+		  handler_(nullptr),
+		  texture_(),
+		  decode_pending_(false)
 	{
 		auto filter = KRE::Surface::getFileFilter(KRE::FileFilterType::LOAD);
 		handler_ = xhtml::url_handler::create(filter(uri_));
@@ -856,6 +859,8 @@ namespace css
 	{ 
 		uri_ = uri; 
 		is_none_ = false; 
+		texture_.reset();
+		decode_pending_ = false;
 		auto filter = KRE::Surface::getFileFilter(KRE::FileFilterType::LOAD);
 		handler_ = xhtml::url_handler::create(filter(uri_));
 	}
@@ -867,7 +872,26 @@ namespace css
 			return nullptr;
 		}
 		ASSERT_LOG(handler_ != nullptr, "Error! handler was nullptr");
-		return KRE::Texture::createFromImage(handler_->getResource());
+		if(texture_ == nullptr && !decode_pending_) {
+			// Left pending on failure so that we don't try to decode a bad image on every layout.
+			decode_pending_ = true;
+			std::weak_ptr<Style> wstyle = shared_from_this();
+			const std::string uri = uri_;
+			KRE::ImageDecodeQueue::getInstance().queue(handler_->getResource(), KRE::SurfaceFlags::FROM_DATA | KRE::SurfaceFlags::NO_CACHE, [wstyle, uri](const KRE::SurfacePtr& surf) {
+				auto style = std::static_pointer_cast<UriStyle>(wstyle.lock());
+				if(style == nullptr || style->uri_ != uri) {
+					return;
+				}
+				if(surf == nullptr) {
+					LOG_ERROR("Unable to decode background image: " << uri);
+					return;
+				}
+				style->texture_ = KRE::Texture::createTexture(surf);
+				style->decode_pending_ = false;
+			});
+		}
+		// Nothing is drawn until the image has been decoded, the callers change the texture parameters so they get a copy.
+		return texture_ != nullptr ? texture_->clone() : nullptr;
 	}
 
 	// Convert a length value, either dimension or percentage into a value, 
@@ -952,8 +976,6 @@ namespace css
 
 		lg.addColorStop(last_color, last_len);
 
-		// XXX we should cache the texture, in-case
-		// to do.
 		return lg.createAsTexture(static_cast<int>(width), static_cast<int>(height));
 	}
 
@@ -478,8 +478,8 @@ namespace css
 	{
 	public:
 		MAKE_FACTORY(UriStyle);
-		UriStyle() : is_none_(true), uri_() {}
-		explicit UriStyle(bool none) : is_none_(none), uri_() {}
+		UriStyle() : is_none_(true), uri_(), handler_(), texture_(), decode_pending_(false) {}
+		explicit UriStyle(bool none) : is_none_(none), uri_(), handler_(), texture_(), decode_pending_(false) {}
 		explicit UriStyle(const std::string uri);
 		bool isNone() const { return is_none_; }
 		const std::string& getUri() const { return uri_; }
@@ -491,6 +491,9 @@ namespace css
 		bool is_none_;
 		std::string uri_;
 		xhtml::url_handler_ptr handler_;
+		// Decoded image, shared by every layout that uses this style.
+		KRE::TexturePtr texture_;
+		bool decode_pending_;
 	};
 
 	class LinearGradient : public ImageSource
@@ -60,6 +60,7 @@ namespace xhtml
 		vc.emplace_back(glm::vec2(vx2, vy2), col.as_u8vec4());
 		vc.emplace_back(glm::vec2(vx1, vy2), col.as_u8vec4());
 		attribs_->update(&vc);
+		setLocalBounds(rectf::from_coordinates(vx1, vy1, vx2, vy2));
 	}
 
 	SolidRenderable::SolidRenderable(const rectf& r, const KRE::ColorPtr& color)
@@ -83,6 +84,7 @@ namespace xhtml
 		vc.emplace_back(glm::vec2(vx2, vy2), col.as_u8vec4());
 		vc.emplace_back(glm::vec2(vx1, vy2), col.as_u8vec4());
 		attribs_->update(&vc);
+		setLocalBounds(rectf::from_coordinates(vx1, vy1, vx2, vy2));
 	}
 
 	void SolidRenderable::setDrawMode(KRE::DrawMode draw_mode)
@@ -113,6 +115,8 @@ namespace xhtml
 
 	void SolidRenderable::update(std::vector<KRE::vertex_color>* coords)
 	{
+		clearLocalBounds();
+		extendLocalBounds(coords->cbegin(), coords->cend(), [](const KRE::vertex_color& vc) { return vc.vertex; });
 		attribs_->update(coords);
 	}
 
@@ -144,6 +148,8 @@ namespace xhtml
 
 	void SimpleRenderable::update(std::vector<glm::vec2>* coords)
 	{
+		clearLocalBounds();
+		extendLocalBounds(coords->cbegin(), coords->cend(), [](const glm::vec2& v) { return v; });
 		attribs_->update(coords);
 	}
 
@@ -21,6 +21,10 @@
 	   distribution.
 */
 
+#include <array>
+#include <functional>
+#include <map>
+
 #include <cairo.h>
 
 #include "AttributeSet.hpp"
@@ -35,6 +39,7 @@
 
 #include "profile_timer.hpp"
 #include "solid_renderable.hpp"
+#include "unit_test.hpp"
 #include "xhtml_background_info.hpp"
 #include "xhtml_layout_engine.hpp"
 
@@ -262,6 +267,178 @@ namespace xhtml
 
 			return sr;
 		}
+
+		// A rendered box-shadow. The target holds the horizontally blurred shadow, the
+		// vertical pass is done by the shader when the shadow is drawn.
+		struct BoxShadowCacheEntry
+		{
+			BoxShadowCacheEntry() : target(), shader(), last_used(0) {}
+			KRE::RenderTargetPtr target;
+			KRE::ShaderProgramPtr shader;
+			unsigned last_used;
+		};
+
+		// box size, clip type and rectangle, border radii, blur, spread and color.
+		typedef std::array<int, 21> box_shadow_key;
+
+		const int max_box_shadow_cache_entries = 256;
+		const int box_shadow_gaussian_radius = 7;
+
+		struct BoxShadowCache
+		{
+			BoxShadowCache() : entries(), generation(0), stats(), verify(false) {}
+			std::map<box_shadow_key, BoxShadowCacheEntry> entries;
+			unsigned generation;
+			BoxShadowCacheStats stats;
+			bool verify;
+		};
+
+		BoxShadowCache& get_box_shadow_cache()
+		{
+			static BoxShadowCache res;
+			return res;
+		}
+
+		BoxShadowCacheEntry render_box_shadow(const KRE::ColorPtr& color, float spread_width, float spread_height, float ssr, 
+			int box_width, int box_height, const KRE::RenderablePtr& clip_shape)
+		{
+			using namespace KRE;
+			const int gaussian_radius = box_shadow_gaussian_radius;
+				
+			const int width = static_cast<int>(spread_width + gaussian_radius * 4); 
+			const int height = static_cast<int>(spread_height + gaussian_radius * 4);
+
+			auto shader_blur = ShaderProgram::createGaussianShader(gaussian_radius)->clone();
+			const int blur_two = shader_blur->getUniform("texel_width_offset");
+			const int blur_tho = shader_blur->getUniform("texel_height_offset");
+			const int u_gaussian = shader_blur->getUniform("gaussian");
+			std::vector<float> gaussian = generate_gaussian(ssr/2.0f, gaussian_radius);
+
+			CameraPtr rt_cam = std::make_shared<Camera>("ortho_blur", 0, width, 0, height);
+
+			rect box_size(0, 0, static_cast<int>(spread_width), static_cast<int>(spread_height));
+			SolidRenderablePtr box = std::make_shared<SolidRenderable>(box_size, color);
+			if(clip_shape != nullptr) {
+				const float scalew = spread_width / static_cast<float>(box_width);
+				const float scaleh = spread_height / static_cast<float>(box_height);
+				clip_shape->setScale(scalew, scaleh);
+				box->setClipSettings(get_stencil_mask_settings(), clip_shape);
+			}
+			box->setPosition(gaussian_radius * 2, gaussian_radius * 2);
+			box->setCamera(rt_cam);
+
+			WindowPtr wnd = WindowManager::getMainWindow();
+			// We need to create the "rt_blur_h" render target with a minimum of a stencil buffer.
+			RenderTargetPtr rt_blur_h = RenderTarget::create(width, height, 1, false, true/*, true, 4*/);
+			rt_blur_h->getTexture()->setFiltering(-1, Texture::Filtering::LINEAR, Texture::Filtering::LINEAR, Texture::Filtering::POINT);
+			rt_blur_h->getTexture()->setAddressModes(-1, Texture::AddressMode::CLAMP, Texture::AddressMode::CLAMP);
+			rt_blur_h->setCentre(Blittable::Centre::TOP_LEFT);
+			rt_blur_h->setClearColor(Color(0,0,0,0));
+			{
+				RenderTarget::RenderScope rs(rt_blur_h, rect(0, 0, width, height));
+				box->preRender(wnd);
+				wnd->render(box.get());
+			}
+			rt_blur_h->setCamera(rt_cam);
+			rt_blur_h->setShader(shader_blur);
+			shader_blur->setUniformDrawFunction([blur_two, blur_tho, width, gaussian, u_gaussian](ShaderProgramPtr shader){ 
+				shader->setUniformValue(u_gaussian, &gaussian[0]);
+				shader->setUniformValue(blur_two, 1.0f / (width - 1.0f));
+				shader->setUniformValue(blur_tho, 0.0f);
+			});
+
+			RenderTargetPtr rt_blur_v = RenderTarget::create(width, height);
+			rt_blur_v->getTexture()->setFiltering(-1, Texture::Filtering::LINEAR, Texture::Filtering::LINEAR, Texture::Filtering::POINT);
+			rt_blur_v->getTexture()->setAddressModes(-1, Texture::AddressMode::CLAMP, Texture::AddressMode::CLAMP);
+			rt_blur_v->setCentre(Blittable::Centre::TOP_LEFT);
+			rt_blur_v->setClearColor(Color(0,0,0,0));
+			{
+				RenderTarget::RenderScope rs(rt_blur_v, rect(0, 0, width, height));
+				rt_blur_h->preRender(wnd);
+				wnd->render(rt_blur_h.get());
+			}
+			rt_blur_v->setShader(shader_blur);
+			shader_blur->setUniformDrawFunction([blur_two, blur_tho, height, gaussian, u_gaussian](ShaderProgramPtr shader){ 
+				shader->setUniformValue(u_gaussian, &gaussian[0]);
+				shader->setUniformValue(blur_two, 0.0f);
+				shader->setUniformValue(blur_tho, 1.0f / (height - 1.0f));
+			});
+
+			BoxShadowCacheEntry res;
+			res.target = rt_blur_v;
+			res.shader = shader_blur;
+			return res;
+		}
+
+		void evict_box_shadows(BoxShadowCache& cache)
+		{
+			while(cache.entries.size() >= static_cast<size_t>(max_box_shadow_cache_entries)) {
+				auto oldest = cache.entries.begin();
+				for(auto it = cache.entries.begin(); it != cache.entries.end(); ++it) {
+					if(it->second.last_used < oldest->second.last_used) {
+						oldest = it;
+					}
+				}
+				cache.entries.erase(oldest);
+			}
+		}
+
+		// Adds the parts of the key that differ between the shadows on one box.
+		box_shadow_key make_box_shadow_key(const box_shadow_key& base_key, const BgBoxShadow& shadow)
+		{
+			box_shadow_key key = base_key;
+			key[15] = shadow.blur_radius;
+			key[16] = shadow.spread_radius;
+			key[17] = shadow.color->ri();
+			key[18] = shadow.color->gi();
+			key[19] = shadow.color->bi();
+			key[20] = shadow.color->ai();
+			return key;
+		}
+
+		bool box_shadows_match(const BoxShadowCacheEntry& a, const BoxShadowCacheEntry& b)
+		{
+			return a.target->width() == b.target->width()
+				&& a.target->height() == b.target->height()
+				&& a.target->readPixels() == b.target->readPixels();
+		}
+
+		// Returns the cached shadow for key, calling render_fn to create it on a miss. When
+		// verifying, hits are rendered again and compared with the cached shadow.
+		const BoxShadowCacheEntry& find_box_shadow(BoxShadowCache& cache, const box_shadow_key& key, const std::function<BoxShadowCacheEntry()>& render_fn)
+		{
+			auto it = cache.entries.find(key);
+			if(it == cache.entries.end()) {
+				++cache.stats.misses;
+				evict_box_shadows(cache);
+				it = cache.entries.emplace(key, render_fn()).first;
+			} else {
+				++cache.stats.hits;
+				if(cache.verify && !box_shadows_match(render_fn(), it->second)) {
+					++cache.stats.mismatches;
+					LOG_ERROR("Cached box-shadow differs from a freshly rendered one, size: " << key[0] << "x" << key[1]);
+				}
+			}
+			it->second.last_used = ++cache.generation;
+			return it->second;
+		}
+	}
+
+	BoxShadowCacheStats BackgroundInfo::getBoxShadowCacheStats()
+	{
+		BoxShadowCacheStats res = get_box_shadow_cache().stats;
+		res.entries = static_cast<int>(get_box_shadow_cache().entries.size());
+		return res;
+	}
+
+	void BackgroundInfo::clearBoxShadowCache()
+	{
+		get_box_shadow_cache().entries.clear();
+	}
+
+	void BackgroundInfo::setBoxShadowCacheVerify(bool en)
+	{
+		get_box_shadow_cache().verify = en;
 	}
 
 	BgBoxShadow::BgBoxShadow() 
@@ -367,6 +544,36 @@ namespace xhtml
 			new_clip_shape = std::shared_ptr<Renderable>(new Renderable(*clip_shape));
 		}
 
+		// The parts of the cache key that are the same for all the shadows on this box, the
+		// clip shape is derived from the background clip and the box dimensions.
+		box_shadow_key base_key;
+		base_key.fill(0);
+		base_key[0] = box_width;
+		base_key[1] = box_height;
+		base_key[2] = clip_shape == nullptr ? -1 : static_cast<int>(styles_->getBackgroundClip());
+		if(clip_shape != nullptr) {
+			switch(styles_->getBackgroundClip()) {
+				case BackgroundClip::BORDER_BOX:
+					for(int n = 0; n != 4; ++n) {
+						base_key[7 + n] = border_radius_horiz_[n];
+						base_key[11 + n] = border_radius_vert_[n];
+					}
+					break;
+				case BackgroundClip::PADDING_BOX:
+					base_key[3] = dims.border_.left;
+					base_key[4] = dims.border_.top;
+					base_key[5] = dims.content_.width + dims.padding_.left + dims.padding_.right;
+					base_key[6] = dims.content_.height + dims.padding_.top + dims.padding_.bottom;
+					break;
+				case BackgroundClip::CONTENT_BOX:
+					base_key[3] = dims.padding_.left + dims.border_.left;
+					base_key[4] = dims.padding_.top + dims.border_.top;
+					base_key[5] = dims.content_.width;
+					base_key[6] = dims.content_.height;
+					break;
+			}
+		}
+
 		for(auto& shadow : box_shadows_) {
 			if(shadow.inset) {
 				// XXX
@@ -392,70 +599,22 @@ namespace xhtml
 						(shadow.y_offset) / LayoutEngine::getFixedPointScaleFloat() - ssr);
 					scene_tree->addObject(box);
 				} else {
-					const int gaussian_radius = 7;
-				
-					const int width = static_cast<int>(spread_width + gaussian_radius * 4); 
-					const int height = static_cast<int>(spread_height + gaussian_radius * 4);
-
-					auto shader_blur = ShaderProgram::createGaussianShader(gaussian_radius)->clone();
-					const int blur_two = shader_blur->getUniform("texel_width_offset");
-					const int blur_tho = shader_blur->getUniform("texel_height_offset");
-					const int u_gaussian = shader_blur->getUniform("gaussian");
-					std::vector<float> gaussian = generate_gaussian(ssr/2.0f, gaussian_radius);
-
-					CameraPtr rt_cam = std::make_shared<Camera>("ortho_blur", 0, width, 0, height);
-
-					rect box_size(0, 0, static_cast<int>(spread_width), static_cast<int>(spread_height));
-					SolidRenderablePtr box = std::make_shared<SolidRenderable>(box_size, shadow.color);
-					if(clip_shape != nullptr) {
-						const float scalew = spread_width / static_cast<float>(box_width);
-						const float scaleh = spread_height / static_cast<float>(box_height);
-						new_clip_shape->setScale(scalew, scaleh);
-						box->setClipSettings(get_stencil_mask_settings(), new_clip_shape);
-					}
-					box->setPosition(gaussian_radius * 2, gaussian_radius * 2);
-					box->setCamera(rt_cam);
-
-					WindowPtr wnd = WindowManager::getMainWindow();
-					// We need to create the "rt_blur_h" render target with a minimum of a stencil buffer.
-					RenderTargetPtr rt_blur_h = RenderTarget::create(width, height, 1, false, true/*, true, 4*/);
-					rt_blur_h->getTexture()->setFiltering(-1, Texture::Filtering::LINEAR, Texture::Filtering::LINEAR, Texture::Filtering::POINT);
-					rt_blur_h->getTexture()->setAddressModes(-1, Texture::AddressMode::CLAMP, Texture::AddressMode::CLAMP);
-					rt_blur_h->setCentre(Blittable::Centre::TOP_LEFT);
-					rt_blur_h->setClearColor(Color(0,0,0,0));
-					{
-						RenderTarget::RenderScope rs(rt_blur_h, rect(0, 0, width, height));
-						box->preRender(wnd);
-						wnd->render(box.get());
-					}
-					rt_blur_h->setCamera(rt_cam);
-					rt_blur_h->setShader(shader_blur);
-					shader_blur->setUniformDrawFunction([blur_two, blur_tho, width, gaussian, u_gaussian](ShaderProgramPtr shader){ 
-						shader->setUniformValue(u_gaussian, &gaussian[0]);
-						shader->setUniformValue(blur_two, 1.0f / (width - 1.0f));
-						shader->setUniformValue(blur_tho, 0.0f);
-					});
+					const int gaussian_radius = box_shadow_gaussian_radius;
 
-					RenderTargetPtr rt_blur_v = RenderTarget::create(width, height);
-					rt_blur_v->getTexture()->setFiltering(-1, Texture::Filtering::LINEAR, Texture::Filtering::LINEAR, Texture::Filtering::POINT);
-					rt_blur_v->getTexture()->setAddressModes(-1, Texture::AddressMode::CLAMP, Texture::AddressMode::CLAMP);
-					rt_blur_v->setCentre(Blittable::Centre::TOP_LEFT);
-					rt_blur_v->setClearColor(Color(0,0,0,0));
-					{
-						RenderTarget::RenderScope rs(rt_blur_v, rect(0, 0, width, height));
-						rt_blur_h->preRender(wnd);
-						wnd->render(rt_blur_h.get());
-					}
-					rt_blur_v->setShader(shader_blur);
-					shader_blur->setUniformDrawFunction([blur_two, blur_tho, height, gaussian, u_gaussian](ShaderProgramPtr shader){ 
-						shader->setUniformValue(u_gaussian, &gaussian[0]);
-						shader->setUniformValue(blur_two, 0.0f);
-						shader->setUniformValue(blur_tho, 1.0f / (height - 1.0f));
+					const BoxShadowCacheEntry& entry = find_box_shadow(get_box_shadow_cache(), make_box_shadow_key(base_key, shadow), [&]() {
+						return render_box_shadow(shadow.color, spread_width, spread_height, ssr, box_width, box_height, new_clip_shape);
 					});
 
-					rt_blur_v->setPosition((shadow.x_offset) / LayoutEngine::getFixedPointScaleFloat() - ssr - gaussian_radius * 2, 
+					// Draw the cached texture the same way the render target would draw itself.
+					const RenderTargetPtr& rt = entry.target;
+					auto shadow_obj = std::make_shared<Blittable>(rt->getTexture()->clone());
+					shadow_obj->setCentre(Blittable::Centre::TOP_LEFT);
+					shadow_obj->setMirrorHoriz(true);
+					shadow_obj->setOrder(rt->getOrder());
+					shadow_obj->setShader(entry.shader);
+					shadow_obj->setPosition((shadow.x_offset) / LayoutEngine::getFixedPointScaleFloat() - ssr - gaussian_radius * 2, 
 						(shadow.y_offset) / LayoutEngine::getFixedPointScaleFloat() - ssr - gaussian_radius * 2);
-					scene_tree->addObject(rt_blur_v);
+					scene_tree->addObject(shadow_obj);
 				}
 			}
 		}
@@ -577,3 +736,72 @@ namespace xhtml
 		}
 	}
 }
+
+UNIT_TEST(box_shadow_cache)
+{
+	using namespace KRE;
+	using namespace xhtml;
+	DisplayDevice::factory("null", nullptr);
+
+	// Unit tests run before there is a window to render the blur passes in, so this
+	// stands in for render_box_shadow(). The null device reads render targets back as
+	// their clear color, so the shadow color and size end up in the pixels.
+	int renders = 0;
+	auto render_fn = [&renders](const BgBoxShadow& shadow) {
+		++renders;
+		const int size = (100 + 2 * shadow.spread_radius / LayoutEngine::getFixedPointScale()) + shadow.blur_radius / LayoutEngine::getFixedPointScale();
+		BoxShadowCacheEntry res;
+		res.target = RenderTarget::create(size, size / 2);
+		res.target->setClearColor(*shadow.color);
+		return res;
+	};
+
+	box_shadow_key base_key;
+	base_key.fill(0);
+	base_key[0] = 100;
+	base_key[1] = 50;
+	base_key[2] = -1;
+
+	const FixedPoint scale = LayoutEngine::getFixedPointScale();
+	const BgBoxShadow shadow(0, 0, 10 * scale, 5 * scale, false, std::make_shared<Color>(255, 0, 0, 128));
+	const std::vector<BgBoxShadow> others = {
+		BgBoxShadow(0, 0, 10 * scale, 5 * scale, false, std::make_shared<Color>(0, 0, 255, 128)),
+		BgBoxShadow(0, 0, 10 * scale, 5 * scale, false, std::make_shared<Color>(255, 0, 0, 255)),
+		BgBoxShadow(0, 0, 12 * scale, 5 * scale, false, std::make_shared<Color>(255, 0, 0, 128)),
+		BgBoxShadow(0, 0, 10 * scale, 6 * scale, false, std::make_shared<Color>(255, 0, 0, 128)),
+	};
+
+	BoxShadowCache cache;
+	cache.verify = true;
+	const box_shadow_key key = make_box_shadow_key(base_key, shadow);
+	const BoxShadowCacheEntry& entry = find_box_shadow(cache, key, [&]() { return render_fn(shadow); });
+	CHECK_EQ(cache.stats.misses, 1);
+
+	// The same shadow, with a different offset and color object, hits and matches a fresh render.
+	const BgBoxShadow same(3 * scale, 4 * scale, 10 * scale, 5 * scale, false, std::make_shared<Color>(255, 0, 0, 128));
+	CHECK(make_box_shadow_key(base_key, same) == key, "identical shadows have different keys");
+	const BoxShadowCacheEntry& hit = find_box_shadow(cache, make_box_shadow_key(base_key, same), [&]() { return render_fn(same); });
+	CHECK_EQ(hit.target, entry.target);
+	CHECK_EQ(cache.stats.hits, 1);
+	CHECK_EQ(renders, 2);
+	CHECK_EQ(cache.stats.mismatches, 0);
+	CHECK(box_shadows_match(hit, render_fn(same)), "cached shadow differs from a fresh render");
+
+	// Shadows differing in color, alpha, blur or spread each get their own entry.
+	for(auto& other : others) {
+		const box_shadow_key other_key = make_box_shadow_key(base_key, other);
+		CHECK(other_key != key, "differing shadows share a key");
+		const BoxShadowCacheEntry& e = find_box_shadow(cache, other_key, [&]() { return render_fn(other); });
+		CHECK(e.target != entry.target, "differing shadows share a cache entry");
+		CHECK(!box_shadows_match(e, entry), "differing shadows rendered the same");
+		CHECK(box_shadows_match(e, render_fn(other)), "cached shadow differs from a fresh render");
+	}
+	CHECK_EQ(cache.entries.size(), 1 + others.size());
+	CHECK_EQ(cache.stats.misses, 1 + static_cast<int>(others.size()));
+	CHECK_EQ(cache.stats.mismatches, 0);
+
+	// Verifying catches a cached shadow that no longer matches what would be rendered.
+	const BgBoxShadow changed(0, 0, 10 * scale, 5 * scale, false, std::make_shared<Color>(0, 255, 0, 128));
+	find_box_shadow(cache, key, [&]() { return render_fn(changed); });
+	CHECK_EQ(cache.stats.mismatches, 1);
+}
@@ -43,12 +43,29 @@ namespace xhtml
 		KRE::ColorPtr color;
 	};
 
+	struct BoxShadowCacheStats
+	{
+		BoxShadowCacheStats() : hits(0), misses(0), mismatches(0), entries(0) {}
+		int hits;
+		int misses;
+		// Number of cache hits that didn't match a fresh render, only counted when verifying.
+		int mismatches;
+		int entries;
+	};
+
 	class BackgroundInfo
 	{
 	public:
 		explicit BackgroundInfo(const StyleNodePtr& styles);
 		void render(const KRE::SceneTreePtr& scene_tree, const Dimensions& dims, const point& offset) const;
 		void init(const Dimensions& dims);
+
+		// Blurred box-shadows are rendered once and shared between all boxes with the same
+		// shadow geometry and color.
+		static BoxShadowCacheStats getBoxShadowCacheStats();
+		static void clearBoxShadowCache();
+		// When enabled every cache hit is rendered again and compared to the cached copy.
+		static void setBoxShadowCacheVerify(bool en);
 	private:
 		void renderBoxShadow(const KRE::SceneTreePtr& scene_tree, const Dimensions& dims, KRE::RenderablePtr clip_shape) const;
 
@@ -25,6 +25,7 @@
 #include "RenderTarget.hpp"
 #include "Shaders.hpp"
 #include "WindowManager.hpp"
+#include "profile_timer.hpp"
 
 #include "solid_renderable.hpp"
 #include "rect_renderable.hpp"
@@ -187,6 +188,7 @@ namespace xhtml
 
 	void Box::layout(LayoutEngine& eng, const Dimensions& ocontaining)
 	{
+		PROFILE_COUNT(BOXES_LAID_OUT, 1);
 		auto containing = ocontaining;
 		auto styles = getStyleNode();
 
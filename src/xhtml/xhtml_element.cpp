@@ -21,6 +21,7 @@
 	   distribution.
 */
 
+#include <algorithm>
 #include <map>
 
 #include <boost/lexical_cast.hpp>
@@ -34,7 +35,9 @@
 
 #include "Blittable.hpp"
 #include "Font.hpp"
+#include "ImageDecodeQueue.hpp"
 #include "Texture.hpp"
+#include "TextureAtlas.hpp"
 
 namespace xhtml
 {
@@ -184,9 +187,40 @@ namespace xhtml
 			explicit ImageElement(ElementId id, const std::string& name, WeakDocumentPtr owner) 
 				: Element(id, name, owner), 
 				  dims_set_(false), 
+				  decode_pending_(false),
+				  load_failed_(false),
+				  intrinsic_width_(0),
+				  intrinsic_height_(0),
+				  opaque_(false),
 				  tex_() 
 			{
 			}
+			// Queues the image to be decoded, using the size from its header until it's ready.
+			void loadImage(const std::string& src) {
+				if(KRE::ImageDecodeQueue::isEnabled()) {
+					KRE::read_image_file_size(KRE::Surface::getFileFilter(KRE::FileFilterType::LOAD)(src), &intrinsic_width_, &intrinsic_height_);
+				}
+				decode_pending_ = true;
+				std::weak_ptr<Node> wnode = shared_from_this();
+				KRE::ImageDecodeQueue::getInstance().queue(src, KRE::SurfaceFlags::NONE, [wnode](const KRE::SurfacePtr& surf) {
+					auto img = std::static_pointer_cast<ImageElement>(wnode.lock());
+					if(img == nullptr) {
+						return;
+					}
+					img->decode_pending_ = false;
+					if(surf != nullptr) {
+						img->tex_ = KRE::TextureAtlas::createTexture(surf);
+						img->opaque_ = surf->isOpaque();
+					} else {
+						img->load_failed_ = true;
+					}
+					// If we finished after init() then work out the dimensions again with the real image.
+					if(img->dims_set_) {
+						img->dims_set_ = false;
+						img->init();
+					}
+				});
+			}
 			void init() override {
 				if(!dims_set_) {
 					// These are non-standard attributes.
@@ -200,9 +234,15 @@ namespace xhtml
 					rect r;
 					int src_x = 0;
 					int src_y = 0;
-					if(attr_src != nullptr && !attr_src->getValue().empty()) {
-						tex_ = KRE::Texture::createTexture(attr_src->getValue());
-						r = rect(0, 0, tex_->width(), tex_->height());
+					if(attr_src != nullptr && !attr_src->getValue().empty() && !load_failed_) {
+						if(tex_ == nullptr && !decode_pending_) {
+							loadImage(attr_src->getValue());
+						}
+						if(tex_ != nullptr) {
+							r = rect(0, 0, tex_->surfaceWidth(), tex_->surfaceHeight());
+						} else {
+							r = rect(0, 0, intrinsic_width_, intrinsic_height_);
+						}
 					} else if(attr_alt != nullptr && !attr_alt->getValue().empty()) {
 						// Render the alt text. This could be improved. 16 below represents a 12pt font.
 						tex_ = KRE::Font::getInstance()->renderText(attr_alt->getValue(), KRE::Color::colorWhite(), 16, true, "FreeSerif.ttf");
@@ -238,7 +278,11 @@ namespace xhtml
 						}
 					}
 
-					tex_->setSourceRect(0, rect(src_x, src_y, r.w(), r.h()));
+					if(tex_ != nullptr) {
+						// Larger sizes scale the image rather than reading past its edges, which could be 
+						// another image if it's in an atlas.
+						tex_->setSourceRect(0, rect(src_x, src_y, std::min(r.w(), tex_->surfaceWidth() - src_x), std::min(r.h(), tex_->surfaceHeight() - src_y)));
+					}
 
 					dims_set_ = true;
 					setDimensions(r);
@@ -250,11 +294,20 @@ namespace xhtml
 				if(tex_ != nullptr) {
 					auto b = std::make_shared<KRE::Blittable>(tex_);
 					b->setDrawRect(getDimensions());
+					if(opaque_) {
+						b->setBlendState(false);
+					}
 					return b;
 				}
 				return nullptr;
 			}
 			bool dims_set_;
+			bool decode_pending_;
+			bool load_failed_;
+			int intrinsic_width_;
+			int intrinsic_height_;
+			// Image has no transparent or translucent pixels so doesn't need blending.
+			bool opaque_;
 			KRE::TexturePtr tex_;
 		};
 		ElementRegistrar<ImageElement> img_element(ElementId::IMG, "img");
@@ -291,6 +344,15 @@ namespace xhtml
 					return;
 				}
 
+				std::weak_ptr<Node> wnode = shared_from_this();
+				obj_->setChangeHandler([wnode]() {
+					auto obj = std::static_pointer_cast<ObjectElement>(wnode.lock());
+					if(obj != nullptr && obj->obj_ != nullptr) {
+						obj->setDimensions(rect(0, 0, obj->obj_->width(), obj->obj_->height()));
+					}
+				});
+				obj_->init();
+
 				rect r(0, 0, obj_->width(), obj_->height());
 				setDimensions(r);
 
@@ -664,13 +726,33 @@ namespace xhtml
 				  tex_(KRE::svg_texture_from_file(img_src_, width_, height_))
 			{
 			}
+			// Queues the image to be decoded, the default button is shown at the size from its
+			// header until it's ready.
+			void loadImage(const std::string& src) {
+				img_src_ = src;
+				int w = 0;
+				int h = 0;
+				if(KRE::ImageDecodeQueue::isEnabled() 
+					&& KRE::read_image_file_size(KRE::Surface::getFileFilter(KRE::FileFilterType::LOAD)(src), &w, &h)) {
+					width_ = w;
+					height_ = h;
+				}
+				std::weak_ptr<Node> wnode = shared_from_this();
+				KRE::ImageDecodeQueue::getInstance().queue(src, KRE::SurfaceFlags::NONE, [wnode, src](const KRE::SurfacePtr& surf) {
+					auto btn = std::static_pointer_cast<ButtonElement>(wnode.lock());
+					if(btn == nullptr || surf == nullptr || btn->img_src_ != src) {
+						return;
+					}
+					btn->tex_ = KRE::Texture::createTexture(surf);
+					btn->width_ = btn->tex_->width();
+					btn->height_ = btn->tex_->height();
+					btn->setDimensions(rect(0, 0, btn->width_, btn->height_));
+				});
+			}
 			void init() override {
 				auto attr_src = getAttribute("src");
-				if(attr_src != nullptr && !attr_src->getValue().empty()) {
-					img_src_ = attr_src->getValue();
-					tex_ = KRE::Texture::createTexture(img_src_);
-					width_ = tex_->width();
-					height_ = tex_->height();
+				if(attr_src != nullptr && !attr_src->getValue().empty() && attr_src->getValue() != img_src_) {
+					loadImage(attr_src->getValue());
 				}
 				setDimensions(rect(0, 0, width_, height_));
 			}
@@ -1133,7 +1215,8 @@ namespace xhtml
 	ObjectProxy::ObjectProxy(const AttributeMap& attributes)
 		: width_(300),
 		  height_(300),
-		  dimensions_fixed_(false)
+		  dimensions_fixed_(false),
+		  change_handler_()
 	{
 		auto attr_w = attributes.find("width");
 		if(attr_w != attributes.end()) {
@@ -1170,22 +1253,44 @@ namespace xhtml
 	public:
 		explicit ImageObject(const AttributeMap& am) 
 			: ObjectProxy(am),
+			  src_(),
 			  tex_(nullptr)
 		{
 			auto attr_data = am.find("data");
 			if(attr_data != am.end()) {
-				tex_ = KRE::Texture::createTexture(attr_data->second->getValue());
+				src_ = attr_data->second->getValue();
 			} else {
 				auto attr_clsid = am.find("classid");
 				if(attr_clsid != am.end()) {
-					tex_ = KRE::Texture::createTexture(attr_clsid->second->getValue());
+					src_ = attr_clsid->second->getValue();
 				} else {
 					LOG_ERROR("No data or classid tag for ImageObject");
 				}
 			}
-			if(tex_ != nullptr && !areDimensionsFixed()) {
-				setDimensions(tex_->width(), tex_->height());
+		}
+		void init() override
+		{
+			if(src_.empty() || tex_ != nullptr) {
+				return;
+			}
+			int w = 0;
+			int h = 0;
+			if(!areDimensionsFixed() && KRE::ImageDecodeQueue::isEnabled() 
+				&& KRE::read_image_file_size(KRE::Surface::getFileFilter(KRE::FileFilterType::LOAD)(src_), &w, &h)) {
+				setDimensions(w, h);
 			}
+			std::weak_ptr<ObjectProxy> wobj = shared_from_this();
+			KRE::ImageDecodeQueue::getInstance().queue(src_, KRE::SurfaceFlags::NONE, [wobj](const KRE::SurfacePtr& surf) {
+				auto obj = std::static_pointer_cast<ImageObject>(wobj.lock());
+				if(obj == nullptr || surf == nullptr) {
+					return;
+				}
+				obj->tex_ = KRE::TextureAtlas::createTexture(surf);
+				if(!obj->areDimensionsFixed()) {
+					obj->setDimensions(obj->tex_->width(), obj->tex_->height());
+				}
+				obj->notifyChanged();
+			});
 		}
 		KRE::SceneObjectPtr getRenderable() override
 		{
@@ -1197,6 +1302,7 @@ namespace xhtml
 			return nullptr;
 		}
 	private:
+		std::string src_;
 		KRE::TexturePtr tex_;
 	};
 
@@ -47,16 +47,21 @@ namespace xhtml
 		void setDimensions(int w, int h);
 		rect getDimensions() { return rect(0, 0, width_, height_); }
 		bool areDimensionsFixed() const { return dimensions_fixed_; }
+		// Called when the size or content of the object changes after init(), i.e. once an image has loaded.
+		void setChangeHandler(std::function<void()> fn) { change_handler_ = fn; }
 
 		virtual bool mouseButtonUp(const point& p, int button, unsigned button_state, unsigned short ctrl_key_state) { return false; }
 		virtual bool mouseButtonDown(const point& p, int button, unsigned button_state, unsigned short ctrl_key_state) { return false; }
 		virtual bool mouseMove(const point& p, unsigned button_state, unsigned ctrl_key_state) { return false; }
 		virtual bool keyDown(const point& p, const Keystate& keysym, bool pressed, bool repeat) { return false; }
 		virtual bool keyUp(const point& p, const Keystate& keysym, bool pressed, bool repeat) { return false; }
+	protected:
+		void notifyChanged() { if(change_handler_) { change_handler_(); } }
 	private:
 		int width_;
 		int height_;
 		bool dimensions_fixed_;
+		std::function<void()> change_handler_;
 	};
 
 	typedef std::shared_ptr<ObjectProxy> ObjectProxyPtr;
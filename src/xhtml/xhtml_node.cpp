@@ -33,9 +33,7 @@
 #include "xhtml_style_tree.hpp"
 
 #include "filesystem.hpp"
-#if defined(ENABLE_PROFILING)
 #include "profile_timer.hpp"
-#endif
 
 namespace xhtml
 {
@@ -826,16 +824,12 @@ namespace xhtml
 
 			// XXX should we should have a re-process styles flag here.
 			{
-#if defined(ENABLE_PROFILING)
-				profile::manager pman("apply styles");
-#endif
+				PROFILE_SCOPE("apply styles");
 				processStyleRules();
 			}
 
 			{
-#if defined(ENABLE_PROFILING)
-				profile::manager pman("update style tree");
-#endif
+				PROFILE_SCOPE("update style tree");
 				if(style_tree == nullptr) {
 					style_tree = StyleNode::createStyleTree(std::static_pointer_cast<Document>(shared_from_this()));
 					processScriptAttributes();
@@ -845,9 +839,7 @@ namespace xhtml
 			}
 
 			{
-#if defined(ENABLE_PROFILING)
-				profile::manager pman("layout");
-#endif
+				PROFILE_SCOPE("layout");
 				layout = Box::createLayout(style_tree, w, h);
 			}
 
@@ -856,9 +848,7 @@ namespace xhtml
 		}
 
 		if(needsRender() && layout != nullptr) {
-#if defined(ENABLE_PROFILING)
-			profile::manager pman_render("render");
-#endif
+			PROFILE_SCOPE("render");
 			layout_x_ = x;
 			layout_y_ = y;
 			auto st = layout->getSceneTree();
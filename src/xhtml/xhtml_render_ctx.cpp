@@ -45,9 +45,10 @@ namespace xhtml
 			KRE::FontHandlePtr parent_font = get_font_handle_stack().empty() ? nullptr : get_font_handle_stack().top();
 			auto ff = ctx.getComputedValue(Property::FONT_FAMILY)->asType<FontFamily>()->getFontList();
 			auto fs = ctx.getComputedValue(Property::FONT_SIZE)->asType<FontSize>()->compute(static_cast<FixedPoint>((parent_font ? parent_font->getFontSize() : 12.0f) * 65536.0f), ctx.getDPI());
-			auto fw = ctx.getComputedValue(Property::FONT_WEIGHT)->asType<FontWeight>()->compute(400/*parent_font ? parent_font->getFontWeight() : 400*/);
+			auto fw = ctx.getComputedValue(Property::FONT_WEIGHT)->asType<FontWeight>()->compute(parent_font ? parent_font->getFontWeight() : 400);
 			auto ft = ctx.getComputedValue(Property::FONT_STYLE)->getEnum<FontStyle>();
-			return KRE::FontDriver::getFontHandle(ff, static_cast<float>(fs)/65536.0f*72.0f/static_cast<float>(ctx.getDPI())/*, fw, ft*/);
+			const KRE::FontStyle style = ft == FontStyle::ITALIC ? KRE::FontStyle::ITALIC : ft == FontStyle::OBLIQUE ? KRE::FontStyle::OBLIQUE : KRE::FontStyle::NORMAL;
+			return KRE::FontDriver::getFontHandle(ff, static_cast<float>(fs)/65536.0f*72.0f/static_cast<float>(ctx.getDPI()), KRE::Color::colorWhite(), true, std::string(), fw, style);
 		}
 
 		typedef std::vector<std::stack<StylePtr>> stack_array;
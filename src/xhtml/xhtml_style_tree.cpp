@@ -22,6 +22,7 @@
 */
 
 #include "css_parser.hpp"
+#include "profile_timer.hpp"
 #include "xhtml_render_ctx.hpp"
 #include "xhtml_style_tree.hpp"
 
@@ -300,6 +301,7 @@ namespace xhtml
 
 	void StyleNode::processStyles(bool created)
 	{
+		PROFILE_COUNT(RESTYLED_NODES, 1);
 		RenderContext& ctx = RenderContext::get();
 
 		background_attachment_style_ = ctx.getComputedValue(Property::BACKGROUND_ATTACHMENT);
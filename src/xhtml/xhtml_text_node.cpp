@@ -49,39 +49,41 @@ namespace xhtml
 		};
 
 		bool is_white_space(char32_t cp) {  return cp == '\r' || cp == '\t' || cp == ' ' || cp == '\n'; }
+	}
 
-		void tokenize_text(const std::string& text, bool collapse_ws, bool break_at_newline, Line& res) 
-		{
-			bool in_ws = false;
-			for(auto cp : utils::utf8_to_codepoint(text)) {
-				if(cp == '\n' && break_at_newline) {
-					if(res.line.empty() || !res.line.back().word.empty()) {
-						res.line.emplace_back(std::string(1, '\n'));
-						res.line.emplace_back(std::string());
-					} else {
-						res.line.back().word = "\n";
-						res.line.emplace_back(std::string());
-					}
-					continue;
+	void tokenize_text(const std::string& text, bool collapse_ws, bool break_at_newline, Line& res) 
+	{
+		// All the characters that split words are ascii and bytes of multi-byte utf-8 sequences 
+		// are never ascii, so the text can be split without decoding it.
+		bool in_ws = false;
+		for(char ch : text) {
+			const char32_t cp = static_cast<uint8_t>(ch);
+			if(cp == '\n' && break_at_newline) {
+				if(res.line.empty() || !res.line.back().word.empty()) {
+					res.line.emplace_back(std::string(1, '\n'));
+					res.line.emplace_back(std::string());
+				} else {
+					res.line.back().word = "\n";
+					res.line.emplace_back(std::string());
 				}
+				continue;
+			}
 
-				if(is_white_space(cp) && collapse_ws) {
-					in_ws = true;
-				} else {
-					if(in_ws) {
-						in_ws = false;
-						if(!res.line.empty() && !res.line.back().word.empty()) {
-							res.line.emplace_back(std::string());
-						}
-					}					
-					if(res.line.empty()) {
+			if(is_white_space(cp) && collapse_ws) {
+				in_ws = true;
+			} else {
+				if(in_ws) {
+					in_ws = false;
+					if(!res.line.empty() && !res.line.back().word.empty()) {
 						res.line.emplace_back(std::string());
 					}
-					res.line.back().word += utils::codepoint_to_utf8(cp);
+				}					
+				if(res.line.empty()) {
+					res.line.emplace_back(std::string());
 				}
+				res.line.back().word += ch;
 			}
 		}
-
 	}
 
 	Text::Text(const std::string& txt, WeakDocumentPtr owner)
@@ -121,7 +123,7 @@ namespace xhtml
 			case css::TextTransform::CAPITALIZE: {
 				bool first_letter = true;
 				transformed_text.clear();
-				for(auto cp : utils::utf8_to_codepoint(text_)) {
+				for(auto cp : utils::utf8_to_codepoints(text_)) {
 					if(is_white_space(cp)) {
 						first_letter = true;
 						transformed_text += utils::codepoint_to_utf8(cp);
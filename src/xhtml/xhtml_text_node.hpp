@@ -33,6 +33,9 @@ namespace KRE
 
 namespace xhtml
 {
+	// Splits text into words, appending them to res.
+	void tokenize_text(const std::string& text, bool collapse_ws, bool break_at_newline, Line& res);
+
 	class Text : public Node
 	{
 	public: